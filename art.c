@@ -0,0 +1,438 @@
+/***********************************************************************
+ *  File Name   : art.c
+ *  Description : Source file for the Album Art Module.
+ *                Extraction walks the frame headers (query.c), reads at
+ *                most ART_HEADER_SIZE bytes of the chosen APIC frame to
+ *                find where the picture starts, and hands the rest to
+ *                the copy engine (copy_file_range, sendfile or one
+ *                buffer). Replacement is part of a normal edit: the old
+ *                picture of the same type is dropped from the rebuilt
+ *                tag, and the new APIC frame is written after the other
+ *                frames with its data copied straight from the image.
+ *
+ *                Functions:
+ *                - run_extract_art()
+ *                - extract_art()
+ *                - find_picture()
+ *                - parse_picture_header()
+ *                - frame_data_prefix()
+ *                - undo_unsync()
+ *                - copy_unsync_data()
+ *                - picture_type_name()
+ *                - add_art_edit()
+ *                - art_frame_size()
+ *                - write_art_frame()
+ *
+ ***********************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "art.h"
+#include "copy.h"
+#include "id3.h"
+#include "text.h"
+#include "stats.h"
+
+// Largest picture that still fits in a tag (tag sizes are 28-bit)
+#define ART_MAX_SIZE 0x0F000000
+
+// Picture type names from the ID3v2 specification
+static const char *const picture_types[] =
+{
+    "other", "file icon", "other file icon", "front cover", "back cover", "leaflet page",
+    "media", "lead artist", "artist", "conductor", "band", "composer", "lyricist",
+    "recording location", "during recording", "during performance", "video capture",
+    "bright coloured fish", "illustration", "band logotype", "publisher logotype"
+};
+
+/*
+ * Writes the attached picture of one file to an image file, or to
+ * stdout when the output name is "-" (messages then go to stderr).
+ */
+Status run_extract_art(int argc, char **argv)
+{
+    if(argc != 4)
+    {
+        fprintf(stderr, "To Extract Art   : %s -x <file_name.mp3> <image_file|->\n", argv[0]);
+        return e_failure;
+    }
+    return extract_art(argv[2], argv[3]);
+}
+
+// Function to find the picture and copy its bytes (and only those) into the output
+Status extract_art(const char *fname, const char *out_fname)
+{
+    FrameDir dir;
+    PictureInfo pic;
+    int to_stdout = strcmp(out_fname, "-") == 0;
+
+    int fd = open(fname, O_RDONLY);
+    if(fd == -1)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", fname);
+        return e_failure;
+    }
+
+    if(read_frame_directory(fd, &dir) == e_failure)
+    {
+        fprintf(stderr, "ERROR: No ID3v2 tag found in %s\n", fname);
+        close(fd);
+        return e_failure;
+    }
+
+    // A v2.3 tag unsynchronised as a whole is only available decoded in memory, so the picture cannot be copied from the file
+    if(dir.header.version < 4 && (dir.header.flags & TAG_FLAG_UNSYNC))
+    {
+        fprintf(stderr, "ERROR: Unsynchronised ID3v2.%d tags are not supported for picture extraction\n", dir.header.version);
+        release_frame_directory(&dir);
+        close(fd);
+        return e_failure;
+    }
+
+    const FrameDirEntry *entry = find_picture(fd, &dir, &pic);
+    if(entry == NULL)
+    {
+        fprintf(stderr, "ERROR: No picture found in %s\n", fname);
+        release_frame_directory(&dir);
+        close(fd);
+        return e_failure;
+    }
+
+    int out = to_stdout ? STDOUT_FILENO : open(out_fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out == -1)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to create file %s\n", out_fname);
+        release_frame_directory(&dir);
+        close(fd);
+        return e_failure;
+    }
+
+    // Regular output files are written by offset; a pipe or terminal at its current position
+    off_t dst_off = to_stdout ? -1 : 0;
+    CopyMethod method = e_copy_buffered;
+    off_t copied;
+    Status status;
+
+    if(pic.unsync)
+        status = copy_unsync_data(fd, entry->offset, entry->size, pic.data_offset, out, &copied);
+    else
+        status = copy_file_span(fd, entry->offset + pic.data_offset, entry->size - pic.data_offset, out, dst_off, &method, &copied);
+
+    if(!to_stdout && close(out) == -1)
+        status = e_failure;
+    release_frame_directory(&dir);
+    close(fd);
+
+    if(status == e_failure)
+    {
+        fprintf(stderr, "ERROR: Unable to write the picture to %s\n", out_fname);
+        if(!to_stdout)
+            unlink(out_fname);
+        return e_failure;
+    }
+
+    fprintf(to_stdout ? stderr : stdout, "INFO: %s picture (%s, %lld bytes) written to %s via %s\n",
+            picture_type_name(pic.type), pic.mime, (long long)copied, to_stdout ? "stdout" : out_fname,
+            pic.unsync ? "unsynchronisation buffer" : copy_method_name(method));
+    return e_success;
+}
+
+/*
+ * Reads the first bytes of every APIC frame and returns the front cover,
+ * or the first picture when there is no front cover. Compressed and
+ * encrypted frames are skipped. pic->data_offset counts from the start
+ * of the frame data (after undoing unsynchronisation when pic->unsync).
+ */
+const FrameDirEntry *find_picture(int fd, const FrameDir *dir, PictureInfo *pic)
+{
+    const FrameDirEntry *found = NULL;
+    unsigned char head[ART_HEADER_SIZE];
+    PictureInfo candidate;
+
+    for(int i = 0; i < dir->frame_count; i++)
+    {
+        const FrameDirEntry *entry = &dir->frames[i];
+        if(entry->id != FRAME_FOURCC('A', 'P', 'I', 'C'))
+            continue;
+
+        int prefix = frame_data_prefix(&dir->header, entry->flags, &candidate.unsync);
+        if(prefix < 0)
+            continue;
+
+        size_t want = entry->size < ART_HEADER_SIZE ? entry->size : ART_HEADER_SIZE;
+        ssize_t got = pread(fd, head, want, entry->offset);
+        STATS_READ(got);
+        if(got != (ssize_t)want)
+            continue;
+
+        // Offsets are counted in decoded bytes when the frame is unsynchronised
+        uint length = candidate.unsync ? undo_unsync(head, want) : want;
+        if((uint)prefix >= length || parse_picture_header(head + prefix, length - prefix, &candidate) == e_failure)
+            continue;
+        candidate.data_offset += prefix;
+
+        if(found == NULL || (candidate.type == ART_FRONT_COVER && pic->type != ART_FRONT_COVER))
+        {
+            *pic = candidate;
+            found = entry;
+        }
+    }
+    return found;
+}
+
+/*
+ * APIC data: encoding byte, null-terminated MIME type (ISO-8859-1),
+ * picture type byte, description terminated in the text encoding, then
+ * the picture. Fails if the picture does not start within size bytes.
+ */
+Status parse_picture_header(const unsigned char *data, uint size, PictureInfo *pic)
+{
+    uint pos = 1;
+
+    if(size < 4)
+        return e_failure;
+    pic->encoding = data[0];
+
+    const unsigned char *end = memchr(data + pos, 0, size - pos);
+    if(end == NULL)
+        return e_failure;
+    size_t mime_len = end - (data + pos);
+    if(mime_len >= sizeof(pic->mime))
+        mime_len = sizeof(pic->mime) - 1;
+    memcpy(pic->mime, data + pos, mime_len);
+    pic->mime[mime_len] = '\0';
+    pos = end - data + 1;
+
+    if(pos >= size)
+        return e_failure;
+    pic->type = data[pos++];
+
+    // Description: one zero byte, or two aligned zero bytes for UTF-16
+    if(pic->encoding == e_text_utf16 || pic->encoding == e_text_utf16be)
+    {
+        for(; pos + 1 < size; pos += 2)
+            if(data[pos] == 0 && data[pos + 1] == 0)
+                break;
+        if(pos + 1 >= size)
+            return e_failure;
+        pos += 2;
+    }
+    else
+    {
+        end = memchr(data + pos, 0, size - pos);
+        if(end == NULL)
+            return e_failure;
+        pos = end - data + 1;
+    }
+
+    pic->data_offset = pos;
+    return e_success;
+}
+
+/*
+ * Bytes in front of the frame data (id3_frame_prefix()), and whether the
+ * data is unsynchronised. Compressed or encrypted data cannot be copied
+ * as it is, so those return -1.
+ */
+int frame_data_prefix(const TagHeader *header, uint flags, int *unsync)
+{
+    unsigned char format = flags & 0xFF;
+
+    *unsync = (header->flags & TAG_FLAG_UNSYNC) || (header->version >= 4 && (format & FRAME_FLAG_UNSYNC));
+    return id3_frame_prefix(header->version, format);
+}
+
+// Function to remove the 0x00 after every 0xFF in place; returns the decoded length
+uint undo_unsync(unsigned char *data, uint size)
+{
+    uint out = 0;
+
+    for(uint i = 0; i < size; i++)
+        if(!(i > 0 && data[i - 1] == 0xFF && data[i] == 0x00))
+            data[out++] = data[i];
+    return out;
+}
+
+/*
+ * Reads length raw bytes at offset through one ART_BUFFER_SIZE buffer,
+ * removes the 0x00 that unsynchronisation put after every 0xFF (also
+ * across buffer boundaries), drops the first skip decoded bytes and
+ * writes the rest at the output's current position.
+ */
+Status copy_unsync_data(int fd_src, off_t offset, off_t length, off_t skip, int fd_dst, off_t *copied)
+{
+    unsigned char *buffer = malloc(ART_BUFFER_SIZE);
+    int prev_ff = 0;
+
+    *copied = 0;
+    if(buffer == NULL)
+        return e_failure;
+    STATS_ADD(allocs, 1);
+
+    while(length > 0)
+    {
+        size_t chunk = length > ART_BUFFER_SIZE ? ART_BUFFER_SIZE : (size_t)length;
+        ssize_t got = pread(fd_src, buffer, chunk, offset);
+        STATS_READ(got);
+        if(got == -1 && errno == EINTR)
+            continue;
+        if(got <= 0)
+        {
+            free(buffer);
+            return e_failure;
+        }
+        offset += got;
+        length -= got;
+
+        size_t out = 0;
+        for(ssize_t i = 0; i < got; i++)
+        {
+            unsigned char byte = buffer[i];
+            int dropped = prev_ff && byte == 0x00;
+            prev_ff = byte == 0xFF;
+            if(dropped)
+                continue;
+            if(skip > 0)
+                skip--;
+            else
+                buffer[out++] = byte;
+        }
+
+        for(size_t done = 0; done < out;)
+        {
+            ssize_t put = write(fd_dst, buffer + done, out - done);
+            STATS_WRITE(put);
+            if(put == -1 && errno == EINTR)
+                continue;
+            if(put <= 0)
+            {
+                free(buffer);
+                return e_failure;
+            }
+            done += put;
+        }
+        *copied += out;
+    }
+
+    free(buffer);
+    return e_success;
+}
+
+// Function to name a picture type ("unknown" past the defined types)
+const char *picture_type_name(unsigned char type)
+{
+    if(type < sizeof(picture_types) / sizeof(picture_types[0]))
+        return picture_types[type];
+    return "unknown";
+}
+
+/*
+ * Opens the image that replaces the front cover and works out its MIME
+ * type from the first bytes. The image stays open until the edit is
+ * closed; only its size is needed before the tag is written.
+ */
+Status add_art_edit(Edit *edit, const char *image_fname)
+{
+    struct stat st;
+    unsigned char magic[12] = { 0 };
+
+    int fd = open(image_fname, O_RDONLY);
+    if(fd == -1)
+    {
+        edit_error(edit, "Unable to open image %s: %s", image_fname, strerror(errno));
+        return e_failure;
+    }
+
+    if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0 || st.st_size > ART_MAX_SIZE)
+    {
+        edit_error(edit, "%s is not a usable image (empty, too large or not a regular file)", image_fname);
+        close(fd);
+        return e_failure;
+    }
+
+    ssize_t got = pread(fd, magic, sizeof(magic), 0);
+    STATS_READ(got);
+
+    const char *mime = "application/octet-stream";
+    if(got >= 3 && magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF)
+        mime = "image/jpeg";
+    else if(got >= 8 && memcmp(magic, "\x89PNG\r\n\x1a\n", 8) == 0)
+        mime = "image/png";
+    else if(got >= 4 && memcmp(magic, "GIF8", 4) == 0)
+        mime = "image/gif";
+    else if(got >= 12 && memcmp(magic, "RIFF", 4) == 0 && memcmp(magic + 8, "WEBP", 4) == 0)
+        mime = "image/webp";
+    else if(got >= 2 && memcmp(magic, "BM", 2) == 0)
+        mime = "image/bmp";
+
+    if(edit->art_fd >= 0)
+        close(edit->art_fd);    // A later APIC=@ replaces an earlier one
+    edit->art_fd = fd;
+    edit->art_size = st.st_size;
+    strcpy(edit->art_mime, mime);
+    return e_success;
+}
+
+// Frame header, encoding byte, MIME type and its terminator, picture type, empty description, picture
+uint art_frame_size(const Edit *edit)
+{
+    if(edit->art_fd < 0)
+        return 0;
+    return FRAME_HEADER_SIZE + 1 + strlen(edit->art_mime) + 1 + 1 + 1 + (uint)edit->art_size;
+}
+
+/*
+ * Writes the APIC frame header and picture header through stdio, then
+ * flushes and lets the copy engine move the picture from the image file
+ * into the output descriptor.
+ */
+Status write_art_frame(Edit *edit)
+{
+    unsigned char head[FRAME_HEADER_SIZE + sizeof(edit->art_mime) + 4];
+    uint pos = 0;
+
+    memcpy(head, "APIC", FRAME_ID_SIZE);
+    encode_frame_size(art_frame_size(edit) - FRAME_HEADER_SIZE, edit->header[3], head + FRAME_ID_SIZE);
+    head[8] = head[9] = 0;
+    pos = FRAME_HEADER_SIZE;
+
+    head[pos++] = e_text_latin1;
+    strcpy((char *)head + pos, edit->art_mime);
+    pos += strlen(edit->art_mime) + 1;
+    head[pos++] = ART_FRONT_COVER;
+    head[pos++] = 0;    // Empty description
+
+    if(write_data_to_file((char *)head, pos, edit->fptr_new) == e_failure || fflush(edit->fptr_new) == EOF)
+        return e_failure;
+
+    // A pipe has no position: the copy then writes where the stream is
+    off_t dst_off = ftello(edit->fptr_new);
+    STATS_ADD(seek_calls, 1);
+
+    CopyMethod method;
+    off_t copied;
+    if(copy_file_span(edit->art_fd, 0, edit->art_size, fileno(edit->fptr_new), dst_off, &method, &copied) == e_failure)
+    {
+        edit_error(edit, "Unable to copy the picture into the tag of %s", edit->old_fname);
+        return e_failure;
+    }
+
+    if(dst_off >= 0)
+    {
+        fseeko(edit->fptr_new, dst_off + copied, SEEK_SET);
+        STATS_ADD(seek_calls, 1);
+    }
+
+    edit_info(edit, "INFO: Picture (%s, %lld bytes) copied via %s\n", edit->art_mime, (long long)copied, copy_method_name(method));
+    return e_success;
+}
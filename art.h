@@ -0,0 +1,91 @@
+/***********************************************************************
+ *  File Name   : art.h
+ *  Description : Header file for the Album Art Module.
+ *                Declares the functions used to extract an attached
+ *                picture (APIC frame) to an image file and to replace
+ *                it from one. Picture data is never held in memory: it
+ *                is copied between the files by the copy engine, or
+ *                through one fixed-size buffer when the tag is
+ *                unsynchronised, so memory use does not depend on the
+ *                size of the image.
+ *
+ *                Structures:
+ *                - PictureInfo
+ *
+ *                Functions:
+ *                - run_extract_art()
+ *                - extract_art()
+ *                - find_picture()
+ *                - parse_picture_header()
+ *                - frame_data_prefix()
+ *                - undo_unsync()
+ *                - copy_unsync_data()
+ *                - picture_type_name()
+ *                - add_art_edit()
+ *                - art_frame_size()
+ *                - write_art_frame()
+ *
+ ***********************************************************************/
+
+#ifndef ART_H
+#define ART_H
+
+#include <sys/types.h>
+
+#include "types.h"
+#include "query.h"
+#include "edit.h"
+
+// Bytes read from the start of an APIC frame to find where the picture starts
+#define ART_HEADER_SIZE 4096
+
+// Buffer used to undo unsynchronisation while copying
+#define ART_BUFFER_SIZE (64 * 1024)
+
+// Picture type written for a new picture and replaced by it (front cover)
+#define ART_FRONT_COVER 3
+
+// Layout of one APIC frame
+typedef struct PictureInfo
+{
+    unsigned char encoding;      // Text encoding of the description
+    char mime[64];               // MIME type (e.g. image/jpeg), truncated if longer
+    unsigned char type;          // Picture type (3 = front cover)
+    uint data_offset;            // Where the picture bytes start inside the frame data
+    int unsync;                  // 1 if the frame data is unsynchronised
+} PictureInfo;
+
+// Function to run -x <file.mp3> <image|->: write the attached picture to a file or stdout
+Status run_extract_art(int argc, char **argv);
+
+// Function to copy the front cover (or the first picture) of an MP3 file into out_fname ("-" for stdout)
+Status extract_art(const char *fname, const char *out_fname);
+
+// Function to pick the picture to extract and read its header
+const FrameDirEntry *find_picture(int fd, const FrameDir *dir, PictureInfo *pic);
+
+// Function to decode encoding, MIME type, picture type and description at the start of the frame data
+Status parse_picture_header(const unsigned char *data, uint size, PictureInfo *pic);
+
+// Function to find the bytes added in front of the frame data by its format flags (-1 if compressed or encrypted)
+int frame_data_prefix(const TagHeader *header, uint flags, int *unsync);
+
+// Function to undo unsynchronisation of a buffer in place
+uint undo_unsync(unsigned char *data, uint size);
+
+// Function to copy unsynchronised data, dropping the 0x00 inserted after each 0xFF and the first skip decoded bytes
+Status copy_unsync_data(int fd_src, off_t offset, off_t length, off_t skip, int fd_dst, off_t *copied);
+
+// Function to get a printable name for a picture type
+const char *picture_type_name(unsigned char type);
+
+// Function to set the picture of an edit from an image file (APIC=@image)
+Status add_art_edit(Edit *edit, const char *image_fname);
+
+// Function to compute the size of the new APIC frame, header included (0 when the edit sets no picture)
+uint art_frame_size(const Edit *edit);
+
+// Function to write the new APIC frame to the edit's output, streaming the picture from the image file
+Status write_art_frame(Edit *edit);
+
+#endif  // ART_H
@@ -0,0 +1,586 @@
+/***********************************************************************
+ *  File Name   : batch.c
+ *  Description : Source file for the MP3 Batch Edit Module.
+ *                Reads a manifest of edits, groups them by file and
+ *                applies each file's edits in a single pass on a
+ *                bounded pool of worker threads. Every worker edits
+ *                through its own temporary file, so files never
+ *                collide. The number of workers and the number of
+ *                files started per second can both be limited.
+ *
+ *                Manifest lines (blank lines and lines starting with
+ *                '#' are ignored):
+ *                - CSV    : path,frame,value   (quotes as in RFC 4180)
+ *                - NDJSON : {"path": "...", "frame": "...", "value": "..."}
+ *                The frame may be a frame ID (TPE1) or an edit option (-a).
+ *
+ *                Functions:
+ *                - run_batch()
+ *                - read_and_validate_batch_args()
+ *                - load_manifest()
+ *                - parse_csv_line()
+ *                - parse_json_line()
+ *                - parse_json_string()
+ *                - group_batch_edits()
+ *                - batch_worker()
+ *                - wait_for_rate_slot()
+ *                - apply_batch_file()
+ *                - print_batch_report()
+ *
+ ***********************************************************************/
+
+#define _GNU_SOURCE
+
+#include "batch.h"
+#include "view.h"
+
+// Function to run the whole batch: load, group, edit in parallel, report
+Status run_batch(int argc, char **argv)
+{
+    BatchPool pool;
+    BatchEdit *edits = NULL;
+    char *manifest;
+    int edit_count = 0;
+
+    if(read_and_validate_batch_args(argc, argv, &manifest, &pool) == e_failure)
+        return e_failure;
+
+    if(load_manifest(manifest, &edits, &edit_count) == e_failure)
+        return e_failure;
+
+    if(edit_count == 0)
+    {
+        fprintf(stderr, "ERROR: Manifest %s has no edits\n", manifest);
+        return e_failure;
+    }
+
+    if(group_batch_edits(edits, edit_count, &pool.files, &pool.file_count) == e_failure)
+        return e_failure;
+
+    if(pool.max_jobs > pool.file_count)
+        pool.max_jobs = pool.file_count;
+
+    pool.next_file = 0;
+    clock_gettime(CLOCK_MONOTONIC, &pool.next_start);
+    pthread_mutex_init(&pool.lock, NULL);
+
+    // Workers take files from one shared counter, so any that started get through the whole manifest
+    pthread_t *threads = malloc(sizeof(pthread_t) * pool.max_jobs);
+    int started = 0;
+    while(threads != NULL && started < pool.max_jobs && pthread_create(&threads[started], NULL, batch_worker, &pool) == 0)
+        started++;
+    for(int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&pool.lock);
+    free(threads);
+
+    Status status = e_failure;
+    if(started == 0)
+        fprintf(stderr, "ERROR: Unable to start batch workers\n");
+    else
+        status = print_batch_report(&pool);
+
+    for(int i = 0; i < edit_count; i++)
+    {
+        free(edits[i].path);
+        free(edits[i].description);
+        free(edits[i].value);
+    }
+    free(edits);
+    free(pool.files);
+    return status;
+}
+
+// Function to read the manifest name and the optional --jobs / --rate limits
+Status read_and_validate_batch_args(int argc, char **argv, char **manifest, BatchPool *pool)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    pool->max_jobs = cores < 1 ? 1 : (int)cores;
+    pool->rate = 0;
+
+    if(argc < 3)
+    {
+        fprintf(stderr, "ERROR: Missing manifest. Usage: %s -b <manifest> [--jobs N] [--rate FILES_PER_SEC]\n", argv[0]);
+        return e_failure;
+    }
+    *manifest = argv[2];
+
+    for(int i = 3; i < argc; i += 2)
+    {
+        if(i + 1 >= argc)
+        {
+            fprintf(stderr, "ERROR: Missing value for %s\n", argv[i]);
+            return e_failure;
+        }
+
+        if(strcmp(argv[i], "--jobs") == 0)
+        {
+            pool->max_jobs = atoi(argv[i + 1]);
+            if(pool->max_jobs < 1)
+            {
+                fprintf(stderr, "ERROR: --jobs must be at least 1\n");
+                return e_failure;
+            }
+        }
+        else if(strcmp(argv[i], "--rate") == 0)
+        {
+            pool->rate = atof(argv[i + 1]);
+            if(pool->rate < 0)
+            {
+                fprintf(stderr, "ERROR: --rate must not be negative\n");
+                return e_failure;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Invalid batch option => %s\n", argv[i]);
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+/*
+ * Reads the manifest line by line. Each line is CSV unless it starts
+ * with '{', in which case it is read as one JSON object. Any malformed
+ * line fails the whole batch before a single file is touched.
+ */
+Status load_manifest(const char *fname, BatchEdit **edits, int *count)
+{
+    FILE *fptr = fopen(fname, "r");
+    if(fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open manifest %s\n", fname);
+        return e_failure;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    int line_no = 0, capacity = 0;
+    Status status = e_success;
+
+    while(status == e_success && (length = getline(&line, &line_size, fptr)) != -1)
+    {
+        line_no++;
+        while(length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            line[--length] = '\0';
+
+        char *start = line;
+        while(*start == ' ' || *start == '\t')
+            start++;
+        if(*start == '\0' || *start == '#')
+            continue;
+
+        char *path = NULL, *frame = NULL, *value = NULL;
+        if(*start == '{')
+        {
+            if(parse_json_line(start, &path, &frame, &value) == e_failure)
+                status = e_failure;
+        }
+        else
+        {
+            char *fields[3];
+            if(parse_csv_line(start, fields, 3) == e_failure)
+                status = e_failure;
+            else if(line_no == 1 && strcmp(fields[0], "path") == 0)
+                continue;   // Header row
+            else
+            {
+                path = strdup(fields[0]);
+                frame = strdup(fields[1]);
+                value = strdup(fields[2]);
+            }
+        }
+
+        if(status == e_failure || path == NULL || frame == NULL || value == NULL)
+        {
+            fprintf(stderr, "ERROR: %s:%d: expected path, frame and value\n", fname, line_no);
+            free(path);
+            free(frame);
+            free(value);
+            status = e_failure;
+            break;
+        }
+
+        if(*count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            BatchEdit *grown = realloc(*edits, sizeof(BatchEdit) * capacity);
+            if(grown == NULL)
+            {
+                free(path);
+                free(frame);
+                free(value);
+                status = e_failure;
+                break;
+            }
+            *edits = grown;
+        }
+
+        BatchEdit *edit = &(*edits)[*count];
+        const char *description;
+        edit->description = NULL;
+        if(resolve_frame_id(frame, edit->frame_id, &description) == e_failure)
+        {
+            fprintf(stderr, "ERROR: %s:%d: unsupported frame %s\n", fname, line_no, frame);
+            free(path);
+            free(value);
+            status = e_failure;
+        }
+        else if(description != NULL && (edit->description = strdup(description)) == NULL)
+        {
+            fprintf(stderr, "ERROR: %s:%d: out of memory\n", fname, line_no);
+            free(path);
+            free(value);
+            status = e_failure;
+        }
+        else
+        {
+            edit->path = path;
+            edit->value = value;
+            edit->line = line_no;
+            (*count)++;
+        }
+        free(frame);
+    }
+
+    free(line);
+    fclose(fptr);
+    return status;
+}
+
+/*
+ * Splits a CSV line in place into exactly field_count fields.
+ * Quoted fields may contain commas, and "" stands for one quote.
+ */
+Status parse_csv_line(char *line, char **fields, int field_count)
+{
+    char *read = line;
+
+    for(int i = 0; i < field_count; i++)
+    {
+        char *write = read;
+        fields[i] = write;
+
+        if(*read == '"')
+        {
+            read++;
+            for(;;)
+            {
+                if(*read == '\0')
+                    return e_failure;   // Unterminated quote
+                if(*read == '"' && read[1] == '"')
+                {
+                    *write++ = '"';
+                    read += 2;
+                }
+                else if(*read == '"')
+                {
+                    read++;
+                    break;
+                }
+                else
+                    *write++ = *read++;
+            }
+        }
+        else
+        {
+            while(*read != ',' && *read != '\0')
+                *write++ = *read++;
+        }
+
+        // Every field but the last must end at a comma, the last at the end of the line
+        if(i < field_count - 1)
+        {
+            if(*read != ',')
+                return e_failure;
+            read++;
+        }
+        else if(*read != '\0')
+            return e_failure;
+
+        *write = '\0';
+    }
+    return e_success;
+}
+
+// Function to decode one JSON string starting at the opening quote; returns the position after it
+static const char *parse_json_string(const char *pos, char **out)
+{
+    size_t capacity = strlen(pos) + 1;   // Decoded text is never longer than the source
+    char *buf = malloc(capacity);
+    char *write = buf;
+
+    if(buf == NULL || *pos != '"')
+    {
+        free(buf);
+        return NULL;
+    }
+    pos++;
+
+    while(*pos != '"')
+    {
+        if(*pos == '\0')
+        {
+            free(buf);
+            return NULL;
+        }
+        if(*pos != '\\')
+        {
+            *write++ = *pos++;
+            continue;
+        }
+
+        pos++;
+        switch(*pos)
+        {
+            case '"':  *write++ = '"';  break;
+            case '\\': *write++ = '\\'; break;
+            case '/':  *write++ = '/';  break;
+            case 'b':  *write++ = '\b'; break;
+            case 'f':  *write++ = '\f'; break;
+            case 'n':  *write++ = '\n'; break;
+            case 'r':  *write++ = '\r'; break;
+            case 't':  *write++ = '\t'; break;
+            case 'u':
+            {
+                unsigned int code;
+                if(sscanf(pos + 1, "%4x", &code) != 1)
+                {
+                    free(buf);
+                    return NULL;
+                }
+                pos += 4;
+
+                // Combine a surrogate pair into one code point
+                unsigned int low;
+                if(code >= 0xD800 && code < 0xDC00 && pos[1] == '\\' && pos[2] == 'u' &&
+                   sscanf(pos + 3, "%4x", &low) == 1 && low >= 0xDC00 && low < 0xE000)
+                {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    pos += 6;
+                }
+
+                // Encode as UTF-8 (never longer than the 6-byte escape it came from)
+                if(code < 0x80)
+                    *write++ = code;
+                else if(code < 0x800)
+                {
+                    *write++ = 0xC0 | (code >> 6);
+                    *write++ = 0x80 | (code & 0x3F);
+                }
+                else if(code < 0x10000)
+                {
+                    *write++ = 0xE0 | (code >> 12);
+                    *write++ = 0x80 | ((code >> 6) & 0x3F);
+                    *write++ = 0x80 | (code & 0x3F);
+                }
+                else
+                {
+                    *write++ = 0xF0 | (code >> 18);
+                    *write++ = 0x80 | ((code >> 12) & 0x3F);
+                    *write++ = 0x80 | ((code >> 6) & 0x3F);
+                    *write++ = 0x80 | (code & 0x3F);
+                }
+                break;
+            }
+            default:
+                free(buf);
+                return NULL;
+        }
+        pos++;
+    }
+
+    *write = '\0';
+    *out = buf;
+    return pos + 1;
+}
+
+/*
+ * Reads a flat JSON object whose members are all strings and picks out
+ * "path", "frame" and "value". Unknown string members are ignored.
+ */
+Status parse_json_line(const char *line, char **path, char **frame, char **value)
+{
+    const char *pos = line + 1;   // Skip '{'
+
+    for(;;)
+    {
+        while(isspace((unsigned char)*pos))
+            pos++;
+        if(*pos == '}')
+            return e_success;
+
+        char *key = NULL, *member = NULL;
+        pos = parse_json_string(pos, &key);
+        if(pos == NULL)
+            return e_failure;
+
+        while(isspace((unsigned char)*pos))
+            pos++;
+        if(*pos++ != ':')
+        {
+            free(key);
+            return e_failure;
+        }
+        while(isspace((unsigned char)*pos))
+            pos++;
+
+        pos = parse_json_string(pos, &member);
+        if(pos == NULL)
+        {
+            free(key);
+            return e_failure;
+        }
+
+        char **target = strcmp(key, "path") == 0 ? path :
+                        strcmp(key, "frame") == 0 ? frame :
+                        strcmp(key, "value") == 0 ? value : NULL;
+        free(key);
+        if(target != NULL)
+        {
+            free(*target);
+            *target = member;
+        }
+        else
+            free(member);
+
+        while(isspace((unsigned char)*pos))
+            pos++;
+        if(*pos == ',')
+            pos++;
+        else if(*pos != '}')
+            return e_failure;
+    }
+}
+
+// Orders edits by path, keeping manifest order for edits of the same file
+static int compare_batch_edits(const void *a, const void *b)
+{
+    const BatchEdit *x = a, *y = b;
+    int order = strcmp(x->path, y->path);
+    return order != 0 ? order : x->line - y->line;
+}
+
+// Function to group the edits so each file is handled by exactly one worker
+Status group_batch_edits(BatchEdit *edits, int count, BatchFile **files, int *file_count)
+{
+    qsort(edits, count, sizeof(BatchEdit), compare_batch_edits);
+
+    *files = calloc(count, sizeof(BatchFile));
+    if(*files == NULL)
+        return e_failure;
+
+    *file_count = 0;
+    for(int i = 0; i < count; i++)
+    {
+        if(i == 0 || strcmp(edits[i].path, edits[i - 1].path) != 0)
+        {
+            BatchFile *file = &(*files)[(*file_count)++];
+            file->path = edits[i].path;
+            file->edits = &edits[i];
+        }
+        (*files)[*file_count - 1].edit_count++;
+    }
+    return e_success;
+}
+
+// Thread entry point: take files one at a time until none are left
+void *batch_worker(void *arg)
+{
+    BatchPool *pool = arg;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        int next = pool->next_file < pool->file_count ? pool->next_file++ : -1;
+        pthread_mutex_unlock(&pool->lock);
+
+        if(next == -1)
+            break;
+
+        wait_for_rate_slot(pool);
+        apply_batch_file(&pool->files[next]);
+    }
+    return NULL;
+}
+
+// Function to space file starts 1/rate seconds apart across all workers
+void wait_for_rate_slot(BatchPool *pool)
+{
+    if(pool->rate <= 0)
+        return;
+
+    struct timespec now, slot;
+    long interval = (long)(1e9 / pool->rate);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&pool->lock);
+    slot = pool->next_start;
+    if(slot.tv_sec < now.tv_sec || (slot.tv_sec == now.tv_sec && slot.tv_nsec < now.tv_nsec))
+        slot = now;
+
+    pool->next_start.tv_sec = slot.tv_sec + interval / 1000000000L;
+    pool->next_start.tv_nsec = slot.tv_nsec + interval % 1000000000L;
+    if(pool->next_start.tv_nsec >= 1000000000L)
+    {
+        pool->next_start.tv_sec++;
+        pool->next_start.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &slot, NULL) == EINTR)
+        ;
+}
+
+// Function to apply every edit of one file with a single tag rewrite (or in-place patch)
+void apply_batch_file(BatchFile *file)
+{
+    Edit edit;
+    Status status = prepare_edit(&edit, file->path);
+
+    edit.quiet = 1;
+    file->status = e_success;
+
+    // Manifest order is kept, so a later line for the same frame wins
+    for(int i = 0; i < file->edit_count && status == e_success; i++)
+        status = add_frame_edit(&edit, file->edits[i].frame_id, file->edits[i].description, file->edits[i].value);
+
+    if(status == e_success)
+        status = open_edit_files(&edit);
+    if(status == e_success)
+        status = edit_tag(&edit);
+    close_edit_files(&edit);
+
+    if(status == e_failure)
+    {
+        file->status = e_failure;
+        snprintf(file->message, sizeof(file->message), "%s (manifest line %d)",
+                 edit.error[0] != '\0' ? edit.error : "edit failed", file->edits[0].line);
+    }
+}
+
+// Function to print one line per file and a summary; fails if any file failed
+Status print_batch_report(BatchPool *pool)
+{
+    int failed = 0;
+
+    for(int i = 0; i < pool->file_count; i++)
+    {
+        BatchFile *file = &pool->files[i];
+        if(file->status == e_success)
+            printf("OK   %s (%d frame%s)\n", file->path, file->edit_count, file->edit_count == 1 ? "" : "s");
+        else
+        {
+            printf("FAIL %s: %s\n", file->path, file->message);
+            failed++;
+        }
+    }
+
+    printf("INFO: %d file%s edited, %d failed\n", pool->file_count - failed, pool->file_count - failed == 1 ? "" : "s", failed);
+    return failed ? e_failure : e_success;
+}
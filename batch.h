@@ -0,0 +1,99 @@
+/***********************************************************************
+ *  File Name   : batch.h
+ *  Description : Header file for the MP3 Batch Edit Module.
+ *                Declares structures and function prototypes used to
+ *                apply a manifest of edits (CSV or NDJSON lines of
+ *                path + frame + value) to many files with a bounded
+ *                pool of worker threads.
+ *
+ *                Structures:
+ *                - BatchEdit
+ *                - BatchFile
+ *                - BatchPool
+ *
+ *                Functions:
+ *                - run_batch()
+ *                - read_and_validate_batch_args()
+ *                - load_manifest()
+ *                - parse_csv_line()
+ *                - parse_json_line()
+ *                - group_batch_edits()
+ *                - batch_worker()
+ *                - wait_for_rate_slot()
+ *                - apply_batch_file()
+ *                - print_batch_report()
+ *
+ ***********************************************************************/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <pthread.h>
+#include <time.h>
+
+#include "edit.h"
+#include "types.h"
+
+// One line of the manifest
+typedef struct BatchEdit
+{
+    char *path;                          // MP3 file to edit
+    char frame_id[FRAME_ID_SIZE + 1];    // Frame to set
+    char *description;                   // Description of the TXXX, WXXX, COMM or USLT frame to set, NULL if none
+    char *value;                         // New frame text
+    int line;                            // Manifest line number (for error messages)
+} BatchEdit;
+
+// All edits for one file, applied by a single worker
+typedef struct BatchFile
+{
+    char *path;                 // MP3 file to edit
+    BatchEdit *edits;           // First edit of this file (edits are grouped by path)
+    int edit_count;             // Number of edits for this file
+    Status status;              // Result for the report
+    char message[320];          // Failure reason for the report
+} BatchFile;
+
+// Shared state of one batch run
+typedef struct BatchPool
+{
+    BatchFile *files;           // Files to edit, in report order
+    int file_count;             // Number of files
+    int next_file;              // Next file to hand out (protected by lock)
+    int max_jobs;               // Number of worker threads (concurrency limit)
+    double rate;                // Maximum files started per second (0 = unlimited)
+    struct timespec next_start; // Earliest start time of the next file (protected by lock)
+    pthread_mutex_t lock;       // Protects next_file and next_start
+} BatchPool;
+
+// Function to run batch mode: -b <manifest> [--jobs N] [--rate FILES_PER_SEC]
+Status run_batch(int argc, char **argv);
+
+// Function to validate batch arguments and fill the limits in the pool
+Status read_and_validate_batch_args(int argc, char **argv, char **manifest, BatchPool *pool);
+
+// Function to read every edit from a CSV or NDJSON manifest
+Status load_manifest(const char *fname, BatchEdit **edits, int *count);
+
+// Function to split one CSV line (path,frame,value with RFC 4180 quoting)
+Status parse_csv_line(char *line, char **fields, int field_count);
+
+// Function to read the path, frame and value members from one JSON object line
+Status parse_json_line(const char *line, char **path, char **frame, char **value);
+
+// Function to sort edits by path and build one BatchFile per path
+Status group_batch_edits(BatchEdit *edits, int count, BatchFile **files, int *file_count);
+
+// Thread entry point for a batch worker
+void *batch_worker(void *arg);
+
+// Function to wait until the throughput limit allows the next file to start
+void wait_for_rate_slot(BatchPool *pool);
+
+// Function to apply all edits of one file in a single pass
+void apply_batch_file(BatchFile *file);
+
+// Function to print the per-file success/failure report
+Status print_batch_report(BatchPool *pool);
+
+#endif  // BATCH_H
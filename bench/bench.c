@@ -0,0 +1,432 @@
+/***********************************************************************
+ *  File Name   : bench.c
+ *  Description : Benchmark driver for the MP3 Tag Editor and Viewer.
+ *                Generates synthetic MP3 corpora (tag size and frame
+ *                count, APIC size, padding, ID3v2.3 / ID3v2.4, audio
+ *                payload from 1 KB up to 1 GB), then times view,
+ *                single-frame edit, multi-frame edit and directory
+ *                scan on each corpus through the same functions the CLI
+ *                uses. Results are printed to stdout as JSON.
+ *
+ *                Counters per run:
+ *                - files/s and MB/s (file bytes processed)
+ *                - heap allocations (malloc/calloc/realloc/memalign
+ *                  family, counted by wrappers in this file)
+ *                - read and write syscalls and bytes (/proc/self/io)
+ *
+ *                Structures:
+ *                - CorpusSpec
+ *                - BenchCounters
+ *
+ *                Functions:
+ *                - main()
+ *                - generate_corpus()
+ *                - write_synthetic_mp3()
+ *                - read_counters()
+ *                - run_view()
+ *                - run_edit()
+ *                - run_scan()
+ *                - print_result()
+ *
+ ***********************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../view.h"
+#include "../edit.h"
+#include "../scan.h"
+#include "../id3.h"
+#include "../frames.h"
+
+// Size of the buffer used to write audio payloads
+#define BENCH_WRITE_CHUNK (1024 * 1024)
+
+// One synthetic corpus
+typedef struct CorpusSpec
+{
+    const char *name;           // Scenario name used in the JSON output
+    int files;                  // Number of files
+    int version;                // ID3v2 major version (3 or 4)
+    int frames;                 // Number of text frames per tag
+    uint text_size;             // Bytes of text per frame
+    uint apic_size;             // Bytes of APIC picture data (0 = no APIC frame)
+    uint padding;               // Padding bytes after the frames
+    long long audio_size;       // Bytes of audio after the tag
+} CorpusSpec;
+
+// Process-wide counters sampled before and after each run
+typedef struct BenchCounters
+{
+    long allocs;                // Heap allocations
+    long read_calls;            // read-family syscalls (syscr)
+    long write_calls;           // write-family syscalls (syscw)
+    long long read_bytes;       // Bytes read (rchar)
+    long long write_bytes;      // Bytes written (wchar)
+} BenchCounters;
+
+// Default scenarios; the 1 GB payload is only generated with --huge
+static const CorpusSpec scenarios[] =
+{
+    { "small-v23",     200, 3,  8,  16,      0,  256, 1024 },
+    { "small-v24",     200, 4,  8,  16,      0,  256, 1024 },
+    { "many-frames",   100, 3, 60,  64,      0, 2048, 64 * 1024 },
+    { "large-apic",     50, 3,  8,  16, 512 * 1024, 256, 256 * 1024 },
+    { "no-padding",     50, 3,  8,  16,      0,    0, 4 * 1024 * 1024 },
+    { "large-audio",     2, 3,  8,  16,      0,    0, 64LL * 1024 * 1024 },
+    { "huge-audio",      1, 4,  8,  16, 64 * 1024, 0, 1024LL * 1024 * 1024 },
+};
+
+/*
+ * Allocation counting: the allocator entry points are wrapped and forward
+ * to glibc's own implementation, so every allocation made by the code
+ * under test (and by stdio on its behalf) is counted.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static atomic_long alloc_count;
+
+void *malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr == NULL ? 12 : 0;   // ENOMEM
+}
+
+// Function to sample the allocation count and the kernel I/O accounting of this process
+static void read_counters(BenchCounters *counters)
+{
+    char line[128];
+
+    memset(counters, 0, sizeof(*counters));
+    counters->allocs = atomic_load(&alloc_count);
+
+    FILE *fptr = fopen("/proc/self/io", "r");
+    if(fptr == NULL)
+        return;
+    while(fgets(line, sizeof(line), fptr))
+    {
+        sscanf(line, "rchar: %lld", &counters->read_bytes);
+        sscanf(line, "wchar: %lld", &counters->write_bytes);
+        sscanf(line, "syscr: %ld", &counters->read_calls);
+        sscanf(line, "syscw: %ld", &counters->write_calls);
+    }
+    fclose(fptr);
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Writes one frame header; v2.4 frame sizes are syncsafe, v2.3 sizes are plain big-endian
+static void put_frame_header(FILE *fptr, const char *id, uint size, int version)
+{
+    unsigned char header[FRAME_HEADER_SIZE] = {0};
+
+    memcpy(header, id, FRAME_ID_SIZE);
+    encode_frame_size(size, version, header + FRAME_ID_SIZE);
+    fwrite(header, 1, FRAME_HEADER_SIZE, fptr);
+}
+
+/*
+ * Writes one synthetic file: tag header, text frames taken from the frame
+ * registry (only frames valid for the version), an optional APIC frame,
+ * padding, then audio frames made of a repeated MPEG frame header and filler.
+ */
+static Status write_synthetic_mp3(const char *path, const CorpusSpec *spec, int seed, unsigned char *chunk)
+{
+    FILE *fptr = fopen(path, "wb");
+    if(fptr == NULL)
+    {
+        perror(path);
+        return e_failure;
+    }
+
+    uint version_bit = spec->version >= 4 ? FRAME_V24 : FRAME_V23;
+    uint tag_size = spec->padding;
+    int written = 0;
+
+    for(int i = 0; written < spec->frames && i < frame_table_size; i++)
+        if(frame_table[i].kind == e_frame_text && (frame_table[i].versions & version_bit))
+        {
+            tag_size += FRAME_HEADER_SIZE + 1 + spec->text_size;
+            written++;
+        }
+    if(spec->apic_size > 0)
+        tag_size += FRAME_HEADER_SIZE + 14 + spec->apic_size;
+
+    unsigned char header[HEADER_SIZE] = {'I', 'D', '3', (unsigned char)spec->version, 0, 0};
+    encode_syncsafe(tag_size, header + 6);
+    fwrite(header, 1, HEADER_SIZE, fptr);
+
+    written = 0;
+    for(int i = 0; written < spec->frames && i < frame_table_size; i++)
+    {
+        if(frame_table[i].kind != e_frame_text || !(frame_table[i].versions & version_bit))
+            continue;
+
+        put_frame_header(fptr, frame_table[i].name, 1 + spec->text_size, spec->version);
+        fputc(0, fptr);
+        for(uint j = 0; j < spec->text_size; j++)
+            fputc('a' + (seed + i + j) % 26, fptr);
+        written++;
+    }
+
+    if(spec->apic_size > 0)
+    {
+        put_frame_header(fptr, "APIC", 14 + spec->apic_size, spec->version);
+        fwrite("\0image/jpeg\0\3\0", 1, 14, fptr);
+        for(uint left = spec->apic_size; left > 0; )
+        {
+            uint n = left > BENCH_WRITE_CHUNK ? BENCH_WRITE_CHUNK : left;
+            fwrite(chunk, 1, n, fptr);
+            left -= n;
+        }
+    }
+
+    for(uint i = 0; i < spec->padding; i++)
+        fputc(0, fptr);
+
+    for(long long left = spec->audio_size; left > 0; )
+    {
+        size_t n = left > BENCH_WRITE_CHUNK ? BENCH_WRITE_CHUNK : (size_t)left;
+        fwrite(chunk, 1, n, fptr);
+        left -= n;
+    }
+
+    if(fclose(fptr) == EOF)
+    {
+        perror(path);
+        return e_failure;
+    }
+    return e_success;
+}
+
+// Function to create the corpus directory and its files
+static Status generate_corpus(const char *base, const CorpusSpec *spec, char ***paths, char **dir)
+{
+    unsigned char *chunk = malloc(BENCH_WRITE_CHUNK);
+    if(chunk == NULL)
+        return e_failure;
+
+    // Audio filler: MPEG-1 Layer III frame sync followed by pseudo-random bytes
+    srand(1);
+    for(int i = 0; i < BENCH_WRITE_CHUNK; i++)
+        chunk[i] = (i % 418 == 0) ? 0xFF : (i % 418 == 1) ? 0xFB : rand() & 0xFF;
+
+    *dir = malloc(strlen(base) + strlen(spec->name) + 2);
+    sprintf(*dir, "%s/%s", base, spec->name);
+    mkdir(*dir, 0755);
+
+    *paths = calloc(spec->files, sizeof(char *));
+    for(int i = 0; i < spec->files; i++)
+    {
+        (*paths)[i] = malloc(strlen(*dir) + 32);
+        sprintf((*paths)[i], "%s/track%05d.mp3", *dir, i);
+        if(write_synthetic_mp3((*paths)[i], spec, i, chunk) == e_failure)
+        {
+            free(chunk);
+            return e_failure;
+        }
+    }
+
+    free(chunk);
+    return e_success;
+}
+
+// Function to view every file once, output discarded
+static void run_view(char **paths, int count)
+{
+    FILE *null_out = fopen("/dev/null", "w");
+
+    for(int i = 0; i < count; i++)
+    {
+        TagInfo tagInfo;
+        memset(&tagInfo, 0, sizeof(tagInfo));
+        tagInfo.src_mp3_fname = paths[i];
+        if(open_files(&tagInfo) == e_failure)
+            continue;
+        tagInfo.fptr_out = null_out;
+        display_tag(&tagInfo);
+        fclose(tagInfo.fptr_src_mp3);
+    }
+    fclose(null_out);
+}
+
+// Function to set the given frames on every file, one pass per file
+static void run_edit(char **paths, int count, const char *const *frames, int frame_count)
+{
+    for(int i = 0; i < count; i++)
+    {
+        Edit edit;
+        if(prepare_edit(&edit, paths[i]) == e_failure)
+            continue;
+        edit.quiet = 1;
+
+        for(int f = 0; f < frame_count; f++)
+            add_frame_edit(&edit, frames[2 * f], NULL, frames[2 * f + 1]);
+
+        if(open_edit_files(&edit) == e_success)
+            edit_tag(&edit);
+        close_edit_files(&edit);
+    }
+}
+
+// Function to scan the corpus directory with the worker pool, output discarded
+static void run_scan(char *dir)
+{
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+
+    scan_paths(&dir, 1, NULL);
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+// Function to print one JSON result object
+static void print_result(int *first, const CorpusSpec *spec, const char *op, int files, long long bytes,
+                         double seconds, const BenchCounters *before, const BenchCounters *after)
+{
+    printf("%s\n    {\"scenario\": \"%s\", \"op\": \"%s\", \"version\": %d, \"files\": %d, \"bytes\": %lld, "
+           "\"seconds\": %.6f, \"files_per_sec\": %.1f, \"mb_per_sec\": %.1f, \"allocs\": %ld, "
+           "\"read_syscalls\": %ld, \"write_syscalls\": %ld, \"read_bytes\": %lld, \"write_bytes\": %lld}",
+           *first ? "" : ",", spec->name, op, spec->version, files, bytes, seconds,
+           seconds > 0 ? files / seconds : 0.0, seconds > 0 ? bytes / seconds / 1e6 : 0.0,
+           after->allocs - before->allocs, after->read_calls - before->read_calls,
+           after->write_calls - before->write_calls, after->read_bytes - before->read_bytes,
+           after->write_bytes - before->write_bytes);
+    *first = 0;
+}
+
+/*
+ * mp3bench [--dir DIR] [--scenario NAME] [--huge] [--keep]
+ * Each scenario generates its corpus, then runs view, scan, single-frame
+ * edit and multi-frame edit on it (in that order, so the edits start from
+ * the generated padding).
+ */
+int main(int argc, char *argv[])
+{
+    const char *base = "/tmp/mp3bench";
+    const char *only = NULL;
+    int huge = 0, keep = 0, first = 1;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+            base = argv[++i];
+        else if(strcmp(argv[i], "--scenario") == 0 && i + 1 < argc)
+            only = argv[++i];
+        else if(strcmp(argv[i], "--huge") == 0)
+            huge = 1;
+        else if(strcmp(argv[i], "--keep") == 0)
+            keep = 1;
+        else
+        {
+            fprintf(stderr, "Usage: %s [--dir DIR] [--scenario NAME] [--huge] [--keep]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    static const char *const single[] = { "TIT2", "Benchmark Title" };
+    static const char *const multi[] = { "TPE1", "Benchmark Artist", "TALB", "Benchmark Album",
+                                         "TCON", "Electronic", "COMM", "Generated by mp3bench" };
+
+    mkdir(base, 0755);
+    printf("{\n  \"benchmark\": \"mp3tag\",\n  \"results\": [");
+
+    for(size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++)
+    {
+        const CorpusSpec *spec = &scenarios[s];
+        if(only != NULL ? strcmp(only, spec->name) != 0 : (!huge && spec->audio_size >= 1024LL * 1024 * 1024))
+            continue;
+
+        char **paths, *dir;
+        fprintf(stderr, "Generating %s (%d files)...\n", spec->name, spec->files);
+        if(generate_corpus(base, spec, &paths, &dir) == e_failure)
+            return 1;
+
+        long long bytes = 0;
+        struct stat st;
+        for(int i = 0; i < spec->files; i++)
+            if(stat(paths[i], &st) == 0)
+                bytes += st.st_size;
+
+        BenchCounters before, after;
+        double start;
+
+        read_counters(&before);
+        start = now_seconds();
+        run_view(paths, spec->files);
+        read_counters(&after);
+        print_result(&first, spec, "view", spec->files, bytes, now_seconds() - start, &before, &after);
+
+        read_counters(&before);
+        start = now_seconds();
+        run_scan(dir);
+        read_counters(&after);
+        print_result(&first, spec, "scan", spec->files, bytes, now_seconds() - start, &before, &after);
+
+        read_counters(&before);
+        start = now_seconds();
+        run_edit(paths, spec->files, single, 1);
+        read_counters(&after);
+        print_result(&first, spec, "edit_single", spec->files, bytes, now_seconds() - start, &before, &after);
+
+        read_counters(&before);
+        start = now_seconds();
+        run_edit(paths, spec->files, multi, 4);
+        read_counters(&after);
+        print_result(&first, spec, "edit_multi", spec->files, bytes, now_seconds() - start, &before, &after);
+
+        for(int i = 0; i < spec->files; i++)
+        {
+            if(!keep)
+                unlink(paths[i]);
+            free(paths[i]);
+        }
+        if(!keep)
+            rmdir(dir);
+        free(paths);
+        free(dir);
+    }
+
+    printf("\n  ]\n}\n");
+    return 0;
+}
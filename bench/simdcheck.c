@@ -0,0 +1,580 @@
+/***********************************************************************
+ *  File Name   : simdcheck.c
+ *  Description : Self-check for the vector kernels of libid3.
+ *                Runs the unsynchronisation and text functions on
+ *                random and edge-case inputs and compares every result
+ *                with a plain byte-at-a-time reference written here.
+ *                The edge cases put the byte a kernel looks for at
+ *                each side of a 16- and 32-byte block, at the last byte
+ *                of a block and of the input, and vary the tail length
+ *                and the alignment of the input. All checks run once
+ *                with the AVX2 kernels (when the CPU has them) and once
+ *                with the SSE2 ones. Output written past the documented
+ *                maximum size is reported too.
+ *
+ *                Functions:
+ *                - main()
+ *                - next_random()
+ *                - fill_bytes()
+ *                - fill_utf16()
+ *                - fill_utf8()
+ *                - ref_ff_prefix()
+ *                - ref_unsync_decode()
+ *                - ref_unsync_encode()
+ *                - ref_put_utf8()
+ *                - ref_decode_text()
+ *                - ref_text_view_length()
+ *                - ref_next_code_point()
+ *                - ref_encode_text()
+ *                - ref_choose_text_encoding()
+ *                - check_result()
+ *                - check_bytes()
+ *                - check_utf16()
+ *                - check_utf8()
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../unsync.h"
+#include "../text.h"
+#include "../cpu.h"
+
+// Largest input tried (the buffers have room for the worst-case output and a guard)
+#define CHECK_MAX_LEN   4096
+#define CHECK_GUARD     64
+#define CHECK_BUF_SIZE  (4 * CHECK_MAX_LEN + 8 + CHECK_GUARD)
+
+// Value of the bytes after the allowed output; a kernel that writes there is reported
+#define GUARD_BYTE      0xA5
+
+// Mismatches printed before the rest are only counted
+#define MAX_REPORTS     20
+
+static unsigned long long random_state = 0x9E3779B97F4A7C15ULL;
+static const char *pass_name;
+static long cases, failures;
+
+// Lengths around the 16- and 32-byte blocks, plus a few longer inputs
+static const size_t lengths[] = { 0, 1, 2, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 47, 48, 49, 63, 64, 65,
+                                  95, 96, 97, 127, 128, 129, 255, 256, 257, 1000, 4096 };
+
+// Positions that sit at the edges of 16- and 32-byte blocks
+static const size_t edges[] = { 0, 1, 7, 8, 14, 15, 16, 17, 30, 31, 32, 33, 47, 48, 63, 64, 95, 96 };
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+// Function to return the next value of a xorshift generator (fixed seed, so a failure can be repeated)
+static unsigned long long next_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+/*
+ * Fills len bytes in one of the byte modes:
+ * 0 random, 1 ASCII with special at one edge position (or as the last
+ * byte), 2 ASCII with rare specials, 3 mostly specials and zero bytes
+ */
+static void fill_bytes(unsigned char *buf, size_t len, int mode, unsigned char special, size_t edge)
+{
+    for(size_t i = 0; i < len; i++)
+    {
+        unsigned r = next_random() % 64;
+        switch(mode)
+        {
+            case 0:
+                buf[i] = next_random();
+                break;
+            case 1:
+                buf[i] = 'a' + i % 26;
+                break;
+            case 2:
+                buf[i] = r == 0 ? special : 'A' + r % 26;
+                break;
+            default:
+                buf[i] = r < 24 ? special : (r < 40 ? 0x00 : (r < 52 ? 0xE0 + r % 32 : next_random()));
+                break;
+        }
+    }
+    if(mode == 1 && len > 0)
+        buf[edge < len ? edge : len - 1] = special;
+}
+
+/*
+ * Fills units UTF-16 code units in one of the unit modes: 0 ASCII,
+ * 1 two-byte characters, 2 ASCII with one other unit at an edge,
+ * 3 random mix of every class (surrogates, lone surrogates, zero)
+ */
+static void fill_utf16(unsigned *unit, size_t units, int mode, size_t edge)
+{
+    for(size_t i = 0; i < units; i++)
+    {
+        unsigned r = next_random();
+        switch(mode)
+        {
+            case 0:
+            case 2:
+                unit[i] = 0x20 + r % 0x5F;
+                break;
+            case 1:
+                unit[i] = 0x80 + r % 0x780;
+                break;
+            default:
+                switch(r % 8)
+                {
+                    case 0: case 1: unit[i] = 1 + (r >> 8) % 0x7F; break;
+                    case 2: unit[i] = 0x80 + (r >> 8) % 0x780; break;
+                    case 3: unit[i] = 0x800 + (r >> 8) % 0xD000; break;
+                    case 4: unit[i] = 0xE000 + (r >> 8) % 0x2000; break;
+                    case 5: unit[i] = 0xD800 + (r >> 8) % 0x400; break;
+                    case 6: unit[i] = 0xDC00 + (r >> 8) % 0x400; break;
+                    default: unit[i] = (r >> 8) % 16 == 0 ? 0 : 0x7F + (r >> 8) % 2; break;
+                }
+                break;
+        }
+    }
+    if(mode == 2 && units > 0)
+    {
+        static const unsigned odd[] = { 0x80, 0x7FF, 0x800, 0xFFFF, 0xD800, 0xDC00, 0x0000 };
+        unit[edge < units ? edge : units - 1] = odd[next_random() % COUNT(odd)];
+    }
+}
+
+// Function to build UTF-8 text from ASCII runs of edge lengths and single other characters (some malformed), ending in a run
+static size_t fill_utf8(unsigned char *buf, size_t max)
+{
+    static const size_t runs[] = { 0, 1, 15, 16, 17, 31, 32, 33, 64 };
+    static const char *const others[] = { "\xC3\xA9", "\xD0\x96", "\xE2\x82\xAC", "\xF0\x9F\x8E\xB5", "\xC2\x80",
+                                          "\x80", "\xC0\xAF", "\xED\xA0\x80", "\xF5\x80\x80\x80", "\xFF", "\xE2\x82" };
+    size_t len = 0;
+
+    while(len + 64 + 4 <= max && next_random() % 8 != 0)
+    {
+        size_t run = runs[next_random() % COUNT(runs)];
+        for(size_t i = 0; i < run; i++, len++)
+            buf[len] = 'a' + len % 26;
+
+        const char *other = others[next_random() % COUNT(others)];
+        memcpy(buf + len, other, strlen(other));
+        len += strlen(other);
+    }
+
+    // Text often ends in an ASCII run, so the last vector block is the last of the output
+    size_t run = runs[next_random() % COUNT(runs)];
+    for(size_t i = 0; i < run && len < max; i++, len++)
+        buf[len] = 'a' + len % 26;
+    return len;
+}
+
+// Function to count the bytes before the first 0xFF, one byte at a time
+static size_t ref_ff_prefix(const unsigned char *src, size_t len)
+{
+    size_t i = 0;
+
+    while(i < len && src[i] != 0xFF)
+        i++;
+    return i;
+}
+
+// Function to drop the 0x00 after every 0xFF into out
+static size_t ref_unsync_decode(const unsigned char *src, size_t len, unsigned char *out)
+{
+    size_t o = 0;
+
+    for(size_t i = 0; i < len; i++)
+    {
+        out[o++] = src[i];
+        if(src[i] == 0xFF && i + 1 < len && src[i + 1] == 0x00)
+            i++;
+    }
+    return o;
+}
+
+// Function to add a 0x00 after every 0xFF that ends the data or comes before 0x00 or a byte >= 0xE0
+static size_t ref_unsync_encode(const unsigned char *src, size_t len, unsigned char *out)
+{
+    size_t o = 0;
+
+    for(size_t i = 0; i < len; i++)
+    {
+        out[o++] = src[i];
+        if(src[i] == 0xFF && (i + 1 == len || src[i + 1] == 0x00 || src[i + 1] >= 0xE0))
+            out[o++] = 0x00;
+    }
+    return o;
+}
+
+// Function to append one code point as UTF-8
+static size_t ref_put_utf8(unsigned cp, unsigned char *out)
+{
+    if(cp < 0x80)
+    {
+        out[0] = cp;
+        return 1;
+    }
+    if(cp < 0x800)
+    {
+        out[0] = 0xC0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    if(cp < 0x10000)
+    {
+        out[0] = 0xE0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3F);
+    out[2] = 0x80 | ((cp >> 6) & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+// Function to decode a text field up to its terminator the way decode_text() is documented to
+static size_t ref_decode_text(unsigned char encoding, const unsigned char *src, size_t len, unsigned char *out)
+{
+    size_t o = 0, i = 0;
+
+    if(encoding == e_text_utf16 || encoding == e_text_utf16be)
+    {
+        int big_endian = encoding == e_text_utf16be;
+        if(len >= 2 && src[0] == 0xFE && src[1] == 0xFF)
+            big_endian = 1, src += 2, len -= 2;
+        else if(len >= 2 && src[0] == 0xFF && src[1] == 0xFE)
+            big_endian = 0, src += 2, len -= 2;
+
+        size_t units = 0;
+        while(units < len / 2 && (src[2 * units] != 0 || src[2 * units + 1] != 0))
+            units++;
+
+        while(i < units)
+        {
+            unsigned u = big_endian ? (src[2 * i] << 8 | src[2 * i + 1]) : (src[2 * i + 1] << 8 | src[2 * i]);
+            i++;
+            if(u >= 0xD800 && u <= 0xDBFF && i < units)
+            {
+                unsigned low = big_endian ? (src[2 * i] << 8 | src[2 * i + 1]) : (src[2 * i + 1] << 8 | src[2 * i]);
+                if(low >= 0xDC00 && low <= 0xDFFF)
+                {
+                    u = 0x10000 + ((u - 0xD800) << 10) + (low - 0xDC00);
+                    i++;
+                }
+                else
+                    u = 0xFFFD;
+            }
+            else if(u >= 0xD800 && u <= 0xDFFF)
+                u = 0xFFFD;
+            o += ref_put_utf8(u, out + o);
+        }
+        return o;
+    }
+
+    for(; i < len && src[i] != 0; i++)
+    {
+        if(encoding == e_text_utf8)
+            out[o++] = src[i];
+        else
+            o += ref_put_utf8(src[i], out + o);
+    }
+    return o;
+}
+
+// Function to give the in-place length of UTF-8 or all-ASCII ISO-8859-1, else TEXT_NEEDS_DECODE
+static size_t ref_text_view_length(unsigned char encoding, const unsigned char *src, size_t len)
+{
+    size_t length = 0;
+    int ascii = 1;
+
+    if(encoding == e_text_utf16 || encoding == e_text_utf16be)
+        return TEXT_NEEDS_DECODE;
+    for(; length < len && src[length] != 0; length++)
+        if(src[length] >= 0x80)
+            ascii = 0;
+    return encoding == e_text_utf8 || ascii ? length : TEXT_NEEDS_DECODE;
+}
+
+// Function to read one code point (malformed input gives U+FFFD and skips one byte)
+static unsigned ref_next_code_point(const unsigned char *s, size_t len, size_t *pos)
+{
+    size_t i = *pos;
+    unsigned c = s[i], cp;
+    size_t extra;
+
+    *pos = i + 1;
+    if(c < 0x80)
+        return c;
+    if(c >= 0xC2 && c <= 0xDF)
+        extra = 1, cp = c & 0x1F;
+    else if(c >= 0xE0 && c <= 0xEF)
+        extra = 2, cp = c & 0x0F;
+    else if(c >= 0xF0 && c <= 0xF4)
+        extra = 3, cp = c & 0x07;
+    else
+        return 0xFFFD;
+
+    if(i + extra >= len)
+        return 0xFFFD;
+    for(size_t k = 1; k <= extra; k++)
+    {
+        if((s[i + k] & 0xC0) != 0x80)
+            return 0xFFFD;
+        cp = cp << 6 | (s[i + k] & 0x3F);
+    }
+    *pos = i + 1 + extra;
+    if((extra == 2 && cp < 0x800) || (extra == 3 && (cp < 0x10000 || cp > 0x10FFFF)) || (cp >= 0xD800 && cp <= 0xDFFF))
+        return 0xFFFD;
+    return cp;
+}
+
+// Function to encode UTF-8 one code point at a time the way encode_text() is documented to
+static size_t ref_encode_text(TextEncoding encoding, const unsigned char *s, size_t len, unsigned char *out)
+{
+    int big_endian = encoding == e_text_utf16be;
+    size_t i = 0, o = 0;
+
+    if(encoding == e_text_utf8)
+    {
+        memcpy(out, s, len);
+        return len;
+    }
+    if(encoding == e_text_utf16)
+    {
+        out[o++] = 0xFF;
+        out[o++] = 0xFE;
+    }
+
+    while(i < len)
+    {
+        unsigned cp = ref_next_code_point(s, len, &i);
+        unsigned units[2] = { cp, 0 };
+        int count = 1;
+
+        if(encoding == e_text_latin1)
+        {
+            out[o++] = cp <= 0xFF ? cp : '?';
+            continue;
+        }
+        if(cp >= 0x10000)
+        {
+            units[0] = 0xD800 | ((cp - 0x10000) >> 10);
+            units[1] = 0xDC00 | ((cp - 0x10000) & 0x3FF);
+            count = 2;
+        }
+        for(int k = 0; k < count; k++, o += 2)
+        {
+            out[o + (big_endian ? 0 : 1)] = units[k] >> 8;
+            out[o + (big_endian ? 1 : 0)] = units[k] & 0xFF;
+        }
+    }
+    return o;
+}
+
+// Function to pick the encoding for new text the way choose_text_encoding() is documented to
+static TextEncoding ref_choose_text_encoding(int old_encoding, int version, const unsigned char *s, size_t len)
+{
+    int latin1 = 1;
+
+    for(size_t i = 0; i < len; i++)
+        if(s[i] >= 0xC0 && s[i] != 0xC2 && s[i] != 0xC3)
+            latin1 = 0;
+
+    if(old_encoding == e_text_utf16)
+        return e_text_utf16;
+    if((old_encoding == e_text_utf16be || old_encoding == e_text_utf8) && version >= 4)
+        return old_encoding;
+    if(latin1)
+        return e_text_latin1;
+    return version >= 4 ? e_text_utf8 : e_text_utf16;
+}
+
+/*
+ * Compares one result with the reference: the returned length, the
+ * output bytes, and the guard bytes after the largest allowed output
+ */
+static void check_result(const char *kernel, const char *input, size_t len, size_t got, size_t want,
+                         const unsigned char *out, const unsigned char *ref, size_t allowed)
+{
+    size_t diff = 0;
+    const char *what = NULL;
+
+    cases++;
+    if(got != want)
+        what = "length";
+    else if(out != NULL && memcmp(out, ref, got) != 0)
+    {
+        what = "bytes";
+        while(out[diff] == ref[diff])
+            diff++;
+    }
+    else if(out != NULL)
+    {
+        for(diff = allowed; diff < allowed + CHECK_GUARD && out[diff] == GUARD_BYTE; diff++)
+            ;
+        if(diff < allowed + CHECK_GUARD)
+            what = "guard";
+    }
+    if(what == NULL)
+        return;
+
+    if(++failures <= MAX_REPORTS)
+        printf("FAIL %-22s [%s] %s input, %zu bytes: %s differs (got %zu, want %zu, offset %zu)\n",
+               kernel, pass_name, input, len, what, got, want, diff);
+}
+
+// Function to run the byte kernels (0xFF search, unsync both ways, ISO-8859-1 and UTF-8 decoding) on one input
+static void check_bytes(const unsigned char *src, size_t len, const char *input)
+{
+    static unsigned char out[CHECK_BUF_SIZE], ref[CHECK_BUF_SIZE], copy[CHECK_BUF_SIZE];
+
+    check_result("ff_prefix", input, len, ff_prefix(src, len), ref_ff_prefix(src, len), NULL, NULL, 0);
+
+    memset(copy, GUARD_BYTE, len + CHECK_GUARD);
+    memcpy(copy, src, len);
+    check_result("unsync_decode", input, len, unsync_decode(copy, len), ref_unsync_decode(src, len, ref), copy, ref, len);
+
+    memset(out, GUARD_BYTE, sizeof(out));
+    check_result("unsync_encode", input, len, unsync_encode(src, len, out), ref_unsync_encode(src, len, ref),
+                 out, ref, UNSYNC_ENCODED_MAX(len));
+
+    for(unsigned char encoding = e_text_latin1; encoding <= e_text_utf8 + 1; encoding++)
+    {
+        if(encoding == e_text_utf16 || encoding == e_text_utf16be)
+            continue;
+        memset(out, GUARD_BYTE, sizeof(out));
+        check_result(encoding == e_text_utf8 ? "decode_text(utf8)" : "decode_text(latin1)", input, len,
+                     decode_text(encoding, src, len, (char *)out), ref_decode_text(encoding, src, len, ref),
+                     out, ref, TEXT_DECODED_MAX(len));
+        check_result("text_view_length", input, len, text_view_length(encoding, src, len),
+                     ref_text_view_length(encoding, src, len), NULL, NULL, 0);
+    }
+}
+
+// Function to decode one unit array as UTF-16 with every byte order mark choice
+static void check_utf16(const unsigned *unit, size_t units, const char *input)
+{
+    static unsigned char src[CHECK_BUF_SIZE], out[CHECK_BUF_SIZE], ref[CHECK_BUF_SIZE];
+
+    for(int form = 0; form < 4; form++)
+    {
+        // No BOM (UTF-16BE / BOM-less little-endian), FF FE, FE FF
+        int big_endian = form == 0 || form == 3;
+        unsigned char encoding = form == 0 ? e_text_utf16be : e_text_utf16;
+        size_t len = 0;
+
+        if(form == 2)
+            src[len++] = 0xFF, src[len++] = 0xFE;
+        else if(form == 3)
+            src[len++] = 0xFE, src[len++] = 0xFF;
+        for(size_t i = 0; i < units; i++, len += 2)
+        {
+            src[len + (big_endian ? 0 : 1)] = unit[i] >> 8;
+            src[len + (big_endian ? 1 : 0)] = unit[i] & 0xFF;
+        }
+        if(units % 3 == 1)
+            src[len++] = 0x41;    // An odd trailing byte is not a unit
+
+        memset(out, GUARD_BYTE, sizeof(out));
+        check_result("decode_text(utf16)", input, len, decode_text(encoding, src, len, (char *)out),
+                     ref_decode_text(encoding, src, len, ref), out, ref, TEXT_DECODED_MAX(len));
+    }
+}
+
+// Function to encode one UTF-8 string in every encoding and choose an encoding for it
+static void check_utf8(const unsigned char *src, size_t len, const char *input)
+{
+    static const char *const names[] = { "encode_text(latin1)", "encode_text(utf16)", "encode_text(utf16be)", "encode_text(utf8)" };
+    static unsigned char out[CHECK_BUF_SIZE], ref[CHECK_BUF_SIZE];
+
+    for(int encoding = e_text_latin1; encoding <= e_text_utf8; encoding++)
+    {
+        memset(out, GUARD_BYTE, sizeof(out));
+        check_result(names[encoding], input, len, encode_text(encoding, (const char *)src, len, out),
+                     ref_encode_text(encoding, src, len, ref), out, ref, TEXT_ENCODED_MAX(len));
+    }
+    for(int old = -1; old <= e_text_utf8; old++)
+        for(int version = 3; version <= 4; version++)
+            check_result("choose_text_encoding", input, len, choose_text_encoding(old, version, (const char *)src, len),
+                         ref_choose_text_encoding(old, version, src, len), NULL, NULL, 0);
+}
+
+int main(int argc, char *argv[])
+{
+    static unsigned char buf[CHECK_MAX_LEN + 8];
+    static unsigned unit[CHECK_MAX_LEN];
+    static const char *const byte_modes[] = { "random", "edge", "sparse", "dense" };
+    static const char *const unit_modes[] = { "ascii", "two-byte", "edge", "mixed" };
+    int rounds = 20;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--rounds") == 0 && i + 1 < argc)
+            rounds = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            random_state = strtoull(argv[++i], NULL, 0) | 1;
+        else
+        {
+            fprintf(stderr, "Usage: %s [--rounds N] [--seed N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for(int avx2 = 1; avx2 >= 0; avx2--)
+    {
+        cpu_set_avx2(avx2);
+        if(avx2 && !cpu_has_avx2())
+        {
+            printf("SKIP avx2: not available on this CPU\n");
+            continue;
+        }
+#ifdef CPU_SSE2
+        pass_name = avx2 ? "avx2" : "sse2";
+#else
+        pass_name = "scalar";
+#endif
+        long before = failures, start = cases;
+
+        for(int round = 0; round < rounds; round++)
+        {
+            for(size_t l = 0; l < COUNT(lengths); l++)
+            {
+                size_t len = lengths[l];
+                // Inputs start at every offset within 8 bytes, so unaligned loads are covered
+                unsigned char *src = buf + round % 8;
+
+                for(int mode = 0; mode < 4; mode++)
+                {
+                    size_t edge_count = mode == 1 ? COUNT(edges) + 1 : 1;
+                    for(size_t e = 0; e < edge_count; e++)
+                    {
+                        // The last edge case puts the byte at the end of the input
+                        size_t edge = e < COUNT(edges) ? edges[e] : len - 1;
+
+                        fill_bytes(src, len, mode, 0xFF, edge);
+                        check_bytes(src, len, byte_modes[mode]);
+                        fill_bytes(src, len, mode, 0x80 + next_random() % 0x80, edge);
+                        check_bytes(src, len, byte_modes[mode]);
+
+                        fill_utf16(unit, len, mode, edge);
+                        check_utf16(unit, len, unit_modes[mode]);
+                    }
+                }
+            }
+
+            for(int i = 0; i < 64; i++)
+            {
+                size_t len = fill_utf8(buf + round % 8, CHECK_MAX_LEN);
+                check_utf8(buf + round % 8, len, "utf8");
+            }
+        }
+        printf("%s %s: %ld cases, %ld mismatches\n", failures == before ? "PASS" : "FAIL", pass_name,
+               cases - start, failures - before);
+    }
+    return failures == 0 ? 0 : 1;
+}
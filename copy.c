@@ -0,0 +1,353 @@
+/***********************************************************************
+ *  File Name   : copy.c
+ *  Description : Source file for the bulk data copy module.
+ *                Copies the tail (or any byte range) of one file into
+ *                another using the cheapest mechanism the kernel and
+ *                filesystem support, falling back step by step:
+ *                reflink → copy_file_range → sendfile → read/write.
+ *
+ *                Functions:
+ *                - copy_file_data()
+ *                - copy_file_span()
+ *                - copy_stream_data()
+ *                - copy_method_name()
+ *                - try_reflink()
+ *                - try_copy_range()
+ *                - try_sendfile()
+ *                - copy_buffered()
+ *
+ ***********************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/sendfile.h>
+#endif
+
+#include "copy.h"
+#include "stats.h"
+
+// Errors meaning "this mechanism does not work here", as opposed to a real I/O failure
+static int is_unsupported(int err)
+{
+    return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP ||
+           err == ENOTTY || err == EBADF || err == ETXTBSY;
+}
+
+// Function to share the blocks with the destination (same filesystem, block aligned offsets, up to the source's end only)
+static Status try_reflink(int fd_src, off_t *src_off, int fd_dst, off_t *dst_off, off_t *remaining, blksize_t blksize)
+{
+#ifdef FICLONERANGE
+    if(blksize <= 0 || *dst_off < 0 || *src_off % blksize != 0 || *dst_off % blksize != 0)
+        return e_failure;
+
+    struct file_clone_range range;
+    range.src_fd = fd_src;
+    range.src_offset = *src_off;
+    range.src_length = 0;          // 0 → clone up to the end of the source
+    range.dest_offset = *dst_off;
+
+    STATS_ADD(copy_calls, 1);
+    if(ioctl(fd_dst, FICLONERANGE, &range) == -1)
+        return e_failure;
+    STATS_ADD(bytes_copied, *remaining);
+
+    *src_off += *remaining;
+    *dst_off += *remaining;
+    *remaining = 0;
+    return e_success;
+#else
+    (void)fd_src; (void)src_off; (void)fd_dst; (void)dst_off; (void)remaining; (void)blksize;
+    return e_failure;
+#endif
+}
+
+// Function to copy inside the kernel with copy_file_range()
+static Status try_copy_range(int fd_src, off_t *src_off, int fd_dst, off_t *dst_off, off_t *remaining)
+{
+#ifdef __linux__
+    while(*remaining > 0)
+    {
+        size_t chunk = *remaining > 0x40000000 ? 0x40000000 : (size_t)*remaining;
+        ssize_t done = copy_file_range(fd_src, src_off, fd_dst, *dst_off < 0 ? NULL : dst_off, chunk, 0);
+        STATS_ADD(copy_calls, 1);
+        if(done > 0)
+            STATS_ADD(bytes_copied, done);
+        if(done == -1 && errno == EINTR)
+            continue;
+        if(done == 0)
+            errno = EINVAL;   // Nothing copied (e.g. special filesystems), let the next method try
+        if(done <= 0)
+            return e_failure;
+        *remaining -= done;
+    }
+    return e_success;
+#else
+    (void)fd_src; (void)src_off; (void)fd_dst; (void)dst_off; (void)remaining;
+    return e_failure;
+#endif
+}
+
+// Function to copy inside the kernel with sendfile()
+static Status try_sendfile(int fd_src, off_t *src_off, int fd_dst, off_t *dst_off, off_t *remaining)
+{
+#ifdef __linux__
+    // sendfile() writes at the current position of the destination (a stream is written where it is)
+    if(*dst_off >= 0)
+    {
+        STATS_ADD(seek_calls, 1);
+        if(lseek(fd_dst, *dst_off, SEEK_SET) == -1)
+            return e_failure;
+    }
+
+    while(*remaining > 0)
+    {
+        size_t chunk = *remaining > 0x40000000 ? 0x40000000 : (size_t)*remaining;
+        ssize_t done = sendfile(fd_dst, fd_src, src_off, chunk);
+        STATS_ADD(copy_calls, 1);
+        if(done > 0)
+            STATS_ADD(bytes_copied, done);
+        if(done == -1 && errno == EINTR)
+            continue;
+        if(done == 0)
+            errno = EINVAL;
+        if(done <= 0)
+            return e_failure;
+        if(*dst_off >= 0)
+            *dst_off += done;
+        *remaining -= done;
+    }
+    return e_success;
+#else
+    (void)fd_src; (void)src_off; (void)fd_dst; (void)dst_off; (void)remaining;
+    return e_failure;
+#endif
+}
+
+// Function to copy through a large page-aligned buffer (works everywhere)
+static Status copy_buffered(int fd_src, off_t *src_off, int fd_dst, off_t *dst_off, off_t *remaining)
+{
+    void *buffer;
+    if(posix_memalign(&buffer, 4096, COPY_BUFFER_SIZE) != 0)
+        return e_failure;
+    STATS_ADD(allocs, 1);
+
+    while(*remaining > 0)
+    {
+        size_t chunk = *remaining > COPY_BUFFER_SIZE ? COPY_BUFFER_SIZE : (size_t)*remaining;
+        ssize_t got = pread(fd_src, buffer, chunk, *src_off);
+        STATS_READ(got);
+        if(got == -1 && errno == EINTR)
+            continue;
+        if(got <= 0)
+        {
+            free(buffer);
+            return e_failure;
+        }
+
+        ssize_t off = 0;
+        while(off < got)
+        {
+            ssize_t put = *dst_off < 0 ? write(fd_dst, (char *)buffer + off, got - off)
+                                       : pwrite(fd_dst, (char *)buffer + off, got - off, *dst_off + off);
+            STATS_WRITE(put);
+            if(put == -1 && errno == EINTR)
+                continue;
+            if(put <= 0)
+            {
+                free(buffer);
+                return e_failure;
+            }
+            off += put;
+        }
+
+        *src_off += got;
+        if(*dst_off >= 0)
+            *dst_off += got;
+        *remaining -= got;
+    }
+
+    free(buffer);
+    return e_success;
+}
+
+// Function to copy from src_off to the end of fd_src into fd_dst starting at dst_off
+Status copy_file_data(int fd_src, off_t src_off, int fd_dst, off_t dst_off, CopyMethod *method, off_t *copied)
+{
+    struct stat st;
+    if(fstat(fd_src, &st) == -1)
+    {
+        perror("fstat");
+        return e_failure;
+    }
+
+    off_t length = st.st_size > src_off ? st.st_size - src_off : 0;
+    return copy_file_span(fd_src, src_off, length, fd_dst, dst_off, method, copied);
+}
+
+/*
+ * Copies length bytes from src_off of fd_src into fd_dst at dst_off, or
+ * at the destination's current position when dst_off is -1 (a pipe or
+ * terminal). Each faster mechanism is tried first; if one is unsupported
+ * (or stops part way through) the next one continues from where it left
+ * off, so memory use does not depend on the length. The mechanism that
+ * finished the copy is stored in *method.
+ */
+Status copy_file_span(int fd_src, off_t src_off, off_t length, int fd_dst, off_t dst_off, CopyMethod *method, off_t *copied)
+{
+    struct stat st;
+    if(fstat(fd_src, &st) == -1)
+    {
+        perror("fstat");
+        return e_failure;
+    }
+
+    off_t remaining = length;
+    off_t total = remaining;
+    *copied = 0;
+    *method = e_copy_range;
+
+    if(remaining == 0)
+        return e_success;
+
+    // A clone of 0 bytes means "to the end", so only a span that ends at the end of the source can be cloned
+    if(src_off + length == st.st_size &&
+       try_reflink(fd_src, &src_off, fd_dst, &dst_off, &remaining, st.st_blksize) == e_success)
+    {
+        *method = e_copy_reflink;
+        *copied = total;
+        return e_success;
+    }
+
+    if(try_copy_range(fd_src, &src_off, fd_dst, &dst_off, &remaining) == e_success)
+    {
+        *method = e_copy_range;
+        *copied = total;
+        return e_success;
+    }
+    if(!is_unsupported(errno))
+    {
+        perror("copy_file_range");
+        return e_failure;
+    }
+
+    if(try_sendfile(fd_src, &src_off, fd_dst, &dst_off, &remaining) == e_success)
+    {
+        *method = e_copy_sendfile;
+        *copied = total;
+        return e_success;
+    }
+    if(!is_unsupported(errno))
+    {
+        perror("sendfile");
+        return e_failure;
+    }
+
+    if(copy_buffered(fd_src, &src_off, fd_dst, &dst_off, &remaining) == e_failure)
+    {
+        perror("read/write");
+        return e_failure;
+    }
+
+    *method = e_copy_buffered;
+    *copied = total;
+    return e_success;
+}
+
+/*
+ * Copies a forward-only stream to the end. splice() moves the data inside
+ * the kernel when either side is a pipe; otherwise one COPY_BUFFER_SIZE
+ * buffer is reused, so memory stays bounded whatever the stream length.
+ */
+Status copy_stream_data(int fd_src, int fd_dst, CopyMethod *method, off_t *copied)
+{
+    *copied = 0;
+
+#ifdef __linux__
+    *method = e_copy_splice;
+    for(;;)
+    {
+        ssize_t moved = splice(fd_src, NULL, fd_dst, NULL, COPY_BUFFER_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+        STATS_ADD(copy_calls, 1);
+        if(moved > 0)
+            STATS_ADD(bytes_copied, moved);
+        if(moved == 0)
+            return e_success;
+        if(moved > 0)
+        {
+            *copied += moved;
+            continue;
+        }
+        if(errno == EINTR)
+            continue;
+        if(*copied > 0 || !is_unsupported(errno))
+        {
+            perror("splice");
+            return e_failure;
+        }
+        break;   // Neither side is a pipe: use the buffer
+    }
+#endif
+
+    *method = e_copy_buffered;
+
+    void *buffer;
+    if(posix_memalign(&buffer, 4096, COPY_BUFFER_SIZE) != 0)
+        return e_failure;
+    STATS_ADD(allocs, 1);
+
+    for(;;)
+    {
+        ssize_t got = read(fd_src, buffer, COPY_BUFFER_SIZE);
+        STATS_READ(got);
+        if(got == -1 && errno == EINTR)
+            continue;
+        if(got <= 0)
+        {
+            free(buffer);
+            if(got == 0)
+                return e_success;
+            perror("read");
+            return e_failure;
+        }
+
+        ssize_t off = 0;
+        while(off < got)
+        {
+            ssize_t put = write(fd_dst, (char *)buffer + off, got - off);
+            STATS_WRITE(put);
+            if(put == -1 && errno == EINTR)
+                continue;
+            if(put <= 0)
+            {
+                perror("write");
+                free(buffer);
+                return e_failure;
+            }
+            off += put;
+        }
+        *copied += got;
+    }
+}
+
+// Function to get a printable name for a copy method
+const char *copy_method_name(CopyMethod method)
+{
+    switch(method)
+    {
+        case e_copy_reflink:  return "reflink";
+        case e_copy_range:    return "copy_file_range";
+        case e_copy_sendfile: return "sendfile";
+        case e_copy_splice:   return "splice";
+        case e_copy_buffered: return "read/write";
+    }
+    return "unknown";
+}
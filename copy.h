@@ -0,0 +1,58 @@
+/***********************************************************************
+ *  File Name   : copy.h
+ *  Description : Header file for the bulk data copy module.
+ *                Declares the copy engine used to move the audio payload
+ *                from the original MP3 file to the rewritten file, and
+ *                picture data between image files and tags.
+ *
+ *                Enumerations:
+ *                - CopyMethod
+ *
+ *                Functions:
+ *                - copy_file_data()
+ *                - copy_file_span()
+ *                - copy_stream_data()
+ *                - copy_method_name()
+ *
+ ***********************************************************************/
+
+#ifndef COPY_H
+#define COPY_H
+
+#include <sys/types.h>
+
+#include "types.h"
+
+// Size of the aligned buffer used by the read/write fallback
+#define COPY_BUFFER_SIZE (1024 * 1024)
+
+/*
+ * Enum representing the path used to copy the data, fastest first
+ * e_copy_reflink   → Blocks shared with FICLONERANGE (no data copied)
+ * e_copy_range     → copy_file_range() inside the kernel
+ * e_copy_sendfile  → sendfile() inside the kernel
+ * e_copy_splice    → splice() through a pipe (streaming, no offsets)
+ * e_copy_buffered  → read()/write() through a large aligned buffer
+ */
+typedef enum
+{
+    e_copy_reflink,
+    e_copy_range,
+    e_copy_sendfile,
+    e_copy_splice,
+    e_copy_buffered
+} CopyMethod;
+
+// Copies everything from offset src_off of fd_src to the end into fd_dst at offset dst_off
+Status copy_file_data(int fd_src, off_t src_off, int fd_dst, off_t dst_off, CopyMethod *method, off_t *copied);
+
+// Copies length bytes at src_off of fd_src into fd_dst at dst_off (-1: at the current position of a stream)
+Status copy_file_span(int fd_src, off_t src_off, off_t length, int fd_dst, off_t dst_off, CopyMethod *method, off_t *copied);
+
+// Copies fd_src to fd_dst until end of input, forward only (pipes, sockets, terminals)
+Status copy_stream_data(int fd_src, int fd_dst, CopyMethod *method, off_t *copied);
+
+// Returns a printable name for the copy method
+const char *copy_method_name(CopyMethod method);
+
+#endif  // COPY_H
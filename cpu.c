@@ -0,0 +1,50 @@
+/***********************************************************************
+ *  File Name   : cpu.c
+ *  Description : Source file for the CPU feature module.
+ *                The answer of the feature check is cached, so the
+ *                kernels can ask for every call.
+ *
+ *                Functions:
+ *                - cpu_has_avx2()
+ *                - cpu_set_avx2()
+ *
+ ***********************************************************************/
+
+#include "cpu.h"
+
+#ifdef CPU_AVX2
+// 1 or 0 once checked (or set), -1 before
+static int avx2_state = -1;
+#endif
+
+/*
+ * Checks whether the CPU has AVX2. The result is cached; a race between
+ * two threads only repeats the check.
+ */
+int cpu_has_avx2(void)
+{
+#ifdef CPU_AVX2
+    int avx2 = __atomic_load_n(&avx2_state, __ATOMIC_RELAXED);
+
+    if(avx2 < 0)
+    {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+        __atomic_store_n(&avx2_state, avx2, __ATOMIC_RELAXED);
+    }
+    return avx2;
+#else
+    return 0;
+#endif
+}
+
+// Function to override the check: the AVX2 kernels are used only if enabled and the CPU has AVX2
+void cpu_set_avx2(int enabled)
+{
+#ifdef CPU_AVX2
+    __builtin_cpu_init();
+    __atomic_store_n(&avx2_state, enabled && __builtin_cpu_supports("avx2") ? 1 : 0, __ATOMIC_RELAXED);
+#else
+    (void)enabled;
+#endif
+}
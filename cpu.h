@@ -0,0 +1,38 @@
+/***********************************************************************
+ *  File Name   : cpu.h
+ *  Description : Header file for the CPU feature module.
+ *                Says which vector kernels the build can contain and
+ *                whether the CPU running it has AVX2, so the text and
+ *                unsynchronisation modules share one run-time check.
+ *                Part of libid3.
+ *
+ *                Macros:
+ *                - CPU_SSE2
+ *                - CPU_AVX2
+ *
+ *                Functions:
+ *                - cpu_has_avx2()
+ *                - cpu_set_avx2()
+ *
+ ***********************************************************************/
+
+#ifndef CPU_H
+#define CPU_H
+
+// SSE2 is part of the x86-64 baseline; AVX2 kernels are built with a target attribute and chosen at run time
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__SSE2__)
+#define CPU_SSE2 1
+#endif
+#if defined(__GNUC__)
+#define CPU_AVX2 1
+#endif
+#endif
+
+// Function to check once whether the CPU has AVX2 (always 0 where CPU_AVX2 is not defined)
+int cpu_has_avx2(void);
+
+// Function to turn the AVX2 kernels off (or back on where the CPU has AVX2), so the SSE2 ones can be checked too
+void cpu_set_avx2(int enabled);
+
+#endif  // CPU_H
@@ -1,65 +1,132 @@
 /***********************************************************************
  *  File Name   : edit.c
  *  Description : Source file for the MP3 Tag Editing Module.
- *                Provides functions to locate and modify specific
- *                ID3v2 tag frames in an MP3 file.
+ *                Provides functions to locate and modify ID3v2 tag
+ *                frames in an MP3 file. Any number of frames can be
+ *                set in one pass: the tag is read once, rebuilt in
+ *                memory, and then either patched in place (when it
+ *                still fits in the existing padding) or written out
+ *                once together with the audio data.
  *
  *                Functions:
  *                - read_and_validate_edit_args()
  *                - check_edit_operation()
+ *                - resolve_frame_id()
+ *                - add_frame_edit()
  *                - replace_old_file()
+ *                - parse_durability_args()
  *                - open_edit_files()
+ *                - lock_edit_target()
+ *                - open_temp_file()
+ *                - link_temp_file()
+ *                - sync_edit()
+ *                - close_edit_files()
+ *                - prepare_edit()
+ *                - edit_info()
+ *                - edit_error()
  *                - edit_tag()
- *                - read_edit_frame_id()
- *                - read_edit_frame_size()
- *                - replace_edit_frame_size()
- *                - read_old_frame_data()
+ *                - load_old_tag()
+ *                - build_edited_tag()
+ *                - unsync_edited_tag()
+ *                - encode_frame_value()
+ *                - patch_tag_in_place()
+ *                - stream_edit_tag()
+ *                - rewrite_file()
  *                - write_data_to_file()
- *                - write_size_to_file()
  *                - copy_header_to_file()
- *                - copy_flag_to_file()
- *                - write_new_frame_data()
  *                - copy_frame_data_to_file()
  *                - copy_remainig_data()
  *
  ***********************************************************************/
 
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <libgen.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "edit.h"
+#include "art.h"
+#include "trailer.h"
 #include "view.h"
+#include "id3.h"
+#include "copy.h"
+#include "frames.h"
+#include "text.h"
+#include "unsync.h"
+#include "stats.h"
 
-// External frame ID array defined in view.c
-extern const char *tags_name[MAX_FRAME_COUNT];
-
-// Mapping edit options to frame IDs (e.g., -a → TPE1)
-const char *edit_operation[MAX_FRAME_COUNT] = {"-a", "-t", "-A", "-y", "-m", "-l", "-c", "-C"};
+// Durability given to every new Edit (changed with --durability)
+static Durability default_durability = e_durable_file;
 
 /*
  * Validates and parses the command-line arguments for edit operation.
- * Stores target frame ID, source file name, and new tag data into the Edit struct.
+ * Two forms are accepted:
+ *   -e <tag_code> <file.mp3> <new data words...>
+ *   -e <file.mp3> <FRAME=value> [<FRAME=value> ...]   (FRAME is a frame ID or tag code)
+ * A file name of "-" streams from stdin to stdout.
+ * Stores the source file name and the frames to set into the Edit struct.
  */
 Status read_and_validate_edit_args(char **argv, Edit *edit)
 {
-    int index = check_edit_operation(argv[2]);
-    if(index == -1)
-    {
-        fprintf(stderr, "ERROR: Invalid operation => %s\n", argv[2]);
-        return e_failure;
-    }
-
-    // Get corresponding frame ID based on edit option
-    strcpy(edit->frame_id, tags_name[index]);
+    int multi = argv[2][0] != '-' || strcmp(argv[2], "-") == 0;
+    char *fname = multi ? argv[2] : argv[3];
 
     // Validate MP3 file
-    if(argv[3] == NULL)
+    if(fname == NULL)
         return e_failure;
 
-    if(strncmp(argv[3] + strlen(argv[3]) - 4, ".mp3", 4) != 0)
+    if(strcmp(fname, "-") != 0 && (strlen(fname) < 4 || strncmp(fname + strlen(fname) - 4, ".mp3", 4) != 0))
     {
         fprintf(stderr, "File should be .mp3 file\n");
         return e_failure;
     }
 
-    edit->old_fname = strdup(argv[3]);
+    if(prepare_edit(edit, fname) == e_failure)
+        return e_failure;
+
+    if(multi)
+    {
+        for(int i = 3; argv[i]; i++)
+        {
+            char frame_id[FRAME_ID_SIZE + 1];
+            char *equals = strchr(argv[i], '=');
+            if(equals == NULL)
+            {
+                fprintf(stderr, "ERROR: Expected FRAME=value => %s\n", argv[i]);
+                return e_failure;
+            }
+
+            // The description (TXXX:desc=value) ends at the '=', so it is used before the '=' is put back
+            const char *description;
+            *equals = '\0';
+            Status status = resolve_frame_id(argv[i], frame_id, &description);
+            if(status == e_failure)
+                fprintf(stderr, "ERROR: Invalid frame => %s\n", argv[i]);
+            else
+                status = add_frame_edit(edit, frame_id, description, equals + 1);
+            *equals = '=';
+
+            if(status == e_failure)
+                return e_failure;
+        }
+
+        if(edit->frame_count == 0 && edit->art_fd < 0)
+        {
+            fprintf(stderr, "The new Data should not be Empty\n");
+            return e_failure;
+        }
+        return e_success;
+    }
+
+    const FrameDesc *desc = check_edit_operation(argv[2]);
+    if(desc == NULL)
+    {
+        fprintf(stderr, "ERROR: Invalid operation => %s\n", argv[2]);
+        return e_failure;
+    }
 
     // Collect all new data passed after filename
     if(argv[4] == NULL)
@@ -68,290 +135,1196 @@ Status read_and_validate_edit_args(char **argv, Edit *edit)
         return e_failure;
     }
 
-    int i = 4;
-    char buffer[100] = {0};
-    while(argv[i])
+    size_t length = 0;
+    for(int i = 4; argv[i]; i++)
+        length += strlen(argv[i]) + 1;
+
+    char *buffer = malloc(length);
+    if(buffer == NULL)
+        return e_failure;
+
+    // Words are joined with single spaces
+    buffer[0] = '\0';
+    for(int i = 4; argv[i]; i++)
     {
-        strcat(buffer, argv[i++]);
-        strcat(buffer, " ");
+        if(i > 4)
+            strcat(buffer, " ");
+        strcat(buffer, argv[i]);
     }
 
-    // Store new frame data and its length
-    edit->new_frame_data = strdup(buffer);
-    edit->new_frame_size = strlen(edit->new_frame_data);
+    Status status = add_frame_edit(edit, desc->name, NULL, buffer);
+    free(buffer);
+    return status;
+}
+
+/*
+ * Maps the edit option (like "-a") to its frame in the registry
+ */
+const FrameDesc *check_edit_operation(char *op)
+{
+    return lookup_frame_option(op);
+}
+
+/*
+ * Accepts either an edit option (-a) or any registered frame ID (TPE1)
+ * whose value is text; binary frames cannot be set from the command line,
+ * except APIC, which is set from an image file (APIC=@cover.jpg).
+ * TXXX, WXXX, COMM and USLT take a description after a colon
+ * (TXXX:MusicBrainz Album Id); *description points at it, or is NULL.
+ */
+Status resolve_frame_id(const char *name, char *frame_id, const char **description)
+{
+    const FrameDesc *desc;
+    const char *colon = strchr(name, ':');
+    size_t length = colon != NULL ? (size_t)(colon - name) : strlen(name);
+    char key[16];
+
+    if(length >= sizeof(key))
+        return e_failure;
+    memcpy(key, name, length);
+    key[length] = '\0';
+
+    if(key[0] == '-')
+        desc = check_edit_operation(key);
+    else if(length == FRAME_ID_SIZE)
+        desc = lookup_frame(pack_frame_id(key));
+    else
+        desc = NULL;
+
+    if(desc == NULL || (desc->kind == e_frame_binary && desc->id != FRAME_FOURCC('A', 'P', 'I', 'C')))
+        return e_failure;
+
+    // Only frames that carry a description can be picked by one
+    if(colon != NULL && desc->kind != e_frame_user_text && desc->kind != e_frame_user_url && desc->kind != e_frame_comment)
+        return e_failure;
+
+    strcpy(frame_id, desc->name);
+    *description = colon != NULL ? colon + 1 : NULL;
     return e_success;
 }
 
 /*
- * Maps the edit option (like "-a") to index of tags_name[]
+ * Adds a frame to set in this pass. Setting the same frame twice keeps the last value.
+ * APIC takes @image and replaces the front cover with that image.
+ * TXXX and WXXX are only told apart by their description, so one is required;
+ * COMM and USLT without a description set the frame whose description is empty.
  */
-int check_edit_operation(char *op)
+Status add_frame_edit(Edit *edit, const char *frame_id, const char *description, const char *value)
 {
-    for(int i = 0; i < MAX_FRAME_COUNT; i++)
+    const FrameDesc *desc = lookup_frame(pack_frame_id(frame_id));
+    FrameEdit *frame = NULL;
+
+    if(strcmp(frame_id, "APIC") == 0)
+    {
+        if(value[0] != '@')
+        {
+            edit_error(edit, "APIC takes an image file => APIC=@cover.jpg");
+            return e_failure;
+        }
+        return add_art_edit(edit, value + 1);
+    }
+
+    if(description == NULL && (desc->kind == e_frame_user_text || desc->kind == e_frame_user_url))
     {
-        if(strcmp(edit_operation[i], op) == 0)
-            return i;
+        edit_error(edit, "%s needs a description => %s:description=value", frame_id, frame_id);
+        return e_failure;
     }
-    return -1;
+    if(description == NULL && desc->kind == e_frame_comment)
+        description = "";
+
+    for(int i = 0; i < edit->frame_count; i++)
+        if(strcmp(edit->frames[i].frame_id, frame_id) == 0 &&
+           (description == NULL || strcmp(edit->frames[i].description, description) == 0))
+            frame = &edit->frames[i];
+
+    if(frame == NULL)
+    {
+        if(edit->frame_count == edit->frame_capacity)
+        {
+            int capacity = edit->frame_capacity ? edit->frame_capacity * 2 : EDIT_FRAME_ENTRIES;
+            FrameEdit *grown = realloc(edit->frames, sizeof(FrameEdit) * capacity);
+            if(grown == NULL)
+            {
+                edit_error(edit, "Out of memory");
+                return e_failure;
+            }
+            STATS_ADD(allocs, 1);
+            edit->frames = grown;
+            edit->frame_capacity = capacity;
+        }
+        frame = &edit->frames[edit->frame_count++];
+        strcpy(frame->frame_id, frame_id);
+        frame->desc = desc;
+        frame->data = NULL;
+        frame->description = NULL;
+        frame->description_size = 0;
+        if(description != NULL)
+        {
+            frame->description = strdup(description);
+            if(frame->description == NULL)
+            {
+                edit_error(edit, "Out of memory");
+                return e_failure;
+            }
+            STATS_ADD(allocs, 1);
+            frame->description_size = strlen(description);
+        }
+    }
+    else
+        free(frame->data);
+
+    frame->data = strdup(value);
+    if(frame->data == NULL)
+    {
+        edit_error(edit, "Out of memory");
+        return e_failure;
+    }
+    STATS_ADD(allocs, 1);
+    frame->size = strlen(value);
+    frame->applied = 0;
+    return e_success;
 }
 
 /*
- * Opens old MP3 file for reading and a temp file for writing updated data
+ * Opens old MP3 file for reading ("-" streams stdin to stdout)
  */
 Status open_edit_files(Edit *edit)
 {
+    edit->fptr_new = NULL;
+    if(strcmp(edit->old_fname, "-") == 0)
+    {
+        edit->fptr_old = stdin;
+        edit->stream = 1;
+        return e_success;
+    }
+
     edit->fptr_old = fopen(edit->old_fname, "rb");
     if (edit->fptr_old == NULL)
     {
-        perror("fopen");
-        fprintf(stderr, "ERROR: Unable to open file %s\n", edit->old_fname);
+        edit_error(edit, "Unable to open file %s: %s", edit->old_fname, strerror(errno));
         return e_failure;
     }
+    return lock_edit_target(edit);
+}
 
-    edit->new_fname = strdup("temp.mp3");
-    edit->fptr_new = fopen(edit->new_fname, "wb");
-    if (edit->fptr_new == NULL)
+/*
+ * Takes an exclusive flock() on the original file, held until the edit is
+ * finished (the original stays open until after the final rename). If a
+ * concurrent edit replaced the file while we waited, the lock is on the
+ * old inode, so the new file is opened and locked instead.
+ */
+Status lock_edit_target(Edit *edit)
+{
+    for(;;)
     {
-        perror("fopen");
-        fprintf(stderr, "ERROR: Unable to open file %s\n", edit->new_fname);
+        struct stat held, current;
+
+        if(flock(fileno(edit->fptr_old), LOCK_EX) == -1)
+        {
+            edit_error(edit, "Unable to lock file %s: %s", edit->old_fname, strerror(errno));
+            return e_failure;
+        }
+
+        if(fstat(fileno(edit->fptr_old), &held) == 0 && stat(edit->old_fname, &current) == 0 &&
+           held.st_dev == current.st_dev && held.st_ino == current.st_ino)
+            return e_success;
+
+        fclose(edit->fptr_old);
+        edit->fptr_old = fopen(edit->old_fname, "rb");
+        if(edit->fptr_old == NULL)
+        {
+            edit_error(edit, "Unable to open file %s: %s", edit->old_fname, strerror(errno));
+            return e_failure;
+        }
+    }
+}
+
+/*
+ * Opens a temp file for writing updated data (only needed for a full rewrite).
+ * It is created in the same directory as the original, with the original's
+ * permissions, so the final rename stays on one filesystem. Where O_TMPFILE
+ * is supported the file has no name until it is complete, so a crash never
+ * leaves a partial file behind; otherwise mkstemp() gives a unique name.
+ * new_fname holds the name (or, for O_TMPFILE, the template for it).
+ */
+Status open_temp_file(Edit *edit)
+{
+    char *dir_copy = strdup(edit->old_fname);
+    char *base_copy = strdup(edit->old_fname);
+    struct stat st;
+    int fd = -1;
+
+    if(dir_copy == NULL || base_copy == NULL)
+    {
+        free(dir_copy);
+        free(base_copy);
+        edit_error(edit, "Out of memory");
+        return e_failure;
+    }
+
+    const char *dir = dirname(dir_copy);
+    const char *base = basename(base_copy);
+    mode_t mode = fstat(fileno(edit->fptr_old), &st) == 0 ? (st.st_mode & 07777) : 0644;
+
+    edit->new_fname = malloc(strlen(dir) + strlen(base) + 16);
+    if(edit->new_fname != NULL)
+        sprintf(edit->new_fname, "%s/.%s.XXXXXX", dir, base);
+
+#ifdef O_TMPFILE
+    // linkat() needs /proc to name the file later
+    if(edit->new_fname != NULL && access("/proc/self/fd", X_OK) == 0)
+    {
+        fd = open(dir, O_TMPFILE | O_WRONLY, mode);
+        edit->anonymous_temp = fd != -1;
+    }
+#endif
+    free(dir_copy);
+    free(base_copy);
+    if(edit->new_fname == NULL)
+    {
+        edit_error(edit, "Out of memory");
+        return e_failure;
+    }
+
+    if(fd == -1)
+        fd = mkstemp(edit->new_fname);
+    if(fd != -1)
+        fchmod(fd, mode);
+
+    if(fd == -1 || (edit->fptr_new = fdopen(fd, "wb")) == NULL)
+    {
+        edit_error(edit, "Unable to create temporary file %s: %s", edit->new_fname, strerror(errno));
+        if(fd != -1)
+        {
+            close(fd);
+            if(!edit->anonymous_temp)
+                unlink(edit->new_fname);
+        }
+        free(edit->new_fname);
+        edit->new_fname = NULL;
         return e_failure;
     }
     return e_success;
 }
 
 /*
- * The main logic to edit the tag. It:
- * - Copies header and all frames from old to new file.
- * - Replaces the target frame's data and size.
- * - Copies rest of the MP3 data.
- * - Replaces the old file with new one.
+ * Names a finished O_TMPFILE: the XXXXXX of the template is filled in
+ * and the file linked there through /proc/self/fd, retrying on a clash.
  */
-Status edit_tag(Edit *edit)
+Status link_temp_file(Edit *edit)
 {
-    fseek(edit->fptr_old, 0, SEEK_END);
-    int file_end = ftell(edit->fptr_old);
-    fseek(edit->fptr_old, 0, SEEK_SET);
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    static unsigned long counter;
+    char proc_path[64];
+    struct timespec ts;
 
-    if(copy_header_to_file(edit) == e_failure)
-        return e_failure;
+    if(!edit->anonymous_temp)
+        return e_success;
+
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fileno(edit->fptr_new));
+    char *suffix = edit->new_fname + strlen(edit->new_fname) - 6;
 
-    while(ftell(edit->fptr_old) < file_end)
+    for(int attempt = 0; attempt < 100; attempt++)
     {
-        if(read_edit_frame_id(edit) == e_failure)
-            return e_failure;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        unsigned long value = ts.tv_nsec ^ ((unsigned long)getpid() << 16) ^
+                              (__atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED) * 2654435761UL);
+        for(int i = 0; i < 6; i++, value /= 62)
+            suffix[i] = letters[value % 62];
 
-        if(read_edit_frame_size(edit) == e_failure)
-            return e_failure;
+        if(linkat(AT_FDCWD, proc_path, AT_FDCWD, edit->new_fname, AT_SYMLINK_FOLLOW) == 0)
+        {
+            edit->anonymous_temp = 0;
+            return e_success;
+        }
+        if(errno != EEXIST)
+            break;
+    }
 
-        if(copy_flag_to_file(edit) == e_failure)
-            return e_failure;
+    edit_error(edit, "Unable to name temporary file for %s: %s", edit->old_fname, strerror(errno));
+    return e_failure;
+}
 
-        if(read_old_frame_data(edit) == e_failure)
-            return e_failure;
+/*
+ * Flushes fd when the durability level is file or dir, and with with_dir
+ * also the directory of the original (so a rename into it is durable)
+ */
+Status sync_edit(Edit *edit, int fd, int with_dir)
+{
+    if(edit->durability >= e_durable_file && fd != -1 && fdatasync(fd) == -1)
+    {
+        edit_error(edit, "Unable to sync %s: %s", edit->old_fname, strerror(errno));
+        return e_failure;
+    }
 
-        // If the frame matches the one to be edited
-        if(strncmp(edit->old_frame_id, edit->frame_id, FRAME_ID_SIZE) == 0)
+    if(with_dir && edit->durability == e_durable_dir)
+    {
+        char *dir_copy = strdup(edit->old_fname);
+        if(dir_copy == NULL)
         {
-            printf("INFO: Frame Id found!\n");
-            
-            // Move file pointer back to size field (4 bytes) before flag (2 bytes) and null (1 byte)
-            fseek(edit->fptr_new, -7, SEEK_CUR);
+            edit_error(edit, "Out of memory");
+            return e_failure;
+        }
 
-            if(replace_edit_frame_size(edit) == e_failure)
-                return e_failure;
+        int dir_fd = open(dirname(dir_copy), O_RDONLY | O_DIRECTORY);
+        free(dir_copy);
+        if(dir_fd == -1 || fsync(dir_fd) == -1)
+        {
+            edit_error(edit, "Unable to sync the directory of %s: %s", edit->old_fname, strerror(errno));
+            if(dir_fd != -1)
+                close(dir_fd);
+            return e_failure;
+        }
+        close(dir_fd);
+    }
+    return e_success;
+}
 
-            fseek(edit->fptr_new, FLAG_SIZE + 1, SEEK_CUR);  // Skip flag and null byte
+/*
+ * Accepts --durability=none|file|dir or --durability <level> anywhere in argv
+ */
+Status parse_durability_args(int *argc, char **argv)
+{
+    int out = 1;
 
-            if(write_new_frame_data(edit) == e_failure)
-                return e_failure;
+    for(int i = 1; i < *argc; i++)
+    {
+        const char *level = NULL;
 
-            break;  // Stop after replacing the required frame
+        if(strncmp(argv[i], "--durability=", 13) == 0)
+            level = argv[i] + 13;
+        else if(strcmp(argv[i], "--durability") == 0 && i + 1 < *argc)
+            level = argv[++i];
+        else
+        {
+            argv[out++] = argv[i];
+            continue;
         }
-        else if(copy_frame_data_to_file(edit) == e_failure)
+
+        if(strcmp(level, "none") == 0)
+            default_durability = e_durable_none;
+        else if(strcmp(level, "file") == 0)
+            default_durability = e_durable_file;
+        else if(strcmp(level, "dir") == 0)
+            default_durability = e_durable_dir;
+        else
         {
+            fprintf(stderr, "ERROR: Invalid durability => %s (none, file or dir)\n", level);
             return e_failure;
         }
+    }
 
-        free(edit->old_frame_data);
+    argv[out] = NULL;
+    *argc = out;
+    return e_success;
+}
+
+/*
+ * Closes whatever is still open after an edit and frees the Edit buffers.
+ * A temp file that is still open means the rewrite did not finish, so it is removed.
+ */
+void close_edit_files(Edit *edit)
+{
+    if(edit->fptr_new != NULL)
+    {
+        fclose(edit->fptr_new);
+        if(!edit->anonymous_temp)
+            unlink(edit->new_fname);    // An unnamed O_TMPFILE disappears on close
+        edit->fptr_new = NULL;
+    }
+    if(edit->fptr_old != NULL)
+    {
+        if(!edit->stream)
+            fclose(edit->fptr_old);
+        edit->fptr_old = NULL;
     }
 
-    if(copy_remainig_data(edit) == e_failure)
-        return e_failure;
+    for(int i = 0; i < edit->frame_count; i++)
+    {
+        free(edit->frames[i].description);
+        free(edit->frames[i].data);
+    }
+    free(edit->frames);
+    edit->frames = NULL;
+    edit->frame_count = edit->frame_capacity = 0;
 
-    if(replace_old_file(edit->old_fname, edit->new_fname) == e_failure)
-        return e_failure;
+    if(edit->art_fd >= 0)
+        close(edit->art_fd);
+    edit->art_fd = -1;
 
-    printf("INFO: Tag Edited Successfully\n");
-    return e_success;
+    if(edit->old_mapped)
+        munmap(edit->old_block, edit->old_block_len);
+    else
+        free(edit->old_block);
+    free(edit->old_fname);
+    free(edit->new_fname);
+    free(edit->new_tag);
+    edit->old_fname = edit->new_fname = NULL;
+    edit->old_tag = edit->new_tag = edit->old_block = NULL;
+    edit->old_mapped = 0;
 }
 
 /*
- * Reads frame ID and writes it to the new file
+ * Starts an Edit for a file; frames are then added with add_frame_edit()
  */
-Status read_edit_frame_id(Edit *edit)
+Status prepare_edit(Edit *edit, const char *fname)
 {
-    char frame_id[5] = {0};
-    if(read_data_from_file(frame_id, FRAME_ID_SIZE, edit->fptr_old) == e_failure)
+    memset(edit, 0, sizeof(*edit));
+    edit->durability = default_durability;
+    edit->art_fd = -1;
+    edit->old_fname = strdup(fname);
+    if(edit->old_fname == NULL)
         return e_failure;
+    return e_success;
+}
 
-    if(write_data_to_file(frame_id, FRAME_ID_SIZE, edit->fptr_new) == e_failure)
-        return e_failure;
+/*
+ * Prints an INFO message unless the edit runs in quiet (batch) mode.
+ * When streaming, stdout carries the MP3 data, so messages go to stderr.
+ */
+void edit_info(Edit *edit, const char *format, ...)
+{
+    va_list args;
 
-    strcpy(edit->old_frame_id, frame_id);
-    return e_success;
+    if(edit->quiet)
+        return;
+
+    va_start(args, format);
+    vfprintf(edit->stream ? stderr : stdout, format, args);
+    va_end(args);
 }
 
 /*
- * Reads frame size and writes it to new file.
- * Also converts it from big-endian (sync-safe format).
+ * Prints an ERROR message and keeps the first one in edit->error, so
+ * batch mode and the daemon can report why a file was not edited.
  */
-Status read_edit_frame_size(Edit *edit)
+void edit_error(Edit *edit, const char *format, ...)
 {
-    int frame_size;
-    if(read_size_from_file(&frame_size, 4, edit->fptr_old) == e_failure)
+    va_list args;
+    char message[sizeof(edit->error)];
+
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    fprintf(stderr, "ERROR: %s\n", message);
+    if(edit->error[0] == '\0')
+        strcpy(edit->error, message);
+}
+
+/*
+ * The main logic to edit the tag. It:
+ * - Reads the original tag once.
+ * - Rebuilds the frame area with every requested frame replaced
+ *   (or appended when the frame does not exist yet).
+ * - Patches the tag in place if the result fits in the existing
+ *   frames + padding space and no picture is being set; a file with
+ *   only an ID3v1 tag has just its last 128 bytes patched when the
+ *   new values fit in the ID3v1 fields.
+ * - Otherwise writes header, frames, fresh padding and the audio data
+ *   into a new file in one pass and replaces the old file with it.
+ */
+Status edit_tag(Edit *edit)
+{
+    long long start = STATS_START();
+    if(load_old_tag(edit) == e_failure)
         return e_failure;
+    STATS_PHASE(e_phase_header, start);
 
-    if(write_size_to_file(&frame_size, 4, edit->fptr_new) == e_failure)
+    start = STATS_START();
+    if(build_edited_tag(edit) == e_failure)
         return e_failure;
+    STATS_PHASE(e_phase_build, start);
 
-    unsigned int b0 = (frame_size & 0x000000FF) << 24;
-    unsigned int b1 = (frame_size & 0x0000FF00) << 8;
-    unsigned int b2 = (frame_size & 0x00FF0000) >> 8;
-    unsigned int b3 = (frame_size & 0xFF000000) >> 24;
+    // An unsynchronised tag is written back unsynchronised, unless a picture is streamed into it
+    if(edit->header[5] & TAG_FLAG_UNSYNC)
+    {
+        if(edit->art_fd >= 0)
+            edit->header[5] &= ~TAG_FLAG_UNSYNC;
+        else if(unsync_edited_tag(edit) == e_failure)
+            return e_failure;
+    }
+
+    if(edit->stream)
+        return stream_edit_tag(edit);
+
+    // Extended header and footer change the layout, and a decoded tag no longer matches the
+    // file byte for byte; those tags are always rewritten
+    int flags_ok = (edit->header[5] & (TAG_FLAG_UNSYNC | TAG_FLAG_EXTENDED | TAG_FLAG_FOOTER)) == 0 && !edit->resynced;
+
+    // A new picture is streamed from the image file, so it is never patched into the tag in memory
+    if(edit->has_tag && flags_ok && edit->art_fd < 0 && edit->new_tag_len <= edit->tag_size)
+    {
+        start = STATS_START();
+        Status status = patch_tag_in_place(edit);
+        STATS_PHASE(e_phase_patch, start);
+        return status;
+    }
 
-    frame_size = b0 | b1 | b2 | b3;
-    edit->frame_size = frame_size;
+    // A file tagged only with ID3v1 stays that way when every new value fits in its fields
+    if(!edit->has_tag && edit->art_fd < 0 && id3v1_holds_edit(edit, fileno(edit->fptr_old)))
+    {
+        start = STATS_START();
+        Status status = patch_tag_in_place(edit);
+        STATS_PHASE(e_phase_patch, start);
+        return status;
+    }
+
+    if(edit->art_fd < 0)
+        edit_info(edit, "INFO: Edited tag does not fit in the existing tag space, rewriting file\n");
+    return rewrite_file(edit);
+}
+
+// Reads length bytes at offset with pread, or the next length bytes of a stream
+static ssize_t edit_read(Edit *edit, void *buf, size_t length, off_t offset)
+{
+    int fd = fileno(edit->fptr_old);
+
+    if(!edit->stream)
+    {
+        ssize_t got = pread(fd, buf, length, offset);
+        STATS_READ(got);
+        return got;
+    }
+
+    size_t done = 0;
+    while(done < length)
+    {
+        ssize_t got = read(fd, (char *)buf + done, length - done);
+        STATS_READ(got);
+        if(got == -1 && errno == EINTR)
+            continue;
+        if(got <= 0)
+            break;
+        done += got;
+    }
+    return done;
+}
+
+/*
+ * Reads the 10-byte header and, if there is an ID3v2 tag, maps the tag
+ * (or, when streaming, reads the body on from the header), so a large
+ * picture in the tag is paged in from the file rather than copied to
+ * the heap. An unsynchronised tag is decoded in place. A file without a tag gets a fresh ID3v2.3 header and its whole
+ * content is treated as audio data; a stream keeps the bytes it already
+ * consumed in pending so they are written out ahead of the rest.
+ */
+Status load_old_tag(Edit *edit)
+{
+    TagHeader header;
+    ssize_t got = edit_read(edit, edit->header, HEADER_SIZE, 0);
+
+    if(got == HEADER_SIZE && read_tag_header(edit->header, &header) == e_success)
+    {
+        edit->has_tag = 1;
+        edit->tag_size = header.tag_size;
+        edit->audio_offset = HEADER_SIZE + (off_t)header.tag_size;
+        if(header.flags & TAG_FLAG_FOOTER)
+            edit->audio_offset += HEADER_SIZE;   // v2.4 footer repeats the header after the tag
+
+        // Mappings start on a page boundary, so the header is kept in front of the body either way
+        edit->old_block_len = HEADER_SIZE + (size_t)edit->tag_size;
+
+        struct stat st;
+        if(!edit->stream && fstat(fileno(edit->fptr_old), &st) == 0 && S_ISREG(st.st_mode))
+        {
+            if(st.st_size < (off_t)edit->old_block_len)
+            {
+                edit_error(edit, "Tag of %s is truncated", edit->old_fname);
+                return e_failure;
+            }
+
+            // Private and writable: an unsynchronised tag is decoded in the mapping without touching the file
+            void *map = mmap(NULL, edit->old_block_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(edit->fptr_old), 0);
+            if(map == MAP_FAILED)
+            {
+                edit_error(edit, "Unable to map the tag of %s: %s", edit->old_fname, strerror(errno));
+                return e_failure;
+            }
+            edit->old_block = map;
+            edit->old_mapped = 1;
+        }
+        else
+        {
+            edit->old_block = malloc(edit->old_block_len);
+            if(edit->old_block == NULL)
+            {
+                edit_error(edit, "Out of memory");
+                return e_failure;
+            }
+            STATS_ADD(allocs, 1);
+
+            memcpy(edit->old_block, edit->header, HEADER_SIZE);
+            if(edit_read(edit, edit->old_block + HEADER_SIZE, edit->tag_size, HEADER_SIZE) != (ssize_t)edit->tag_size)
+            {
+                edit_error(edit, "Tag of %s is truncated", edit->old_fname);
+                return e_failure;
+            }
+
+            // A stream has to consume the footer too; it is not written back
+            unsigned char footer[HEADER_SIZE];
+            if(edit->stream && (header.flags & TAG_FLAG_FOOTER) && edit_read(edit, footer, HEADER_SIZE, 0) != HEADER_SIZE)
+            {
+                edit_error(edit, "Tag of %s is truncated", edit->old_fname);
+                return e_failure;
+            }
+        }
+
+        edit->old_tag = edit->old_block + HEADER_SIZE;
+        if(id3_needs_resync(edit->old_block, edit->old_block_len))
+        {
+            id3_resync(edit->old_block, edit->old_block_len);
+            edit->resynced = 1;
+        }
+        return e_success;
+    }
+
+    if(edit->stream && got > 0)
+    {
+        memcpy(edit->pending, edit->header, got);
+        edit->pending_len = got;
+    }
+
+    // No tag yet: start a new ID3v2.3 tag in front of the existing data
+    memcpy(edit->header, "ID3\x03\x00\x00\x00\x00\x00\x00", HEADER_SIZE);
+    edit->has_tag = 0;
+    edit->tag_size = 0;
+    edit->audio_offset = 0;
     return e_success;
 }
 
+// Checks whether an APIC frame holds the picture type that the new picture replaces
+static int is_replaced_picture(const Edit *edit, const unsigned char *frame, uint size)
+{
+    TagHeader header = { .version = edit->header[3], .flags = edit->header[5] };
+    unsigned char head[ART_HEADER_SIZE];
+    PictureInfo pic;
+    int unsync;
+
+    if(memcmp(frame, "APIC", FRAME_ID_SIZE) != 0)
+        return 0;
+
+    // Only the first bytes are decoded: the picture type comes right after the MIME type
+    int prefix = frame_data_prefix(&header, (frame[8] << 8) | frame[9], &unsync);
+    uint length = size < ART_HEADER_SIZE ? size : ART_HEADER_SIZE;
+    memcpy(head, frame + FRAME_HEADER_SIZE, length);
+    if(unsync)
+        length = undo_unsync(head, length);
+    if(prefix < 0 || (uint)prefix >= length)
+        return 0;
+    return parse_picture_header(head + prefix, length - prefix, &pic) == e_success && pic.type == ART_FRONT_COVER;
+}
+
 /*
- * Writes the new frame size in big-endian (sync-safe) format
+ * Checks whether the old frame data holds the description the edit asks
+ * for (any frame does when the edit has no description). The description
+ * is decoded from at most 2n + 4 bytes for an n byte request: that covers
+ * it in any encoding with BOM and terminator, and a longer description
+ * decodes from those bytes to more than n bytes, so it is never taken for it.
  */
-Status replace_edit_frame_size(Edit *edit)
+static int has_frame_description(const FrameEdit *frame, const unsigned char *data, uint size)
 {
-    int frame_size = edit->new_frame_size;
+    uint start = frame->desc->kind == e_frame_comment ? 4 : 1;
 
-    unsigned int b0 = (frame_size & 0x000000FF) << 24;
-    unsigned int b1 = (frame_size & 0x0000FF00) << 8;
-    unsigned int b2 = (frame_size & 0x00FF0000) >> 8;
-    unsigned int b3 = (frame_size & 0xFF000000) >> 24;
+    if(frame->description == NULL)
+        return 1;
+    if(size <= start)
+        return frame->description_size == 0;
 
-    frame_size = b0 | b1 | b2 | b3;
+    size_t length = size - start;
+    if(length > 2 * (size_t)frame->description_size + 4)
+        length = 2 * (size_t)frame->description_size + 4;
 
-    if(write_size_to_file(&frame_size, 4, edit->fptr_new) == e_failure)
+    char *decoded = malloc(TEXT_DECODED_MAX(length));
+    if(decoded == NULL)
+        return 0;
+    STATS_ADD(allocs, 1);
+    size_t decoded_size = decode_text(data[0], data + start, length, decoded);
+    int same = decoded_size == frame->description_size && memcmp(decoded, frame->description, decoded_size) == 0;
+    free(decoded);
+    return same;
+}
+
+/*
+ * Rebuilds the frame area in memory. Existing frames are copied through
+ * unchanged unless they are being set, in which case the frame ID and
+ * status flags are kept and the data is replaced (keeping the encoding when it
+ * can hold the new text), laid out as the frame registry describes for
+ * that frame. TXXX, WXXX, COMM and USLT frames are only replaced when their
+ * description matches too. Frames that were not found are appended at the end. When
+ * a picture is being set, the old front cover is left out; the new one
+ * is written by write_art_frame() after these frames.
+ */
+Status build_edited_tag(Edit *edit)
+{
+    uint pos = 0, out = 0;
+    uint capacity = edit->tag_size;
+    uint longest = 0;
+
+    // Room for every description and value at its largest encoded size (UTF-16 with BOM)
+    for(int i = 0; i < edit->frame_count; i++)
+    {
+        const FrameEdit *frame = &edit->frames[i];
+        capacity += FRAME_HEADER_SIZE + frame_payload_size(frame->desc, e_text_utf16, TEXT_ENCODED_MAX(frame->description_size),
+                                                           TEXT_ENCODED_MAX(frame->size));
+        if(frame->description_size + frame->size > longest)
+            longest = frame->description_size + frame->size;
+        edit->frames[i].applied = 0;
+    }
+
+    // The description and the value are encoded one after the other, each with its own BOM
+    edit->new_tag = calloc(1, capacity ? capacity : 1);   // Zero-filled, so the unused tail becomes padding
+    unsigned char *encoded = malloc(TEXT_ENCODED_MAX(longest) + 2);
+    if(edit->new_tag == NULL || encoded == NULL)
+    {
+        free(encoded);
+        edit_error(edit, "Out of memory");
         return e_failure;
+    }
+    STATS_ADD(allocs, 2);
+
+    // Skip the extended header (v2.3 size excludes itself, v2.4 size is syncsafe and includes itself)
+    if(edit->has_tag && (edit->header[5] & TAG_FLAG_EXTENDED) && edit->tag_size >= 4)
+    {
+        uint ext = edit->header[3] >= 4 ? decode_syncsafe(edit->old_tag) : decode_be32(edit->old_tag) + 4;
+        pos = ext < edit->tag_size ? ext : edit->tag_size;
+    }
+
+    // Walk the frames until the first padding byte or the end of the tag
+    while(pos + FRAME_HEADER_SIZE <= edit->tag_size && edit->old_tag[pos] != 0)
+    {
+        const unsigned char *frame = edit->old_tag + pos;
+        uint size = decode_frame_size(frame + FRAME_ID_SIZE, edit->header[3]);
+
+        if(size > edit->tag_size - pos - FRAME_HEADER_SIZE)
+        {
+            edit_error(edit, "Frame %.4s runs past the end of the tag of %s", frame, edit->old_fname);
+            free(encoded);
+            return e_failure;
+        }
+
+        if(edit->art_fd >= 0 && is_replaced_picture(edit, frame, size))
+        {
+            pos += FRAME_HEADER_SIZE + size;
+            continue;
+        }
 
-    printf("INFO: Old Frame Size Replaced\n");
+        // The old data starts after the grouping identity and data length indicator;
+        // compressed or encrypted data is not read (its encoding, language and description are lost)
+        int prefix = id3_frame_prefix(edit->header[3], frame[FRAME_ID_SIZE + 5]);
+        const unsigned char *data = frame + FRAME_HEADER_SIZE + (prefix > 0 ? prefix : 0);
+        uint data_size = prefix >= 0 && (uint)prefix <= size ? size - prefix : 0;
+
+        // A tag can hold several TXXX (or COMM) frames; only the one with the same description is replaced
+        FrameEdit *target = NULL;
+        for(int i = 0; i < edit->frame_count; i++)
+            if(!edit->frames[i].applied && memcmp(frame, edit->frames[i].frame_id, FRAME_ID_SIZE) == 0 &&
+               has_frame_description(&edit->frames[i], data, data_size))
+                target = &edit->frames[i];
+
+        if(target != NULL)
+        {
+            uint description_size, encoded_size;
+            int old_encoding = data_size > 0 && target->desc->kind != e_frame_url ? data[0] : -1;
+            unsigned char encoding = encode_frame_value(edit, target, old_encoding, encoded, &description_size, &encoded_size);
+            uint payload = frame_payload_size(target->desc, encoding, description_size, encoded_size);
+
+            // Frame ID and status flags are kept, size is replaced; the new data is plain,
+            // so the format flags that describe how the old data was stored are cleared
+            unsigned char format = frame[FRAME_ID_SIZE + 5];
+            if(edit->header[3] >= 4)
+                format &= ~(FRAME_FLAG_GROUP | FRAME_FLAG_PACKED | FRAME_FLAG_UNSYNC | FRAME_FLAG_LENGTH);
+            else
+                format &= ~(FRAME_FLAG_V23_GROUP | FRAME_FLAG_V23_PACKED);
+            memcpy(edit->new_tag + out, frame, FRAME_ID_SIZE);
+            encode_frame_size(payload, edit->header[3], edit->new_tag + out + FRAME_ID_SIZE);
+            edit->new_tag[out + FRAME_ID_SIZE + 4] = frame[FRAME_ID_SIZE + 4];
+            edit->new_tag[out + FRAME_ID_SIZE + 5] = format;
+            out += FRAME_HEADER_SIZE;
+
+            // Keep the comment language, followed by the description and the new text
+            write_frame_payload(target->desc, encoding, data_size >= 4 ? (const char *)data + 1 : NULL,
+                                (const char *)encoded, description_size,
+                                (const char *)encoded + description_size, encoded_size, edit->new_tag + out);
+            out += payload;
+            target->applied = 1;
+        }
+        else
+        {
+            memcpy(edit->new_tag + out, frame, FRAME_HEADER_SIZE + size);
+            out += FRAME_HEADER_SIZE + size;
+        }
+        pos += FRAME_HEADER_SIZE + size;
+    }
+
+    int replaced = 0, appended = 0;
+    for(int i = 0; i < edit->frame_count; i++)
+    {
+        FrameEdit *frame = &edit->frames[i];
+        if(frame->applied)
+        {
+            replaced++;
+            continue;
+        }
+
+        // Frames that do not exist in this tag version are still written, but flagged
+        uint version_bit = edit->header[3] >= 4 ? FRAME_V24 : FRAME_V23;
+        if(!(frame->desc->versions & version_bit))
+            fprintf(stderr, "WARNING: %s is not an ID3v2.%d frame\n", frame->frame_id, edit->header[3]);
+
+        // New frame: no flags, ISO-8859-1 unless the text needs Unicode
+        uint description_size, encoded_size;
+        unsigned char encoding = encode_frame_value(edit, frame, -1, encoded, &description_size, &encoded_size);
+        uint payload = frame_payload_size(frame->desc, encoding, description_size, encoded_size);
+        memcpy(edit->new_tag + out, frame->frame_id, FRAME_ID_SIZE);
+        encode_frame_size(payload, edit->header[3], edit->new_tag + out + FRAME_ID_SIZE);
+        out += FRAME_HEADER_SIZE;
+        write_frame_payload(frame->desc, encoding, NULL, (const char *)encoded, description_size,
+                            (const char *)encoded + description_size, encoded_size, edit->new_tag + out);
+        out += payload;
+        frame->applied = 1;
+        appended++;
+    }
+
+    free(encoded);
+    edit->new_tag_len = out;
+    edit_info(edit, "INFO: %d frame(s) replaced, %d frame(s) appended\n", replaced, appended);
     return e_success;
 }
 
 /*
- * Reads old frame data and stores it
+ * Unsynchronises the rebuilt frame area (as one block in ID3v2.3, frame
+ * by frame in ID3v2.4) into a new buffer that replaces it.
  */
-Status read_old_frame_data(Edit *edit)
+Status unsync_edited_tag(Edit *edit)
 {
-    int size = edit->frame_size;
-    edit->old_frame_data = malloc(size);
-    if(read_data_from_file(edit->old_frame_data, size - 1, edit->fptr_old) == e_failure)
+    unsigned char *encoded = malloc(UNSYNC_ENCODED_MAX(edit->new_tag_len) + 1);
+    if(encoded == NULL)
+    {
+        edit_error(edit, "Out of memory");
         return e_failure;
+    }
+    STATS_ADD(allocs, 1);
 
-    edit->old_frame_data[size - 1] = '\0';
+    edit->new_tag_len = id3_unsync_frames(edit->header[3], edit->new_tag, edit->new_tag_len, encoded);
+    free(edit->new_tag);
+    edit->new_tag = encoded;
     return e_success;
 }
 
 /*
- * Writes the new frame data to the file
+ * Encodes the new description and value (UTF-8 from the command line) for
+ * the frame, one after the other into out, and returns the encoding byte to
+ * write. The encoding has to hold both. old_encoding is the frame's current
+ * encoding, -1 for a new frame. URLs are written as given.
+ */
+unsigned char encode_frame_value(const Edit *edit, const FrameEdit *frame, int old_encoding, unsigned char *out,
+                                 uint *description_size, uint *size)
+{
+    TextEncoding encoding;
+
+    if(frame->desc->kind == e_frame_url)
+    {
+        memcpy(out, frame->data, frame->size);
+        *description_size = 0;
+        *size = frame->size;
+        return e_text_latin1;
+    }
+
+    // The encoding byte of WXXX covers only its description
+    if(frame->desc->kind == e_frame_user_url)
+        encoding = old_encoding >= 0 ? old_encoding : e_text_latin1;
+    else
+        encoding = choose_text_encoding(old_encoding, edit->header[3], frame->data, frame->size);
+    if(frame->description_size > 0)
+        encoding = choose_text_encoding(encoding, edit->header[3], frame->description, frame->description_size);
+
+    // An empty description is just its terminator, without a BOM
+    *description_size = frame->description_size > 0 ? encode_text(encoding, frame->description, frame->description_size, out) : 0;
+    out += *description_size;
+
+    if(frame->desc->kind == e_frame_user_url)
+    {
+        memcpy(out, frame->data, frame->size);
+        *size = frame->size;
+    }
+    else
+        *size = encode_text(encoding, frame->data, frame->size, out);
+    return encoding;
+}
+
+/*
+ * Writes the changed range of the rebuilt tag over the original file.
+ * The bytes after the rebuilt frames are zeroed, so the old tail becomes padding.
  */
-Status write_new_frame_data(Edit *edit)
+Status patch_tag_in_place(Edit *edit)
 {
-    if(write_data_to_file(edit->new_frame_data, edit->new_frame_size - 1, edit->fptr_new) == e_failure)
+    // Only the bytes that actually changed need to be written back (none when only ID3v1 is edited)
+    uint start = 0, end = edit->has_tag ? edit->tag_size : 0;
+
+    // new_tag has room for the whole old tag; clear everything after the frames
+    if(edit->has_tag)
+        memset(edit->new_tag + edit->new_tag_len, 0, edit->tag_size - edit->new_tag_len);
+
+    while(start < end && edit->old_tag[start] == edit->new_tag[start])
+        start++;
+    while(end > start && edit->old_tag[end - 1] == edit->new_tag[end - 1])
+        end--;
+    edit->patch_start = start;
+    edit->patch_end = end;
+
+    // The ID3v1 trailer, if the file has one, is patched in the same pass
+    unsigned char trailer[ID3V1_SIZE];
+    int trailer_changed = id3v1_apply_edit(edit, fileno(edit->fptr_old), trailer);
+
+    uint length = end - start;
+    if(length == 0 && !trailer_changed)
+    {
+        edit_info(edit, "INFO: Tag already up to date\n");
+        return e_success;
+    }
+
+    int fd = open(edit->old_fname, O_WRONLY);
+    if(fd == -1)
+    {
+        edit_error(edit, "Unable to open file %s for writing: %s", edit->old_fname, strerror(errno));
+        return e_failure;
+    }
+
+    off_t offset = HEADER_SIZE + start;
+    const unsigned char *data = edit->new_tag + start;
+    while(length > 0)
+    {
+        ssize_t written = pwrite(fd, data, length, offset);
+        STATS_WRITE(written);
+        if(written <= 0)
+        {
+            edit_error(edit, "Unable to write %s: %s", edit->old_fname, strerror(errno));
+            close(fd);
+            return e_failure;
+        }
+        data += written;
+        offset += written;
+        length -= written;
+    }
+
+    if(trailer_changed && write_id3v1_trailer(fd, trailer) == e_failure)
+    {
+        edit_error(edit, "Unable to write the ID3v1 tag of %s", edit->old_fname);
+        close(fd);
+        return e_failure;
+    }
+
+    if(sync_edit(edit, fd, 0) == e_failure)
+    {
+        close(fd);
         return e_failure;
+    }
 
-    printf("INFO: Old Frame Data Replaced\n");
+    if(close(fd) == -1)
+    {
+        edit_error(edit, "Unable to write %s: %s", edit->old_fname, strerror(errno));
+        return e_failure;
+    }
+
+    edit_info(edit, "INFO: Tag Edited In Place (%u bytes written)\n", end - start + (trailer_changed ? ID3V1_SIZE : 0));
     return e_success;
 }
 
 /*
- * Writes the existing frame data (not edited) to the new file
+ * Streaming edit: the rebuilt tag (with fresh padding) is written to
+ * stdout, followed by the bytes already consumed while looking for a
+ * tag, and the rest of stdin is passed through. Only the tag is held in
+ * memory; the audio goes through splice() or one fixed-size buffer.
  */
-Status copy_frame_data_to_file(Edit *edit)
+Status stream_edit_tag(Edit *edit)
 {
-    if(write_data_to_file(edit->old_frame_data, edit->frame_size - 1, edit->fptr_new) == e_failure)
+    CopyMethod method;
+    off_t copied;
+
+    long long start = STATS_START();
+    edit->fptr_new = stdout;
+    Status status = copy_header_to_file(edit);
+    if(status == e_success)
+        status = copy_frame_data_to_file(edit);
+    if(status == e_success && edit->pending_len > 0)
+        status = write_data_to_file((char *)edit->pending, edit->pending_len, stdout);
+    if(fflush(stdout) == EOF)
+        status = e_failure;
+    edit->fptr_new = NULL;    // stdout is not a temp file: never unlink it
+    STATS_PHASE(e_phase_frames, start);
+
+    start = STATS_START();
+    if(status == e_success)
+        status = copy_stream_data(fileno(edit->fptr_old), fileno(stdout), &method, &copied);
+    STATS_PHASE(e_phase_audio, start);
+    if(status == e_failure)
+    {
+        edit_error(edit, "Unable to write the edited stream");
         return e_failure;
+    }
+
+    edit_info(edit, "INFO: Tag Edited, %lld bytes of audio streamed via %s\n", (long long)(copied + edit->pending_len), copy_method_name(method));
     return e_success;
 }
 
 /*
- * Writes binary data to the file
+ * Writes the new file in one pass: header, rebuilt frames, EDIT_PADDING
+ * bytes of padding, then the audio data, and renames it over the original.
  */
-Status write_data_to_file(char *data, int size, FILE *fptr)
+Status rewrite_file(Edit *edit)
 {
-    if(fwrite(data, size, 1, fptr) != 1)
+    if(open_temp_file(edit) == e_failure)
+        return e_failure;
+
+    long long start = STATS_START();
+    if(copy_header_to_file(edit) == e_failure || copy_frame_data_to_file(edit) == e_failure)
+    {
+        edit_error(edit, "Unable to write the new tag of %s", edit->old_fname);
+        return e_failure;
+    }
+    STATS_PHASE(e_phase_frames, start);
+
+    start = STATS_START();
+    if(copy_remainig_data(edit) == e_failure)
+    {
+        edit_error(edit, "Unable to copy the audio data of %s", edit->old_fname);
+        return e_failure;
+    }
+
+    // An ID3v1 trailer came along with the audio; it gets the new values too
+    unsigned char trailer[ID3V1_SIZE];
+    if(id3v1_apply_edit(edit, fileno(edit->fptr_old), trailer) && write_id3v1_trailer(fileno(edit->fptr_new), trailer) == e_failure)
+    {
+        edit_error(edit, "Unable to write the ID3v1 tag of %s", edit->old_fname);
+        return e_failure;
+    }
+    STATS_PHASE(e_phase_audio, start);
+
+    // Data reaches the disk (per durability) before the file gets a name; close_edit_files() cleans up on failure
+    if(fflush(edit->fptr_new) == EOF)
+    {
+        edit_error(edit, "Unable to write the edited copy of %s: %s", edit->old_fname, strerror(errno));
+        return e_failure;
+    }
+    if(sync_edit(edit, fileno(edit->fptr_new), 0) == e_failure || link_temp_file(edit) == e_failure)
+        return e_failure;
+
+    if(fclose(edit->fptr_new) == EOF)
+    {
+        edit_error(edit, "Unable to write the edited copy of %s: %s", edit->old_fname, strerror(errno));
+        edit->fptr_new = NULL;
+        unlink(edit->new_fname);
+        return e_failure;
+    }
+    edit->fptr_new = NULL;
+
+    // The original stays open (and locked) until it has been replaced
+    start = STATS_START();
+    Status status = replace_old_file(edit);
+    if(status == e_success)
+        status = sync_edit(edit, -1, 1);
+    STATS_PHASE(e_phase_replace, start);
+
+    fclose(edit->fptr_old);
+    edit->fptr_old = NULL;
+    if(status == e_failure)
         return e_failure;
+
+    edit_info(edit, "INFO: Tag Edited Successfully\n");
     return e_success;
 }
 
 /*
- * Writes frame size (4 bytes) to file
+ * Writes binary data to the file
  */
-Status write_size_to_file(int *data, int size, FILE *fptr)
+Status write_data_to_file(char *data, int size, FILE *fptr)
 {
+    STATS_WRITE(size);
     if(fwrite(data, size, 1, fptr) != 1)
         return e_failure;
     return e_success;
 }
 
 /*
- * Copies the 10-byte ID3 header from old file to new file
+ * Writes the 10-byte ID3 header to the new file with the new tag size.
+ * Extended header and footer are not carried over, so their flags are cleared.
  */
 Status copy_header_to_file(Edit *edit)
 {
-    char buffer[10];
-    if(read_data_from_file(buffer, HEADER_SIZE, edit->fptr_old) == e_failure)
-        return e_failure;
+    unsigned char buffer[HEADER_SIZE];
+
+    memcpy(buffer, edit->header, HEADER_SIZE);
+    buffer[5] &= ~(TAG_FLAG_EXTENDED | TAG_FLAG_FOOTER);
+    encode_syncsafe(edit->new_tag_len + art_frame_size(edit) + EDIT_PADDING, buffer + 6);
 
-    if(write_data_to_file(buffer, HEADER_SIZE, edit->fptr_new) == e_failure)
+    if(write_data_to_file((char *)buffer, HEADER_SIZE, edit->fptr_new) == e_failure)
         return e_failure;
 
     return e_success;
 }
 
 /*
- * Copies the 3-byte (2 flag + 1 null) data to new file
+ * Writes the rebuilt frames, the new APIC frame if a picture is being
+ * set, and EDIT_PADDING zero bytes
  */
-Status copy_flag_to_file(Edit *edit)
+Status copy_frame_data_to_file(Edit *edit)
 {
-    char buffer[3];
-    if(read_data_from_file(buffer, FLAG_SIZE + 1, edit->fptr_old) == e_failure)
+    static const char padding[EDIT_PADDING];
+
+    if(edit->new_tag_len > 0 && write_data_to_file((char *)edit->new_tag, edit->new_tag_len, edit->fptr_new) == e_failure)
+        return e_failure;
+
+    if(edit->art_fd >= 0 && write_art_frame(edit) == e_failure)
         return e_failure;
 
-    if(write_data_to_file(buffer, FLAG_SIZE + 1, edit->fptr_new) == e_failure)
+    if(write_data_to_file((char *)padding, EDIT_PADDING, edit->fptr_new) == e_failure)
         return e_failure;
 
     return e_success;
 }
 
 /*
- * Copies all remaining data after frames to the new file
+ * Copies all data after the original tag to the new file.
+ * The stdio buffer of the new file is flushed and the copy is done on the
+ * underlying descriptors by the bulk copy engine (reflink, copy_file_range,
+ * sendfile or a large read/write buffer, whichever works first).
  */
 Status copy_remainig_data(Edit *edit)
 {
-    char buffer;
-    while(fread(&buffer, 1, 1, edit->fptr_old) == 1)
-    {
-        if(fwrite(&buffer, 1, 1, edit->fptr_new) != 1)
-            return e_failure;
-    }
+    if(fflush(edit->fptr_new) == EOF)
+        return e_failure;
+
+    off_t src_off = edit->audio_offset;
+    off_t dst_off = ftello(edit->fptr_new);
+    STATS_ADD(seek_calls, 1);
+    if(dst_off == -1)
+        return e_failure;
+
+    CopyMethod method;
+    off_t copied;
+    if(copy_file_data(fileno(edit->fptr_old), src_off, fileno(edit->fptr_new), dst_off, &method, &copied) == e_failure)
+        return e_failure;
 
-    printf("INFO: Remaining Data Copied Successfully\n");
+    // Keep the stdio stream consistent with what was done on the descriptor
+    fseeko(edit->fptr_new, dst_off + copied, SEEK_SET);
+    STATS_ADD(seek_calls, 1);
+
+    edit_info(edit, "INFO: Remaining Data Copied Successfully (%lld bytes via %s)\n", (long long)copied, copy_method_name(method));
     return e_success;
 }
 
 /*
- * Replaces the original file with the edited one
+ * Replaces the original file with the edited one (atomic: readers see
+ * either the old or the new file). On failure the temp file is removed.
  */
-Status replace_old_file(char *old_fname, char *new_fname)
+Status replace_old_file(Edit *edit)
 {
-    rename(new_fname, old_fname);  // Rename temp to original
+    if(rename(edit->new_fname, edit->old_fname) == -1)
+    {
+        edit_error(edit, "Unable to replace %s: %s", edit->old_fname, strerror(errno));
+        unlink(edit->new_fname);
+        return e_failure;
+    }
     return e_success;
-}
\ No newline at end of file
+}
@@ -5,23 +5,35 @@
  *                editing ID3v2 tag frames in an MP3 file.
  *
  *                Structures:
+ *                - FrameEdit
  *                - Edit
  *
  *                Functions:
  *                - read_and_validate_edit_args()
  *                - check_edit_operation()
+ *                - resolve_frame_id()
+ *                - add_frame_edit()
  *                - replace_old_file()
+ *                - parse_durability_args()
  *                - open_edit_files()
+ *                - lock_edit_target()
+ *                - open_temp_file()
+ *                - link_temp_file()
+ *                - sync_edit()
+ *                - close_edit_files()
+ *                - prepare_edit()
+ *                - edit_info()
+ *                - edit_error()
  *                - edit_tag()
- *                - read_edit_frame_id()
- *                - read_edit_frame_size()
- *                - replace_edit_frame_size()
- *                - read_old_frame_data()
+ *                - load_old_tag()
+ *                - build_edited_tag()
+ *                - unsync_edited_tag()
+ *                - encode_frame_value()
+ *                - patch_tag_in_place()
+ *                - stream_edit_tag()
+ *                - rewrite_file()
  *                - write_data_to_file()
- *                - write_size_to_file()
  *                - copy_header_to_file()
- *                - copy_flag_to_file()
- *                - write_new_frame_data()
  *                - copy_frame_data_to_file()
  *                - copy_remainig_data()
  *
@@ -33,7 +45,42 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "types.h"  // Includes Status and other common definitions
+#include "frames.h" // Includes the frame-ID registry
+
+/*
+ * Enum representing how much is flushed to stable storage before an edit reports success
+ * e_durable_none → Nothing is synced (fastest; a crash may lose the edit)
+ * e_durable_file → The edited file is synced before it replaces the original
+ * e_durable_dir  → The file and then its directory are synced, so the rename itself survives a crash
+ */
+typedef enum
+{
+    e_durable_none,
+    e_durable_file,
+    e_durable_dir
+} Durability;
+
+// Padding reserved after the frames when the whole file has to be rewritten,
+// so that later edits of the same file can be done in place
+#define EDIT_PADDING 1024
+
+// Frame slots allocated by the first add_frame_edit(); the array doubles when full
+#define EDIT_FRAME_ENTRIES 8
+
+// One frame to set: replaced where it exists, appended to the tag otherwise
+typedef struct FrameEdit
+{
+    char frame_id[FRAME_ID_SIZE + 1];    // Frame ID to be edited (null-terminated)
+    const FrameDesc *desc;               // Registry entry of the frame (data layout)
+    char *description;                   // Description that picks the TXXX, WXXX, COMM or USLT frame (UTF-8), NULL for other frames
+    uint description_size;               // Length of the description
+    char *data;                          // New frame text
+    uint size;                           // Length of the new text (encoding byte, language and description not included)
+    int applied;                         // Set once the frame has been written into the new tag
+} FrameEdit;
 
 // Structure to hold all necessary information for editing MP3 tag frames
 typedef struct Edit
@@ -41,61 +88,115 @@ typedef struct Edit
     FILE *fptr_old;                      // File pointer to the original MP3 file
     FILE *fptr_new;                      // File pointer to the temporary new MP3 file
     char *old_fname;                     // Name of the original MP3 file
-    char frame_id[FRAME_ID_SIZE + 1];    // Frame ID to be edited (null-terminated)
-    char old_frame_id[FRAME_ID_SIZE + 1];// Currently read frame ID (for comparison)
-    int frame_size;                      // Original size of the frame to be edited
-    int new_frame_size;                  // New size of the frame data
-    char *old_frame_data;                // Pointer to original frame data
-    char *new_frame_data;                // Pointer to new frame data (to replace with)
     char *new_fname;                     // Name of the temporary edited file
+    FrameEdit *frames;                   // Frames to set in this pass (grown by add_frame_edit())
+    int frame_count;                     // Number of frames to set
+    int frame_capacity;                  // Slots allocated in frames
+    unsigned char header[HEADER_SIZE];   // Original ID3v2 header (or a fresh one if the file had none)
+    int has_tag;                         // 1 if the file already starts with an ID3v2 tag
+    unsigned char *old_block;            // Original header + tag body (private mapping of the file, or read from a stream)
+    size_t old_block_len;                // Length of old_block
+    int old_mapped;                      // 1 if old_block is a mapping, 0 if it is on the heap
+    unsigned char *old_tag;              // Tag body inside old_block
+    int resynced;                        // 1 if old_tag was decoded from unsynchronised data (it no longer matches the file)
+    uint tag_size;                       // Tag size from the ID3v2 header (frames + padding)
+    off_t audio_offset;                  // Where the data after the tag starts in the original file
+    unsigned char *new_tag;              // Rebuilt frame area (no padding)
+    uint new_tag_len;                    // Length of the rebuilt frame area
+    uint patch_start;                    // First changed byte of the tag body
+    uint patch_end;                      // One past the last changed byte of the tag body
+    int quiet;                           // Suppress INFO messages (batch mode)
+    int stream;                          // 1 when editing stdin to stdout ("-")
+    int anonymous_temp;                  // 1 while the temp file is an unnamed O_TMPFILE
+    Durability durability;               // What is synced before the edit reports success
+    unsigned char pending[HEADER_SIZE];  // Stream bytes read while looking for a tag that belong to the audio
+    uint pending_len;                    // Number of pending bytes
+    int art_fd;                          // Image that replaces the front cover (APIC=@image), -1 if none
+    off_t art_size;                      // Size of that image
+    char art_mime[32];                   // MIME type sniffed from the image
+    char error[256];                     // First failure reason (reported per file by batch mode and the daemon)
 } Edit;
 
 // Function to validate and initialize arguments for edit operation
 Status read_and_validate_edit_args(char **argv, Edit *edit);
 
-// Function to check if the operation passed is valid (e.g., "-e" for edit)
-int check_edit_operation(char *op);
+// Function to check if the operation passed is valid (e.g., "-a" for artist)
+const FrameDesc *check_edit_operation(char *op);
+
+// Function to turn a frame ID or edit option (e.g. TPE1, TXXX:desc or -a) into a registered text frame ID and its description
+Status resolve_frame_id(const char *name, char *frame_id, const char **description);
+
+// Function to add one frame to set; a later value for the same frame (and description) replaces an earlier one
+Status add_frame_edit(Edit *edit, const char *frame_id, const char *description, const char *value);
 
 // Function to replace the original MP3 file with the newly edited one
-Status replace_old_file(char *old_fname, char *new_fname);
+Status replace_old_file(Edit *edit);
 
-// Function to open both original and new files required for editing
+// Function to take --durability=none|file|dir out of argv and make it the default for new edits
+Status parse_durability_args(int *argc, char **argv);
+
+// Function to open the original file required for editing
 Status open_edit_files(Edit *edit);
 
+// Function to take an exclusive advisory lock on the file being edited
+Status lock_edit_target(Edit *edit);
+
+// Function to create the temporary file used when the whole file is rewritten
+Status open_temp_file(Edit *edit);
+
+// Function to give an unnamed O_TMPFILE a name next to the original so it can be renamed over it
+Status link_temp_file(Edit *edit);
+
+// Function to flush a file (and optionally its directory) as the durability level asks
+Status sync_edit(Edit *edit, int fd, int with_dir);
+
+// Function to close any open files, remove an unfinished temp file and free the Edit strings
+void close_edit_files(Edit *edit);
+
+// Function to start an Edit for a file without going through argv
+Status prepare_edit(Edit *edit, const char *fname);
+
+// Function to print an INFO message unless the edit is quiet
+void edit_info(Edit *edit, const char *format, ...);
+
+// Function to print an ERROR message and remember the first one as the reason the edit failed
+void edit_error(Edit *edit, const char *format, ...);
+
 // Function that performs the overall tag editing process
 Status edit_tag(Edit *edit);
 
-// Function to read a frame ID during edit processing
-Status read_edit_frame_id(Edit *edit);
+// Function to read the original header and map (or read) the tag body
+Status load_old_tag(Edit *edit);
 
-// Function to read the size of a frame during edit processing
-Status read_edit_frame_size(Edit *edit);
+// Function to rebuild the frame area with every requested frame replaced or appended
+Status build_edited_tag(Edit *edit);
 
-// Function to write the new frame size to the output file
-Status replace_edit_frame_size(Edit *edit);
+// Function to unsynchronise the rebuilt frame area the way the tag version does it
+Status unsync_edited_tag(Edit *edit);
 
-// Function to read the original frame data
-Status read_old_frame_data(Edit *edit);
+// Function to encode a new description and value in the frame's encoding (or the best one for a new frame)
+unsigned char encode_frame_value(const Edit *edit, const FrameEdit *frame, int old_encoding, unsigned char *out,
+                                 uint *description_size, uint *size);
 
-// Writes generic data of given size to a file
-Status write_data_to_file(char *data, int size, FILE *fptr);
+// Function to write the rebuilt tag over the original tag region
+Status patch_tag_in_place(Edit *edit);
 
-// Writes frame size to a file (typically 4 bytes)
-Status write_size_to_file(int *data, int size, FILE *fptr);
+// Function to write the rebuilt tag to stdout and pass the rest of stdin through
+Status stream_edit_tag(Edit *edit);
 
-// Copies the initial 10-byte MP3 ID3v2 header to the new file
-Status copy_header_to_file(Edit *edit);
+// Function to write header, frames, padding and audio into a new file and swap it in
+Status rewrite_file(Edit *edit);
 
-// Copies the 2-byte flag section of the frame to the new file
-Status copy_flag_to_file(Edit *edit);
+// Writes generic data of given size to a file
+Status write_data_to_file(char *data, int size, FILE *fptr);
 
-// Writes the new frame data into the output file
-Status write_new_frame_data(Edit *edit);
+// Writes the 10-byte ID3v2 header (with the new tag size) to the new file
+Status copy_header_to_file(Edit *edit);
 
-// Copies other frame data (non-edited) to the output file
+// Writes the rebuilt frames and the padding to the new file
 Status copy_frame_data_to_file(Edit *edit);
 
-// Copies remaining data (after frame data) from original to new file
+// Copies remaining data (after the tag) from original to new file
 Status copy_remainig_data(Edit *edit);
 
-#endif  // EDIT_H
\ No newline at end of file
+#endif  // EDIT_H
@@ -0,0 +1,204 @@
+/***********************************************************************
+ *  File Name   : frames.c
+ *  Description : Source file for the frame-ID registry.
+ *                Expands FRAME_LIST into the descriptor table and into
+ *                the switch statements used for lookups, and knows how
+ *                the data of each kind of frame is laid out.
+ *
+ *                Functions:
+ *                - pack_frame_id()
+ *                - lookup_frame()
+ *                - lookup_frame_option()
+ *                - frame_text_offset()
+ *                - frame_value_encoding()
+ *                - frame_payload_size()
+ *                - write_frame_payload()
+ *
+ ***********************************************************************/
+
+#include <string.h>
+
+#include "frames.h"
+#include "id3.h"
+#include "text.h"
+
+// Position of every frame in frame_table
+enum
+{
+#define X(id, a, b, c, d, label, option, kind, versions) e_frame_index_##id,
+    FRAME_LIST(X)
+#undef X
+    e_frame_index_count
+};
+
+const FrameDesc frame_table[] =
+{
+#define X(id, a, b, c, d, label, option, kind, versions) \
+    { FRAME_FOURCC(a, b, c, d), #id, label, option, kind, versions },
+    FRAME_LIST(X)
+#undef X
+};
+
+const int frame_table_size = e_frame_index_count;
+
+// Function to read the four ID bytes as one big-endian integer
+uint32_t pack_frame_id(const char *frame_id)
+{
+    return decode_be32((const unsigned char *)frame_id);
+}
+
+/*
+ * One case per registered frame; the compiler turns this into a jump
+ * table or a binary search over the packed IDs.
+ */
+const FrameDesc *lookup_frame(uint32_t id)
+{
+    switch(id)
+    {
+#define X(id, a, b, c, d, label, option, kind, versions) \
+        case FRAME_FOURCC(a, b, c, d): return &frame_table[e_frame_index_##id];
+        FRAME_LIST(X)
+#undef X
+    }
+    return NULL;
+}
+
+/*
+ * Frames without an option get a distinct negative case label, which an
+ * unsigned character never matches, so every entry can share one switch.
+ */
+const FrameDesc *lookup_frame_option(const char *option)
+{
+    if(option[0] != '-' || option[1] == '\0' || option[2] != '\0')
+        return NULL;
+
+    switch((int)(unsigned char)option[1])
+    {
+#define X(id, a, b, c, d, label, opt, kind, versions) \
+        case (opt) ? (opt) : -1 - e_frame_index_##id: return &frame_table[e_frame_index_##id];
+        FRAME_LIST(X)
+#undef X
+    }
+    return NULL;
+}
+
+// Returns the position just after a null-terminated string (two zero bytes for UTF-16)
+static uint skip_terminated(const unsigned char *data, uint pos, uint size)
+{
+    int wide = data[0] == 1 || data[0] == 2;
+
+    if(wide)
+    {
+        for(; pos + 1 < size; pos += 2)
+            if(data[pos] == 0 && data[pos + 1] == 0)
+                return pos + 2;
+        return size;
+    }
+
+    for(; pos < size; pos++)
+        if(data[pos] == 0)
+            return pos + 1;
+    return size;
+}
+
+/*
+ * Skips the encoding byte, language and description that come before the
+ * value. Binary frames have no displayable value, so the whole size is skipped.
+ */
+uint frame_text_offset(const FrameDesc *desc, const unsigned char *data, uint size)
+{
+    uint offset;
+
+    switch(desc->kind)
+    {
+        case e_frame_url:
+            offset = 0;
+            break;
+        case e_frame_text:
+            offset = 1;
+            break;
+        case e_frame_user_text:
+        case e_frame_user_url:
+            offset = size > 0 ? skip_terminated(data, 1, size) : 0;
+            break;
+        case e_frame_comment:
+            offset = size > 4 ? skip_terminated(data, 4, size) : size;
+            break;
+        default:
+            offset = size;
+            break;
+    }
+    return offset < size ? offset : size;
+}
+
+// URLs are always ISO-8859-1; the encoding byte of WXXX only covers its description
+unsigned char frame_value_encoding(const FrameDesc *desc, const unsigned char *data, uint size)
+{
+    switch(desc->kind)
+    {
+        case e_frame_text:
+        case e_frame_user_text:
+        case e_frame_comment:
+            return size > 0 ? data[0] : e_text_latin1;
+        default:
+            return e_text_latin1;
+    }
+}
+
+// Frame data size for a new value: encoding byte, language and description where the layout has them
+uint frame_payload_size(const FrameDesc *desc, unsigned char encoding, uint description_size, uint text_size)
+{
+    uint terminator = encoding == e_text_utf16 || encoding == e_text_utf16be ? 2 : 1;
+
+    switch(desc->kind)
+    {
+        case e_frame_text:
+            return 1 + text_size;
+        case e_frame_user_text:
+        case e_frame_user_url:
+            return 1 + description_size + terminator + text_size;
+        case e_frame_comment:
+            return 4 + description_size + terminator + text_size;
+        default:
+            return text_size;
+    }
+}
+
+/*
+ * Writes the frame data for a new value. The description is already encoded
+ * (empty when description_size is 0) and gets its terminator here; comment
+ * frames keep the given language, or "eng" when there is none.
+ */
+void write_frame_payload(const FrameDesc *desc, unsigned char encoding, const char *language,
+                         const char *description, uint description_size,
+                         const char *text, uint text_size, unsigned char *out)
+{
+    switch(desc->kind)
+    {
+        case e_frame_text:
+            *out++ = encoding;
+            break;
+        case e_frame_user_text:
+        case e_frame_user_url:
+            *out++ = encoding;
+            memcpy(out, description, description_size);
+            out += description_size;
+            *out++ = 0;
+            if(encoding == e_text_utf16 || encoding == e_text_utf16be)
+                *out++ = 0;
+            break;
+        case e_frame_comment:
+            *out++ = encoding;
+            memcpy(out, language ? language : "eng", 3);
+            out += 3;
+            memcpy(out, description, description_size);
+            out += description_size;
+            *out++ = 0;
+            if(encoding == e_text_utf16 || encoding == e_text_utf16be)
+                *out++ = 0;
+            break;
+        default:
+            break;
+    }
+    memcpy(out, text, text_size);
+}
@@ -0,0 +1,197 @@
+/***********************************************************************
+ *  File Name   : frames.h
+ *  Description : Header file for the frame-ID registry.
+ *                Every ID3v2.3 / ID3v2.4 frame ID is listed once, at
+ *                compile time, in FRAME_LIST together with its display
+ *                label, its short edit option (if any), the layout of
+ *                its data and the tag versions it belongs to. Frame IDs
+ *                are handled as 32-bit integers (the four ID bytes read
+ *                big-endian), so a lookup is a single switch instead of
+ *                a string comparison per known frame.
+ *
+ *                Structures:
+ *                - FrameDesc
+ *
+ *                Functions:
+ *                - pack_frame_id()
+ *                - lookup_frame()
+ *                - lookup_frame_option()
+ *                - frame_text_offset()
+ *                - frame_value_encoding()
+ *                - frame_payload_size()
+ *                - write_frame_payload()
+ *
+ ***********************************************************************/
+
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+// Packs four frame ID characters into the integer key used by the registry
+#define FRAME_FOURCC(a, b, c, d) \
+    (((uint32_t)(unsigned char)(a) << 24) | ((uint32_t)(unsigned char)(b) << 16) | \
+     ((uint32_t)(unsigned char)(c) << 8) | (uint32_t)(unsigned char)(d))
+
+// Tag versions a frame is defined in (bit mask)
+#define FRAME_V23   0x01
+#define FRAME_V24   0x02
+
+/*
+ * Layout of the frame data
+ * e_frame_text      → encoding byte + text            (T***)
+ * e_frame_user_text → encoding byte + description + text (TXXX)
+ * e_frame_url       → URL, no encoding byte           (W***)
+ * e_frame_user_url  → encoding byte + description + URL (WXXX)
+ * e_frame_comment   → encoding byte + language + description + text (COMM, USLT)
+ * e_frame_binary    → anything else; shown by size only and not editable as text
+ */
+typedef enum
+{
+    e_frame_text,
+    e_frame_user_text,
+    e_frame_url,
+    e_frame_user_url,
+    e_frame_comment,
+    e_frame_binary
+} FrameKind;
+
+/*
+ * The registry: X(ID, 4 ID characters, label, edit option character or 0, kind, versions).
+ * Keep it sorted by frame ID.
+ */
+#define FRAME_LIST(X) \
+    X(AENC, 'A','E','N','C', "Audio Encrypt",  0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(APIC, 'A','P','I','C', "Picture",        0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(ASPI, 'A','S','P','I', "Seek Points",    0,     e_frame_binary,    FRAME_V24) \
+    X(COMM, 'C','O','M','M', "Comments",       'C',   e_frame_comment,   FRAME_V23 | FRAME_V24) \
+    X(COMR, 'C','O','M','R', "Commercial",     0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(ENCR, 'E','N','C','R', "Encrypt Method", 0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(EQU2, 'E','Q','U','2', "Equalisation 2", 0,     e_frame_binary,    FRAME_V24) \
+    X(EQUA, 'E','Q','U','A', "Equalisation",   0,     e_frame_binary,    FRAME_V23) \
+    X(ETCO, 'E','T','C','O', "Event Timing",   0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(GEOB, 'G','E','O','B', "General Object", 0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(GRID, 'G','R','I','D', "Group ID Reg",   0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(IPLS, 'I','P','L','S', "Involved People",0,     e_frame_text,      FRAME_V23) \
+    X(LINK, 'L','I','N','K', "Linked Info",    0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(MCDI, 'M','C','D','I', "Music CD ID",    0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(MLLT, 'M','L','L','T', "MPEG Lookup",    0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(OWNE, 'O','W','N','E', "Ownership",      0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(PCNT, 'P','C','N','T', "Play Counter",   0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(POPM, 'P','O','P','M', "Popularimeter",  0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(POSS, 'P','O','S','S', "Position Sync",  0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(PRIV, 'P','R','I','V', "Private",        0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(RBUF, 'R','B','U','F', "Buffer Size",    0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(RVA2, 'R','V','A','2', "Rel Volume 2",   0,     e_frame_binary,    FRAME_V24) \
+    X(RVAD, 'R','V','A','D', "Rel Volume",     0,     e_frame_binary,    FRAME_V23) \
+    X(RVRB, 'R','V','R','B', "Reverb",         0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(SEEK, 'S','E','E','K', "Seek",           0,     e_frame_binary,    FRAME_V24) \
+    X(SIGN, 'S','I','G','N', "Signature",      0,     e_frame_binary,    FRAME_V24) \
+    X(SYLT, 'S','Y','L','T', "Synced Lyrics",  0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(SYTC, 'S','Y','T','C', "Synced Tempo",   0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(TALB, 'T','A','L','B', "Album",          'A',   e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TBPM, 'T','B','P','M', "BPM",            0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TCOM, 'T','C','O','M', "Composer",       'c',   e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TCON, 'T','C','O','N', "Genre",          'm',   e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TCOP, 'T','C','O','P', "Copyright",      0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TDAT, 'T','D','A','T', "Date",           0,     e_frame_text,      FRAME_V23) \
+    X(TDEN, 'T','D','E','N', "Encoding Time",  0,     e_frame_text,      FRAME_V24) \
+    X(TDLY, 'T','D','L','Y', "Playlist Delay", 0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TDOR, 'T','D','O','R', "Orig Release",   0,     e_frame_text,      FRAME_V24) \
+    X(TDRC, 'T','D','R','C', "Recording Time", 0,     e_frame_text,      FRAME_V24) \
+    X(TDRL, 'T','D','R','L', "Release Time",   0,     e_frame_text,      FRAME_V24) \
+    X(TDTG, 'T','D','T','G', "Tagging Time",   0,     e_frame_text,      FRAME_V24) \
+    X(TENC, 'T','E','N','C', "Encoded By",     0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TEXT, 'T','E','X','T', "Lyricist",       'l',   e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TFLT, 'T','F','L','T', "File Type",      0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TIME, 'T','I','M','E', "Time",           0,     e_frame_text,      FRAME_V23) \
+    X(TIPL, 'T','I','P','L', "Involved People",0,     e_frame_text,      FRAME_V24) \
+    X(TIT1, 'T','I','T','1', "Content Group",  0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TIT2, 'T','I','T','2', "Title",          't',   e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TIT3, 'T','I','T','3', "Subtitle",       0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TKEY, 'T','K','E','Y', "Initial Key",    0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TLAN, 'T','L','A','N', "Language",       0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TLEN, 'T','L','E','N', "Length (ms)",    0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TMCL, 'T','M','C','L', "Musicians",      0,     e_frame_text,      FRAME_V24) \
+    X(TMED, 'T','M','E','D', "Media Type",     0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TMOO, 'T','M','O','O', "Mood",           0,     e_frame_text,      FRAME_V24) \
+    X(TOAL, 'T','O','A','L', "Orig Album",     0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TOFN, 'T','O','F','N', "Orig Filename",  0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TOLY, 'T','O','L','Y', "Orig Lyricist",  0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TOPE, 'T','O','P','E', "Orig Artist",    0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TORY, 'T','O','R','Y', "Orig Year",      0,     e_frame_text,      FRAME_V23) \
+    X(TOWN, 'T','O','W','N', "File Owner",     0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TPE1, 'T','P','E','1', "Artist",         'a',   e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TPE2, 'T','P','E','2', "Album Artist",   0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TPE3, 'T','P','E','3', "Conductor",      0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TPE4, 'T','P','E','4', "Remixed By",     0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TPOS, 'T','P','O','S', "Disc Number",    0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TPRO, 'T','P','R','O', "Produced Notice",0,     e_frame_text,      FRAME_V24) \
+    X(TPUB, 'T','P','U','B', "Publisher",      0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TRCK, 'T','R','C','K', "Track Number",   0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TRDA, 'T','R','D','A', "Recording Dates",0,     e_frame_text,      FRAME_V23) \
+    X(TRSN, 'T','R','S','N', "Radio Station",  0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TRSO, 'T','R','S','O', "Station Owner",  0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TSIZ, 'T','S','I','Z', "Size",           0,     e_frame_text,      FRAME_V23) \
+    X(TSOA, 'T','S','O','A', "Album Sort",     0,     e_frame_text,      FRAME_V24) \
+    X(TSOP, 'T','S','O','P', "Artist Sort",    0,     e_frame_text,      FRAME_V24) \
+    X(TSOT, 'T','S','O','T', "Title Sort",     0,     e_frame_text,      FRAME_V24) \
+    X(TSRC, 'T','S','R','C', "ISRC",           0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TSSE, 'T','S','S','E', "Encoder",        0,     e_frame_text,      FRAME_V23 | FRAME_V24) \
+    X(TSST, 'T','S','S','T', "Set Subtitle",   0,     e_frame_text,      FRAME_V24) \
+    X(TXXX, 'T','X','X','X', "User Text",      0,     e_frame_user_text, FRAME_V23 | FRAME_V24) \
+    X(TYER, 'T','Y','E','R', "Year",           'y',   e_frame_text,      FRAME_V23) \
+    X(UFID, 'U','F','I','D', "Unique File ID", 0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(USER, 'U','S','E','R', "Terms of Use",   0,     e_frame_binary,    FRAME_V23 | FRAME_V24) \
+    X(USLT, 'U','S','L','T', "Lyrics",         0,     e_frame_comment,   FRAME_V23 | FRAME_V24) \
+    X(WCOM, 'W','C','O','M', "Commercial URL", 0,     e_frame_url,       FRAME_V23 | FRAME_V24) \
+    X(WCOP, 'W','C','O','P', "Copyright URL",  0,     e_frame_url,       FRAME_V23 | FRAME_V24) \
+    X(WOAF, 'W','O','A','F', "Audio File URL", 0,     e_frame_url,       FRAME_V23 | FRAME_V24) \
+    X(WOAR, 'W','O','A','R', "Artist URL",     0,     e_frame_url,       FRAME_V23 | FRAME_V24) \
+    X(WOAS, 'W','O','A','S', "Source URL",     0,     e_frame_url,       FRAME_V23 | FRAME_V24) \
+    X(WORS, 'W','O','R','S', "Station URL",    0,     e_frame_url,       FRAME_V23 | FRAME_V24) \
+    X(WPAY, 'W','P','A','Y', "Payment URL",    0,     e_frame_url,       FRAME_V23 | FRAME_V24) \
+    X(WPUB, 'W','P','U','B', "Publisher URL",  0,     e_frame_url,       FRAME_V23 | FRAME_V24) \
+    X(WXXX, 'W','X','X','X', "User URL",       0,     e_frame_user_url,  FRAME_V23 | FRAME_V24)
+
+// Registry entry for one frame ID
+typedef struct FrameDesc
+{
+    uint32_t id;                        // Packed frame ID (FRAME_FOURCC)
+    char name[FRAME_ID_SIZE + 1];       // Frame ID as a string
+    const char *label;                  // Human-readable label used in the tag table
+    char option;                        // Short edit option character (-a, -t, ...), 0 if none
+    FrameKind kind;                     // Layout of the frame data
+    unsigned char versions;             // FRAME_V23 / FRAME_V24 mask
+} FrameDesc;
+
+// Every registered frame, sorted by frame ID
+extern const FrameDesc frame_table[];
+extern const int frame_table_size;
+
+// Function to pack a 4-byte frame ID (not necessarily null-terminated) into its integer key
+uint32_t pack_frame_id(const char *frame_id);
+
+// Function to find the registry entry of a packed frame ID, NULL for unknown frames
+const FrameDesc *lookup_frame(uint32_t id);
+
+// Function to find the frame selected by a short edit option such as "-a", NULL if none
+const FrameDesc *lookup_frame_option(const char *option);
+
+// Function to find where the displayed value starts inside the frame data
+uint frame_text_offset(const FrameDesc *desc, const unsigned char *data, uint size);
+
+// Function to find the text encoding (TextEncoding) of the displayed value
+unsigned char frame_value_encoding(const FrameDesc *desc, const unsigned char *data, uint size);
+
+// Function to compute the frame data size needed to store a description and text of the given lengths
+uint frame_payload_size(const FrameDesc *desc, unsigned char encoding, uint description_size, uint text_size);
+
+// Function to lay out encoding byte, language, description and text for a frame
+void write_frame_payload(const FrameDesc *desc, unsigned char encoding, const char *language,
+                         const char *description, uint description_size,
+                         const char *text, uint text_size, unsigned char *out);
+
+#endif  // FRAMES_H
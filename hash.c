@@ -0,0 +1,272 @@
+/***********************************************************************
+ *  File Name   : hash.c
+ *  Description : Source file for the Audio Hash Module.
+ *                The audio range comes from find_audio_range() in
+ *                mpeg.c. Up to HASH_CHUNK_SIZE it is mapped once and
+ *                hashed with XXH64 directly. Longer audio is cut into
+ *                HASH_CHUNK_SIZE chunks which one thread per core maps,
+ *                hashes and unmaps in turn; the digest is the XXH64 of
+ *                the chunk hashes (little-endian, in chunk order), so it
+ *                does not depend on the number of threads. Chunks are
+ *                mapped read-only and MADV_SEQUENTIAL, so the page
+ *                cache reads ahead and memory use stays at a few
+ *                chunks.
+ *
+ *                Functions:
+ *                - parse_hash_args()
+ *                - get_hash_mode()
+ *                - xxh64()
+ *                - hash_audio()
+ *                - hash_range()
+ *                - hash_chunk()
+ *                - hash_worker()
+ *
+ ***********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "hash.h"
+#include "mpeg.h"
+#include "stats.h"
+
+// XXH64 primes
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+// Set by --hash
+static int hash_mode = 0;
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// Little-endian loads; memcpy keeps unaligned reads legal and compiles to one move
+static inline uint64_t read_le64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t read_le32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/*
+ * Removes --hash from argv
+ */
+void parse_hash_args(int *argc, char **argv)
+{
+    int out = 1;
+
+    for(int i = 1; i < *argc; i++)
+    {
+        if(strcmp(argv[i], "--hash") == 0)
+            hash_mode = 1;
+        else
+            argv[out++] = argv[i];
+    }
+
+    argv[out] = NULL;
+    *argc = out;
+}
+
+// Function to check whether --hash was given
+int get_hash_mode(void)
+{
+    return hash_mode;
+}
+
+/*
+ * XXH64 as specified by the xxHash project: four lanes over 32-byte
+ * stripes, then the 8-, 4- and 1-byte tail, then the avalanche.
+ */
+uint64_t xxh64(const void *data, size_t len, uint64_t seed)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    if(len >= 32)
+    {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+
+        const unsigned char *limit = end - 32;
+        do
+        {
+            v1 = xxh64_round(v1, read_le64(p));
+            v2 = xxh64_round(v2, read_le64(p + 8));
+            v3 = xxh64_round(v3, read_le64(p + 16));
+            v4 = xxh64_round(v4, read_le64(p + 24));
+            p += 32;
+        } while(p <= limit);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    }
+    else
+        h = seed + PRIME64_5;
+
+    h += (uint64_t)len;
+
+    for(; p + 8 <= end; p += 8)
+        h = rotl64(h ^ xxh64_round(0, read_le64(p)), 27) * PRIME64_1 + PRIME64_4;
+    if(p + 4 <= end)
+    {
+        h = rotl64(h ^ (uint64_t)read_le32(p) * PRIME64_1, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for(; p < end; p++)
+        h = rotl64(h ^ *p * PRIME64_5, 11) * PRIME64_1;
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Function to hash the audio of fd (fails for input that is not a regular file)
+Status hash_audio(int fd, const TagHeader *header, uint64_t *digest)
+{
+    off_t start, end;
+
+    if(find_audio_range(fd, header, &start, &end) == e_failure)
+        return e_failure;
+
+    long long phase = STATS_START();
+    Status status = hash_range(fd, start, end, digest);
+    STATS_PHASE(e_phase_hash, phase);
+    return status;
+}
+
+/*
+ * One chunk is hashed in the calling thread. Several chunks are spread
+ * over at most one thread per core; each records its leaf by chunk
+ * number, so the order the threads finish in does not matter.
+ */
+Status hash_range(int fd, off_t start, off_t end, uint64_t *digest)
+{
+    if(end - start <= HASH_CHUNK_SIZE)
+        return hash_chunk(fd, start, end, digest);
+
+    HashJob job;
+    job.fd = fd;
+    job.start = start;
+    job.end = end;
+    job.chunk_count = (end - start + HASH_CHUNK_SIZE - 1) / HASH_CHUNK_SIZE;
+    job.next = 0;
+    job.failed = 0;
+    job.leaves = malloc(job.chunk_count * sizeof(uint64_t));
+    if(job.leaves == NULL)
+        return e_failure;
+    STATS_ADD(allocs, 1);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t thread_count = cores < 1 ? 1 : ((size_t)cores > job.chunk_count ? job.chunk_count : (size_t)cores);
+    pthread_t threads[thread_count];
+    size_t started = 0;
+
+    // The calling thread takes chunks too, so a failed pthread_create only costs speed
+    for(; started + 1 < thread_count; started++)
+        if(pthread_create(&threads[started], NULL, hash_worker, &job) != 0)
+            break;
+    hash_worker(&job);
+    for(size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    // Leaves are stored little-endian so the digest is the same on every host
+    for(size_t i = 0; i < job.chunk_count; i++)
+    {
+        unsigned char le[8];
+        for(int b = 0; b < 8; b++)
+            le[b] = (unsigned char)(job.leaves[i] >> (8 * b));
+        memcpy(&job.leaves[i], le, sizeof(le));
+    }
+    *digest = xxh64(job.leaves, job.chunk_count * sizeof(uint64_t), 0);
+
+    free(job.leaves);
+    return job.failed ? e_failure : e_success;
+}
+
+/*
+ * Mappings start on a page boundary, so the chunk is mapped from the
+ * page that holds its first byte. An empty range is the hash of nothing.
+ */
+Status hash_chunk(int fd, off_t start, off_t end, uint64_t *digest)
+{
+    if(end <= start)
+    {
+        *digest = xxh64(NULL, 0, 0);
+        return e_success;
+    }
+
+    off_t page = sysconf(_SC_PAGESIZE);
+    off_t map_start = start - start % page;
+    size_t map_len = end - map_start;
+
+    unsigned char *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, map_start);
+    if(map == MAP_FAILED)
+        return e_failure;
+    madvise(map, map_len, MADV_SEQUENTIAL);
+
+    *digest = xxh64(map + (start - map_start), end - start, 0);
+    STATS_ADD(bytes_read, end - start);
+    munmap(map, map_len);
+    return e_success;
+}
+
+// Function to hash chunks of the job until every chunk has been taken
+void *hash_worker(void *arg)
+{
+    HashJob *job = arg;
+
+    for(;;)
+    {
+        size_t chunk = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if(chunk >= job->chunk_count)
+            break;
+
+        off_t start = job->start + (off_t)chunk * HASH_CHUNK_SIZE;
+        off_t end = start + HASH_CHUNK_SIZE < job->end ? start + HASH_CHUNK_SIZE : job->end;
+        if(hash_chunk(job->fd, start, end, &job->leaves[chunk]) == e_failure)
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
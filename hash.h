@@ -0,0 +1,71 @@
+/***********************************************************************
+ *  File Name   : hash.h
+ *  Description : Header file for the Audio Hash Module.
+ *                Declares the content hash of the audio data only (the
+ *                bytes between the ID3v2 tag and the ID3v1/APEv2 tags),
+ *                so the same recording gives the same hash whatever its
+ *                tags say. The hash is XXH64; audio longer than one
+ *                chunk is hashed as a tree: every HASH_CHUNK_SIZE chunk
+ *                is hashed on its own (in parallel) and the result is
+ *                the XXH64 of the chunk hashes.
+ *
+ *                Structures:
+ *                - HashJob
+ *
+ *                Functions:
+ *                - parse_hash_args()
+ *                - get_hash_mode()
+ *                - xxh64()
+ *                - hash_audio()
+ *                - hash_range()
+ *                - hash_chunk()
+ *                - hash_worker()
+ *
+ ***********************************************************************/
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "types.h"
+#include "id3.h"
+
+// Bytes per leaf of the tree hash (also the largest mapping made at once)
+#define HASH_CHUNK_SIZE (64 * 1024 * 1024)
+
+// Chunks of one file handed out to the hash workers
+typedef struct HashJob
+{
+    int fd;                         // File being hashed
+    off_t start;                    // Offset of the first audio byte
+    off_t end;                      // Offset just past the last audio byte
+    uint64_t *leaves;               // Hash of each chunk, by chunk number
+    size_t chunk_count;             // Number of chunks
+    size_t next;                    // Next chunk to take (atomic)
+    int failed;                     // Set when a chunk could not be mapped
+} HashJob;
+
+// Function to take --hash out of argv
+void parse_hash_args(int *argc, char **argv);
+
+// Function to check whether --hash was given
+int get_hash_mode(void);
+
+// Function to compute the XXH64 hash of len bytes
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+
+// Function to hash fd's audio data; header is the ID3v2 header already read (NULL to read it)
+Status hash_audio(int fd, const TagHeader *header, uint64_t *digest);
+
+// Function to hash the bytes [start, end) of fd, as a tree when they span several chunks
+Status hash_range(int fd, off_t start, off_t end, uint64_t *digest);
+
+// Function to map one chunk of the range and hash it
+Status hash_chunk(int fd, off_t start, off_t end, uint64_t *digest);
+
+// Thread entry point that hashes chunks of a HashJob until none are left
+void *hash_worker(void *arg);
+
+#endif  // HASH_H
@@ -0,0 +1,435 @@
+/***********************************************************************
+ *  File Name   : id3.c
+ *  Description : Source file for libid3.
+ *                Implements decoding and encoding of the integer fields
+ *                found in ID3v2 headers and frame headers, and the
+ *                reentrant frame parser. The parser keeps no global
+ *                state and never prints; a mapped file is parsed with
+ *                no heap allocation at all, unless it is unsynchronised
+ *                (it is then decoded into the scratch buffer first).
+ *                Frame sizes are syncsafe in ID3v2.4; the unsync
+ *                scheme applies to the whole tag in ID3v2.3 and to
+ *                single frames (or all of them) in ID3v2.4.
+ *
+ *                Functions:
+ *                - decode_syncsafe()
+ *                - encode_syncsafe()
+ *                - decode_be32()
+ *                - encode_be32()
+ *                - decode_frame_size()
+ *                - encode_frame_size()
+ *                - read_tag_header()
+ *                - id3_needs_resync()
+ *                - id3_resync()
+ *                - id3_unsync_frames()
+ *                - id3_frame_prefix()
+ *                - id3_init()
+ *                - id3_release()
+ *                - id3_parse_memory()
+ *                - id3_parse_fd()
+ *
+ ***********************************************************************/
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "id3.h"
+#include "unsync.h"
+
+// Function to decode a syncsafe integer (only the low 7 bits of each byte are used)
+uint decode_syncsafe(const unsigned char *buf)
+{
+    return ((uint)(buf[0] & 0x7F) << 21) |
+           ((uint)(buf[1] & 0x7F) << 14) |
+           ((uint)(buf[2] & 0x7F) << 7)  |
+            (uint)(buf[3] & 0x7F);
+}
+
+// Function to encode a value (max 28 bits) as a syncsafe integer
+void encode_syncsafe(uint value, unsigned char *buf)
+{
+    buf[0] = (value >> 21) & 0x7F;
+    buf[1] = (value >> 14) & 0x7F;
+    buf[2] = (value >> 7) & 0x7F;
+    buf[3] = value & 0x7F;
+}
+
+// Function to decode a plain big-endian integer
+uint decode_be32(const unsigned char *buf)
+{
+    return ((uint)buf[0] << 24) | ((uint)buf[1] << 16) | ((uint)buf[2] << 8) | (uint)buf[3];
+}
+
+// Function to encode a value as a plain big-endian integer
+void encode_be32(uint value, unsigned char *buf)
+{
+    buf[0] = (value >> 24) & 0xFF;
+    buf[1] = (value >> 16) & 0xFF;
+    buf[2] = (value >> 8) & 0xFF;
+    buf[3] = value & 0xFF;
+}
+
+/*
+ * ID3v2.4 frame sizes are syncsafe. Some writers still put plain
+ * big-endian sizes in v2.4 tags; a size byte with the high bit set
+ * cannot be syncsafe, so that field is read as big-endian.
+ */
+uint decode_frame_size(const unsigned char *buf, unsigned char version)
+{
+    if(version >= 4 && !((buf[0] | buf[1] | buf[2] | buf[3]) & 0x80))
+        return decode_syncsafe(buf);
+    return decode_be32(buf);
+}
+
+// Function to encode a frame size as the tag version expects it
+void encode_frame_size(uint value, unsigned char version, unsigned char *buf)
+{
+    if(version >= 4)
+        encode_syncsafe(value, buf);
+    else
+        encode_be32(value, buf);
+}
+
+// Function to validate the "ID3" marker and decode the header fields
+Status read_tag_header(const unsigned char *buf, TagHeader *header)
+{
+    if(memcmp(buf, "ID3", 3) != 0)
+        return e_failure;
+
+    // Size bytes must be syncsafe (high bit clear)
+    if((buf[6] | buf[7] | buf[8] | buf[9]) & 0x80)
+        return e_failure;
+
+    header->version = buf[3];
+    header->revision = buf[4];
+    header->flags = buf[5];
+    header->tag_size = decode_syncsafe(buf + 6);
+    return e_success;
+}
+
+// Finds where the frames start: after the header and the extended header, if there is one
+static size_t id3_frames_start(const unsigned char *tag, size_t end, const TagHeader *header)
+{
+    size_t pos = HEADER_SIZE;
+
+    // v2.3 size excludes itself, v2.4 size is syncsafe and includes itself
+    if((header->flags & TAG_FLAG_EXTENDED) && pos + 4 <= end)
+        pos += header->version >= 4 ? decode_syncsafe(tag + pos) : decode_be32(tag + pos) + 4;
+    return pos;
+}
+
+/*
+ * A v2.3 tag (and a v2.4 tag with the header flag) says so in the
+ * header; in v2.4 single frames can be unsynchronised too, which needs
+ * a walk over the frame headers.
+ */
+int id3_needs_resync(const unsigned char *tag, size_t len)
+{
+    TagHeader header;
+
+    if(len < HEADER_SIZE || read_tag_header(tag, &header) == e_failure)
+        return 0;
+    if(header.flags & TAG_FLAG_UNSYNC)
+        return 1;
+    if(header.version < 4)
+        return 0;
+
+    size_t end = HEADER_SIZE + (size_t)header.tag_size;
+    if(end > len)
+        end = len;
+
+    size_t pos = id3_frames_start(tag, end, &header);
+    while(pos + FRAME_HEADER_SIZE <= end && tag[pos] != 0)
+    {
+        if(tag[pos + FRAME_ID_SIZE + 5] & FRAME_FLAG_UNSYNC)
+            return 1;
+        pos += FRAME_HEADER_SIZE + (size_t)decode_frame_size(tag + pos + FRAME_ID_SIZE, header.version);
+    }
+    return 0;
+}
+
+/*
+ * ID3v2.3: the whole body is decoded; its frame sizes already count the
+ * decoded bytes. ID3v2.4: every unsynchronised frame is decoded and the
+ * frames are packed down, each with its new size and without the unsync
+ * flag (and without the data length indicator, which only repeated the
+ * decoded size). The header flag is cleared and the tail is zeroed, so
+ * the tag parses as an ordinary one of the same total length.
+ */
+void id3_resync(unsigned char *tag, size_t len)
+{
+    TagHeader header;
+
+    if(len < HEADER_SIZE || read_tag_header(tag, &header) == e_failure)
+        return;
+
+    size_t end = HEADER_SIZE + (size_t)header.tag_size;
+    if(end > len)
+        end = len;
+
+    if(header.version < 4)
+    {
+        if(header.flags & TAG_FLAG_UNSYNC)
+        {
+            size_t length = unsync_decode(tag + HEADER_SIZE, end - HEADER_SIZE);
+            memset(tag + HEADER_SIZE + length, 0, end - HEADER_SIZE - length);
+        }
+        tag[5] &= ~TAG_FLAG_UNSYNC;
+        return;
+    }
+
+    size_t pos = id3_frames_start(tag, end, &header), out = pos;
+    while(pos + FRAME_HEADER_SIZE <= end && tag[pos] != 0)
+    {
+        size_t size = decode_frame_size(tag + pos + FRAME_ID_SIZE, header.version);
+        if(size > end - pos - FRAME_HEADER_SIZE)
+            break;
+
+        unsigned char format = tag[pos + FRAME_ID_SIZE + 5];
+        if(out != pos)
+            memmove(tag + out, tag + pos, FRAME_HEADER_SIZE + size);
+        pos += FRAME_HEADER_SIZE + size;
+
+        if((format & FRAME_FLAG_UNSYNC) || (header.flags & TAG_FLAG_UNSYNC))
+        {
+            unsigned char *data = tag + out + FRAME_HEADER_SIZE;
+            size = unsync_decode(data, size);
+            format &= ~FRAME_FLAG_UNSYNC;
+            if((format & FRAME_FLAG_LENGTH) && !(format & FRAME_FLAG_PACKED) && size >= 4)
+            {
+                memmove(data, data + 4, size - 4);
+                size -= 4;
+                format &= ~FRAME_FLAG_LENGTH;
+            }
+            encode_syncsafe(size, tag + out + FRAME_ID_SIZE);
+            tag[out + FRAME_ID_SIZE + 5] = format;
+        }
+        out += FRAME_HEADER_SIZE + size;
+    }
+
+    if(pos > out)
+        memset(tag + out, 0, pos - out);
+    tag[5] &= ~TAG_FLAG_UNSYNC;
+}
+
+/*
+ * ID3v2.3 unsynchronises the frame area as one block. ID3v2.4 does it
+ * per frame: each frame gets the unsync flag and a size that counts the
+ * encoded bytes.
+ */
+size_t id3_unsync_frames(unsigned char version, const unsigned char *frames, size_t len, unsigned char *out)
+{
+    if(version < 4)
+        return unsync_encode(frames, len, out);
+
+    size_t pos = 0, length = 0;
+    while(pos + FRAME_HEADER_SIZE <= len && frames[pos] != 0)
+    {
+        size_t size = decode_frame_size(frames + pos + FRAME_ID_SIZE, version);
+        if(size > len - pos - FRAME_HEADER_SIZE)
+            break;
+
+        memcpy(out + length, frames + pos, FRAME_HEADER_SIZE);
+        size_t encoded = unsync_encode(frames + pos + FRAME_HEADER_SIZE, size, out + length + FRAME_HEADER_SIZE);
+        encode_syncsafe(encoded, out + length + FRAME_ID_SIZE);
+        out[length + FRAME_ID_SIZE + 5] |= FRAME_FLAG_UNSYNC;
+
+        length += FRAME_HEADER_SIZE + encoded;
+        pos += FRAME_HEADER_SIZE + size;
+    }
+    return length;
+}
+
+/*
+ * Format flags (second flag byte) that put bytes in front of the frame
+ * data: the grouping identity (1 byte) and, in ID3v2.4, the data length
+ * indicator (4 bytes, set with or without unsynchronisation). Compressed
+ * or encrypted data cannot be read as it is, so those return -1.
+ */
+int id3_frame_prefix(unsigned char version, unsigned char format)
+{
+    if(version >= 4)
+    {
+        if(format & FRAME_FLAG_PACKED)
+            return -1;
+        return ((format & FRAME_FLAG_GROUP) ? 1 : 0) + ((format & FRAME_FLAG_LENGTH) ? 4 : 0);
+    }
+
+    if(format & FRAME_FLAG_V23_PACKED)
+        return -1;
+    return (format & FRAME_FLAG_V23_GROUP) ? 1 : 0;
+}
+
+// Default allocator: plain malloc/free
+static void *id3_default_alloc(size_t size, void *user)
+{
+    (void)user;
+    return malloc(size);
+}
+
+static void id3_default_release(void *ptr, size_t size, void *user)
+{
+    (void)size;
+    (void)user;
+    free(ptr);
+}
+
+// Function to set up a context with the caller's allocator (or malloc/free) and frame handler
+void id3_init(Id3Context *ctx, const Id3Allocator *allocator, Id3FrameCallback on_frame, void *user)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    if(allocator != NULL)
+        ctx->allocator = *allocator;
+    else
+    {
+        ctx->allocator.alloc = id3_default_alloc;
+        ctx->allocator.release = id3_default_release;
+    }
+    ctx->on_frame = on_frame;
+    ctx->user = user;
+}
+
+// Function to free the scratch buffer; the context can be initialised again afterwards
+void id3_release(Id3Context *ctx)
+{
+    if(ctx->scratch != NULL)
+        ctx->allocator.release(ctx->scratch, ctx->scratch_size, ctx->allocator.user);
+    ctx->scratch = NULL;
+    ctx->scratch_size = 0;
+}
+
+// Makes the scratch buffer at least size bytes (its old content is not kept)
+static Status id3_reserve(Id3Context *ctx, size_t size)
+{
+    if(ctx->scratch_size >= size)
+        return e_success;
+
+    unsigned char *buf = ctx->allocator.alloc(size, ctx->allocator.user);
+    if(buf == NULL)
+        return e_failure;
+    id3_release(ctx);
+    ctx->scratch = buf;
+    ctx->scratch_size = size;
+    return e_success;
+}
+
+/*
+ * Walks the frames of a tag in memory. Parsing stops at the end of the
+ * tag given by the header (or of the buffer, if it is shorter), at the
+ * first padding (zero) byte, at a frame that runs past the end, or when
+ * the callback asks to stop. An unsynchronised tag is decoded into the
+ * scratch buffer first (in place when it already is the scratch buffer).
+ */
+Status id3_parse_memory(Id3Context *ctx, const unsigned char *tag, size_t len)
+{
+    ctx->frame_count = 0;
+
+    if(len < HEADER_SIZE || read_tag_header(tag, &ctx->header) == e_failure)
+        return e_failure;
+
+    size_t end = HEADER_SIZE + (size_t)ctx->header.tag_size;
+    if(end > len)
+        end = len;   // Truncated tag: parse what is there
+
+    if(id3_needs_resync(tag, end))
+    {
+        if(tag != ctx->scratch)
+        {
+            if(id3_reserve(ctx, end) == e_failure)
+                return e_failure;
+            memcpy(ctx->scratch, tag, end);
+        }
+        id3_resync(ctx->scratch, end);
+        tag = ctx->scratch;
+    }
+
+    size_t pos = id3_frames_start(tag, end, &ctx->header);
+
+    while(pos + FRAME_HEADER_SIZE <= end && tag[pos] != 0)
+    {
+        uint size = decode_frame_size(tag + pos + FRAME_ID_SIZE, ctx->header.version);
+        if(size > end - pos - FRAME_HEADER_SIZE)
+            break;   // Frame runs past the end of the tag
+
+        char id[FRAME_ID_SIZE + 1];
+        memcpy(id, tag + pos, FRAME_ID_SIZE);
+        id[FRAME_ID_SIZE] = '\0';
+
+        // The callback gets the frame data without its grouping identity and data length indicator
+        const unsigned char *data = tag + pos + FRAME_HEADER_SIZE;
+        uint length = size;
+        int prefix = id3_frame_prefix(ctx->header.version, tag[pos + FRAME_ID_SIZE + 5]);
+        if(prefix > 0 && (uint)prefix <= length)
+        {
+            data += prefix;
+            length -= prefix;
+        }
+
+        ctx->frame_count++;
+        if(ctx->on_frame != NULL && ctx->on_frame(ctx->user, id, data, length) != 0)
+            break;
+
+        pos += FRAME_HEADER_SIZE + size;
+    }
+    return e_success;
+}
+
+// Reads up to length bytes at offset; non-seekable input is read sequentially instead
+static ssize_t id3_read_at(int fd, unsigned char *buf, size_t length, off_t offset)
+{
+    ssize_t got = pread(fd, buf, length, offset);
+    if(got >= 0 || errno != ESPIPE)
+        return got;
+
+    size_t done = 0;
+    while(done < length)
+    {
+        got = read(fd, buf + done, length - done);
+        if(got <= 0)
+            break;
+        done += got;
+    }
+    return done > 0 ? (ssize_t)done : got;
+}
+
+/*
+ * Maps just the tag region of a regular file and parses it in place.
+ * Other input (pipes, or files that cannot be mapped) is read into the
+ * context's scratch buffer, which only grows when a larger tag is seen.
+ */
+Status id3_parse_fd(Id3Context *ctx, int fd)
+{
+    unsigned char header[HEADER_SIZE];
+    struct stat st;
+
+    ctx->frame_count = 0;
+    if(id3_read_at(fd, header, HEADER_SIZE, 0) != HEADER_SIZE || read_tag_header(header, &ctx->header) == e_failure)
+        return e_failure;
+
+    size_t end = HEADER_SIZE + (size_t)ctx->header.tag_size;
+
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        if((off_t)end > st.st_size)
+            end = st.st_size;
+
+        void *map = mmap(NULL, end, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map != MAP_FAILED)
+        {
+            Status status = id3_parse_memory(ctx, map, end);
+            munmap(map, end);
+            return status;
+        }
+    }
+
+    if(id3_reserve(ctx, end) == e_failure)
+        return e_failure;
+
+    memcpy(ctx->scratch, header, HEADER_SIZE);
+    ssize_t got = id3_read_at(fd, ctx->scratch + HEADER_SIZE, end - HEADER_SIZE, HEADER_SIZE);
+    return id3_parse_memory(ctx, ctx->scratch, HEADER_SIZE + (got > 0 ? (size_t)got : 0));
+}
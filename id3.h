@@ -0,0 +1,149 @@
+/***********************************************************************
+ *  File Name   : id3.h
+ *  Description : Public header of libid3, the ID3v2 parsing library.
+ *                Declares the helpers for the fixed-size fields of an
+ *                ID3v2 tag (header sizes and frame sizes) and the
+ *                reentrant frame parser: all state lives in an
+ *                Id3Context, memory comes from the caller's allocator,
+ *                and every frame is handed to an on_frame callback as
+ *                a view into the tag, without being copied.
+ *
+ *                The library is id3.c + frames.c + text.c + unsync.c + cpu.c; the CLI
+ *                links it like any other user (see README for the
+ *                static and shared library builds).
+ *
+ *                Structures:
+ *                - TagHeader
+ *                - Id3Allocator
+ *                - Id3Context
+ *
+ *                Functions:
+ *                - decode_syncsafe()
+ *                - encode_syncsafe()
+ *                - decode_be32()
+ *                - encode_be32()
+ *                - decode_frame_size()
+ *                - encode_frame_size()
+ *                - read_tag_header()
+ *                - id3_needs_resync()
+ *                - id3_resync()
+ *                - id3_unsync_frames()
+ *                - id3_frame_prefix()
+ *                - id3_init()
+ *                - id3_release()
+ *                - id3_parse_memory()
+ *                - id3_parse_fd()
+ *
+ ***********************************************************************/
+
+#ifndef ID3_H
+#define ID3_H
+
+#include <stddef.h>
+
+#include "types.h"
+
+// ID3v2 header flag bits (byte 5 of the 10-byte header)
+#define TAG_FLAG_UNSYNC     0x80
+#define TAG_FLAG_EXTENDED   0x40
+#define TAG_FLAG_FOOTER     0x10
+
+// ID3v2.4 frame format flag bits (second flag byte)
+#define FRAME_FLAG_GROUP    0x40
+#define FRAME_FLAG_UNSYNC   0x02
+#define FRAME_FLAG_LENGTH   0x01
+#define FRAME_FLAG_PACKED   0x0C    // Compression or encryption
+
+// ID3v2.3 frame format flag bits (second flag byte)
+#define FRAME_FLAG_V23_GROUP    0x20
+#define FRAME_FLAG_V23_PACKED   0xC0    // Compression or encryption
+
+// Size of a complete frame header (ID + size + flags)
+#define FRAME_HEADER_SIZE   (FRAME_ID_SIZE + 4 + FLAG_SIZE)
+
+// Decoded form of the 10-byte ID3v2 header
+typedef struct TagHeader
+{
+    unsigned char version;     // Major version (3 for ID3v2.3, 4 for ID3v2.4)
+    unsigned char revision;    // Revision number
+    unsigned char flags;       // Header flags (TAG_FLAG_*)
+    uint tag_size;             // Size of the tag excluding the 10-byte header
+} TagHeader;
+
+// Memory functions used by a context (user is passed back unchanged)
+typedef struct Id3Allocator
+{
+    void *(*alloc)(size_t size, void *user);     // Returns NULL on failure
+    void (*release)(void *ptr, size_t size, void *user);
+    void *user;
+} Id3Allocator;
+
+/*
+ * Called once per frame in tag order. id is the null-terminated frame ID,
+ * data/len the frame data (valid only during the call). Returning non-zero
+ * stops the parse.
+ */
+typedef int (*Id3FrameCallback)(void *user, const char *id, const unsigned char *data, size_t len);
+
+/*
+ * Parser state for one thread. A context can parse any number of files one
+ * after another; the scratch buffer is kept and reused, so after the first
+ * file that needs it no further allocation is made.
+ */
+typedef struct Id3Context
+{
+    Id3Allocator allocator;         // Where the scratch buffer comes from
+    Id3FrameCallback on_frame;      // Frame handler
+    void *user;                     // Passed to on_frame
+    TagHeader header;               // Header of the tag being (or last) parsed
+    int frame_count;                // Frames delivered by the last parse
+    unsigned char *scratch;         // Tag buffer for input that cannot be mapped
+    size_t scratch_size;            // Capacity of scratch
+} Id3Context;
+
+// Decodes a 4-byte syncsafe integer (7 bits per byte)
+uint decode_syncsafe(const unsigned char *buf);
+
+// Encodes a value as a 4-byte syncsafe integer
+void encode_syncsafe(uint value, unsigned char *buf);
+
+// Decodes a 4-byte big-endian integer
+uint decode_be32(const unsigned char *buf);
+
+// Encodes a value as a 4-byte big-endian integer
+void encode_be32(uint value, unsigned char *buf);
+
+// Decodes a frame size field (syncsafe in ID3v2.4, big-endian before)
+uint decode_frame_size(const unsigned char *buf, unsigned char version);
+
+// Encodes a frame size field for the given tag version
+void encode_frame_size(uint value, unsigned char version, unsigned char *buf);
+
+// Validates the 10-byte ID3v2 header and decodes it
+Status read_tag_header(const unsigned char *buf, TagHeader *header);
+
+// Checks whether a tag (header + body) is unsynchronised as a whole or has unsynchronised frames
+int id3_needs_resync(const unsigned char *tag, size_t len);
+
+// Undoes unsynchronisation of a tag in place; the bytes freed at the end become padding
+void id3_resync(unsigned char *tag, size_t len);
+
+// Unsynchronises a frame area into out (UNSYNC_ENCODED_MAX(len) bytes) the way the tag version does it; returns the new length
+size_t id3_unsync_frames(unsigned char version, const unsigned char *frames, size_t len, unsigned char *out);
+
+// Returns the bytes in front of a frame's data (grouping identity, data length indicator), -1 if it is compressed or encrypted
+int id3_frame_prefix(unsigned char version, unsigned char format);
+
+// Prepares a context; allocator may be NULL to use malloc/free
+void id3_init(Id3Context *ctx, const Id3Allocator *allocator, Id3FrameCallback on_frame, void *user);
+
+// Gives the scratch buffer back to the allocator
+void id3_release(Id3Context *ctx);
+
+// Parses a tag already in memory (10-byte header followed by the tag body, possibly truncated)
+Status id3_parse_memory(Id3Context *ctx, const unsigned char *tag, size_t len);
+
+// Reads the tag at the start of fd (mapped if possible, else read into the scratch buffer) and parses it
+Status id3_parse_fd(Id3Context *ctx, int fd);
+
+#endif  // ID3_H
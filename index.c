@@ -0,0 +1,504 @@
+/***********************************************************************
+ *  File Name   : index.c
+ *  Description : Source file for the persistent tag index.
+ *                The index is a single file holding an open-addressing
+ *                hash table of entry offsets followed by the entries.
+ *                It is only ever mapped read-only: lookups probe the
+ *                mapping directly and frames are handed out as views
+ *                into it, so nothing is loaded into the heap. A new
+ *                index is written to a temporary file and renamed over
+ *                the old one.
+ *
+ *                Functions:
+ *                - open_tag_index()
+ *                - close_tag_index()
+ *                - lookup_tag_index()
+ *                - index_entry_matches()
+ *                - mark_index_entry()
+ *                - load_index_entry()
+ *                - build_index_record()
+ *                - build_index_removal()
+ *                - write_tag_index()
+ *                - hash_index_path()
+ *
+ ***********************************************************************/
+
+#include <errno.h>
+#include <limits.h>
+
+#include "index.h"
+#include "frames.h"
+
+// Round a length up to the 8-byte record alignment
+#define PAD8(x) (((x) + 7) & ~(size_t)7)
+
+// Bytes of a frame value kept in the index: binary frames only keep their size
+static uint32_t index_stored_length(const TagInfo *tagInfo, int i)
+{
+    const FrameDesc *desc = lookup_frame(pack_frame_id(tagInfo->frame_id[i]));
+
+    if(desc == NULL || desc->kind == e_frame_binary || tagInfo->frame_data[i] == NULL)
+        return 0;
+    return tagInfo->frame_Size[i];
+}
+
+/*
+ * Checks that the record at offset lies inside the mapping and that its
+ * path and every IndexFrame (with its data) lie inside record_size, so a
+ * truncated or corrupt record is never read past its end.
+ */
+static int index_record_valid(const TagIndex *index, uint64_t offset)
+{
+    if(offset % 8 != 0 || offset + sizeof(IndexEntry) > index->map_size)
+        return 0;
+
+    const IndexEntry *entry = (const IndexEntry *)(index->map + offset);
+    uint64_t size = entry->record_size;
+    if(size > index->map_size - offset || size < sizeof(IndexEntry) + PAD8(entry->path_len))
+        return 0;
+
+    uint64_t pos = sizeof(IndexEntry) + PAD8(entry->path_len);
+    for(int i = 0; i < entry->frame_count; i++)
+    {
+        if(size - pos < sizeof(IndexFrame))
+            return 0;
+        const IndexFrame *frame = (const IndexFrame *)((const unsigned char *)entry + pos);
+        if(frame->stored > frame->length || size - pos - sizeof(IndexFrame) < PAD8((uint64_t)frame->stored))
+            return 0;
+        pos += sizeof(IndexFrame) + PAD8((uint64_t)frame->stored);
+    }
+    return 1;
+}
+
+// Function to map the index file and validate its header
+Status open_tag_index(TagIndex *index, const char *fname)
+{
+    struct stat st;
+
+    memset(index, 0, sizeof(*index));
+    index->fname = strdup(fname);
+    if(index->fname == NULL)
+        return e_failure;
+
+    int fd = open(fname, O_RDONLY);
+    if(fd == -1)
+        return e_success;    // No index yet: every lookup misses
+
+    if(fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(IndexHeader))
+    {
+        close(fd);
+        return e_success;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return e_success;
+
+    const IndexHeader *header = map;
+    size_t buckets_end = sizeof(IndexHeader) + (size_t)header->bucket_count * sizeof(uint64_t);
+
+    // Ignore (and later overwrite) anything that does not look like a complete index
+    if(memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || header->version != INDEX_VERSION ||
+       header->file_size != (uint64_t)st.st_size || header->bucket_count == 0 ||
+       (header->bucket_count & (header->bucket_count - 1)) != 0 || buckets_end > (size_t)st.st_size)
+    {
+        fprintf(stderr, "INFO: Ignoring invalid index %s\n", fname);
+        munmap(map, st.st_size);
+        return e_success;
+    }
+
+    index->map = map;
+    index->map_size = st.st_size;
+    index->header = header;
+    index->buckets = (const uint64_t *)(index->map + sizeof(IndexHeader));
+
+    // Without the bitmap nothing is pruned
+    index->seen = calloc(index->map_size / 64 + 1, 1);
+    return e_success;
+}
+
+// Function to release the mapping
+void close_tag_index(TagIndex *index)
+{
+    if(index->map != NULL)
+        munmap((void *)index->map, index->map_size);
+    free(index->seen);
+    free(index->fname);
+    memset(index, 0, sizeof(*index));
+}
+
+/*
+ * Probes the bucket array for the path. The entry is returned only if
+ * the inode, size and mtime recorded with it still match the file, and
+ * only if the whole record is intact; a damaged one is a miss, so the
+ * file is parsed and its record rewritten.
+ */
+const IndexEntry *lookup_tag_index(const TagIndex *index, const char *path, const struct stat *st)
+{
+    if(index->map == NULL)
+        return NULL;
+
+    size_t path_len = strlen(path);
+    uint64_t hash = hash_index_path(path, path_len);
+    uint32_t mask = index->header->bucket_count - 1;
+
+    for(uint32_t probe = 0; probe <= mask; probe++)
+    {
+        uint64_t offset = index->buckets[(hash + probe) & mask];
+        if(offset == 0)
+            return NULL;
+
+        if(!index_record_valid(index, offset))
+            continue;
+
+        const IndexEntry *entry = (const IndexEntry *)(index->map + offset);
+        if(entry->path_hash != hash || entry->path_len != path_len || memcmp(entry + 1, path, path_len) != 0)
+            continue;
+
+        if(!index_entry_matches(entry, st))
+            return NULL;    // File changed since it was indexed
+
+        return entry;
+    }
+    return NULL;
+}
+
+// Function to check that the file still has the inode, size and modification time the entry was built from
+int index_entry_matches(const IndexEntry *entry, const struct stat *st)
+{
+    return entry->inode == (uint64_t)st->st_ino && entry->size == (uint64_t)st->st_size &&
+           entry->mtime_sec == (int64_t)st->st_mtim.tv_sec && entry->mtime_nsec == (uint32_t)st->st_mtim.tv_nsec;
+}
+
+// Function to set the entry's bit in the seen bitmap (workers mark concurrently, so the bit is set atomically)
+void mark_index_entry(const TagIndex *index, const IndexEntry *entry)
+{
+    size_t slot = ((const unsigned char *)entry - index->map) / 8;
+
+    if(index->seen != NULL)
+        __atomic_fetch_or(&index->seen[slot / 8], (unsigned char)(1u << (slot % 8)), __ATOMIC_RELAXED);
+}
+
+// Function to point the TagInfo frames at the data stored in the entry
+void load_index_entry(const IndexEntry *entry, TagInfo *tagInfo)
+{
+    const unsigned char *pos = (const unsigned char *)(entry + 1) + PAD8(entry->path_len);
+
+    tagInfo->frame_count = 0;
+    for(int i = 0; i < entry->frame_count && reserve_tag_frame(tagInfo) == e_success; i++)
+    {
+        const IndexFrame *frame = (const IndexFrame *)pos;
+        int index = tagInfo->frame_count++;
+
+        memcpy(tagInfo->frame_id[index], frame->id, FRAME_ID_SIZE);
+        tagInfo->frame_id[index][FRAME_ID_SIZE] = '\0';
+        tagInfo->frame_Size[index] = frame->length;
+        tagInfo->frame_data[index] = frame->stored ? (const char *)(frame + 1) : NULL;
+
+        pos += sizeof(IndexFrame) + PAD8(frame->stored);
+    }
+
+    if(entry->flags & INDEX_HAS_HASH)
+    {
+        tagInfo->audio_hash = entry->audio_hash;
+        tagInfo->hashed = 1;
+    }
+}
+
+// Function to serialize the decoded frames of one file into a single allocation
+Status build_index_record(const TagInfo *tagInfo, const char *path, const struct stat *st, char **record, size_t *record_len)
+{
+    size_t path_len = strlen(path);
+    size_t size = sizeof(IndexEntry) + PAD8(path_len);
+
+    for(int i = 0; i < tagInfo->frame_count; i++)
+        size += sizeof(IndexFrame) + PAD8(index_stored_length(tagInfo, i));
+
+    // A tag too large for the record fields is not indexed; it is parsed on every scan
+    if(tagInfo->frame_count > UINT16_MAX || size > UINT32_MAX)
+        return e_failure;
+
+    char *buf = calloc(1, size);
+    if(buf == NULL)
+        return e_failure;
+
+    IndexEntry *entry = (IndexEntry *)buf;
+    entry->path_hash = hash_index_path(path, path_len);
+    entry->inode = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime_sec = st->st_mtim.tv_sec;
+    entry->mtime_nsec = st->st_mtim.tv_nsec;
+    entry->record_size = size;
+    entry->path_len = path_len;
+    entry->frame_count = tagInfo->frame_count;
+    if(tagInfo->hashed)
+    {
+        entry->flags |= INDEX_HAS_HASH;
+        entry->audio_hash = tagInfo->audio_hash;
+    }
+    memcpy(entry + 1, path, path_len);
+
+    char *pos = buf + sizeof(IndexEntry) + PAD8(path_len);
+    for(int i = 0; i < tagInfo->frame_count; i++)
+    {
+        IndexFrame *frame = (IndexFrame *)pos;
+        uint32_t stored = index_stored_length(tagInfo, i);
+
+        memcpy(frame->id, tagInfo->frame_id[i], FRAME_ID_SIZE);
+        frame->length = tagInfo->frame_Size[i];
+        frame->stored = stored;
+        memcpy(frame + 1, tagInfo->frame_data[i], stored);
+        pos += sizeof(IndexFrame) + PAD8(stored);
+    }
+
+    *record = buf;
+    *record_len = size;
+    return e_success;
+}
+
+// Function to build a record that removes the path from the next index (the file was deleted)
+Status build_index_removal(const char *path, char **record, size_t *record_len)
+{
+    size_t path_len = strlen(path);
+    size_t size = sizeof(IndexEntry) + PAD8(path_len);
+
+    char *buf = calloc(1, size);
+    if(buf == NULL)
+        return e_failure;
+
+    IndexEntry *entry = (IndexEntry *)buf;
+    entry->path_hash = hash_index_path(path, path_len);
+    entry->record_size = size;
+    entry->path_len = path_len;
+    entry->flags = INDEX_REMOVED;
+    memcpy(entry + 1, path, path_len);
+
+    *record = buf;
+    *record_len = size;
+    return e_success;
+}
+
+// Function to check whether an old entry was marked by mark_index_entry() (every entry counts as seen without the bitmap)
+static int index_entry_seen(const TagIndex *index, const IndexEntry *entry)
+{
+    size_t slot = ((const unsigned char *)entry - index->map) / 8;
+
+    if(index->seen == NULL)
+        return 1;
+    return (__atomic_load_n(&index->seen[slot / 8], __ATOMIC_RELAXED) >> (slot % 8)) & 1;
+}
+
+// Function to check whether an entry's path is one of the roots or lies below one
+static int index_entry_under(const IndexEntry *entry, char **roots, int root_count)
+{
+    const char *path = (const char *)(entry + 1);
+
+    for(int i = 0; i < root_count; i++)
+    {
+        size_t length = strlen(roots[i]);
+        if(length > entry->path_len || memcmp(path, roots[i], length) != 0)
+            continue;
+        if(length == entry->path_len || path[length] == '/' || (length > 0 && roots[i][length - 1] == '/'))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Writes the next generation of the index: the fresh records first, then
+ * every old entry whose path was not re-recorded. A removal record drops
+ * the old entry of its path; an old entry below one of the scanned roots
+ * that the scan did not mark (its file is gone, or no longer parses) is
+ * dropped too, and damaged old entries are always dropped. Entries
+ * outside the roots are kept as they are, without touching their files.
+ * Nothing is written when there are no records and nothing was dropped.
+ * The file is built under a temporary name and renamed into place, so
+ * readers never see a partial index.
+ */
+Status write_tag_index(const TagIndex *index, char **records, int record_count, char **roots, int root_count)
+{
+    uint64_t old_count = index->map ? index->header->entry_count : 0;
+    uint64_t total = record_count + old_count;
+    uint32_t bucket_count = 16;
+
+    while(bucket_count < total * 2)
+        bucket_count <<= 1;
+
+    // Entries that make it into the new file, in write order
+    const IndexEntry **entries = malloc(sizeof(IndexEntry *) * (total ? total : 1));
+    uint32_t *slots = calloc(bucket_count, sizeof(uint32_t));    // entries[] position + 1, 0 = empty
+    uint64_t *buckets = calloc(bucket_count, sizeof(uint64_t));
+    if(entries == NULL || slots == NULL || buckets == NULL)
+    {
+        free(entries);
+        free(slots);
+        free(buckets);
+        return e_failure;
+    }
+
+    uint64_t kept = 0, dropped = 0;
+    uint32_t old_bucket = 0;
+    for(uint64_t n = 0; n < total; n++)
+    {
+        const IndexEntry *entry;
+        if(n < (uint64_t)record_count)
+            entry = (const IndexEntry *)records[n];
+        else
+        {
+            // Walk the old bucket array for the next occupied slot
+            while(old_bucket < index->header->bucket_count && index->buckets[old_bucket] == 0)
+                old_bucket++;
+            if(old_bucket == index->header->bucket_count)
+                break;
+
+            uint64_t old_offset = index->buckets[old_bucket++];
+            if(!index_record_valid(index, old_offset))
+            {
+                dropped++;
+                continue;
+            }
+            entry = (const IndexEntry *)(index->map + old_offset);
+        }
+
+        uint32_t slot = entry->path_hash & (bucket_count - 1);
+        int duplicate = 0;
+        while(slots[slot] != 0)
+        {
+            const IndexEntry *other = entries[slots[slot] - 1];
+            if(other->path_hash == entry->path_hash && other->path_len == entry->path_len &&
+               memcmp(other + 1, entry + 1, entry->path_len) == 0)
+            {
+                duplicate = 1;   // Already have a newer record for this path
+                break;
+            }
+            slot = (slot + 1) & (bucket_count - 1);
+        }
+        if(duplicate)
+            continue;
+        if(n >= (uint64_t)record_count && !index_entry_seen(index, entry) && index_entry_under(entry, roots, root_count))
+        {
+            dropped++;
+            continue;
+        }
+
+        entries[kept] = entry;
+        slots[slot] = ++kept;
+    }
+
+    if(record_count == 0 && dropped == 0)
+    {
+        free(entries);
+        free(slots);
+        free(buckets);
+        return e_success;    // The index on disk is still current
+    }
+
+    // A removal record has shadowed the old entry of its path; it is not written itself
+    uint64_t live = 0;
+    for(uint64_t i = 0; i < kept; i++)
+        if(!(entries[i]->flags & INDEX_REMOVED))
+            entries[live++] = entries[i];
+    if(live != kept)
+    {
+        kept = live;
+        memset(slots, 0, sizeof(uint32_t) * bucket_count);
+        for(uint64_t i = 0; i < kept; i++)
+        {
+            uint32_t slot = entries[i]->path_hash & (bucket_count - 1);
+            while(slots[slot] != 0)
+                slot = (slot + 1) & (bucket_count - 1);
+            slots[slot] = i + 1;
+        }
+    }
+
+    // Assign file offsets: header, bucket array, then the entries back to back
+    uint64_t offset = sizeof(IndexHeader) + (uint64_t)bucket_count * sizeof(uint64_t);
+    uint64_t *entry_offsets = malloc(sizeof(uint64_t) * (kept ? kept : 1));
+    char *tmp_fname = malloc(strlen(index->fname) + 32);
+    if(entry_offsets == NULL || tmp_fname == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory writing index %s\n", index->fname);
+        free(entry_offsets);
+        free(tmp_fname);
+        free(entries);
+        free(slots);
+        free(buckets);
+        return e_failure;
+    }
+    for(uint64_t i = 0; i < kept; i++)
+    {
+        entry_offsets[i] = offset;
+        offset += entries[i]->record_size;
+    }
+    for(uint32_t b = 0; b < bucket_count; b++)
+        if(slots[b] != 0)
+            buckets[b] = entry_offsets[slots[b] - 1];
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.bucket_count = bucket_count;
+    header.entry_count = kept;
+    header.file_size = offset;
+
+    sprintf(tmp_fname, "%s.tmp.%d", index->fname, (int)getpid());
+
+    Status status = e_success;
+    FILE *fptr = fopen(tmp_fname, "wb");
+    if(fptr == NULL)
+    {
+        perror("fopen");
+        status = e_failure;
+    }
+    else
+    {
+        if(fwrite(&header, sizeof(header), 1, fptr) != 1 ||
+           fwrite(buckets, sizeof(uint64_t), bucket_count, fptr) != bucket_count)
+            status = e_failure;
+
+        for(uint64_t i = 0; i < kept && status == e_success; i++)
+            if(fwrite(entries[i], entries[i]->record_size, 1, fptr) != 1)
+                status = e_failure;
+
+        // The data reaches the disk before the rename, so a crash leaves the old index or the whole new one
+        if(status == e_success && (fflush(fptr) == EOF || fsync(fileno(fptr)) == -1))
+        {
+            perror("fsync");
+            status = e_failure;
+        }
+        if(fclose(fptr) == EOF)
+            status = e_failure;
+
+        if(status == e_success && rename(tmp_fname, index->fname) == -1)
+        {
+            perror("rename");
+            status = e_failure;
+        }
+        if(status == e_failure)
+        {
+            fprintf(stderr, "ERROR: Unable to write index %s\n", index->fname);
+            unlink(tmp_fname);
+        }
+    }
+
+    free(tmp_fname);
+    free(entry_offsets);
+    free(entries);
+    free(slots);
+    free(buckets);
+    return status;
+}
+
+// Function to hash a path with 64-bit FNV-1a
+uint64_t hash_index_path(const char *path, size_t length)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)path[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,128 @@
+/***********************************************************************
+ *  File Name   : index.h
+ *  Description : Header file for the persistent tag index.
+ *                Declares the on-disk layout and the functions used to
+ *                look up previously decoded frames for a file without
+ *                parsing it again. An entry is valid only while the
+ *                file's inode, size and modification time are unchanged.
+ *
+ *                On-disk layout (native byte order, 8-byte aligned):
+ *                - IndexHeader
+ *                - uint64_t bucket[bucket_count]  (entry offsets, 0 = empty)
+ *                - entries: IndexEntry, path bytes, then per frame an
+ *                  IndexFrame followed by its data
+ *
+ *                Structures:
+ *                - IndexHeader
+ *                - IndexEntry
+ *                - IndexFrame
+ *                - TagIndex
+ *
+ *                Functions:
+ *                - open_tag_index()
+ *                - close_tag_index()
+ *                - lookup_tag_index()
+ *                - index_entry_matches()
+ *                - mark_index_entry()
+ *                - load_index_entry()
+ *                - build_index_record()
+ *                - build_index_removal()
+ *                - write_tag_index()
+ *                - hash_index_path()
+ *
+ ***********************************************************************/
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "view.h"
+
+// Magic string and format version stored at the start of the index file
+#define INDEX_MAGIC     "MP3TIDX"
+#define INDEX_VERSION   5
+
+// IndexEntry flags
+#define INDEX_HAS_HASH  0x1     // audio_hash holds the hash of the audio data
+#define INDEX_REMOVED   0x2     // Record passed to write_tag_index() to drop the path (never stored)
+
+// Fixed header at offset 0 of the index file
+typedef struct IndexHeader
+{
+    char magic[8];              // INDEX_MAGIC, null-terminated
+    uint32_t version;           // INDEX_VERSION
+    uint32_t bucket_count;      // Number of hash buckets (power of two)
+    uint64_t entry_count;       // Number of entries stored
+    uint64_t file_size;         // Total size of the index file (guards against truncation)
+} IndexHeader;
+
+// One indexed file; followed by path_len path bytes (padded to 8) and frame_count frames
+typedef struct IndexEntry
+{
+    uint64_t path_hash;         // FNV-1a hash of the path
+    uint64_t inode;             // Inode number when the entry was written
+    uint64_t size;              // File size when the entry was written
+    int64_t mtime_sec;          // Modification time (seconds)
+    uint32_t mtime_nsec;        // Modification time (nanoseconds)
+    uint32_t record_size;       // Size of the entry including path and frames
+    uint16_t path_len;          // Length of the path (no terminator stored)
+    uint16_t frame_count;       // Number of frames that follow
+    uint32_t flags;             // INDEX_HAS_HASH (INDEX_REMOVED only in records handed to write_tag_index())
+    uint64_t audio_hash;        // Hash of the audio data (--hash), valid with INDEX_HAS_HASH
+} IndexEntry;
+
+// One stored frame; followed by stored data bytes (padded to 8)
+typedef struct IndexFrame
+{
+    char id[FRAME_ID_SIZE];     // Frame ID
+    uint32_t length;            // Length of the UTF-8 frame value (whole data size for binary frames)
+    uint32_t stored;            // Bytes of the value stored (0 for binary frames, which are shown by size only)
+    uint32_t reserved;          // Keeps the structure 8-byte aligned
+} IndexFrame;
+
+// An open index: a read-only mapping of the file, or empty if it does not exist yet
+typedef struct TagIndex
+{
+    char *fname;                     // Path of the index file
+    const unsigned char *map;        // Mapping of the index file (NULL if empty)
+    size_t map_size;                 // Length of the mapping
+    const IndexHeader *header;       // Header inside the mapping
+    const uint64_t *buckets;         // Bucket array inside the mapping
+    unsigned char *seen;             // One bit per 8-byte offset of the mapping, set for entries this run matched
+} TagIndex;
+
+// Function to map an existing index file (a missing or invalid file gives an empty index)
+Status open_tag_index(TagIndex *index, const char *fname);
+
+// Function to unmap the index
+void close_tag_index(TagIndex *index);
+
+// Function to find a still-valid entry for the path, NULL if absent or stale
+const IndexEntry *lookup_tag_index(const TagIndex *index, const char *path, const struct stat *st);
+
+// Function to check that an entry still describes the file (same inode, size and mtime)
+int index_entry_matches(const IndexEntry *entry, const struct stat *st);
+
+// Function to record that an entry was matched by this run (so write_tag_index() keeps it)
+void mark_index_entry(const TagIndex *index, const IndexEntry *entry);
+
+// Function to fill TagInfo frames with views into an index entry (the frame arrays are freed by release_tag_text())
+void load_index_entry(const IndexEntry *entry, TagInfo *tagInfo);
+
+// Function to serialize the parsed frames of a file into a heap record for the next index
+Status build_index_record(const TagInfo *tagInfo, const char *path, const struct stat *st, char **record, size_t *record_len);
+
+// Function to build a record that drops a deleted file from the next index
+Status build_index_removal(const char *path, char **record, size_t *record_len);
+
+// Function to write a new index from fresh records plus the still-unreplaced old entries (under the scanned roots, only the marked ones)
+Status write_tag_index(const TagIndex *index, char **records, int record_count, char **roots, int root_count);
+
+// Function to hash a path for bucket selection
+uint64_t hash_index_path(const char *path, size_t length);
+
+#endif  // INDEX_H
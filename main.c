@@ -6,8 +6,14 @@
  *                requested functionality.
  *
  *                Supports the following operations:
- *                - Viewing MP3 tag information
+ *                - Viewing MP3 tag information (and the audio duration/bitrate)
+ *                - Scanning directories / many files in parallel
  *                - Editing a specific MP3 tag using tag code
+ *                - Batch editing many files from a manifest
+ *                - Querying single frames without parsing the whole tag
+ *                - Extracting the album art to an image file
+ *                - Serving tag requests from a daemon, and its client
+ *                - Watching a directory and re-reading only changed files
  *                - Displaying help with tag code descriptions
  *
  *                Functions:
@@ -19,11 +25,41 @@
 #include "view.h"
 #include "types.h"
 #include "edit.h"
+#include "scan.h"
+#include "batch.h"
+#include "query.h"
+#include "art.h"
+#include "stats.h"
+#include "hash.h"
+#include "output.h"
+#include "server.h"
+#include "watch.h"
+#include "frames.h"
 
 int main(int argc, char *argv[])
 {
     TagInfo tagInfo;  // Structure to hold information for viewing tags
 
+    memset(&tagInfo, 0, sizeof(tagInfo));
+
+    // --stats / --stats=json may appear anywhere; the report is printed on exit
+    parse_stats_args(&argc, argv);
+
+    // --durability=none|file|dir applies to every edit (-e and -b)
+    if (parse_durability_args(&argc, argv) == e_failure)
+        return -1;
+
+    // --audio / --audio=scan adds duration and bitrate to -v
+    if (parse_audio_args(&argc, argv) == e_failure)
+        return -1;
+
+    // --hash adds a hash of the audio data only, for finding one recording under different tags
+    parse_hash_args(&argc, argv);
+
+    // --format=ndjson|csv|tsv replaces the table of -v
+    if (parse_format_args(&argc, argv) == e_failure)
+        return -1;
+
     // Check if minimum required arguments are passed
     if (argc < 2)
     {
@@ -41,8 +77,9 @@ int main(int argc, char *argv[])
     // Ensure that arguments for operation are sufficient
     if (argc < 3)
     {
-        printf("To View MP3 Tags : %s -v <file_name.mp3>\n", argv[0]);
-        printf("To Edit MP3 Tags : %s -e <tag_code> <file_name.mp3> <new_tag_data>\n", argv[0]); 
+        printf("To View MP3 Tags : %s -v <file_name.mp3|directory> [more paths...]\n", argv[0]);
+        printf("To Edit MP3 Tags : %s -e <tag_code> <file_name.mp3> <new_tag_data>\n", argv[0]);
+        printf("Edit Many Frames : %s -e <file_name.mp3> <FRAME=value> [FRAME=value ...]\n", argv[0]);
         printf("For help, type: \n%s --help\n", argv[0]);
         return -1;
     }
@@ -55,8 +92,27 @@ int main(int argc, char *argv[])
     // If operation is 'view' (-v)
     else if (op == e_display)
     {
+        struct stat st;
+
+        // Optional persistent tag index: -v --index <file> <paths...>
+        if (strcmp(argv[2], "--index") == 0)
+        {
+            if (argc < 5)
+            {
+                fprintf(stderr, "ERROR: Please Enter Correct Syntax. For Help, Type: \n%s --help\n", argv[0]);
+                return -1;
+            }
+            if (scan_paths(argv + 4, argc - 4, argv[3]) == e_failure)
+                return e_failure;
+        }
+        // Several paths, or a directory: scan them all with the worker pool
+        else if (argc > 3 || (stat(argv[2], &st) == 0 && S_ISDIR(st.st_mode)))
+        {
+            if (scan_paths(argv + 2, argc - 2, NULL) == e_failure)
+                return e_failure;
+        }
         // Check for correct number of arguments for view operation
-        if (argc == 3)
+        else if (argc == 3)
         {
             // Validate command-line arguments
             if (read_and_validate_args(argv, &tagInfo) == e_failure)
@@ -94,39 +150,107 @@ int main(int argc, char *argv[])
                 return e_failure;
 
             // Perform the editing operation on the tag
-            if (edit_tag(&edit) == e_failure)
+            Status status = edit_tag(&edit);
+            close_edit_files(&edit);
+            if (status == e_failure)
                 return e_failure;
         }
         else
         {
-            printf("To View MP3 Tags : %s -v <file_name.mp3>\n", argv[0]);
+            printf("To View MP3 Tags : %s -v <file_name.mp3|directory> [more paths...]\n", argv[0]);
             printf("To Edit MP3 Tags : %s -e <tag_code> <file_name.mp3> <new_tag_data>\n", argv[0]);
+            printf("Edit Many Frames : %s -e <file_name.mp3> <FRAME=value> [FRAME=value ...]\n", argv[0]);
             printf("For help, type: \n%s --help\n", argv[0]);
             return -1; 
         }
     }
 
+    // If operation is 'batch' (-b)
+    else if (op == e_batch)
+    {
+        if (run_batch(argc, argv) == e_failure)
+            return e_failure;
+    }
+
+    // If operation is 'query' (-g)
+    else if (op == e_query)
+    {
+        if (run_query(argc, argv) == e_failure)
+            return e_failure;
+    }
+
+    // If operation is 'extract art' (-x)
+    else if (op == e_extract)
+    {
+        if (run_extract_art(argc, argv) == e_failure)
+            return e_failure;
+    }
+
+    // If operation is 'daemon' (-d)
+    else if (op == e_serve)
+    {
+        if (run_server(argc, argv) == e_failure)
+            return e_failure;
+    }
+
+    // If operation is 'client' (-c)
+    else if (op == e_client)
+    {
+        if (run_client(argc, argv) == e_failure)
+            return e_failure;
+    }
+
+    // If operation is 'watch' (--watch)
+    else if (op == e_watch)
+    {
+        if (run_watch(argc, argv) == e_failure)
+            return e_failure;
+    }
+
     return 0; 
 }
 
-// External arrays containing tag label and operation names
-extern const char *tag_labels[MAX_FRAME_COUNT];
-extern const char *edit_operation[MAX_FRAME_COUNT];
-
 // Function to print the help message for usage
 void print_help_msg(char ** argv)
 {
-    printf("To View MP3 Tags : %s -v <file_name.mp3>\n", argv[0]);
+    printf("To View MP3 Tags : %s -v <file_name.mp3|directory> [more paths...]\n", argv[0]);
+    printf("With a Tag Index : %s -v --index <index_file> <paths...>\n", argv[0]);
     printf("To Edit MP3 Tags : %s -e <tag_code> <file_name.mp3> <new_tag_data>\n", argv[0]);
+    printf("Edit Many Frames : %s -e <file_name.mp3> <FRAME=value> [FRAME=value ...]\n", argv[0]);
+    printf("Stream Edit      : %s -e - <FRAME=value> [FRAME=value ...] < in.mp3 > out.mp3\n", argv[0]);
+    printf("Described Frames : TXXX:<description>=value (also WXXX, COMM and USLT)\n");
+    printf("To Batch Edit    : %s -b <manifest.csv|manifest.ndjson> [--jobs N] [--rate FILES_PER_SEC]\n", argv[0]);
+    printf("To Query Frames  : %s -g <FRAMEID>[,<FRAMEID>...] <file_name.mp3> [more files...]\n", argv[0]);
+    printf("To Extract Art   : %s -x <file_name.mp3> <image_file|->\n", argv[0]);
+    printf("To Replace Art   : %s -e <file_name.mp3> APIC=@<image_file> [FRAME=value ...]\n", argv[0]);
+    printf("Run Tag Daemon   : %s -d <socket> [--workers N] [--cache ENTRIES]\n", argv[0]);
+    printf("Daemon Client    : %s -c <socket> GET <file.mp3> [FRAME] | SET <file.mp3> FRAME=value... | STATS\n", argv[0]);
+    printf("Watch a Library  : %s --watch <directory> [--index <index_file>] [--debounce MS]\n", argv[0]);
+    printf("Edit Durability  : add --durability=none|file|dir to -e / -b (default: file)\n");
+    printf("Audio Duration   : add --audio (Xing/VBRI header or CBR) or --audio=scan (every frame) to -v\n");
+    printf("Output Format    : add --format=ndjson|csv|tsv to -v (default: table)\n");
+    printf("Audio Hash       : add --hash to -v (XXH64 of the audio only, tags excluded)\n");
+    printf("Instrumentation  : add --stats (table) or --stats=json to any command; printed to stderr\n");
     printf("===================================\n");
     printf("| %-15s:%15s |\n", "Tag Code", "Tag Name");
     printf("===================================\n");
 
-    // Display supported tag codes and their human-readable names
-    for (int i = 0; i < MAX_FRAME_COUNT; i++)
+    // Display the frames that have a short tag code, from the frame registry
+    for (int i = 0; i < frame_table_size; i++)
     {
-        printf("| %-15s:%15s |\n", edit_operation[i], tag_labels[i]);
+        if (frame_table[i].option)
+            printf("| -%-14c:%15s |\n", frame_table[i].option, frame_table[i].label);
     }
 
     printf("===================================\n");
-}
\ No newline at end of file
+
+    // Every other text, URL and comment frame can be set by its frame ID
+    printf("Frame IDs accepted as FRAME:");
+    for (int i = 0, n = 0; i < frame_table_size; i++)
+    {
+        if (frame_table[i].kind == e_frame_binary)
+            continue;
+        printf("%s%s", n++ % 12 == 0 ? "\n  " : " ", frame_table[i].name);
+    }
+    printf("\n");
+}
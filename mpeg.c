@@ -0,0 +1,434 @@
+/***********************************************************************
+ *  File Name   : mpeg.c
+ *  Description : Source file for the MPEG Audio Module.
+ *                The audio starts where the ID3v2 tag (and its footer)
+ *                ends and stops where the ID3v1/APEv2 trailer begins.
+ *                The fast path reads the first AUDIO_PROBE_SIZE bytes of
+ *                it: a Xing/Info or VBRI header in the first frame gives
+ *                the frame count of a VBR file directly, otherwise the
+ *                CBR formula (bytes * 8 / bitrate) is used. The full
+ *                scan maps the file and walks it frame by frame; when a
+ *                header does not check out, the next 0xFF is searched
+ *                16 or 32 bytes at a time (ff_prefix() in unsync.c) and
+ *                a candidate is accepted only if the frame after it
+ *                starts with a matching header too, so corrupt data and
+ *                junk between frames are skipped and counted.
+ *
+ *                Functions:
+ *                - parse_audio_args()
+ *                - get_audio_mode()
+ *                - parse_mpeg_header()
+ *                - find_frame_sync()
+ *                - find_audio_range()
+ *                - audio_start()
+ *                - read_audio_info()
+ *                - probe_audio()
+ *                - probe_audio_data()
+ *                - scan_audio()
+ *                - read_vbr_header()
+ *                - print_audio_info()
+ *
+ ***********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mpeg.h"
+#include "trailer.h"
+#include "unsync.h"
+#include "stats.h"
+
+// Mode given to every view (changed with --audio)
+static AudioMode audio_mode = e_audio_off;
+
+// Bitrates in kbit/s by [MPEG-1 or MPEG-2/2.5][layer - 1][bitrate index]
+static const short bitrates[2][3][16] =
+{
+    {
+        { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0 },
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0 },
+        { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 }
+    },
+    {
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 }
+    }
+};
+
+// Sample rates in Hz by [MPEG-1, MPEG-2, MPEG-2.5][sample rate index]
+static const int sample_rates[3][3] =
+{
+    { 44100, 48000, 32000 },
+    { 22050, 24000, 16000 },
+    { 11025, 12000, 8000 }
+};
+
+// Frames of one stream keep their version, layer and sample rate
+static int same_stream(const MpegHeader *a, const MpegHeader *b)
+{
+    return a == NULL || (a->version == b->version && a->layer == b->layer && a->sample_rate == b->sample_rate);
+}
+
+/*
+ * Accepts --audio (fast), --audio=fast or --audio=scan anywhere in argv
+ */
+Status parse_audio_args(int *argc, char **argv)
+{
+    int out = 1;
+
+    for(int i = 1; i < *argc; i++)
+    {
+        if(strcmp(argv[i], "--audio") == 0 || strcmp(argv[i], "--audio=fast") == 0)
+            audio_mode = e_audio_fast;
+        else if(strcmp(argv[i], "--audio=scan") == 0)
+            audio_mode = e_audio_scan;
+        else if(strncmp(argv[i], "--audio=", 8) == 0)
+        {
+            fprintf(stderr, "ERROR: Invalid audio mode => %s (fast or scan)\n", argv[i] + 8);
+            return e_failure;
+        }
+        else
+            argv[out++] = argv[i];
+    }
+
+    argv[out] = NULL;
+    *argc = out;
+    return e_success;
+}
+
+// Function to get the mode selected with --audio
+AudioMode get_audio_mode(void)
+{
+    return audio_mode;
+}
+
+/*
+ * 11 sync bits, then version, layer, bitrate, sample rate, padding and
+ * channel mode. Reserved values, free-format bitrate (index 0) and
+ * the reserved emphasis are rejected, which also weeds out most chance
+ * 0xFFEx pairs inside the audio data.
+ */
+int parse_mpeg_header(const unsigned char *p, MpegHeader *header)
+{
+    if(p[0] != 0xFF || (p[1] & 0xE0) != 0xE0)
+        return 0;
+
+    int version_bits = (p[1] >> 3) & 3;
+    int layer_bits = (p[1] >> 1) & 3;
+    int bitrate_index = p[2] >> 4;
+    int rate_index = (p[2] >> 2) & 3;
+    if(version_bits == 1 || layer_bits == 0 || bitrate_index == 0 || bitrate_index == 15 ||
+       rate_index == 3 || (p[3] & 3) == 2)
+        return 0;
+
+    header->version = version_bits == 3 ? 10 : version_bits == 2 ? 20 : 25;
+    header->layer = 4 - layer_bits;
+    header->bitrate = bitrates[header->version != 10][header->layer - 1][bitrate_index];
+    header->sample_rate = sample_rates[version_bits == 3 ? 0 : version_bits == 2 ? 1 : 2][rate_index];
+    header->channels = (p[3] >> 6) == 3 ? 1 : 2;
+
+    int padding = (p[2] >> 1) & 1;
+    if(header->layer == 1)
+    {
+        header->samples = 384;
+        header->frame_size = (12000 * header->bitrate / header->sample_rate + padding) * 4;
+    }
+    else
+    {
+        header->samples = header->layer == 3 && header->version != 10 ? 576 : 1152;
+        header->frame_size = header->samples / 8 * 1000 * header->bitrate / header->sample_rate + padding;
+    }
+    return 1;
+}
+
+/*
+ * A header on its own is often a chance match in the audio data, so a
+ * candidate counts only if the frame after it also starts with a header
+ * of the same stream (or would start past the end of buf).
+ */
+size_t find_frame_sync(const unsigned char *buf, size_t len, const MpegHeader *like, MpegHeader *header)
+{
+    size_t pos = 0;
+
+    while(pos + MPEG_HEADER_SIZE <= len)
+    {
+        pos += ff_prefix(buf + pos, len - pos);
+        if(pos + MPEG_HEADER_SIZE > len)
+            break;
+
+        MpegHeader candidate, next;
+        if(parse_mpeg_header(buf + pos, &candidate) && same_stream(like, &candidate))
+        {
+            size_t next_pos = pos + candidate.frame_size;
+            if(next_pos + MPEG_HEADER_SIZE > len ||
+               (parse_mpeg_header(buf + next_pos, &next) && same_stream(&candidate, &next)))
+            {
+                *header = candidate;
+                return pos;
+            }
+        }
+        pos++;
+    }
+    return len;
+}
+
+/*
+ * The audio is what copy_remainig_data() would copy, minus the trailer:
+ * from the end of the ID3v2 tag (header read here when the caller has
+ * not) to the start of the ID3v1/APEv2 tags. Input that is not a
+ * regular file has no end, so it has no range.
+ */
+Status find_audio_range(int fd, const TagHeader *header, off_t *start, off_t *end)
+{
+    struct stat st;
+    TagHeader file_header;
+
+    if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+        return e_failure;
+
+    if(header == NULL)
+    {
+        unsigned char buf[HEADER_SIZE];
+        ssize_t got = pread(fd, buf, HEADER_SIZE, 0);
+        STATS_READ(got);
+        if(got != HEADER_SIZE || read_tag_header(buf, &file_header) == e_failure)
+            memset(&file_header, 0, sizeof(file_header));
+        header = &file_header;
+    }
+
+    *start = audio_start(header);
+    *end = trailer_start(fd, st.st_size);
+    if(*start > *end)
+        *start = *end;     // Truncated inside the tag: no audio
+    return e_success;
+}
+
+// Function to find where the audio starts: after the ID3v2 tag and its footer (a zeroed header means no tag, so at 0)
+off_t audio_start(const TagHeader *header)
+{
+    if(header->version == 0)
+        return 0;
+    return HEADER_SIZE + (off_t)header->tag_size + ((header->flags & TAG_FLAG_FOOTER) ? HEADER_SIZE : 0);
+}
+
+// Function to measure the audio range of fd with the given mode (info->source stays NULL when it is off)
+Status read_audio_info(int fd, const TagHeader *header, AudioMode mode, AudioInfo *info)
+{
+    off_t start, end;
+
+    memset(info, 0, sizeof(*info));
+    if(mode == e_audio_off || find_audio_range(fd, header, &start, &end) == e_failure)
+        return e_success;
+
+    long long phase = STATS_START();
+    Status status = e_failure;
+    if(start < end)
+        status = mode == e_audio_scan ? scan_audio(fd, start, end, info) : probe_audio(fd, start, end, info);
+    STATS_PHASE(e_phase_mpeg, phase);
+
+    // Still printed, as a file without any audio frames
+    if(status == e_failure)
+    {
+        memset(info, 0, sizeof(*info));
+        info->source = "none";
+    }
+    return status;
+}
+
+// Function to read the first AUDIO_PROBE_SIZE bytes of the audio once and measure them with probe_audio_data()
+Status probe_audio(int fd, off_t start, off_t end, AudioInfo *info)
+{
+    size_t want = end - start < AUDIO_PROBE_SIZE ? (size_t)(end - start) : AUDIO_PROBE_SIZE;
+    unsigned char *buf = malloc(want);
+    if(buf == NULL)
+        return e_failure;
+    STATS_ADD(allocs, 1);
+
+    ssize_t got = pread(fd, buf, want, start);
+    STATS_READ(got);
+    Status status = got > 0 ? probe_audio_data(buf, got, start, end, info) : e_failure;
+    free(buf);
+    return status;
+}
+
+/*
+ * Measures the audio from its first len bytes, read from start. Xing/Info
+ * and VBRI headers count the frames after their own; for CBR the frame
+ * count is estimated from the duration.
+ */
+Status probe_audio_data(const unsigned char *buf, size_t len, off_t start, off_t end, AudioInfo *info)
+{
+    if(len < MPEG_HEADER_SIZE)
+        return e_failure;
+
+    MpegHeader header;
+    size_t pos = find_frame_sync(buf, len, NULL, &header);
+    if(pos == len)
+        return e_failure;
+    info->first = header;
+    info->first_frame = start + pos;
+
+    unsigned long frames = 0, bytes = 0;
+    const char *source = read_vbr_header(buf + pos, len - pos, &header, &frames, &bytes);
+
+    off_t audio_bytes = end - info->first_frame;
+    if(source != NULL && frames > 0)
+    {
+        info->source = source;
+        info->frames = frames;
+        info->duration = (double)frames * header.samples / header.sample_rate;
+        if(bytes == 0)
+            bytes = audio_bytes - header.frame_size;
+        info->bitrate = (int)(bytes * 8.0 / info->duration / 1000.0 + 0.5);
+        info->vbr = strcmp(source, "Info") != 0;
+        return e_success;
+    }
+
+    // Every frame has the first frame's bitrate
+    info->source = "CBR";
+    info->bitrate = header.bitrate;
+    info->duration = audio_bytes * 8.0 / (header.bitrate * 1000.0);
+    info->frames = (unsigned long)(info->duration * header.sample_rate / header.samples + 0.5);
+    return e_success;
+}
+
+/*
+ * Maps the file up to the end of the audio and follows the frame sizes
+ * from header to header. The Xing/Info/VBRI frame carries no audio and
+ * is not counted; bytes that belong to no frame (corrupt data, a stray
+ * tag, a truncated last frame) are added to skipped.
+ */
+Status scan_audio(int fd, off_t start, off_t end, AudioInfo *info)
+{
+    unsigned char *map = mmap(NULL, end, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED)
+        return e_failure;
+    madvise(map, end, MADV_SEQUENTIAL);
+
+    const unsigned char *audio = map + start;
+    size_t len = end - start;
+    MpegHeader header;
+    size_t pos = find_frame_sync(audio, len, NULL, &header);
+    if(pos == len)
+    {
+        munmap(map, end);
+        return e_failure;
+    }
+    info->first = header;
+    info->first_frame = start + pos;
+    info->skipped = pos;
+
+    unsigned long vbr_frames, vbr_bytes;
+    if(read_vbr_header(audio + pos, len - pos, &header, &vbr_frames, &vbr_bytes) != NULL)
+        pos += header.frame_size;
+
+    unsigned long long samples = 0, bytes = 0;
+    int last_bitrate = 0;
+    while(pos + MPEG_HEADER_SIZE <= len)
+    {
+        MpegHeader frame;
+        if(parse_mpeg_header(audio + pos, &frame) && same_stream(&info->first, &frame) &&
+           pos + frame.frame_size <= len)
+        {
+            if(last_bitrate != 0 && frame.bitrate != last_bitrate)
+                info->vbr = 1;
+            last_bitrate = frame.bitrate;
+            samples += frame.samples;
+            bytes += frame.frame_size;
+            info->frames++;
+            pos += frame.frame_size;
+            continue;
+        }
+
+        // Lost sync: skip to the next header that is followed by another one
+        size_t next = find_frame_sync(audio + pos + 1, len - pos - 1, &info->first, &frame);
+        info->skipped += next + 1;
+        pos += next + 1;
+    }
+    info->skipped += len - pos;
+    munmap(map, end);
+
+    if(info->frames == 0)
+        return e_failure;
+
+    info->source = "scan";
+    info->duration = (double)samples / info->first.sample_rate;
+    info->bitrate = (int)(bytes * 8.0 / info->duration / 1000.0 + 0.5);
+    return e_success;
+}
+
+/*
+ * The Xing/Info header follows the side information of a Layer III
+ * frame (17 or 32 bytes for MPEG-1, 9 or 17 for MPEG-2/2.5, by channel
+ * count): flags, then the frame count (flag 1) and byte count (flag 2).
+ * The VBRI header is always 32 bytes after the frame header: version,
+ * delay, quality, byte count, frame count.
+ */
+const char *read_vbr_header(const unsigned char *frame, size_t len, const MpegHeader *header, unsigned long *frames, unsigned long *bytes)
+{
+    size_t side = header->version == 10 ? (header->channels == 1 ? 17 : 32) : (header->channels == 1 ? 9 : 17);
+    size_t pos = MPEG_HEADER_SIZE + side;
+
+    *frames = *bytes = 0;
+    if(pos + 8 <= len && (memcmp(frame + pos, "Xing", 4) == 0 || memcmp(frame + pos, "Info", 4) == 0))
+    {
+        uint flags = decode_be32(frame + pos + 4);
+        size_t field = pos + 8;
+        if(flags & 1)
+        {
+            if(field + 4 > len)
+                return NULL;
+            *frames = decode_be32(frame + field);
+            field += 4;
+        }
+        if((flags & 2) && field + 4 <= len)
+            *bytes = decode_be32(frame + field);
+        return frame[pos] == 'X' ? "Xing" : "Info";
+    }
+
+    pos = MPEG_HEADER_SIZE + 32;
+    if(pos + 18 <= len && memcmp(frame + pos, "VBRI", 4) == 0)
+    {
+        *bytes = decode_be32(frame + pos + 10);
+        *frames = decode_be32(frame + pos + 14);
+        return "VBRI";
+    }
+    return NULL;
+}
+
+// Function to print the audio rows of the tag table (nothing when the audio was not read)
+void print_audio_info(FILE *out, const AudioInfo *info)
+{
+    static const char *const layers[] = { "I", "II", "III" };
+    char value[64];
+
+    if(info->source == NULL)
+        return;
+    if(info->frames == 0)
+    {
+        fprintf(out, "| %-15s:%6s%-50s|\n", "Audio", " ", "No MPEG audio frames found");
+        return;
+    }
+
+    long seconds = (long)(info->duration + 0.5);
+    snprintf(value, sizeof(value), "%ld:%02ld (%.2f s, %s)", seconds / 60, seconds % 60, info->duration, info->source);
+    fprintf(out, "| %-15s:%6s%-50s|\n", "Duration", " ", value);
+
+    snprintf(value, sizeof(value), "%d kbps %s", info->bitrate, info->vbr ? "VBR" : "CBR");
+    fprintf(out, "| %-15s:%6s%-50s|\n", "Bitrate", " ", value);
+
+    snprintf(value, sizeof(value), "MPEG-%s Layer %s, %d Hz, %s",
+             info->first.version == 10 ? "1" : info->first.version == 20 ? "2" : "2.5",
+             layers[info->first.layer - 1], info->first.sample_rate, info->first.channels == 1 ? "mono" : "stereo");
+    fprintf(out, "| %-15s:%6s%-50s|\n", "Audio", " ", value);
+
+    if(info->skipped > 0)
+    {
+        snprintf(value, sizeof(value), "%lld bytes not in any frame", (long long)info->skipped);
+        fprintf(out, "| %-15s:%6s%-50s|\n", "Skipped Data", " ", value);
+    }
+}
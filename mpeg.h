@@ -0,0 +1,117 @@
+/***********************************************************************
+ *  File Name   : mpeg.h
+ *  Description : Header file for the MPEG Audio Module.
+ *                Declares the frame header decoder and the reader that
+ *                finds the duration and bitrate of the audio after the
+ *                tag: from the Xing/Info or VBRI header of the first
+ *                frame, from the CBR formula, or by walking every frame.
+ *
+ *                Structures:
+ *                - MpegHeader
+ *                - AudioInfo
+ *
+ *                Functions:
+ *                - parse_audio_args()
+ *                - get_audio_mode()
+ *                - parse_mpeg_header()
+ *                - find_frame_sync()
+ *                - find_audio_range()
+ *                - audio_start()
+ *                - read_audio_info()
+ *                - probe_audio()
+ *                - probe_audio_data()
+ *                - scan_audio()
+ *                - read_vbr_header()
+ *                - print_audio_info()
+ *
+ ***********************************************************************/
+
+#ifndef MPEG_H
+#define MPEG_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "types.h"
+#include "id3.h"
+
+// Size of an MPEG audio frame header
+#define MPEG_HEADER_SIZE 4
+
+// Bytes read after the tag to find the first frame and its Xing/VBRI header
+#define AUDIO_PROBE_SIZE (64 * 1024)
+
+/*
+ * Enum representing how the audio after the tag is read (--audio)
+ * e_audio_off  → Not at all (default)
+ * e_audio_fast → First frame only: Xing/Info/VBRI header, else the CBR formula
+ * e_audio_scan → Every frame header, so VBR files without a header and corrupt files are measured exactly
+ */
+typedef enum
+{
+    e_audio_off,
+    e_audio_fast,
+    e_audio_scan
+} AudioMode;
+
+// One decoded frame header
+typedef struct MpegHeader
+{
+    int version;                // 10 = MPEG-1, 20 = MPEG-2, 25 = MPEG-2.5
+    int layer;                  // 1, 2 or 3
+    int bitrate;                // kbit/s
+    int sample_rate;            // Hz
+    int channels;               // 1 (mono) or 2
+    int samples;                // Samples per frame
+    int frame_size;             // Bytes, header and padding included
+} MpegHeader;
+
+// Duration and bitrate of the audio data
+typedef struct AudioInfo
+{
+    const char *source;         // Where the duration came from: "Xing", "Info", "VBRI", "CBR" or "scan" (NULL if not read)
+    MpegHeader first;           // Header of the first frame
+    int bitrate;                // Average bitrate in kbit/s
+    int vbr;                    // 1 if the bitrate changes between frames
+    unsigned long frames;       // Audio frames (estimated for CBR)
+    double duration;            // Seconds
+    off_t first_frame;          // File offset of the first frame
+    off_t skipped;              // Bytes that were not part of any frame (full scan only)
+} AudioInfo;
+
+// Function to take --audio / --audio=fast|scan out of argv
+Status parse_audio_args(int *argc, char **argv);
+
+// Function to get the mode selected with --audio
+AudioMode get_audio_mode(void);
+
+// Function to decode and validate the 4-byte frame header at p; returns 1 if it is one
+int parse_mpeg_header(const unsigned char *p, MpegHeader *header);
+
+// Function to find the first frame header in buf whose next frame also checks out (len if there is none)
+size_t find_frame_sync(const unsigned char *buf, size_t len, const MpegHeader *like, MpegHeader *header);
+
+// Function to find the audio data between the ID3v2 tag and the trailer tags; header is the ID3v2 header already read (NULL to read it)
+Status find_audio_range(int fd, const TagHeader *header, off_t *start, off_t *end);
+
+// Function to find where the audio starts after the ID3v2 tag with the given header (zeroed when there is none)
+off_t audio_start(const TagHeader *header);
+
+// Function to read the duration and bitrate of fd's audio; header is the ID3v2 header already read (NULL to read it)
+Status read_audio_info(int fd, const TagHeader *header, AudioMode mode, AudioInfo *info);
+
+// Function to measure the audio from the first frame (Xing/Info/VBRI header or CBR formula)
+Status probe_audio(int fd, off_t start, off_t end, AudioInfo *info);
+
+// Function to measure the audio from its first bytes, already read into buf
+Status probe_audio_data(const unsigned char *buf, size_t len, off_t start, off_t end, AudioInfo *info);
+
+// Function to measure the audio by walking every frame of a mapping of the file
+Status scan_audio(int fd, off_t start, off_t end, AudioInfo *info);
+
+// Function to read the frame count (and byte count) of a Xing/Info or VBRI header in the first frame
+const char *read_vbr_header(const unsigned char *frame, size_t len, const MpegHeader *header, unsigned long *frames, unsigned long *bytes);
+
+// Function to print the audio rows of the tag table
+void print_audio_info(FILE *out, const AudioInfo *info);
+
+#endif  // MPEG_H
@@ -0,0 +1,421 @@
+/***********************************************************************
+ *  File Name   : output.c
+ *  Description : Source file for the Output Format Module.
+ *                Records are built with plain memory appends into an
+ *                OutBuf (no stdio per field); escaping scans a value
+ *                once and copies the runs that need no escape in one
+ *                memcpy. The scan printer collects the finished,
+ *                in-order outputs of many files and writes them with
+ *                one writev().
+ *
+ *                Functions:
+ *                - parse_format_args()
+ *                - get_output_format()
+ *                - out_reserve()
+ *                - out_append()
+ *                - out_json_string()
+ *                - out_csv_field()
+ *                - out_tsv_field()
+ *                - format_header()
+ *                - format_tag_record()
+ *                - write_outputs()
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "frames.h"
+#include "stats.h"
+
+// Format given to every view (changed with --format)
+static OutputFormat output_format = e_format_table;
+
+// Length of the valid UTF-8 sequence at p (0 if the bytes there are not one)
+static size_t utf8_sequence(const unsigned char *p, size_t len)
+{
+    if(p[0] < 0x80)
+        return 1;
+
+    size_t need;
+    unsigned min;
+    unsigned code;
+    if((p[0] & 0xE0) == 0xC0)
+    {
+        need = 2;
+        min = 0x80;
+        code = p[0] & 0x1F;
+    }
+    else if((p[0] & 0xF0) == 0xE0)
+    {
+        need = 3;
+        min = 0x800;
+        code = p[0] & 0x0F;
+    }
+    else if((p[0] & 0xF8) == 0xF0)
+    {
+        need = 4;
+        min = 0x10000;
+        code = p[0] & 0x07;
+    }
+    else
+        return 0;
+
+    if(len < need)
+        return 0;
+    for(size_t i = 1; i < need; i++)
+    {
+        if((p[i] & 0xC0) != 0x80)
+            return 0;
+        code = (code << 6) | (p[i] & 0x3F);
+    }
+
+    // Overlong forms, surrogates and code points past U+10FFFF are not valid UTF-8
+    if(code < min || (code >= 0xD800 && code <= 0xDFFF) || code > 0x10FFFF)
+        return 0;
+    return need;
+}
+
+/*
+ * Accepts --format=table|ndjson|csv|tsv or --format <name> anywhere in argv
+ */
+Status parse_format_args(int *argc, char **argv)
+{
+    int out = 1;
+
+    for(int i = 1; i < *argc; i++)
+    {
+        const char *name = NULL;
+
+        if(strncmp(argv[i], "--format=", 9) == 0)
+            name = argv[i] + 9;
+        else if(strcmp(argv[i], "--format") == 0 && i + 1 < *argc)
+            name = argv[++i];
+        else
+        {
+            argv[out++] = argv[i];
+            continue;
+        }
+
+        if(strcmp(name, "table") == 0)
+            output_format = e_format_table;
+        else if(strcmp(name, "ndjson") == 0)
+            output_format = e_format_ndjson;
+        else if(strcmp(name, "csv") == 0)
+            output_format = e_format_csv;
+        else if(strcmp(name, "tsv") == 0)
+            output_format = e_format_tsv;
+        else
+        {
+            fprintf(stderr, "ERROR: Invalid format => %s (table, ndjson, csv or tsv)\n", name);
+            return e_failure;
+        }
+    }
+
+    argv[out] = NULL;
+    *argc = out;
+    return e_success;
+}
+
+// Function to get the format selected with --format
+OutputFormat get_output_format(void)
+{
+    return output_format;
+}
+
+// Function to grow the buffer (doubling) so len more bytes fit
+int out_reserve(OutBuf *out, size_t len)
+{
+    if(out->failed)
+        return 0;
+    if(out->size - out->len >= len)
+        return 1;
+
+    size_t size = out->size ? out->size : OUTBUF_INITIAL_SIZE;
+    while(size - out->len < len)
+        size *= 2;
+
+    char *grown = realloc(out->data, size);
+    if(grown == NULL)
+    {
+        out->failed = 1;
+        return 0;
+    }
+    STATS_ADD(allocs, 1);
+    out->data = grown;
+    out->size = size;
+    return 1;
+}
+
+// Function to append raw bytes
+void out_append(OutBuf *out, const char *data, size_t len)
+{
+    if(!out_reserve(out, len))
+        return;
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+}
+
+/*
+ * Quote, backslash and control characters are escaped; everything else
+ * (valid UTF-8 included) is copied as it is. Invalid bytes, which a
+ * broken tag can hold, are replaced so the line stays valid JSON.
+ */
+void out_json_string(OutBuf *out, const char *data, size_t len)
+{
+    const unsigned char *src = (const unsigned char *)data;
+    size_t run = 0;
+
+    // Worst case: every byte becomes \u00XX
+    if(!out_reserve(out, 6 * len + 2))
+        return;
+
+    out->data[out->len++] = '"';
+    for(size_t i = 0; i < len; )
+    {
+        size_t seq = utf8_sequence(src + i, len - i);
+        if(seq != 0 && src[i] >= 0x20 && src[i] != '"' && src[i] != '\\')
+        {
+            i += seq;
+            run += seq;
+            continue;
+        }
+
+        memcpy(out->data + out->len, src + i - run, run);
+        out->len += run;
+        run = 0;
+
+        char escape[8];
+        int n;
+        if(seq == 0)
+            n = snprintf(escape, sizeof(escape), "\\ufffd");
+        else if(src[i] == '"' || src[i] == '\\')
+            n = snprintf(escape, sizeof(escape), "\\%c", src[i]);
+        else if(src[i] == '\n')
+            n = snprintf(escape, sizeof(escape), "\\n");
+        else if(src[i] == '\t')
+            n = snprintf(escape, sizeof(escape), "\\t");
+        else if(src[i] == '\r')
+            n = snprintf(escape, sizeof(escape), "\\r");
+        else
+            n = snprintf(escape, sizeof(escape), "\\u%04x", src[i]);
+        memcpy(out->data + out->len, escape, n);
+        out->len += n;
+        i++;
+    }
+    memcpy(out->data + out->len, src + len - run, run);
+    out->len += run;
+    out->data[out->len++] = '"';
+}
+
+/*
+ * Copies a value for CSV or TSV (room already reserved): valid UTF-8 as
+ * it is and each invalid byte as U+FFFD. For TSV, tab, newline, CR and
+ * backslash become a backslash and a letter; for CSV a quote is doubled.
+ */
+static void out_text(OutBuf *out, const unsigned char *src, size_t len, int tsv)
+{
+    for(size_t i = 0; i < len; )
+    {
+        size_t seq = utf8_sequence(src + i, len - i);
+        if(seq == 0)
+        {
+            memcpy(out->data + out->len, "\xEF\xBF\xBD", 3);
+            out->len += 3;
+            i++;
+            continue;
+        }
+
+        char c = src[i];
+        char escaped = !tsv ? 0 : c == '\t' ? 't' : c == '\n' ? 'n' : c == '\r' ? 'r' : c == '\\' ? '\\' : 0;
+        if(escaped)
+        {
+            out->data[out->len++] = '\\';
+            out->data[out->len++] = escaped;
+        }
+        else if(!tsv && c == '"')
+        {
+            out->data[out->len++] = '"';
+            out->data[out->len++] = '"';
+        }
+        else
+        {
+            memcpy(out->data + out->len, src + i, seq);
+            out->len += seq;
+        }
+        i += seq;
+    }
+}
+
+// Function to append one CSV field (RFC 4180: quoted when needed, a quote is doubled)
+void out_csv_field(OutBuf *out, const char *data, size_t len)
+{
+    int quote = memchr(data, ',', len) || memchr(data, '"', len) || memchr(data, '\n', len) || memchr(data, '\r', len);
+
+    // Worst case: every byte is an invalid one, written as 3 bytes
+    if(!out_reserve(out, 3 * len + 2))
+        return;
+
+    if(quote)
+        out->data[out->len++] = '"';
+    out_text(out, (const unsigned char *)data, len, 0);
+    if(quote)
+        out->data[out->len++] = '"';
+}
+
+// Function to append one TSV field with the separators and the backslash escaped (\t \n \r \\)
+void out_tsv_field(OutBuf *out, const char *data, size_t len)
+{
+    if(!out_reserve(out, 3 * len))
+        return;
+    out_text(out, (const unsigned char *)data, len, 1);
+}
+
+// Function to append the column names of CSV and TSV
+void format_header(OutBuf *out, OutputFormat format)
+{
+    if(format == e_format_csv)
+        out_append(out, "path,frame,value\n", 17);
+    else if(format == e_format_tsv)
+        out_append(out, "path\tframe\tvalue\n", 17);
+}
+
+// Appends one CSV/TSV row
+static void format_row(OutBuf *out, OutputFormat format, const char *path, const char *name, const char *value, size_t len)
+{
+    if(format == e_format_csv)
+    {
+        out_csv_field(out, path, strlen(path));
+        out_append(out, ",", 1);
+        out_csv_field(out, name, strlen(name));
+        out_append(out, ",", 1);
+        out_csv_field(out, value, len);
+    }
+    else
+    {
+        out_tsv_field(out, path, strlen(path));
+        out_append(out, "\t", 1);
+        out_tsv_field(out, name, strlen(name));
+        out_append(out, "\t", 1);
+        out_tsv_field(out, value, len);
+    }
+    out_append(out, "\n", 1);
+}
+
+/*
+ * Frames that are not in the registry are left out, as in the table.
+ * NDJSON keeps binary frames as their size; CSV and TSV leave them out,
+ * so their rows can be fed back to -b. --audio and --hash add duration,
+ * bitrate and audio_hash (as extra rows for CSV and TSV).
+ */
+void format_tag_record(OutBuf *out, OutputFormat format, const TagInfo *tagInfo, const char *path)
+{
+    const AudioInfo *audio = &tagInfo->audio;
+    char number[64];
+    int n;
+
+    if(format == e_format_ndjson)
+    {
+        out_append(out, "{\"path\":", 8);
+        out_json_string(out, path, strlen(path));
+        out_append(out, ",\"frames\":[", 11);
+
+        for(int i = 0, written = 0; i < tagInfo->frame_count; i++)
+        {
+            const FrameDesc *desc = lookup_frame(pack_frame_id(tagInfo->frame_id[i]));
+            if(desc == NULL)
+                continue;
+
+            if(written++ > 0)
+                out_append(out, ",", 1);
+            out_append(out, "{\"id\":\"", 7);
+            out_append(out, tagInfo->frame_id[i], FRAME_ID_SIZE);
+            if(desc->kind == e_frame_binary)
+            {
+                n = snprintf(number, sizeof(number), "\",\"size\":%d}", tagInfo->frame_Size[i]);
+                out_append(out, number, n);
+            }
+            else
+            {
+                out_append(out, "\",\"value\":", 10);
+                out_json_string(out, tagInfo->frame_data[i], tagInfo->frame_Size[i]);
+                out_append(out, "}", 1);
+            }
+        }
+        out_append(out, "]", 1);
+
+        if(audio->source != NULL && audio->frames == 0)
+            out_append(out, ",\"duration\":null", 16);
+        else if(audio->source != NULL)
+        {
+            n = snprintf(number, sizeof(number), ",\"duration\":%.3f,\"bitrate\":%d,\"vbr\":%s",
+                         audio->duration, audio->bitrate, audio->vbr ? "true" : "false");
+            out_append(out, number, n);
+        }
+        if(tagInfo->hashed)
+        {
+            n = snprintf(number, sizeof(number), ",\"audio_hash\":\"%016llx\"", (unsigned long long)tagInfo->audio_hash);
+            out_append(out, number, n);
+        }
+        out_append(out, "}\n", 2);
+        return;
+    }
+
+    for(int i = 0; i < tagInfo->frame_count; i++)
+    {
+        const FrameDesc *desc = lookup_frame(pack_frame_id(tagInfo->frame_id[i]));
+        if(desc == NULL || desc->kind == e_frame_binary)
+            continue;
+        format_row(out, format, path, tagInfo->frame_id[i], tagInfo->frame_data[i], tagInfo->frame_Size[i]);
+    }
+
+    if(audio->source != NULL && audio->frames > 0)
+    {
+        n = snprintf(number, sizeof(number), "%.3f", audio->duration);
+        format_row(out, format, path, "duration", number, n);
+        n = snprintf(number, sizeof(number), "%d", audio->bitrate);
+        format_row(out, format, path, "bitrate", number, n);
+    }
+    if(tagInfo->hashed)
+    {
+        n = snprintf(number, sizeof(number), "%016llx", (unsigned long long)tagInfo->audio_hash);
+        format_row(out, format, path, "audio_hash", number, n);
+    }
+}
+
+/*
+ * writev() may stop early (a pipe that is nearly full, a signal), so the
+ * vectors are advanced past what was written and the call is repeated.
+ */
+Status write_outputs(int fd, struct iovec *iov, int count)
+{
+    while(count > 0)
+    {
+        ssize_t written = writev(fd, iov, count);
+        STATS_WRITE(written);
+        if(written == -1 && errno == EINTR)
+            continue;
+        if(written <= 0)
+        {
+            perror("writev");
+            return e_failure;
+        }
+
+        while(count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return e_success;
+}
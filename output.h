@@ -0,0 +1,101 @@
+/***********************************************************************
+ *  File Name   : output.h
+ *  Description : Header file for the Output Format Module.
+ *                Declares the machine-readable formats of -v
+ *                (--format=ndjson|csv|tsv), the growable buffer the
+ *                records are built in, the escapers, and the writev
+ *                helper that hands many buffers to the kernel at once.
+ *
+ *                NDJSON : one object per file
+ *                         {"path":…,"frames":[{"id":…,"value":…}|{"id":…,"size":N}…],
+ *                          "duration":…,"bitrate":…,"vbr":…,"audio_hash":…}
+ *                CSV    : path,frame,value rows (RFC 4180 quoting), the
+ *                         layout -b reads back
+ *                TSV    : path<TAB>frame<TAB>value rows, with \t \n \r \\
+ *                         escaped by a backslash
+ *
+ *                Structures:
+ *                - OutBuf
+ *
+ *                Functions:
+ *                - parse_format_args()
+ *                - get_output_format()
+ *                - out_reserve()
+ *                - out_append()
+ *                - out_json_string()
+ *                - out_csv_field()
+ *                - out_tsv_field()
+ *                - format_header()
+ *                - format_tag_record()
+ *                - write_outputs()
+ *
+ ***********************************************************************/
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <sys/uio.h>
+#include "types.h"
+#include "view.h"
+
+// Capacity an OutBuf starts with; a worker's buffer is reused for every file it formats
+#define OUTBUF_INITIAL_SIZE (64 * 1024)
+
+// Buffers handed to one writev() call
+#define OUTPUT_IOV_MAX 512
+
+/*
+ * Enum representing the output of -v (--format)
+ * e_format_table  → The fixed-width table (default)
+ * e_format_ndjson → One JSON object per file
+ * e_format_csv    → path,frame,value rows
+ * e_format_tsv    → path, frame and value separated by tabs
+ */
+typedef enum
+{
+    e_format_table,
+    e_format_ndjson,
+    e_format_csv,
+    e_format_tsv
+} OutputFormat;
+
+// Growable output buffer; failed is set (and appends stop) when memory runs out
+typedef struct OutBuf
+{
+    char *data;                     // Formatted bytes
+    size_t len;                     // Bytes used
+    size_t size;                    // Capacity of data
+    int failed;                     // 1 after an allocation failure
+} OutBuf;
+
+// Function to take --format=table|ndjson|csv|tsv out of argv
+Status parse_format_args(int *argc, char **argv);
+
+// Function to get the format selected with --format
+OutputFormat get_output_format(void);
+
+// Function to make room for len more bytes; returns 0 (and sets failed) if it cannot
+int out_reserve(OutBuf *out, size_t len);
+
+// Function to append raw bytes
+void out_append(OutBuf *out, const char *data, size_t len);
+
+// Function to append a JSON string literal (quotes included; invalid UTF-8 becomes U+FFFD)
+void out_json_string(OutBuf *out, const char *data, size_t len);
+
+// Function to append one CSV field, quoted when it holds a comma, quote, CR or LF
+void out_csv_field(OutBuf *out, const char *data, size_t len);
+
+// Function to append one TSV field with tab, newline, carriage return and backslash escaped
+void out_tsv_field(OutBuf *out, const char *data, size_t len);
+
+// Function to append the header line of the format (CSV/TSV column names; nothing for NDJSON)
+void format_header(OutBuf *out, OutputFormat format);
+
+// Function to append the record(s) of one file in the given format
+void format_tag_record(OutBuf *out, OutputFormat format, const TagInfo *tagInfo, const char *path);
+
+// Function to write every buffer of iov to fd with as few writev() calls as possible
+Status write_outputs(int fd, struct iovec *iov, int count);
+
+#endif  // OUTPUT_H
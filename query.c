@@ -0,0 +1,407 @@
+/***********************************************************************
+ *  File Name   : query.c
+ *  Description : Source file for the MP3 Frame Query Module.
+ *                A first pass reads only the frame headers (through a
+ *                small window that is refilled with pread when a header
+ *                lies past it) and records each frame's ID, offset,
+ *                size and flags. The data of a frame is read only when
+ *                its value is asked for, so large APIC or PRIV frames
+ *                are skipped without being read. An ID3v2.3 tag that is
+ *                unsynchronised as a whole has frame headers that only
+ *                line up after decoding, so that tag is read and decoded
+ *                in one piece; unsynchronised ID3v2.4 frames are decoded
+ *                one at a time when their value is read. Frames the
+ *                ID3v2 tag does not have are looked up in the APEv2 and
+ *                ID3v1 trailer, which costs one read of the file's end.
+ *
+ *                Functions:
+ *                - run_query()
+ *                - parse_query_frames()
+ *                - read_frame_directory()
+ *                - release_frame_directory()
+ *                - find_frame_entry()
+ *                - read_frame_value()
+ *                - print_query_result()
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "query.h"
+#include "text.h"
+#include "unsync.h"
+#include "trailer.h"
+
+// Tag bytes buffered while walking frame headers
+typedef struct QueryWindow
+{
+    int fd;                                   // File being read
+    off_t start;                              // File offset of buf[0]
+    size_t length;                            // Valid bytes in buf
+    unsigned char buf[QUERY_WINDOW_SIZE];     // Window contents
+} QueryWindow;
+
+// Returns a pointer to length bytes at offset, refilling the window with one pread when needed
+static const unsigned char *window_bytes(QueryWindow *window, off_t offset, size_t length)
+{
+    if(offset >= window->start && offset + (off_t)length <= window->start + (off_t)window->length)
+        return window->buf + (offset - window->start);
+
+    ssize_t got = pread(window->fd, window->buf, QUERY_WINDOW_SIZE, offset);
+    window->start = offset;
+    window->length = got > 0 ? (size_t)got : 0;
+    return window->length >= length ? window->buf : NULL;
+}
+
+/*
+ * Prints the requested frames of every file. With one file only the
+ * values are printed, one per line; with several files each file gets
+ * one line: the path followed by the values, separated by tabs.
+ */
+Status run_query(int argc, char **argv)
+{
+    uint32_t ids[MAX_FRAME_COUNT];
+    int id_count = 0;
+    Status status = e_success;
+
+    if(argc < 4)
+    {
+        fprintf(stderr, "To Query Frames  : %s -g <FRAMEID>[,<FRAMEID>...] <file_name.mp3> [more files...]\n", argv[0]);
+        return e_failure;
+    }
+
+    if(parse_query_frames(argv[2], ids, &id_count) == e_failure)
+        return e_failure;
+
+    for(int i = 3; i < argc; i++)
+    {
+        if(print_query_result(argv[i], ids, id_count, argc > 4) == e_failure)
+            status = e_failure;
+    }
+    return status;
+}
+
+// Accepts frame IDs (TPE1) or edit options (-a), separated by commas
+Status parse_query_frames(char *list, uint32_t *ids, int *count)
+{
+    char *save = NULL;
+
+    for(char *name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save))
+    {
+        const FrameDesc *desc = NULL;
+
+        if(name[0] == '-')
+            desc = lookup_frame_option(name);
+        else if(strlen(name) == FRAME_ID_SIZE)
+            desc = lookup_frame(pack_frame_id(name));
+
+        if(desc == NULL)
+        {
+            fprintf(stderr, "ERROR: Invalid frame => %s\n", name);
+            return e_failure;
+        }
+        if(*count == MAX_FRAME_COUNT)
+        {
+            fprintf(stderr, "ERROR: Too many frames in one query\n");
+            return e_failure;
+        }
+        ids[(*count)++] = desc->id;
+    }
+
+    if(*count == 0)
+    {
+        fprintf(stderr, "ERROR: No frames to query\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+// Returns the next free directory entry, doubling the directory when it is full (NULL when out of memory)
+static FrameDirEntry *add_frame_entry(FrameDir *dir)
+{
+    if(dir->frame_count == dir->frame_capacity)
+    {
+        int capacity = dir->frame_capacity ? dir->frame_capacity * 2 : QUERY_DIR_ENTRIES;
+        FrameDirEntry *frames = realloc(dir->frames, sizeof(FrameDirEntry) * capacity);
+        if(frames == NULL)
+            return NULL;
+        dir->frames = frames;
+        dir->frame_capacity = capacity;
+    }
+    return &dir->frames[dir->frame_count++];
+}
+
+/*
+ * Reads a whole unsynchronised ID3v2.3 tag, decodes it in memory and
+ * records the frames with offsets into the decoded block.
+ */
+static Status read_unsync_directory(int fd, FrameDir *dir)
+{
+    size_t end = HEADER_SIZE + (size_t)dir->header.tag_size;
+
+    dir->block = malloc(end);
+    if(dir->block == NULL)
+        return e_failure;
+
+    ssize_t got = pread(fd, dir->block, end, 0);
+    if(got < HEADER_SIZE)
+    {
+        release_frame_directory(dir);
+        return e_failure;
+    }
+    end = got;   // A truncated tag is walked as far as it goes
+    id3_resync(dir->block, end);
+
+    size_t pos = HEADER_SIZE;
+    if(dir->header.flags & TAG_FLAG_EXTENDED && pos + 4 <= end)
+        pos += decode_be32(dir->block + pos) + 4;
+
+    while(pos + FRAME_HEADER_SIZE <= end && dir->block[pos] != 0)
+    {
+        const unsigned char *bytes = dir->block + pos;
+        uint size = decode_be32(bytes + FRAME_ID_SIZE);
+        if(size > end - pos - FRAME_HEADER_SIZE)
+            break;
+
+        FrameDirEntry *entry = add_frame_entry(dir);
+        if(entry == NULL)
+        {
+            release_frame_directory(dir);
+            return e_failure;
+        }
+        entry->id = pack_frame_id((const char *)bytes);
+        entry->offset = pos + FRAME_HEADER_SIZE;
+        entry->size = size;
+        entry->flags = (bytes[8] << 8) | bytes[9];
+
+        pos += FRAME_HEADER_SIZE + size;
+    }
+    return e_success;
+}
+
+/*
+ * Reads the tag header and then only the 10-byte frame headers, skipping
+ * over the frame data. Parsing stops at the end of the tag, at the first
+ * padding byte, or at a frame that runs past the end of the tag. The
+ * directory grows with the tag, so every frame is listed; it must be
+ * freed with release_frame_directory() (a failed read frees it itself).
+ */
+Status read_frame_directory(int fd, FrameDir *dir)
+{
+    QueryWindow window;
+    const unsigned char *bytes;
+
+    window.fd = fd;
+    window.start = 0;
+    window.length = 0;
+    dir->frames = NULL;
+    dir->frame_count = 0;
+    dir->frame_capacity = 0;
+    dir->block = NULL;
+
+    bytes = window_bytes(&window, 0, HEADER_SIZE);
+    if(bytes == NULL || read_tag_header(bytes, &dir->header) == e_failure)
+        return e_failure;
+
+    off_t end = HEADER_SIZE + (off_t)dir->header.tag_size;
+    off_t pos = HEADER_SIZE;
+
+    if(dir->header.version < 4 && (dir->header.flags & TAG_FLAG_UNSYNC))
+        return read_unsync_directory(fd, dir);
+
+    // Skip the extended header (v2.3 size excludes itself, v2.4 size is syncsafe and includes itself)
+    if((dir->header.flags & TAG_FLAG_EXTENDED) && (bytes = window_bytes(&window, pos, 4)) != NULL)
+        pos += dir->header.version >= 4 ? decode_syncsafe(bytes) : decode_be32(bytes) + 4;
+
+    while(pos + FRAME_HEADER_SIZE <= end)
+    {
+        bytes = window_bytes(&window, pos, FRAME_HEADER_SIZE);
+        if(bytes == NULL || bytes[0] == 0)
+            break;   // Truncated file or start of the padding
+
+        uint size = decode_frame_size(bytes + FRAME_ID_SIZE, dir->header.version);
+        if(size > end - pos - FRAME_HEADER_SIZE)
+            break;   // Frame runs past the end of the tag
+
+        FrameDirEntry *entry = add_frame_entry(dir);
+        if(entry == NULL)
+        {
+            release_frame_directory(dir);
+            return e_failure;
+        }
+        entry->id = pack_frame_id((const char *)bytes);
+        entry->offset = pos + FRAME_HEADER_SIZE;
+        entry->size = size;
+        entry->flags = (bytes[8] << 8) | bytes[9];
+
+        pos += FRAME_HEADER_SIZE + size;
+    }
+    return e_success;
+}
+
+// Function to free the entries and the decoded block
+void release_frame_directory(FrameDir *dir)
+{
+    free(dir->frames);
+    free(dir->block);
+    dir->frames = NULL;
+    dir->frame_count = 0;
+    dir->frame_capacity = 0;
+    dir->block = NULL;
+}
+
+// Function to find the first frame with the given ID
+const FrameDirEntry *find_frame_entry(const FrameDir *dir, uint32_t id)
+{
+    for(int i = 0; i < dir->frame_count; i++)
+        if(dir->frames[i].id == id)
+            return &dir->frames[i];
+    return NULL;
+}
+
+/*
+ * Reads the data of one frame with a single pread and prints the value
+ * as UTF-8 (binary frames are printed by size, without reading their data).
+ * An unsynchronised ID3v2.4 frame is decoded after the read. A grouping
+ * identity or data length indicator in front of the data is skipped,
+ * with or without unsynchronisation.
+ */
+Status read_frame_value(int fd, const FrameDir *dir, const FrameDirEntry *entry, FILE *out)
+{
+    const FrameDesc *desc = lookup_frame(entry->id);
+    int prefix = id3_frame_prefix(dir->header.version, entry->flags & 0xFF);
+
+    if(desc == NULL || desc->kind == e_frame_binary)
+    {
+        fprintf(out, "<binary, %u bytes>", entry->size);
+        return e_success;
+    }
+    if(prefix < 0)
+    {
+        fprintf(out, "<compressed or encrypted, %u bytes>", entry->size);
+        return e_success;
+    }
+
+    unsigned char stack_buf[512];
+    unsigned char *buf = entry->size <= sizeof(stack_buf) ? stack_buf : NULL;
+    const unsigned char *data;
+    uint size = entry->size;
+
+    if(dir->block != NULL)
+        data = dir->block + entry->offset;    // Decoded with the whole tag
+    else
+    {
+        if(buf == NULL && (buf = malloc(entry->size)) == NULL)
+            return e_failure;
+        if(pread(fd, buf, entry->size, entry->offset) != (ssize_t)entry->size)
+        {
+            if(buf != stack_buf)
+                free(buf);
+            return e_failure;
+        }
+        data = buf;
+
+        if(dir->header.version >= 4 && ((entry->flags & FRAME_FLAG_UNSYNC) || (dir->header.flags & TAG_FLAG_UNSYNC)))
+            size = unsync_decode(buf, size);
+    }
+
+    if((uint)prefix <= size)
+    {
+        data += prefix;
+        size -= prefix;
+    }
+
+    Status status = e_failure;
+    uint offset = frame_text_offset(desc, data, size);
+    unsigned char encoding = frame_value_encoding(desc, data, size);
+    size_t length = text_view_length(encoding, data + offset, size - offset);
+
+    if(length != TEXT_NEEDS_DECODE)
+    {
+        fwrite(data + offset, 1, length, out);
+        status = e_success;
+    }
+    else
+    {
+        char *text = malloc(TEXT_DECODED_MAX(size - offset));
+        if(text != NULL)
+        {
+            fwrite(text, 1, decode_text(encoding, data + offset, size - offset, text), out);
+            free(text);
+            status = e_success;
+        }
+    }
+
+    if(buf != NULL && buf != stack_buf)
+        free(buf);
+    return status;
+}
+
+// Function to open one file, build its directory and print the requested values
+Status print_query_result(const char *path, const uint32_t *ids, int id_count, int with_path)
+{
+    FrameDir dir;
+    TagInfo trailer;    // Values from the ID3v1 / APEv2 trailer
+
+    int fd = open(path, O_RDONLY);
+    if(fd == -1)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", path);
+        return e_failure;
+    }
+
+    int has_tag = read_frame_directory(fd, &dir) == e_success;
+    if(!has_tag)
+        dir.frame_count = 0;
+
+    // The trailer is only read when a frame is missing from the ID3v2 tag
+    memset(&trailer, 0, sizeof(trailer));
+    for(int i = 0; i < id_count; i++)
+    {
+        if(find_frame_entry(&dir, ids[i]) == NULL)
+        {
+            if(read_trailer_tags(&trailer, fd))
+                has_tag = 1;
+            break;
+        }
+    }
+
+    if(!has_tag)
+    {
+        fprintf(stderr, "ERROR: No ID3 tag found in %s\n", path);
+        close(fd);
+        return e_failure;
+    }
+
+    Status status = e_success;
+    if(with_path)
+        fputs(path, stdout);
+
+    for(int i = 0; i < id_count; i++)
+    {
+        const FrameDirEntry *entry = find_frame_entry(&dir, ids[i]);
+        int from_trailer = entry == NULL ? find_tag_frame(&trailer, lookup_frame(ids[i])->name) : -1;
+
+        if(with_path)
+            fputc('\t', stdout);
+        if(entry != NULL && read_frame_value(fd, &dir, entry, stdout) == e_failure)
+            status = e_failure;
+        if(from_trailer >= 0)
+            fwrite(trailer.frame_data[from_trailer], 1, trailer.frame_Size[from_trailer], stdout);
+        if(!with_path)
+            fputc('\n', stdout);
+    }
+
+    if(with_path)
+        fputc('\n', stdout);
+
+    release_tag_text(&trailer);
+    release_frame_directory(&dir);
+    close(fd);
+    return status;
+}
@@ -0,0 +1,81 @@
+/***********************************************************************
+ *  File Name   : query.h
+ *  Description : Header file for the MP3 Frame Query Module.
+ *                Declares the frame directory (ID, offset, size and
+ *                flags of every frame, without the frame data) and the
+ *                functions used by the -g query, which reads only the
+ *                data of the frames that were asked for.
+ *
+ *                Structures:
+ *                - FrameDirEntry
+ *                - FrameDir
+ *
+ *                Functions:
+ *                - run_query()
+ *                - parse_query_frames()
+ *                - read_frame_directory()
+ *                - release_frame_directory()
+ *                - find_frame_entry()
+ *                - read_frame_value()
+ *                - print_query_result()
+ *
+ ***********************************************************************/
+
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "types.h"
+#include "id3.h"
+#include "frames.h"
+
+// Bytes of the tag read at a time while walking frame headers
+#define QUERY_WINDOW_SIZE 4096
+
+// Directory entries allocated for the first frames; the directory doubles when a tag has more
+#define QUERY_DIR_ENTRIES 32
+
+// One frame of the directory: where its data is, not the data itself
+typedef struct FrameDirEntry
+{
+    uint32_t id;                 // Packed frame ID
+    off_t offset;                // File offset of the frame data (after the 10-byte frame header), or offset in FrameDir.block
+    uint size;                   // Size of the frame data
+    uint flags;                  // The two frame flag bytes
+} FrameDirEntry;
+
+// Frame directory of one file
+typedef struct FrameDir
+{
+    TagHeader header;                       // Decoded ID3v2 header
+    FrameDirEntry *frames;                  // Frames in tag order (grows with the tag)
+    int frame_count;                        // Number of frames found
+    int frame_capacity;                     // Entries allocated in frames
+    unsigned char *block;                   // Decoded tag when it is unsynchronised as a whole (ID3v2.3), else NULL
+} FrameDir;
+
+// Function to run the query mode: -g <FRAMEID>[,<FRAMEID>...] <file.mp3> [more files...]
+Status run_query(int argc, char **argv);
+
+// Function to split the comma-separated frame list into packed frame IDs
+Status parse_query_frames(char *list, uint32_t *ids, int *count);
+
+// Function to walk the frame headers of a file and record where every frame is
+Status read_frame_directory(int fd, FrameDir *dir);
+
+// Function to free the directory entries and the decoded tag of an unsynchronised directory
+void release_frame_directory(FrameDir *dir);
+
+// Function to find a frame in the directory, NULL if the tag does not have it
+const FrameDirEntry *find_frame_entry(const FrameDir *dir, uint32_t id);
+
+// Function to read just one frame's data and print its value
+Status read_frame_value(int fd, const FrameDir *dir, const FrameDirEntry *entry, FILE *out);
+
+// Function to print the requested values of one file
+Status print_query_result(const char *path, const uint32_t *ids, int id_count, int with_path);
+
+#endif  // QUERY_H
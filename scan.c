@@ -0,0 +1,541 @@
+/***********************************************************************
+ *  File Name   : scan.c
+ *  Description : Source file for the MP3 Library Scan Module.
+ *                Expands directories into a sorted list of MP3 files
+ *                and views them on a work-stealing pool of threads
+ *                (one per core). Each file's table is formatted into
+ *                its own buffer and printed in list order, so the
+ *                output does not depend on thread timing.
+ *                With a tag index, unchanged files are answered from
+ *                the index and only new or modified files are parsed.
+ *                Without an index, the files are read through io_uring
+ *                (see uring.c) when the kernel supports it.
+ *
+ *                Functions:
+ *                - scan_paths()
+ *                - collect_scan_paths()
+ *                - add_scan_path()
+ *                - scan_directory()
+ *                - scan_worker()
+ *                - take_scan_job()
+ *                - finish_scan_job()
+ *                - scan_file()
+ *
+ ***********************************************************************/
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+
+#include "scan.h"
+#include "trailer.h"
+#include "uring.h"
+#include "stats.h"
+#include "hash.h"
+
+/*
+ * Views every MP3 file below the given paths. Jobs are dealt to the
+ * worker queues in chunks of SCAN_CHUNK; the calling thread prints the
+ * finished jobs strictly in order while the workers keep parsing.
+ */
+Status scan_paths(char **paths, int path_count, const char *index_fname)
+{
+    ScanPool pool;
+    TagIndex index;
+    UringRing ring;
+    char **list = NULL;
+    int count = 0;
+
+    if(collect_scan_paths(paths, path_count, &list, &count) == e_failure)
+        return e_failure;
+
+    if(count == 0)
+    {
+        fprintf(stderr, "ERROR: No .mp3 files found\n");
+        free(list);
+        return e_failure;
+    }
+
+    pool.index = NULL;
+    if(index_fname != NULL)
+    {
+        if(open_tag_index(&index, index_fname) == e_failure)
+        {
+            for(int i = 0; i < count; i++)
+                free(list[i]);
+            free(list);
+            return e_failure;
+        }
+        pool.index = &index;
+    }
+
+    // One io_uring thread keeps many files in flight; the index path stays on the thread pool.
+    pool.ring = NULL;
+    // A full audio scan or hash reads whole files, which would stall the ring thread, so it stays on the pool too
+    if(pool.index == NULL && count > 1 && get_audio_mode() != e_audio_scan && !get_hash_mode() && uring_open(&ring, URING_DEPTH) == e_success)
+        pool.ring = &ring;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    pool.worker_count = cores < 1 ? 1 : (cores > count ? count : (int)cores);
+    if(pool.ring != NULL)
+        pool.worker_count = 1;
+    pool.job_count = count;
+    pool.jobs = calloc(count, sizeof(ScanJob));
+    pool.queues = calloc(pool.worker_count, sizeof(WorkQueue));
+    pthread_t *threads = calloc(pool.worker_count, sizeof(pthread_t));
+    ScanWorker *workers = calloc(pool.worker_count, sizeof(ScanWorker));
+    int queues_ok = pool.queues != NULL;
+    for(int w = 0; queues_ok && w < pool.worker_count; w++)
+        queues_ok = (pool.queues[w].jobs = malloc(sizeof(int) * count)) != NULL;
+    if(pool.jobs == NULL || !queues_ok || threads == NULL || workers == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        for(int w = 0; pool.queues != NULL && w < pool.worker_count; w++)
+            free(pool.queues[w].jobs);
+        if(pool.index != NULL)
+            close_tag_index(pool.index);
+        if(pool.ring != NULL)
+            uring_close(pool.ring);
+        for(int i = 0; i < count; i++)
+            free(list[i]);
+        free(threads);
+        free(workers);
+        free(pool.queues);
+        free(pool.jobs);
+        free(list);
+        return e_failure;
+    }
+    pthread_mutex_init(&pool.done_lock, NULL);
+    pthread_cond_init(&pool.done_cond, NULL);
+
+    for(int i = 0; i < count; i++)
+        pool.jobs[i].path = list[i];
+
+    // Deal chunks round-robin so every worker starts near the front of the list
+    for(int w = 0; w < pool.worker_count; w++)
+    {
+        pthread_mutex_init(&pool.queues[w].lock, NULL);
+        pool.queues[w].head = pool.queues[w].tail = 0;
+    }
+    for(int i = 0; i < count; i++)
+    {
+        WorkQueue *queue = &pool.queues[(i / SCAN_CHUNK) % pool.worker_count];
+        queue->jobs[queue->tail++] = i;
+    }
+
+    // Workers steal from every queue, so the queue of a worker that did not start is still emptied
+    int started = 0;
+    for(int w = 0; w < pool.worker_count; w++)
+    {
+        workers[w].pool = &pool;
+        workers[w].index = w;
+        int error = pool.ring != NULL ? pthread_create(&threads[w], NULL, uring_scan_worker, &pool)
+                                      : pthread_create(&threads[w], NULL, scan_worker, &workers[w]);
+        if(error != 0)
+            break;
+        started++;
+    }
+
+    // Without any thread the calling thread does the work before printing it
+    if(started == 0)
+    {
+        fprintf(stderr, "WARNING: Unable to start scan threads, scanning on the main thread\n");
+        if(pool.ring != NULL)
+            uring_scan_worker(&pool);
+        else
+            scan_worker(&workers[0]);
+    }
+
+    // CSV and TSV start with their column names
+    Status status = e_success;
+    OutBuf header = { 0 };
+    format_header(&header, get_output_format());
+    if(header.len > 0)
+    {
+        fflush(stdout);
+        struct iovec iov = { header.data, header.len };
+        status = write_outputs(STDOUT_FILENO, &iov, 1);
+    }
+    free(header.data);
+
+    // Stream the results out in list order: finished jobs are written together, and only
+    // when the next job is not done yet (or OUTPUT_IOV_MAX are waiting)
+    int record_count = 0;
+    int unwritten = 0;
+    for(int i = 0; i < count; i++)
+    {
+        ScanJob *job = &pool.jobs[i];
+
+        pthread_mutex_lock(&pool.done_lock);
+        if(!job->done && unwritten < i)
+        {
+            pthread_mutex_unlock(&pool.done_lock);
+            if(flush_scan_output(&pool, unwritten, i) == e_failure)
+                status = e_failure;
+            unwritten = i;
+            pthread_mutex_lock(&pool.done_lock);
+        }
+        while(!job->done)
+            pthread_cond_wait(&pool.done_cond, &pool.done_lock);
+        pthread_mutex_unlock(&pool.done_lock);
+
+        if(job->status == e_failure)
+            status = e_failure;
+        free(job->path);
+
+        if(i + 1 - unwritten == OUTPUT_IOV_MAX)
+        {
+            if(flush_scan_output(&pool, unwritten, i + 1) == e_failure)
+                status = e_failure;
+            unwritten = i + 1;
+        }
+
+        // Collect fresh records at the front of the list for the index writer
+        if(job->record != NULL)
+            list[record_count++] = job->record;
+    }
+
+    if(flush_scan_output(&pool, unwritten, count) == e_failure)
+        status = e_failure;
+
+    // Workers may still be probing each other's queues until they have all exited
+    for(int w = 0; w < started; w++)
+        pthread_join(threads[w], NULL);
+    for(int w = 0; w < pool.worker_count; w++)
+        free(workers[w].out.data);
+
+    for(int w = 0; w < pool.worker_count; w++)
+    {
+        pthread_mutex_destroy(&pool.queues[w].lock);
+        free(pool.queues[w].jobs);
+    }
+    // Files that had to be parsed change the index, and so do entries of files that were deleted
+    if(pool.index != NULL)
+    {
+        if(write_tag_index(pool.index, list, record_count, paths, path_count) == e_failure)
+            status = e_failure;
+        for(int i = 0; i < record_count; i++)
+            free(list[i]);
+        close_tag_index(pool.index);
+    }
+
+    if(pool.ring != NULL)
+        uring_close(pool.ring);
+    pthread_mutex_destroy(&pool.done_lock);
+    pthread_cond_destroy(&pool.done_cond);
+    free(threads);
+    free(workers);
+    free(pool.queues);
+    free(pool.jobs);
+    free(list);
+    return status;
+}
+
+// Function to expand every argument (file or directory) into the list of MP3 files
+Status collect_scan_paths(char **paths, int path_count, char ***list, int *count)
+{
+    int capacity = 0;
+    struct stat st;
+
+    for(int i = 0; i < path_count; i++)
+    {
+        if(stat(paths[i], &st) == -1)
+        {
+            perror(paths[i]);
+            return e_failure;
+        }
+
+        if(S_ISDIR(st.st_mode))
+        {
+            if(scan_directory(paths[i], list, count, &capacity) == e_failure)
+                return e_failure;
+        }
+        else if(strlen(paths[i]) >= 4 && strcmp(paths[i] + strlen(paths[i]) - 4, ".mp3") == 0)
+        {
+            if(add_scan_path(list, count, &capacity, paths[i]) == e_failure)
+                return e_failure;
+        }
+        else
+        {
+            fprintf(stderr, "File should be .mp3 file: %s\n", paths[i]);
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+// Function to append a copy of the path to the growing list
+Status add_scan_path(char ***list, int *count, int *capacity, const char *path)
+{
+    if(*count == *capacity)
+    {
+        int new_capacity = *capacity ? *capacity * 2 : 256;
+        char **grown = realloc(*list, sizeof(char *) * new_capacity);
+        if(grown == NULL)
+            return e_failure;
+        *list = grown;
+        *capacity = new_capacity;
+    }
+
+    (*list)[*count] = strdup(path);
+    if((*list)[*count] == NULL)
+        return e_failure;
+    (*count)++;
+    return e_success;
+}
+
+// Function to walk a directory tree in sorted name order (symlinked directories are not followed)
+Status scan_directory(const char *dir, char ***list, int *count, int *capacity)
+{
+    struct dirent **names;
+    int entries = scandir(dir, &names, NULL, alphasort);
+    if(entries == -1)
+    {
+        perror(dir);
+        return e_failure;
+    }
+
+    Status status = e_success;
+    for(int i = 0; i < entries; i++)
+    {
+        const char *name = names[i]->d_name;
+        size_t length = strlen(name);
+        int is_dir = names[i]->d_type == DT_DIR;
+        int is_file = names[i]->d_type == DT_REG || names[i]->d_type == DT_LNK;
+
+        if(status == e_failure || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        {
+            free(names[i]);
+            continue;
+        }
+
+        char *path = malloc(strlen(dir) + length + 2);
+        if(path == NULL)
+        {
+            status = e_failure;
+            free(names[i]);
+            continue;
+        }
+        sprintf(path, "%s/%s", dir, name);
+
+        // Some filesystems do not fill in d_type
+        if(names[i]->d_type == DT_UNKNOWN)
+        {
+            struct stat st;
+            if(lstat(path, &st) == 0)
+            {
+                is_dir = S_ISDIR(st.st_mode);
+                is_file = S_ISREG(st.st_mode) || S_ISLNK(st.st_mode);
+            }
+        }
+
+        if(is_dir)
+            status = scan_directory(path, list, count, capacity);
+        else if(is_file && length >= 4 && strcmp(name + length - 4, ".mp3") == 0)
+            status = add_scan_path(list, count, capacity, path);
+
+        free(path);
+        free(names[i]);
+    }
+    free(names);
+    return status;
+}
+
+// Thread entry point: view files until no queue has work left
+void *scan_worker(void *arg)
+{
+    ScanWorker *worker = arg;
+    ScanPool *pool = worker->pool;
+    int job;
+
+    while((job = take_scan_job(pool, worker->index)) != -1)
+    {
+        scan_file(pool, &pool->jobs[job], &worker->out);
+        finish_scan_job(pool, job);
+    }
+    return NULL;
+}
+
+/*
+ * Takes the lowest job from the worker's own queue. When that queue is
+ * empty, steals the highest job from the next non-empty queue.
+ * Returns -1 once every queue is empty.
+ */
+int take_scan_job(ScanPool *pool, int worker)
+{
+    WorkQueue *own = &pool->queues[worker];
+    int job = -1;
+
+    pthread_mutex_lock(&own->lock);
+    if(own->head < own->tail)
+        job = own->jobs[own->head++];
+    pthread_mutex_unlock(&own->lock);
+    if(job != -1)
+        return job;
+
+    for(int i = 1; i < pool->worker_count && job == -1; i++)
+    {
+        WorkQueue *victim = &pool->queues[(worker + i) % pool->worker_count];
+
+        pthread_mutex_lock(&victim->lock);
+        if(victim->head < victim->tail)
+            job = victim->jobs[--victim->tail];
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return job;
+}
+
+// Function to publish a finished job to the thread printing the results
+void finish_scan_job(ScanPool *pool, int job)
+{
+    pthread_mutex_lock(&pool->done_lock);
+    pool->jobs[job].done = 1;
+    pthread_cond_broadcast(&pool->done_cond);
+    pthread_mutex_unlock(&pool->done_lock);
+}
+
+/*
+ * Views one file, formatting the table (or records) into the job's
+ * memory buffer. An index entry that still matches the file's inode,
+ * size and mtime is printed directly; otherwise the file is parsed and
+ * a new record is produced for the index.
+ */
+void scan_file(ScanPool *pool, ScanJob *job, OutBuf *out)
+{
+    TagInfo tagInfo;
+    struct stat st;
+
+    memset(&tagInfo, 0, sizeof(tagInfo));
+    tagInfo.src_mp3_fname = job->path;
+    if(open_scan_output(job, &tagInfo) == e_failure)
+    {
+        job->status = e_failure;
+        return;
+    }
+
+    if(pool->index != NULL && stat(job->path, &st) == 0)
+    {
+        const IndexEntry *entry = lookup_tag_index(pool->index, job->path, &st);
+        if(entry != NULL)
+        {
+            mark_index_entry(pool->index, entry);
+            load_index_entry(entry, &tagInfo);
+
+            // The index keeps the audio hash but not the duration; anything missing is read from the file
+            int need_file = get_audio_mode() != e_audio_off || (get_hash_mode() && !tagInfo.hashed);
+            FILE *fptr = need_file ? fopen(job->path, "rb") : NULL;
+            if(fptr != NULL)
+            {
+                measure_audio(&tagInfo, fileno(fptr), NULL);
+                fclose(fptr);
+            }
+            job->status = e_success;
+            print_scan_output(job, &tagInfo, out);
+            release_tag_text(&tagInfo);
+            if(tagInfo.fptr_out != NULL)
+                fclose(tagInfo.fptr_out);
+            return;
+        }
+    }
+
+    job->status = open_files(&tagInfo);
+    if(job->status == e_success)
+    {
+        job->status = read_tag_info(&tagInfo);
+        if(job->status == e_success)
+        {
+            long long start = STATS_START();
+            print_scan_output(job, &tagInfo, out);
+            STATS_PHASE(e_phase_output, start);
+
+            // Stat through the open descriptor so the record matches what was parsed
+            size_t record_len;
+            if(pool->index != NULL && fstat(fileno(tagInfo.fptr_src_mp3), &st) == 0)
+                build_index_record(&tagInfo, job->path, &st, &job->record, &record_len);
+            release_tag_block(&tagInfo);
+        }
+        fclose(tagInfo.fptr_src_mp3);
+    }
+
+    if(tagInfo.fptr_out != NULL)
+        fclose(tagInfo.fptr_out);
+}
+
+// Function to open the memory stream the table is printed to, headed by the file name (the other formats need none)
+Status open_scan_output(ScanJob *job, TagInfo *tagInfo)
+{
+    tagInfo->fptr_out = NULL;
+    if(get_output_format() != e_format_table)
+        return e_success;
+
+    tagInfo->fptr_out = open_memstream(&job->output, &job->output_len);
+    if(tagInfo->fptr_out == NULL)
+        return e_failure;
+    fprintf(tagInfo->fptr_out, "File: %s\n", job->path);
+    return e_success;
+}
+
+/*
+ * The table goes through the job's memory stream. The other formats are
+ * built in the thread's reusable buffer and copied out once, so a file
+ * costs one allocation of exactly its output size.
+ */
+void print_scan_output(ScanJob *job, TagInfo *tagInfo, OutBuf *out)
+{
+    if(tagInfo->fptr_out != NULL)
+    {
+        print_tag(tagInfo);
+        return;
+    }
+
+    out->len = 0;
+    format_tag_record(out, get_output_format(), tagInfo, job->path);
+    job->output = out->failed ? NULL : malloc(out->len);
+    if(job->output == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory formatting %s\n", job->path);
+        out->failed = 0;
+        job->status = e_failure;
+        return;
+    }
+    STATS_ADD(allocs, 1);
+    memcpy(job->output, out->data, out->len);
+    job->output_len = out->len;
+}
+
+/*
+ * Hands the finished outputs to the kernel OUTPUT_IOV_MAX at a time, so
+ * a long run of small records costs a few writev() calls rather than one
+ * write per file.
+ */
+Status flush_scan_output(ScanPool *pool, int from, int to)
+{
+    struct iovec iov[OUTPUT_IOV_MAX];
+    Status status = e_success;
+    int count = 0;
+
+    for(int i = from; i < to; i++)
+    {
+        ScanJob *job = &pool->jobs[i];
+        if(job->output_len > 0)
+        {
+            iov[count].iov_base = job->output;
+            iov[count].iov_len = job->output_len;
+            count++;
+        }
+
+        if(count == OUTPUT_IOV_MAX || (i == to - 1 && count > 0))
+        {
+            if(write_outputs(STDOUT_FILENO, iov, count) == e_failure)
+                status = e_failure;
+            count = 0;
+        }
+    }
+
+    for(int i = from; i < to; i++)
+    {
+        free(pool->jobs[i].output);
+        pool->jobs[i].output = NULL;
+    }
+    return status;
+}
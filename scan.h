@@ -0,0 +1,117 @@
+/***********************************************************************
+ *  File Name   : scan.h
+ *  Description : Header file for the MP3 Library Scan Module.
+ *                Declares structures and function prototypes used to
+ *                view the tags of many files (directories and multiple
+ *                path arguments) with a pool of worker threads, or
+ *                with one io_uring thread where the kernel allows it.
+ *
+ *                Structures:
+ *                - ScanJob
+ *                - WorkQueue
+ *                - ScanPool
+ *                - ScanWorker
+ *
+ *                Functions:
+ *                - scan_paths()
+ *                - collect_scan_paths()
+ *                - add_scan_path()
+ *                - scan_directory()
+ *                - scan_worker()
+ *                - take_scan_job()
+ *                - finish_scan_job()
+ *                - scan_file()
+ *                - open_scan_output()
+ *                - print_scan_output()
+ *                - flush_scan_output()
+ *
+ ***********************************************************************/
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <pthread.h>
+
+#include "view.h"
+#include "types.h"
+#include "index.h"
+#include "output.h"
+
+// Number of consecutive files handed to the same worker when the queues are seeded
+#define SCAN_CHUNK 16
+
+// One file to be viewed and the buffered output produced for it
+typedef struct ScanJob
+{
+    char *path;                 // Path of the MP3 file
+    char *output;               // Formatted tag table or records (filled by the worker)
+    size_t output_len;          // Length of the formatted output
+    Status status;              // Result of viewing the file
+    int done;                   // Set once the worker has finished the job
+    char *record;               // Freshly parsed frames for the tag index (NULL on an index hit)
+} ScanJob;
+
+// Per-worker double-ended queue of job indices
+typedef struct WorkQueue
+{
+    pthread_mutex_t lock;       // Protects head and tail
+    int *jobs;                  // Job indices owned by this worker
+    int head;                   // Next job the owner takes (lowest index first)
+    int tail;                   // One past the last job; thieves take from here
+} WorkQueue;
+
+// Shared state of one scan run
+typedef struct ScanPool
+{
+    ScanJob *jobs;              // All files in output order
+    int job_count;              // Number of files
+    WorkQueue *queues;          // One queue per worker
+    int worker_count;           // Number of worker threads
+    pthread_mutex_t done_lock;  // Protects ScanJob.done
+    pthread_cond_t done_cond;   // Signalled whenever a job finishes
+    TagIndex *index;            // Persistent tag index (NULL when not used)
+    struct UringRing *ring;     // io_uring used instead of the workers (NULL for the thread pool)
+} ScanPool;
+
+// Argument passed to each worker thread
+typedef struct ScanWorker
+{
+    ScanPool *pool;             // Shared scan state
+    int index;                  // Index of this worker's own queue
+    OutBuf out;                 // Records are formatted here (--format), reused for every file
+} ScanWorker;
+
+// Function to view the tags of every MP3 file under the given paths, printed in a deterministic order
+Status scan_paths(char **paths, int path_count, const char *index_fname);
+
+// Function to expand files and directories into a sorted list of MP3 paths
+Status collect_scan_paths(char **paths, int path_count, char ***list, int *count);
+
+// Function to append one path to the list
+Status add_scan_path(char ***list, int *count, int *capacity, const char *path);
+
+// Function to recursively collect MP3 files below a directory in name order
+Status scan_directory(const char *dir, char ***list, int *count, int *capacity);
+
+// Thread entry point for a scan worker
+void *scan_worker(void *arg);
+
+// Function to take the next job from the worker's own queue or steal one from another worker
+int take_scan_job(ScanPool *pool, int worker);
+
+// Function to mark a job finished and wake the printing thread
+void finish_scan_job(ScanPool *pool, int job);
+
+// Function to view one file into the job's output buffer, using the tag index when it is still valid
+void scan_file(ScanPool *pool, ScanJob *job, OutBuf *out);
+
+// Function to start the job's output: a memory stream with the file name for the table, nothing for the other formats
+Status open_scan_output(ScanJob *job, TagInfo *tagInfo);
+
+// Function to format a parsed file into the job's output in the selected format
+void print_scan_output(ScanJob *job, TagInfo *tagInfo, OutBuf *out);
+
+// Function to write the outputs of jobs [from, to) to stdout with writev and free them
+Status flush_scan_output(ScanPool *pool, int from, int to);
+
+#endif  // SCAN_H
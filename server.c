@@ -0,0 +1,1244 @@
+/***********************************************************************
+ *  File Name   : server.c
+ *  Description : Source file for the Tag Daemon Module.
+ *                One thread runs an epoll loop over the listening
+ *                socket, every connection, an eventfd the workers signal
+ *                and a signalfd for SIGINT/SIGTERM. It only moves bytes:
+ *                complete request lines are queued for a pool of worker
+ *                threads, which do all file I/O and build the reply.
+ *                Each connection has at most one request with a worker,
+ *                so replies go out in request order; pipelined requests
+ *                wait in the connection's input buffer.
+ *
+ *                Parsed files are kept in an LRU cache as tag index
+ *                records (build_index_record()), checked against a fresh
+ *                stat() of the path on every request: a changed inode,
+ *                size or mtime reparses the file. Parsing takes a shared
+ *                flock(), so it never sees an edit (which holds the
+ *                exclusive lock) half written, and SET drops the entry
+ *                it edited.
+ *
+ *                Functions:
+ *                - run_server()
+ *                - read_and_validate_server_args()
+ *                - open_server_socket()
+ *                - server_loop()
+ *                - server_worker()
+ *                - serve_request()
+ *                - serve_get()
+ *                - serve_set()
+ *                - load_cache_entry()
+ *                - cache_lookup()
+ *                - cache_insert()
+ *                - cache_release()
+ *                - cache_invalidate()
+ *                - run_client()
+ *
+ ***********************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "index.h"
+#include "edit.h"
+#include "frames.h"
+
+// Bytes moved per read in the client
+#define CLIENT_BUFFER_SIZE (64 * 1024)
+
+// Function to append an ERR line
+static void reply_error(OutBuf *reply, const char *message, const char *detail)
+{
+    reply->len = 0;
+    out_append(reply, "ERR\t", 4);
+    out_append(reply, message, strlen(message));
+    if(detail != NULL)
+    {
+        out_append(reply, " ", 1);
+        out_tsv_field(reply, detail, strlen(detail));
+    }
+    out_append(reply, "\n", 1);
+}
+
+// Function to undo the \t \n \r \\ escapes of a field in place
+static void unescape_field(char *field)
+{
+    char *out = field;
+
+    for(char *in = field; *in; in++)
+    {
+        if(*in == '\\' && in[1] != '\0')
+        {
+            in++;
+            *out++ = *in == 't' ? '\t' : *in == 'n' ? '\n' : *in == 'r' ? '\r' : *in;
+        }
+        else
+            *out++ = *in;
+    }
+    *out = '\0';
+}
+
+// Function to split a request line on tabs; returns the field count, -1 if there are more than max
+static int split_request(char *line, char **fields, int max)
+{
+    int count = 0;
+
+    for(char *pos = line; ; )
+    {
+        if(count == max)
+            return -1;
+
+        char *tab = strchr(pos, '\t');
+        if(tab != NULL)
+            *tab = '\0';
+        fields[count] = pos;
+        unescape_field(fields[count++]);
+        if(tab == NULL)
+            return count;
+        pos = tab + 1;
+    }
+}
+
+// Function to add one fd to the epoll set, tagged with ptr
+static Status watch_fd(Server *server, int fd, void *ptr, uint32_t events)
+{
+    struct epoll_event event;
+
+    event.events = events;
+    event.data.ptr = ptr;
+    if(epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+        perror("epoll_ctl");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/*
+ * Sets up the fds and the workers, runs the loop and tears everything
+ * down again. SIGINT and SIGTERM are blocked before any thread starts,
+ * so they only ever arrive through the signalfd.
+ */
+Status run_server(int argc, char **argv)
+{
+    Server server;
+    sigset_t signals;
+
+    if(read_and_validate_server_args(argc, argv, &server) == e_failure)
+        return e_failure;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    server.signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    server.done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    server.cache.bucket_count = 16;
+    while(server.cache.bucket_count < (uint32_t)server.cache.capacity)
+        server.cache.bucket_count <<= 1;
+    server.cache.buckets = calloc(server.cache.bucket_count, sizeof(CacheEntry *));
+
+    pthread_t *threads = malloc(sizeof(pthread_t) * server.worker_count);
+    Status status = e_failure;
+
+    if(server.signal_fd == -1 || server.done_fd == -1 || server.epoll_fd == -1)
+        perror("server");
+    else if(server.cache.buckets != NULL && threads != NULL && open_server_socket(&server) == e_success)
+    {
+        pthread_mutex_init(&server.cache.lock, NULL);
+        pthread_mutex_init(&server.lock, NULL);
+        pthread_cond_init(&server.work_cond, NULL);
+
+        int started = 0;
+        while(started < server.worker_count && pthread_create(&threads[started], NULL, server_worker, &server) == 0)
+            started++;
+
+        if(started > 0)
+        {
+            fprintf(stderr, "INFO: Listening on %s (%d worker%s, cache of %d files)\n",
+                    server.socket_path, started, started == 1 ? "" : "s", server.cache.capacity);
+            status = server_loop(&server);
+        }
+
+        pthread_mutex_lock(&server.lock);
+        server.stopping = 1;
+        pthread_cond_broadcast(&server.work_cond);
+        pthread_mutex_unlock(&server.lock);
+        for(int i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+
+        // Connections still open (queued requests included) go with the daemon
+        while(server.clients != NULL)
+        {
+            ServerClient *client = server.clients;
+            server.clients = client->client_next;
+            if(client->fd >= 0)
+                close(client->fd);
+            free(client->in);
+            free(client->out.data);
+            free(client->request);
+            free(client->reply.data);
+            free(client);
+        }
+        while(server.cache.lru_head != NULL)
+        {
+            CacheEntry *entry = server.cache.lru_head;
+            server.cache.lru_head = entry->lru_next;
+            free(entry->record);
+            free(entry);
+        }
+
+        pthread_cond_destroy(&server.work_cond);
+        pthread_mutex_destroy(&server.lock);
+        pthread_mutex_destroy(&server.cache.lock);
+        close(server.listen_fd);
+        unlink(server.socket_path);
+        fprintf(stderr, "INFO: Stopped (%lu cache hits, %lu misses)\n", server.cache.hits, server.cache.misses);
+    }
+
+    free(threads);
+    free(server.cache.buckets);
+    if(server.signal_fd >= 0)
+        close(server.signal_fd);
+    if(server.done_fd >= 0)
+        close(server.done_fd);
+    if(server.epoll_fd >= 0)
+        close(server.epoll_fd);
+    return status;
+}
+
+// Function to read the socket path and the optional --workers / --cache values
+Status read_and_validate_server_args(int argc, char **argv, Server *server)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(server, 0, sizeof(*server));
+    server->listen_fd = -1;
+    server->worker_count = cores < 1 ? 1 : (int)cores;
+    server->cache.capacity = SERVER_CACHE_ENTRIES;
+
+    if(argc < 3)
+    {
+        fprintf(stderr, "ERROR: Missing socket. Usage: %s -d <socket> [--workers N] [--cache ENTRIES]\n", argv[0]);
+        return e_failure;
+    }
+    server->socket_path = argv[2];
+
+    for(int i = 3; i < argc; i += 2)
+    {
+        if(i + 1 >= argc)
+        {
+            fprintf(stderr, "ERROR: Missing value for %s\n", argv[i]);
+            return e_failure;
+        }
+
+        if(strcmp(argv[i], "--workers") == 0)
+        {
+            server->worker_count = atoi(argv[i + 1]);
+            if(server->worker_count < 1)
+            {
+                fprintf(stderr, "ERROR: --workers must be at least 1\n");
+                return e_failure;
+            }
+        }
+        else if(strcmp(argv[i], "--cache") == 0)
+        {
+            server->cache.capacity = atoi(argv[i + 1]);
+            if(server->cache.capacity < 1)
+            {
+                fprintf(stderr, "ERROR: --cache must be at least 1\n");
+                return e_failure;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Unknown option %s\n", argv[i]);
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+// Function to check whether a daemon still accepts connections on the socket file
+static int socket_in_use(const struct sockaddr_un *addr)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int in_use = fd >= 0 && connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0;
+
+    if(fd >= 0)
+        close(fd);
+    return in_use;
+}
+
+/*
+ * A socket file left behind by a daemon that was killed makes bind()
+ * fail with EADDRINUSE. It is replaced when nothing accepts on it; a
+ * path that is not a socket is never removed.
+ */
+Status open_server_socket(Server *server)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(server->socket_path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "ERROR: Socket path too long => %s\n", server->socket_path);
+        return e_failure;
+    }
+    strcpy(addr.sun_path, server->socket_path);
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(server->listen_fd == -1)
+    {
+        perror("socket");
+        return e_failure;
+    }
+
+    int bound = bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    if(!bound && errno == EADDRINUSE && lstat(server->socket_path, &st) == 0 && S_ISSOCK(st.st_mode) && !socket_in_use(&addr))
+    {
+        unlink(server->socket_path);
+        bound = bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    }
+
+    if(!bound || listen(server->listen_fd, SOMAXCONN) == -1)
+    {
+        perror("bind");
+        fprintf(stderr, "ERROR: Unable to listen on %s\n", server->socket_path);
+        close(server->listen_fd);
+        return e_failure;
+    }
+    return e_success;
+}
+
+// Function to stop watching a connection; it is freed once no worker holds it
+static void close_client(Server *server, ServerClient *client)
+{
+    if(client->fd < 0)
+        return;
+
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+    client->closing = 1;
+    if(!client->busy)
+    {
+        client->next = server->closed;
+        server->closed = client;
+    }
+}
+
+// Function to free the closed connections (after the events that may still name them)
+static void free_closed_clients(Server *server)
+{
+    while(server->closed != NULL)
+    {
+        ServerClient *client = server->closed;
+        server->closed = client->next;
+
+        if(client->client_prev != NULL)
+            client->client_prev->client_next = client->client_next;
+        else
+            server->clients = client->client_next;
+        if(client->client_next != NULL)
+            client->client_next->client_prev = client->client_prev;
+
+        free(client->in);
+        free(client->out.data);
+        free(client->request);
+        free(client->reply.data);
+        free(client);
+    }
+}
+
+// Function to accept every pending connection
+static void accept_clients(Server *server)
+{
+    for(;;)
+    {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd == -1)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("accept4");
+            if(errno == EINTR)
+                continue;
+            return;
+        }
+
+        ServerClient *client = calloc(1, sizeof(*client));
+        if(client == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->events = EPOLLIN;
+        if(watch_fd(server, fd, client, client->events) == e_failure)
+        {
+            close(fd);
+            free(client);
+            continue;
+        }
+
+        client->client_next = server->clients;
+        if(server->clients != NULL)
+            server->clients->client_prev = client;
+        server->clients = client;
+    }
+}
+
+// Function to read what the peer sent, up to SERVER_REQUEST_MAX unanswered bytes
+static void read_client(Server *server, ServerClient *client)
+{
+    while(!client->eof && client->in_len < SERVER_REQUEST_MAX)
+    {
+        if(client->in_size - client->in_len < CLIENT_BUFFER_SIZE / 4)
+        {
+            size_t size = client->in_size ? client->in_size * 2 : CLIENT_BUFFER_SIZE;
+            char *in = realloc(client->in, size);
+            if(in == NULL)
+            {
+                close_client(server, client);
+                return;
+            }
+            client->in = in;
+            client->in_size = size;
+        }
+
+        ssize_t got = recv(client->fd, client->in + client->in_len, client->in_size - client->in_len, 0);
+        if(got > 0)
+            client->in_len += got;
+        else if(got == 0)
+            client->eof = 1;
+        else if(errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+        else if(errno != EINTR)
+        {
+            close_client(server, client);
+            return;
+        }
+    }
+}
+
+/*
+ * Hands the next complete line to the workers, unless the connection
+ * already has a request out or too much unsent output. A last line
+ * without a newline counts once the peer has stopped sending.
+ */
+static void dispatch_request(Server *server, ServerClient *client)
+{
+    if(client->busy || client->out.len - client->out_sent >= SERVER_REPLY_LIMIT)
+        return;
+
+    char *newline = memchr(client->in, '\n', client->in_len);
+    size_t line_len, used;
+    if(newline != NULL)
+    {
+        line_len = newline - client->in;
+        used = line_len + 1;
+    }
+    else if(client->eof && client->in_len > 0)
+        line_len = used = client->in_len;
+    else
+    {
+        if(client->in_len >= SERVER_REQUEST_MAX)
+        {
+            reply_error(&client->reply, "request too long", NULL);
+            out_append(&client->out, client->reply.data, client->reply.len);
+            client->in_len = 0;
+            client->eof = 1;     // Nothing after it can be framed; the connection closes once this is sent
+        }
+        return;
+    }
+
+    client->request = malloc(line_len + 1);
+    if(client->request == NULL)
+    {
+        close_client(server, client);
+        return;
+    }
+    memcpy(client->request, client->in, line_len);
+    if(line_len > 0 && client->request[line_len - 1] == '\r')
+        line_len--;
+    client->request[line_len] = '\0';
+    memmove(client->in, client->in + used, client->in_len - used);
+    client->in_len -= used;
+
+    client->busy = 1;
+    pthread_mutex_lock(&server->lock);
+    client->next = NULL;
+    if(server->work_tail != NULL)
+        server->work_tail->next = client;
+    else
+        server->work_head = client;
+    server->work_tail = client;
+    pthread_cond_signal(&server->work_cond);
+    pthread_mutex_unlock(&server->lock);
+}
+
+// Function to send as much of the pending output as the socket takes
+static Status write_client(Server *server, ServerClient *client)
+{
+    while(client->out_sent < client->out.len)
+    {
+        ssize_t sent = send(client->fd, client->out.data + client->out_sent, client->out.len - client->out_sent, MSG_NOSIGNAL);
+        if(sent > 0)
+            client->out_sent += sent;
+        else if(errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        else if(errno != EINTR)
+        {
+            close_client(server, client);
+            return e_failure;
+        }
+    }
+
+    if(client->out_sent == client->out.len)
+        client->out.len = client->out_sent = 0;
+    return e_success;
+}
+
+/*
+ * Moves a connection on after anything happened to it: dispatch, send,
+ * close once the peer is done and everything was answered, and register
+ * only the events it can act on (no EPOLLIN while the input is full).
+ */
+static void settle_client(Server *server, ServerClient *client)
+{
+    if(client->fd < 0)
+        return;
+
+    dispatch_request(server, client);
+    if(client->fd < 0 || write_client(server, client) == e_failure)
+        return;
+
+    if(client->eof && !client->busy && client->in_len == 0 && client->out.len == 0)
+    {
+        close_client(server, client);
+        return;
+    }
+
+    uint32_t events = 0;
+    if(!client->eof && client->in_len < SERVER_REQUEST_MAX)
+        events |= EPOLLIN;
+    if(client->out_sent < client->out.len)
+        events |= EPOLLOUT;
+    if(events != client->events)
+    {
+        struct epoll_event event;
+        event.events = events;
+        event.data.ptr = client;
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+        client->events = events;
+    }
+}
+
+// Function to take the answered requests back from the workers and queue their replies
+static void collect_replies(Server *server)
+{
+    uint64_t count;
+    if(read(server->done_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+        perror("read");
+
+    pthread_mutex_lock(&server->lock);
+    ServerClient *client = server->done_head;
+    server->done_head = NULL;
+    pthread_mutex_unlock(&server->lock);
+
+    while(client != NULL)
+    {
+        ServerClient *next = client->next;
+
+        client->busy = 0;
+        free(client->request);
+        client->request = NULL;
+        if(client->closing)
+        {
+            client->next = server->closed;
+            server->closed = client;
+        }
+        else
+        {
+            out_append(&client->out, client->reply.data, client->reply.len);
+            if(client->out.failed)
+                close_client(server, client);
+            else
+                settle_client(server, client);
+        }
+        client = next;
+    }
+}
+
+// Function to run the loop; it returns when SIGINT or SIGTERM arrives
+Status server_loop(Server *server)
+{
+    struct epoll_event events[SERVER_EVENT_MAX];
+
+    if(watch_fd(server, server->listen_fd, &server->listen_fd, EPOLLIN) == e_failure ||
+       watch_fd(server, server->done_fd, &server->done_fd, EPOLLIN) == e_failure ||
+       watch_fd(server, server->signal_fd, &server->signal_fd, EPOLLIN) == e_failure)
+        return e_failure;
+
+    for(;;)
+    {
+        int count = epoll_wait(server->epoll_fd, events, SERVER_EVENT_MAX, -1);
+        if(count == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return e_failure;
+        }
+
+        for(int i = 0; i < count; i++)
+        {
+            void *source = events[i].data.ptr;
+
+            if(source == &server->signal_fd)
+                return e_success;
+            else if(source == &server->listen_fd)
+                accept_clients(server);
+            else if(source == &server->done_fd)
+                collect_replies(server);
+            else
+            {
+                ServerClient *client = source;
+                if(client->fd < 0)
+                    continue;    // Closed earlier in this batch
+                if(events[i].events & (EPOLLERR | EPOLLHUP))
+                    close_client(server, client);
+                else
+                {
+                    if(events[i].events & EPOLLIN)
+                        read_client(server, client);
+                    settle_client(server, client);
+                }
+            }
+        }
+        free_closed_clients(server);
+    }
+}
+
+// Function to serve queued requests until the daemon stops
+void *server_worker(void *arg)
+{
+    Server *server = arg;
+    uint64_t one = 1;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&server->lock);
+        while(!server->stopping && server->work_head == NULL)
+            pthread_cond_wait(&server->work_cond, &server->lock);
+        if(server->stopping)
+        {
+            pthread_mutex_unlock(&server->lock);
+            return NULL;
+        }
+        ServerClient *client = server->work_head;
+        server->work_head = client->next;
+        if(server->work_head == NULL)
+            server->work_tail = NULL;
+        pthread_mutex_unlock(&server->lock);
+
+        serve_request(server, client);
+
+        pthread_mutex_lock(&server->lock);
+        client->next = server->done_head;
+        server->done_head = client;
+        pthread_mutex_unlock(&server->lock);
+        if(write(server->done_fd, &one, sizeof(one)) == -1)
+            perror("write");
+    }
+}
+
+// Function to parse the request line and build exactly one reply line
+void serve_request(Server *server, ServerClient *client)
+{
+    OutBuf *reply = &client->reply;
+    int max = 1;
+
+    // One field per tab, so a SET can carry any number of frames
+    for(const char *tab = strchr(client->request, '\t'); tab != NULL; tab = strchr(tab + 1, '\t'))
+        max++;
+    char **fields = malloc(sizeof(char *) * max);
+    int field_count = fields != NULL ? split_request(client->request, fields, max) : -1;
+
+    reply->len = 0;
+    if(field_count < 0)
+        reply_error(reply, "out of memory", NULL);
+    else if(strcmp(fields[0], "GET") == 0)
+        serve_get(server, reply, fields, field_count);
+    else if(strcmp(fields[0], "SET") == 0)
+        serve_set(server, reply, fields, field_count);
+    else if(strcmp(fields[0], "STATS") == 0 && field_count == 1)
+    {
+        char line[160];
+        pthread_mutex_lock(&server->cache.lock);
+        int n = snprintf(line, sizeof(line), "OK\t{\"entries\":%d,\"capacity\":%d,\"hits\":%lu,\"misses\":%lu}\n",
+                         server->cache.count, server->cache.capacity, server->cache.hits, server->cache.misses);
+        pthread_mutex_unlock(&server->cache.lock);
+        out_append(reply, line, n);
+    }
+    else
+        reply_error(reply, "unknown request", fields[0]);
+    free(fields);
+
+    // An allocation failure leaves a partial line; replace it with a short one
+    if(reply->failed)
+    {
+        reply->failed = 0;
+        reply_error(reply, "out of memory", NULL);
+    }
+}
+
+// Function to look up a frame by ID (TIT2) or edit option (-t)
+static const FrameDesc *lookup_request_frame(const char *name)
+{
+    if(name[0] == '-')
+        return lookup_frame_option(name);
+    if(strlen(name) == FRAME_ID_SIZE)
+        return lookup_frame(pack_frame_id(name));
+    return NULL;
+}
+
+/*
+ * Answers from the cache when the file has not changed since it was
+ * parsed, and parses it (and caches the result) otherwise. The whole
+ * record is the NDJSON object of -v --format=ndjson; a single frame is
+ * its value with the TSV escapes, as -g would print it.
+ */
+Status serve_get(Server *server, OutBuf *reply, char **fields, int field_count)
+{
+    const FrameDesc *desc = NULL;
+    struct stat st;
+
+    if(field_count < 2 || field_count > 3)
+    {
+        reply_error(reply, "usage: GET <path> [FRAME]", NULL);
+        return e_failure;
+    }
+    if(field_count == 3 && (desc = lookup_request_frame(fields[2])) == NULL)
+    {
+        reply_error(reply, "invalid frame", fields[2]);
+        return e_failure;
+    }
+    if(stat(fields[1], &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        reply_error(reply, "cannot open", fields[1]);
+        return e_failure;
+    }
+
+    CacheEntry *entry = cache_lookup(&server->cache, fields[1], &st);
+    if(entry == NULL)
+        entry = load_cache_entry(&server->cache, fields[1]);
+    if(entry == NULL)
+    {
+        reply_error(reply, "no tag in", fields[1]);
+        return e_failure;
+    }
+
+    TagInfo tagInfo;
+    memset(&tagInfo, 0, sizeof(tagInfo));
+    load_index_entry((const IndexEntry *)entry->record, &tagInfo);
+    tagInfo.audio = entry->audio;
+
+    Status status = e_success;
+    if(desc == NULL)
+    {
+        out_append(reply, "OK\t", 3);
+        format_tag_record(reply, e_format_ndjson, &tagInfo, fields[1]);
+    }
+    else
+    {
+        int found = -1;
+        for(int i = 0; i < tagInfo.frame_count && found < 0; i++)
+            if(pack_frame_id(tagInfo.frame_id[i]) == desc->id)
+                found = i;
+
+        if(found < 0)
+        {
+            reply_error(reply, "no frame", desc->name);
+            status = e_failure;
+        }
+        else if(desc->kind == e_frame_binary)
+        {
+            char line[64];
+            int n = snprintf(line, sizeof(line), "OK\t<binary, %d bytes>\n", tagInfo.frame_Size[found]);
+            out_append(reply, line, n);
+        }
+        else
+        {
+            out_append(reply, "OK\t", 3);
+            out_tsv_field(reply, tagInfo.frame_data[found], tagInfo.frame_Size[found]);
+            out_append(reply, "\n", 1);
+        }
+    }
+
+    release_tag_text(&tagInfo);
+    cache_release(&server->cache, entry);
+    return status;
+}
+
+/*
+ * Applies every FRAME=value of the request in one edit, exactly as -b
+ * applies one file of a manifest, then drops the cached entry so the
+ * next GET reads the edited tag.
+ */
+Status serve_set(Server *server, OutBuf *reply, char **fields, int field_count)
+{
+    Edit edit;
+    const char *error = "edit failed";
+    const char *detail = fields[1];
+
+    if(field_count < 3 || strcmp(fields[1], "-") == 0)
+    {
+        reply_error(reply, "usage: SET <path> <FRAME=value>...", NULL);
+        return e_failure;
+    }
+    if(prepare_edit(&edit, fields[1]) == e_failure)
+    {
+        reply_error(reply, "out of memory", NULL);
+        return e_failure;
+    }
+    edit.quiet = 1;
+
+    Status status = e_success;
+    for(int i = 2; i < field_count && status == e_success; i++)
+    {
+        char frame_id[FRAME_ID_SIZE + 1];
+        const char *description;
+        char *equals = strchr(fields[i], '=');
+
+        if(equals != NULL)
+            *equals = '\0';
+        if(equals == NULL || resolve_frame_id(fields[i], frame_id, &description) == e_failure)
+        {
+            error = "invalid frame";
+            detail = fields[i];
+            status = e_failure;
+        }
+        else
+            status = add_frame_edit(&edit, frame_id, description, equals + 1);
+    }
+
+    if(status == e_success)
+        status = open_edit_files(&edit);
+    if(status == e_success)
+        status = edit_tag(&edit);
+    close_edit_files(&edit);
+
+    // The mtime check would catch the change too, unless the edit landed within one timestamp tick
+    cache_invalidate(&server->cache, fields[1]);
+
+    if(status == e_failure && edit.error[0] != '\0')
+        reply_error(reply, "edit failed:", edit.error);
+    else if(status == e_failure)
+        reply_error(reply, error, detail);
+    else
+        out_append(reply, "OK\n", 3);
+    return status;
+}
+
+/*
+ * Parses the file through read_tag_info(), the path of -v, and caches
+ * the result as an index record. The file is stat()ed before it is read
+ * and a shared flock() is held while reading, so a concurrent edit either
+ * finishes first or changes what the next lookup sees.
+ */
+CacheEntry *load_cache_entry(TagCache *cache, const char *path)
+{
+    TagInfo tagInfo;
+    struct stat st;
+    char *record = NULL;
+    size_t record_len;
+
+    memset(&tagInfo, 0, sizeof(tagInfo));
+    tagInfo.src_mp3_fname = (char *)path;
+    if(open_files(&tagInfo) == e_failure)
+        return NULL;
+
+    int fd = fileno(tagInfo.fptr_src_mp3);
+    flock(fd, LOCK_SH);
+    if(fstat(fd, &st) == 0 && read_tag_info(&tagInfo) == e_success)
+    {
+        build_index_record(&tagInfo, path, &st, &record, &record_len);
+        release_tag_block(&tagInfo);
+    }
+    fclose(tagInfo.fptr_src_mp3);
+
+    if(record == NULL)
+        return NULL;
+
+    CacheEntry *entry = cache_insert(cache, record, &tagInfo.audio);
+    if(entry == NULL)
+        free(record);
+    return entry;
+}
+
+// Function to find the entry of a path (cache lock held)
+static CacheEntry *find_cache_entry(TagCache *cache, const char *path, size_t path_len, uint64_t hash)
+{
+    for(CacheEntry *entry = cache->buckets[hash & (cache->bucket_count - 1)]; entry != NULL; entry = entry->hash_next)
+    {
+        const IndexEntry *key = (const IndexEntry *)entry->record;
+        if(key->path_hash == hash && key->path_len == path_len && memcmp(key + 1, path, path_len) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+// Function to take an entry out of the table and the LRU list (cache lock held); freed here if unreferenced
+static void unlink_cache_entry(TagCache *cache, CacheEntry *entry)
+{
+    const IndexEntry *key = (const IndexEntry *)entry->record;
+    CacheEntry **link = &cache->buckets[key->path_hash & (cache->bucket_count - 1)];
+
+    while(*link != entry)
+        link = &(*link)->hash_next;
+    *link = entry->hash_next;
+
+    if(entry->lru_prev != NULL)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        cache->lru_head = entry->lru_next;
+    if(entry->lru_next != NULL)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        cache->lru_tail = entry->lru_prev;
+
+    cache->count--;
+    entry->linked = 0;
+    if(entry->refs == 0)
+    {
+        free(entry->record);
+        free(entry);
+    }
+}
+
+// Function to put an entry at the most recently used end (cache lock held)
+static void push_cache_entry(TagCache *cache, CacheEntry *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if(cache->lru_head != NULL)
+        cache->lru_head->lru_prev = entry;
+    else
+        cache->lru_tail = entry;
+    cache->lru_head = entry;
+}
+
+// Function to find a valid entry and mark it most recently used; a stale entry is dropped
+CacheEntry *cache_lookup(TagCache *cache, const char *path, const struct stat *st)
+{
+    size_t path_len = strlen(path);
+    uint64_t hash = hash_index_path(path, path_len);
+
+    pthread_mutex_lock(&cache->lock);
+    CacheEntry *entry = find_cache_entry(cache, path, path_len, hash);
+    if(entry != NULL && !index_entry_matches((const IndexEntry *)entry->record, st))
+    {
+        unlink_cache_entry(cache, entry);
+        entry = NULL;
+    }
+
+    if(entry != NULL)
+    {
+        if(entry != cache->lru_head)
+        {
+            entry->lru_prev->lru_next = entry->lru_next;
+            if(entry->lru_next != NULL)
+                entry->lru_next->lru_prev = entry->lru_prev;
+            else
+                cache->lru_tail = entry->lru_prev;
+            push_cache_entry(cache, entry);
+        }
+        entry->refs++;
+        cache->hits++;
+    }
+    else
+        cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+// Function to add a freshly parsed file; the least recently used entries make room
+CacheEntry *cache_insert(TagCache *cache, char *record, const AudioInfo *audio)
+{
+    const IndexEntry *key = (const IndexEntry *)record;
+    CacheEntry *entry = calloc(1, sizeof(*entry));
+
+    if(entry == NULL)
+        return NULL;
+    entry->record = record;
+    entry->audio = *audio;
+    entry->refs = 1;
+    entry->linked = 1;
+
+    pthread_mutex_lock(&cache->lock);
+    CacheEntry *old = find_cache_entry(cache, (const char *)(key + 1), key->path_len, key->path_hash);
+    if(old != NULL)
+        unlink_cache_entry(cache, old);
+
+    CacheEntry **bucket = &cache->buckets[key->path_hash & (cache->bucket_count - 1)];
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    push_cache_entry(cache, entry);
+    cache->count++;
+
+    while(cache->count > cache->capacity)
+        unlink_cache_entry(cache, cache->lru_tail);
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+// Function to drop a reference; an entry evicted meanwhile is freed by its last user
+void cache_release(TagCache *cache, CacheEntry *entry)
+{
+    pthread_mutex_lock(&cache->lock);
+    int unused = --entry->refs == 0 && !entry->linked;
+    pthread_mutex_unlock(&cache->lock);
+
+    if(unused)
+    {
+        free(entry->record);
+        free(entry);
+    }
+}
+
+// Function to drop the entry of a path, if it is cached
+void cache_invalidate(TagCache *cache, const char *path)
+{
+    size_t path_len = strlen(path);
+    uint64_t hash = hash_index_path(path, path_len);
+
+    pthread_mutex_lock(&cache->lock);
+    CacheEntry *entry = find_cache_entry(cache, path, path_len, hash);
+    if(entry != NULL)
+        unlink_cache_entry(cache, entry);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Function to connect to the daemon's socket
+static int connect_server(const char *path)
+{
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "ERROR: Socket path too long => %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        perror("connect");
+        fprintf(stderr, "ERROR: No daemon listening on %s\n", path);
+        if(fd != -1)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Function to write all of buf to fd
+static Status write_all(int fd, const char *buf, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t done = send(fd, buf, len, MSG_NOSIGNAL);
+        if(done == -1 && errno == ENOTSOCK)
+            done = write(fd, buf, len);
+        if(done == -1 && errno == EINTR)
+            continue;
+        if(done <= 0)
+            return e_failure;
+        buf += done;
+        len -= done;
+    }
+    return e_success;
+}
+
+// Function to append one request field with the protocol escapes (other bytes, invalid UTF-8 included, go through unchanged)
+static void append_request_field(OutBuf *out, const char *field)
+{
+    for(; *field; field++)
+    {
+        const char *escape = *field == '\t' ? "\\t" : *field == '\n' ? "\\n" : *field == '\r' ? "\\r" : *field == '\\' ? "\\\\" : NULL;
+        if(escape != NULL)
+            out_append(out, escape, 2);
+        else
+            out_append(out, field, 1);
+    }
+}
+
+/*
+ * Sends one request built from the arguments and prints the reply: the
+ * record of GET <path>, or the plain value of GET <path> <FRAME> (as -g
+ * prints it). An ERR reply goes to stderr and fails.
+ */
+static Status client_request(int fd, int argc, char **argv)
+{
+    OutBuf line = { 0 };
+
+    for(int i = 3; i < argc; i++)
+    {
+        if(i > 3)
+            out_append(&line, "\t", 1);
+        append_request_field(&line, argv[i]);
+    }
+    out_append(&line, "\n", 1);
+
+    Status status = line.failed ? e_failure : write_all(fd, line.data, line.len);
+    shutdown(fd, SHUT_WR);
+
+    // The daemon closes the connection after the one reply
+    line.len = 0;
+    char buf[CLIENT_BUFFER_SIZE];
+    ssize_t got;
+    while(status == e_success && (got = recv(fd, buf, sizeof(buf), 0)) != 0)
+    {
+        if(got == -1 && errno == EINTR)
+            continue;
+        if(got == -1)
+            status = e_failure;
+        else
+            out_append(&line, buf, got);
+    }
+
+    if(status == e_success && !line.failed && line.len >= 3 && memcmp(line.data, "OK", 2) == 0)
+    {
+        // SET answers a bare OK; a frame value comes escaped and is printed as it is
+        char *payload = line.data + 3;
+        size_t length = line.len - 3;
+        if(line.data[2] == '\t' && length > 0 && argc == 6 && strcmp(argv[3], "GET") == 0)
+        {
+            payload[length - 1] = '\0';
+            unescape_field(payload);
+            printf("%s\n", payload);
+        }
+        else if(line.data[2] == '\t')
+            fwrite(payload, 1, length, stdout);
+    }
+    else
+    {
+        if(line.len > 4 && memcmp(line.data, "ERR\t", 4) == 0)
+            fprintf(stderr, "ERROR: %.*s", (int)(line.len - 4), line.data + 4);
+        else
+            fprintf(stderr, "ERROR: No reply from the daemon\n");
+        status = e_failure;
+    }
+
+    free(line.data);
+    return status;
+}
+
+/*
+ * Relays request lines from stdin and replies to stdout. Stdin is only
+ * read once the previous chunk is sent, and replies are read all the
+ * while, so a long pipeline never blocks both ends on full buffers.
+ */
+static Status client_relay(int fd)
+{
+    char in[CLIENT_BUFFER_SIZE], out[CLIENT_BUFFER_SIZE];
+    size_t pending = 0, sent = 0;
+    int input_open = 1;
+
+    for(;;)
+    {
+        struct pollfd fds[2];
+        fds[0].fd = input_open && pending == 0 ? STDIN_FILENO : -1;
+        fds[0].events = POLLIN;
+        fds[1].fd = fd;
+        fds[1].events = POLLIN | (pending ? POLLOUT : 0);
+
+        if(poll(fds, 2, -1) == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            perror("poll");
+            return e_failure;
+        }
+
+        if(fds[0].revents)
+        {
+            ssize_t got = read(STDIN_FILENO, in, sizeof(in));
+            if(got > 0)
+            {
+                pending = got;
+                sent = 0;
+            }
+            else if(got == 0 || errno != EINTR)
+            {
+                input_open = 0;
+                shutdown(fd, SHUT_WR);
+            }
+        }
+
+        if(fds[1].revents & POLLOUT)
+        {
+            ssize_t done = send(fd, in + sent, pending - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if(done > 0 && (sent += done) == pending)
+                pending = 0;
+            else if(done == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                return e_failure;
+        }
+
+        if(fds[1].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            ssize_t got = recv(fd, out, sizeof(out), MSG_DONTWAIT);
+            if(got == 0)
+                return e_success;
+            if(got > 0)
+            {
+                if(write_all(STDOUT_FILENO, out, got) == e_failure)
+                    return e_failure;
+            }
+            else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                return e_failure;
+        }
+    }
+}
+
+// Function to run the client: one request from the arguments, or request lines from stdin
+Status run_client(int argc, char **argv)
+{
+    if(argc < 3)
+    {
+        fprintf(stderr, "Usage: %s -c <socket> [GET <file.mp3> [FRAME] | SET <file.mp3> FRAME=value... | STATS]\n", argv[0]);
+        return e_failure;
+    }
+
+    int fd = connect_server(argv[2]);
+    if(fd == -1)
+        return e_failure;
+
+    Status status = argc > 3 ? client_request(fd, argc, argv) : client_relay(fd);
+    close(fd);
+    return status;
+}
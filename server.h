@@ -0,0 +1,175 @@
+/***********************************************************************
+ *  File Name   : server.h
+ *  Description : Header file for the Tag Daemon Module.
+ *                Declares the long-running server (-d) that answers tag
+ *                requests over a Unix domain socket, its cache of parsed
+ *                tags, and the bundled client (-c).
+ *
+ *                Protocol: one request per line, fields separated by a
+ *                tab; a tab, newline, carriage return or backslash inside
+ *                a field is written \t \n \r \\ (the TSV escapes of
+ *                --format=tsv). Every request gets exactly one line back,
+ *                in request order:
+ *                - GET <path>                  → OK <NDJSON record of -v>
+ *                - GET <path> <FRAME>          → OK <value, escaped>
+ *                - SET <path> <FRAME=value>... → OK
+ *                - STATS                       → OK {"entries":…,"hits":…,"misses":…}
+ *                - anything that fails         → ERR <message>
+ *                FRAME is a frame ID (TIT2) or an edit option (-t).
+ *
+ *                Structures:
+ *                - CacheEntry
+ *                - TagCache
+ *                - ServerClient
+ *                - Server
+ *
+ *                Functions:
+ *                - run_server()
+ *                - read_and_validate_server_args()
+ *                - open_server_socket()
+ *                - server_loop()
+ *                - server_worker()
+ *                - serve_request()
+ *                - serve_get()
+ *                - serve_set()
+ *                - load_cache_entry()
+ *                - cache_lookup()
+ *                - cache_insert()
+ *                - cache_release()
+ *                - cache_invalidate()
+ *                - run_client()
+ *
+ ***********************************************************************/
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "view.h"
+#include "output.h"
+
+// Parsed files kept in the cache unless --cache gives another number
+#define SERVER_CACHE_ENTRIES 4096
+
+// Unanswered request bytes buffered per client; a longer request is refused
+#define SERVER_REQUEST_MAX (1024 * 1024)
+
+// Unsent response bytes after which a client's next request waits
+#define SERVER_REPLY_LIMIT (256 * 1024)
+
+// Events taken from epoll_wait() at a time
+#define SERVER_EVENT_MAX 64
+
+// One cached file: its parsed frames as a tag index record, plus the audio measurements
+typedef struct CacheEntry
+{
+    char *record;                    // IndexEntry + path + frames (build_index_record); validated by inode, size and mtime
+    AudioInfo audio;                 // Duration and bitrate when the daemon runs with --audio
+    struct CacheEntry *hash_next;    // Next entry of the same bucket
+    struct CacheEntry *lru_prev;     // More recently used entry
+    struct CacheEntry *lru_next;     // Less recently used entry
+    int refs;                        // Requests still formatting from this entry
+    int linked;                      // 1 while the entry is in the table; freed when unlinked and refs reaches 0
+} CacheEntry;
+
+// LRU cache of parsed files, shared by the workers
+typedef struct TagCache
+{
+    CacheEntry **buckets;            // Hash table on the path (bucket_count entries)
+    uint32_t bucket_count;           // Power of two
+    CacheEntry *lru_head;            // Most recently used
+    CacheEntry *lru_tail;            // Least recently used, evicted first
+    int count;                       // Entries in the table
+    int capacity;                    // Most entries kept (--cache)
+    unsigned long hits;              // Requests answered without parsing
+    unsigned long misses;            // Requests that parsed the file
+    pthread_mutex_t lock;            // Protects everything above and CacheEntry links and refs
+} TagCache;
+
+// One connection. The loop owns it, except for request and reply while busy is set
+typedef struct ServerClient
+{
+    int fd;                          // Connected socket
+    char *in;                        // Received bytes not yet handed to a worker
+    size_t in_len;                   // Bytes used in in
+    size_t in_size;                  // Capacity of in
+    OutBuf out;                      // Responses not yet sent
+    size_t out_sent;                 // Bytes of out already sent
+    char *request;                   // Line being served (the worker's input)
+    OutBuf reply;                    // Response the worker built
+    int busy;                        // 1 while a worker has the request
+    int eof;                         // 1 once the peer stopped sending
+    int closing;                     // 1 after an error; closed once the worker gives it back
+    uint32_t events;                 // epoll interest currently registered
+    struct ServerClient *next;       // Link in the work, done or closed list
+    struct ServerClient *client_prev; // Previous connection in Server.clients
+    struct ServerClient *client_next; // Next connection in Server.clients
+} ServerClient;
+
+// Shared state of the daemon
+typedef struct Server
+{
+    char *socket_path;               // Path the socket is bound to (unlinked on exit)
+    int listen_fd;                   // Listening socket
+    int epoll_fd;                    // Event loop
+    int done_fd;                     // eventfd: workers signal finished requests
+    int signal_fd;                   // signalfd for SIGINT / SIGTERM
+    int worker_count;                // Threads doing file I/O (--workers)
+    TagCache cache;                  // Parsed files
+    ServerClient *work_head;         // Requests waiting for a worker
+    ServerClient *work_tail;         // Last request waiting for a worker
+    ServerClient *done_head;         // Requests answered, waiting for the loop
+    ServerClient *clients;           // Every open connection (loop only)
+    ServerClient *closed;            // Connections to free once the current events are handled (loop only)
+    int stopping;                    // Set to make the workers exit
+    pthread_mutex_t lock;            // Protects the work and done queues and stopping
+    pthread_cond_t work_cond;        // Signalled when a request is queued or the daemon stops
+} Server;
+
+// Function to run the daemon: -d <socket> [--workers N] [--cache ENTRIES]
+Status run_server(int argc, char **argv);
+
+// Function to read the socket path and the optional --workers / --cache values
+Status read_and_validate_server_args(int argc, char **argv, Server *server);
+
+// Function to bind and listen on the Unix socket (a stale socket file is replaced)
+Status open_server_socket(Server *server);
+
+// Function to run the epoll loop until SIGINT or SIGTERM
+Status server_loop(Server *server);
+
+// Thread entry point for a worker: takes requests, answers them, hands them back to the loop
+void *server_worker(void *arg);
+
+// Function to answer one request line into the client's reply
+void serve_request(Server *server, ServerClient *client);
+
+// Function to answer GET <path> [FRAME]
+Status serve_get(Server *server, OutBuf *reply, char **fields, int field_count);
+
+// Function to answer SET <path> <FRAME=value>...
+Status serve_set(Server *server, OutBuf *reply, char **fields, int field_count);
+
+// Function to parse a file through read_tag_info() and put it in the cache
+CacheEntry *load_cache_entry(TagCache *cache, const char *path);
+
+// Function to find a cached file that has not changed since it was parsed (the entry is referenced)
+CacheEntry *cache_lookup(TagCache *cache, const char *path, const struct stat *st);
+
+// Function to add a parsed file, replacing an older entry for the path and evicting the least recently used
+CacheEntry *cache_insert(TagCache *cache, char *record, const AudioInfo *audio);
+
+// Function to drop the reference taken by cache_lookup() / cache_insert()
+void cache_release(TagCache *cache, CacheEntry *entry);
+
+// Function to forget the cached entry of a path
+void cache_invalidate(TagCache *cache, const char *path);
+
+// Function to run the bundled client: -c <socket> [GET|SET|STATS args...], or request lines from stdin
+Status run_client(int argc, char **argv);
+
+#endif  // SERVER_H
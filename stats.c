@@ -0,0 +1,112 @@
+/***********************************************************************
+ *  File Name   : stats.c
+ *  Description : Source file for the --stats instrumentation.
+ *                Holds the process-wide counters and prints them to
+ *                stderr when the program exits.
+ *
+ *                Functions:
+ *                - parse_stats_args()
+ *                - stats_now()
+ *                - stats_add_phase()
+ *                - print_stats()
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+Stats stats;
+
+// Names of the phases, in StatsPhase order
+static const char *const phase_names[e_phase_count] =
+{
+    "header", "parse", "output", "build", "patch", "frames", "audio", "replace", "mpeg", "hash"
+};
+
+/*
+ * Removes --stats and --stats=json from argv and enables the counters.
+ * The report is printed by an exit handler, so every return path of
+ * main() produces it.
+ */
+void parse_stats_args(int *argc, char **argv)
+{
+    int out = 1;
+
+    for(int i = 1; i < *argc; i++)
+    {
+        if(strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=table") == 0)
+            stats.enabled = 1;
+        else if(strcmp(argv[i], "--stats=json") == 0)
+            stats.enabled = stats.json = 1;
+        else
+            argv[out++] = argv[i];
+    }
+
+    argv[out] = NULL;
+    *argc = out;
+
+    if(stats.enabled)
+        atexit(print_stats);
+}
+
+// Function to read CLOCK_MONOTONIC in nanoseconds
+long long stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Function to add the elapsed time since start to a phase
+void stats_add_phase(StatsPhase phase, long long start)
+{
+    __atomic_fetch_add(&stats.phase_ns[phase], stats_now() - start, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.phase_runs[phase], 1, __ATOMIC_RELAXED);
+}
+
+// Function to print every phase that ran and the I/O counters to stderr
+void print_stats(void)
+{
+    fflush(stdout);
+
+    if(stats.json)
+    {
+        fprintf(stderr, "{\"phases\": {");
+        for(int i = 0, n = 0; i < e_phase_count; i++)
+        {
+            if(stats.phase_runs[i] == 0)
+                continue;
+            fprintf(stderr, "%s\"%s\": {\"ms\": %.3f, \"runs\": %ld}", n++ ? ", " : "",
+                    phase_names[i], stats.phase_ns[i] / 1e6, stats.phase_runs[i]);
+        }
+        fprintf(stderr, "}, \"bytes_read\": %lld, \"bytes_written\": %lld, \"bytes_copied\": %lld, "
+                "\"read_calls\": %ld, \"write_calls\": %ld, \"seek_calls\": %ld, \"copy_calls\": %ld, "
+                "\"allocs\": %ld}\n",
+                stats.bytes_read, stats.bytes_written, stats.bytes_copied, stats.read_calls,
+                stats.write_calls, stats.seek_calls, stats.copy_calls, stats.allocs);
+        return;
+    }
+
+    fprintf(stderr, "=====================================\n");
+    fprintf(stderr, "| %-10s:%12s %9s |\n", "Phase", "Time (ms)", "Runs");
+    fprintf(stderr, "=====================================\n");
+    for(int i = 0; i < e_phase_count; i++)
+    {
+        if(stats.phase_runs[i] > 0)
+            fprintf(stderr, "| %-10s:%12.3f %9ld |\n", phase_names[i], stats.phase_ns[i] / 1e6, stats.phase_runs[i]);
+    }
+    fprintf(stderr, "=====================================\n");
+    fprintf(stderr, "| %-13s:%19lld |\n", "Bytes read", stats.bytes_read);
+    fprintf(stderr, "| %-13s:%19lld |\n", "Bytes written", stats.bytes_written);
+    fprintf(stderr, "| %-13s:%19lld |\n", "Bytes copied", stats.bytes_copied);
+    fprintf(stderr, "| %-13s:%19ld |\n", "Read calls", stats.read_calls);
+    fprintf(stderr, "| %-13s:%19ld |\n", "Write calls", stats.write_calls);
+    fprintf(stderr, "| %-13s:%19ld |\n", "Seek calls", stats.seek_calls);
+    fprintf(stderr, "| %-13s:%19ld |\n", "Copy calls", stats.copy_calls);
+    fprintf(stderr, "| %-13s:%19ld |\n", "Allocations", stats.allocs);
+    fprintf(stderr, "=====================================\n");
+}
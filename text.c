@@ -0,0 +1,506 @@
+/***********************************************************************
+ *  File Name   : text.c
+ *  Description : Source file for the ID3 text-encoding module.
+ *                The vector kernels handle the common cases of whole
+ *                blocks: all ASCII (copied, or narrowed from UTF-16 with
+ *                one pack), and all two-byte characters such as Cyrillic,
+ *                Greek or Hebrew (each UTF-16 unit becomes its two UTF-8
+ *                bytes in one lane). Any other block falls back to the
+ *                scalar loop, which also handles surrogate pairs and
+ *                replaces malformed input with U+FFFD.
+ *
+ *                Functions:
+ *                - text_view_length()
+ *                - decode_text()
+ *                - encode_text()
+ *                - choose_text_encoding()
+ *                - utf8_prefix()
+ *                - ascii_prefix()
+ *                - utf16_length()
+ *                - utf16_scalar()
+ *                - utf16_to_utf8()
+ *                - latin1_to_utf8()
+ *                - next_code_point()
+ *                - put_utf8()
+ *                - put_utf16()
+ *
+ ***********************************************************************/
+
+#include <string.h>
+
+#include "text.h"
+#include "cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define REPLACEMENT_CHAR 0xFFFD
+
+#ifdef CPU_AVX2
+__attribute__((target("avx2")))
+static size_t ascii_prefix_avx2(const unsigned char *src, size_t len)
+{
+    size_t i = 0;
+
+    for(; i + 32 <= len; i += 32)
+    {
+        unsigned mask = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(src + i)));
+        if(mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    while(i < len && src[i] < 0x80)
+        i++;
+    return i;
+}
+#endif
+
+// Function to count the leading ASCII bytes (the sign bit of every byte is tested a block at a time)
+static size_t ascii_prefix(const unsigned char *src, size_t len)
+{
+    size_t i = 0;
+
+#ifdef CPU_AVX2
+    if(len >= 32 && cpu_has_avx2())
+        return ascii_prefix_avx2(src, len);
+#endif
+#ifdef CPU_SSE2
+    for(; i + 16 <= len; i += 16)
+    {
+        unsigned mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(src + i)));
+        if(mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    while(i < len && src[i] < 0x80)
+        i++;
+    return i;
+}
+
+// Function to count the UTF-16 units before the first 0x0000 unit
+static size_t utf16_length(const unsigned char *src, size_t units)
+{
+    size_t i = 0;
+
+#ifdef CPU_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 8 <= units; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi16(v, zero));
+        if(mask != 0)
+            return i + __builtin_ctz(mask) / 2;
+    }
+#endif
+    for(; i < units; i++)
+        if(src[2 * i] == 0 && src[2 * i + 1] == 0)
+            break;
+    return i;
+}
+
+// Function to append one code point as UTF-8; returns the bytes written
+static size_t put_utf8(unsigned cp, char *out)
+{
+    unsigned char *o = (unsigned char *)out;
+
+    if(cp < 0x80)
+    {
+        o[0] = cp;
+        return 1;
+    }
+    if(cp < 0x800)
+    {
+        o[0] = 0xC0 | (cp >> 6);
+        o[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    if(cp < 0x10000)
+    {
+        o[0] = 0xE0 | (cp >> 12);
+        o[1] = 0x80 | ((cp >> 6) & 0x3F);
+        o[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    o[0] = 0xF0 | (cp >> 18);
+    o[1] = 0x80 | ((cp >> 12) & 0x3F);
+    o[2] = 0x80 | ((cp >> 6) & 0x3F);
+    o[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+// Function to convert UTF-16 units [*pos, end) one at a time; a pair may read one unit past end (but not past units)
+static size_t utf16_scalar(const unsigned char *src, size_t *pos, size_t end, size_t units, int big_endian, char *out)
+{
+    size_t i = *pos, o = 0;
+
+    while(i < end)
+    {
+        unsigned u = big_endian ? (src[2 * i] << 8 | src[2 * i + 1]) : (src[2 * i + 1] << 8 | src[2 * i]);
+        i++;
+
+        if(u >= 0xD800 && u <= 0xDBFF && i < units)
+        {
+            unsigned low = big_endian ? (src[2 * i] << 8 | src[2 * i + 1]) : (src[2 * i + 1] << 8 | src[2 * i]);
+            if(low >= 0xDC00 && low <= 0xDFFF)
+            {
+                u = 0x10000 + ((u - 0xD800) << 10) + (low - 0xDC00);
+                i++;
+            }
+            else
+                u = REPLACEMENT_CHAR;
+        }
+        else if(u >= 0xD800 && u <= 0xDFFF)
+            u = REPLACEMENT_CHAR;
+
+        o += put_utf8(u, out + o);
+    }
+    *pos = i;
+    return o;
+}
+
+#ifdef CPU_AVX2
+__attribute__((target("avx2")))
+static size_t utf16_to_utf8_avx2(const unsigned char *src, size_t *pos, size_t units, int big_endian, char *out)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i not_ascii = _mm256_set1_epi16((short)0xFF80);
+    const __m256i not_two = _mm256_set1_epi16((short)0xF800);
+    size_t i = *pos, o = 0;
+
+    while(i + 16 <= units)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + 2 * i));
+        if(big_endian)
+            v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+
+        unsigned ascii = _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(v, not_ascii), zero));
+        if(ascii == 0xFFFFFFFFu)
+        {
+            // Pack works per 128-bit lane; gather the two 8-byte halves into the low lane
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+            _mm_storeu_si128((__m128i *)(out + o), _mm256_castsi256_si128(packed));
+            i += 16;
+            o += 16;
+            continue;
+        }
+
+        unsigned two = _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(v, not_two), zero));
+        if(two == 0xFFFFFFFFu && ascii == 0)
+        {
+            // 110xxxxx 10xxxxxx per unit, lead byte first in memory
+            __m256i lead = _mm256_or_si256(_mm256_srli_epi16(v, 6), _mm256_set1_epi16(0xC0));
+            __m256i trail = _mm256_or_si256(_mm256_and_si256(v, _mm256_set1_epi16(0x3F)), _mm256_set1_epi16(0x80));
+            _mm256_storeu_si256((__m256i *)(out + o), _mm256_or_si256(lead, _mm256_slli_epi16(trail, 8)));
+            i += 16;
+            o += 32;
+            continue;
+        }
+
+        o += utf16_scalar(src, &i, i + 16, units, big_endian, out + o);
+    }
+    *pos = i;
+    return o;
+}
+#endif
+
+// Function to convert n UTF-16 units to UTF-8, a vector block at a time where the block allows it
+static size_t utf16_to_utf8(const unsigned char *src, size_t units, int big_endian, char *out)
+{
+    size_t i = 0, o = 0;
+
+#ifdef CPU_AVX2
+    if(units >= 16 && cpu_has_avx2())
+        o = utf16_to_utf8_avx2(src, &i, units, big_endian, out);
+#endif
+#ifdef CPU_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i not_ascii = _mm_set1_epi16((short)0xFF80);
+    const __m128i not_two = _mm_set1_epi16((short)0xF800);
+
+    while(i + 8 <= units)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+        if(big_endian)
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+
+        unsigned ascii = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, not_ascii), zero));
+        if(ascii == 0xFFFF)
+        {
+            _mm_storel_epi64((__m128i *)(out + o), _mm_packus_epi16(v, v));
+            i += 8;
+            o += 8;
+            continue;
+        }
+
+        unsigned two = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, not_two), zero));
+        if(two == 0xFFFF && ascii == 0)
+        {
+            __m128i lead = _mm_or_si128(_mm_srli_epi16(v, 6), _mm_set1_epi16(0xC0));
+            __m128i trail = _mm_or_si128(_mm_and_si128(v, _mm_set1_epi16(0x3F)), _mm_set1_epi16(0x80));
+            _mm_storeu_si128((__m128i *)(out + o), _mm_or_si128(lead, _mm_slli_epi16(trail, 8)));
+            i += 8;
+            o += 16;
+            continue;
+        }
+
+        o += utf16_scalar(src, &i, i + 8, units, big_endian, out + o);
+    }
+#endif
+    o += utf16_scalar(src, &i, units, units, big_endian, out + o);
+    return o;
+}
+
+// Function to widen ISO-8859-1 to UTF-8: ASCII runs are copied whole, other bytes become two
+static size_t latin1_to_utf8(const unsigned char *src, size_t len, char *out)
+{
+    size_t i = 0, o = 0;
+
+    while(i < len)
+    {
+        size_t run = ascii_prefix(src + i, len - i);
+        memcpy(out + o, src + i, run);
+        i += run;
+        o += run;
+
+        for(; i < len && src[i] >= 0x80; i++)
+            o += put_utf8(src[i], out + o);
+    }
+    return o;
+}
+
+/*
+ * Returns the length up to the terminator when the field can be shown
+ * as it is (UTF-8, or ISO-8859-1 that is all ASCII), so the common case
+ * needs no copy. UTF-16 always needs decoding.
+ */
+size_t text_view_length(unsigned char encoding, const unsigned char *src, size_t len)
+{
+    if(encoding == e_text_utf16 || encoding == e_text_utf16be)
+        return TEXT_NEEDS_DECODE;
+
+    const unsigned char *end = memchr(src, 0, len);
+    size_t length = end ? (size_t)(end - src) : len;
+
+    if(encoding == e_text_utf8)
+        return length;
+    return ascii_prefix(src, length) == length ? length : TEXT_NEEDS_DECODE;
+}
+
+/*
+ * Decodes up to the first terminator. UTF-16 with BOM follows the BOM
+ * (little-endian when it is missing, as many taggers write it); unknown
+ * encoding bytes are treated as ISO-8859-1. out must have room for
+ * TEXT_DECODED_MAX(len) bytes.
+ */
+size_t decode_text(unsigned char encoding, const unsigned char *src, size_t len, char *out)
+{
+    int big_endian = encoding == e_text_utf16be;
+    const unsigned char *end;
+
+    switch(encoding)
+    {
+        case e_text_utf16:
+        case e_text_utf16be:
+            if(len >= 2 && src[0] == 0xFE && src[1] == 0xFF)
+            {
+                big_endian = 1;
+                src += 2;
+                len -= 2;
+            }
+            else if(len >= 2 && src[0] == 0xFF && src[1] == 0xFE)
+            {
+                big_endian = 0;
+                src += 2;
+                len -= 2;
+            }
+            return utf16_to_utf8(src, utf16_length(src, len / 2), big_endian, out);
+
+        case e_text_utf8:
+            end = memchr(src, 0, len);
+            len = end ? (size_t)(end - src) : len;
+            memcpy(out, src, len);
+            return len;
+
+        default:
+            end = memchr(src, 0, len);
+            return latin1_to_utf8(src, end ? (size_t)(end - src) : len, out);
+    }
+}
+
+// Function to read one code point from UTF-8 at *pos (malformed bytes give U+FFFD and advance by one)
+static unsigned next_code_point(const unsigned char *s, size_t len, size_t *pos)
+{
+    size_t i = *pos;
+    unsigned c = s[i];
+    int extra;
+    unsigned cp;
+
+    if(c < 0x80)
+    {
+        *pos = i + 1;
+        return c;
+    }
+    if(c >= 0xC2 && c <= 0xDF)
+    {
+        extra = 1;
+        cp = c & 0x1F;
+    }
+    else if(c >= 0xE0 && c <= 0xEF)
+    {
+        extra = 2;
+        cp = c & 0x0F;
+    }
+    else if(c >= 0xF0 && c <= 0xF4)
+    {
+        extra = 3;
+        cp = c & 0x07;
+    }
+    else
+    {
+        *pos = i + 1;
+        return REPLACEMENT_CHAR;
+    }
+
+    if(i + extra >= len)
+    {
+        *pos = i + 1;
+        return REPLACEMENT_CHAR;
+    }
+    for(int k = 1; k <= extra; k++)
+    {
+        if((s[i + k] & 0xC0) != 0x80)
+        {
+            *pos = i + 1;
+            return REPLACEMENT_CHAR;
+        }
+        cp = cp << 6 | (s[i + k] & 0x3F);
+    }
+
+    // Overlong forms, surrogates and values past U+10FFFF are not characters
+    if((extra == 2 && cp < 0x800) || (extra == 3 && (cp < 0x10000 || cp > 0x10FFFF)) || (cp >= 0xD800 && cp <= 0xDFFF))
+        cp = REPLACEMENT_CHAR;
+    *pos = i + 1 + extra;
+    return cp;
+}
+
+// Function to store one UTF-16 unit in the requested byte order
+static void put_utf16(unsigned unit, int big_endian, unsigned char *out)
+{
+    out[big_endian ? 0 : 1] = unit >> 8;
+    out[big_endian ? 1 : 0] = unit & 0xFF;
+}
+
+/*
+ * Encodes UTF-8 into a frame encoding. UTF-16 is written little-endian
+ * after an FF FE byte order mark; ISO-8859-1 gets '?' for characters it
+ * cannot hold (choose_text_encoding() avoids that). out must have room
+ * for TEXT_ENCODED_MAX(len) bytes.
+ */
+size_t encode_text(TextEncoding encoding, const char *utf8, size_t len, unsigned char *out)
+{
+    const unsigned char *s = (const unsigned char *)utf8;
+    int big_endian = encoding == e_text_utf16be;
+    size_t i = 0, o = 0;
+
+    if(encoding == e_text_utf8)
+    {
+        memcpy(out, utf8, len);
+        return len;
+    }
+
+    if(encoding == e_text_utf16)
+    {
+        out[o++] = 0xFF;
+        out[o++] = 0xFE;
+    }
+
+    while(i < len)
+    {
+        // ASCII runs: bytes copied (ISO-8859-1) or widened with a zero byte (UTF-16)
+        size_t run = ascii_prefix(s + i, len - i);
+        if(encoding == e_text_latin1)
+        {
+            memcpy(out + o, s + i, run);
+            o += run;
+            i += run;
+        }
+        else
+        {
+            size_t end = i + run;
+#ifdef CPU_SSE2
+            const __m128i zero = _mm_setzero_si128();
+            for(; i + 16 <= end; i += 16, o += 32)
+            {
+                __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+                __m128i lo = big_endian ? _mm_unpacklo_epi8(zero, v) : _mm_unpacklo_epi8(v, zero);
+                __m128i hi = big_endian ? _mm_unpackhi_epi8(zero, v) : _mm_unpackhi_epi8(v, zero);
+                _mm_storeu_si128((__m128i *)(out + o), lo);
+                _mm_storeu_si128((__m128i *)(out + o + 16), hi);
+            }
+#endif
+            for(; i < end; i++, o += 2)
+                put_utf16(s[i], big_endian, out + o);
+        }
+        if(i >= len)
+            break;
+
+        unsigned cp = next_code_point(s, len, &i);
+        if(encoding == e_text_latin1)
+            out[o++] = cp <= 0xFF ? cp : '?';
+        else if(cp >= 0x10000)
+        {
+            cp -= 0x10000;
+            put_utf16(0xD800 | (cp >> 10), big_endian, out + o);
+            put_utf16(0xDC00 | (cp & 0x3FF), big_endian, out + o + 2);
+            o += 4;
+        }
+        else
+        {
+            put_utf16(cp, big_endian, out + o);
+            o += 2;
+        }
+    }
+    return o;
+}
+
+/*
+ * Keeps the frame's own encoding unless it cannot hold the text or does
+ * not exist in the tag version (UTF-16BE and UTF-8 are ID3v2.4 only).
+ * Otherwise ISO-8859-1 is used when the text fits, then UTF-8 for
+ * ID3v2.4 and UTF-16 with BOM for ID3v2.3.
+ */
+TextEncoding choose_text_encoding(int old_encoding, int version, const char *utf8, size_t len)
+{
+    const unsigned char *s = (const unsigned char *)utf8;
+    int latin1 = 1;
+
+    // Only C2/C3 lead bytes encode U+0080..U+00FF
+    for(size_t i = ascii_prefix(s, len); i < len && latin1; i++)
+        if(s[i] >= 0xC0 && s[i] != 0xC2 && s[i] != 0xC3)
+            latin1 = 0;
+
+    if(old_encoding == e_text_utf16)
+        return e_text_utf16;
+    if((old_encoding == e_text_utf16be || old_encoding == e_text_utf8) && version >= 4)
+        return old_encoding;
+    if(latin1)
+        return e_text_latin1;
+    return version >= 4 ? e_text_utf8 : e_text_utf16;
+}
+
+// Function to cut UTF-8 after max_chars characters (continuation bytes do not start a character)
+size_t utf8_prefix(const char *s, size_t len, size_t max_chars, size_t *chars)
+{
+    size_t count = 0, i = 0;
+
+    for(; i < len; i++)
+    {
+        if(((unsigned char)s[i] & 0xC0) == 0x80)
+            continue;
+        if(count == max_chars)
+            break;
+        count++;
+    }
+    *chars = count;
+    return i;
+}
@@ -0,0 +1,70 @@
+/***********************************************************************
+ *  File Name   : text.h
+ *  Description : Header file for the ID3 text-encoding module.
+ *                Decodes the four encodings an ID3v2 text field can use
+ *                (ISO-8859-1, UTF-16 with BOM, UTF-16BE, UTF-8) into
+ *                UTF-8 for display, and encodes UTF-8 from the command
+ *                line back into a frame's encoding for edits. The inner
+ *                loops run 16 (SSE2) or 32 (AVX2, chosen at run time)
+ *                bytes at a time over ASCII runs and over runs of
+ *                two-byte characters, with a scalar fallback for mixed
+ *                blocks, surrogate pairs and other architectures.
+ *                Part of libid3.
+ *
+ *                Enumerations:
+ *                - TextEncoding
+ *
+ *                Functions:
+ *                - text_view_length()
+ *                - decode_text()
+ *                - encode_text()
+ *                - choose_text_encoding()
+ *                - utf8_prefix()
+ *
+ ***********************************************************************/
+
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <stddef.h>
+
+/*
+ * Encoding byte at the start of a text frame
+ * e_text_latin1  → ISO-8859-1, terminated by 0x00
+ * e_text_utf16   → UTF-16 with a byte order mark, terminated by 0x00 0x00
+ * e_text_utf16be → UTF-16BE without BOM (ID3v2.4 only)
+ * e_text_utf8    → UTF-8 (ID3v2.4 only)
+ */
+typedef enum
+{
+    e_text_latin1,
+    e_text_utf16,
+    e_text_utf16be,
+    e_text_utf8
+} TextEncoding;
+
+// Returned by text_view_length() when the field has to be decoded
+#define TEXT_NEEDS_DECODE ((size_t)-1)
+
+// Largest UTF-8 output of decode_text() for len input bytes
+#define TEXT_DECODED_MAX(len) (2 * (size_t)(len))
+
+// Largest output of encode_text() for len bytes of UTF-8 (BOM included)
+#define TEXT_ENCODED_MAX(len) (2 * (size_t)(len) + 2)
+
+// Function to return the length of a field that is already UTF-8 (so it can be shown in place), or TEXT_NEEDS_DECODE
+size_t text_view_length(unsigned char encoding, const unsigned char *src, size_t len);
+
+// Function to decode a field up to its terminator into UTF-8; returns the bytes written to out
+size_t decode_text(unsigned char encoding, const unsigned char *src, size_t len, char *out);
+
+// Function to encode UTF-8 text in the given encoding (with BOM for UTF-16); returns the bytes written to out
+size_t encode_text(TextEncoding encoding, const char *utf8, size_t len, unsigned char *out);
+
+// Function to pick the encoding for new text: the old one when it can hold it and the tag version allows it (-1 for a new frame)
+TextEncoding choose_text_encoding(int old_encoding, int version, const char *utf8, size_t len);
+
+// Function to find how many bytes of UTF-8 hold at most max_chars characters; the character count goes to *chars
+size_t utf8_prefix(const char *s, size_t len, size_t max_chars, size_t *chars);
+
+#endif  // TEXT_H
@@ -0,0 +1,485 @@
+/***********************************************************************
+ *  File Name   : trailer.c
+ *  Description : Source file for the Tag Trailer Module.
+ *                The last 160 bytes of the file hold an ID3v1 tag (last
+ *                128) and/or an APEv2 footer (last 32, or the 32 before
+ *                the ID3v1 tag), so one pread finds both. The APE item
+ *                block before the footer is read with a second pread
+ *                only when there is a footer; both are parsed from the
+ *                bytes read, so the io_uring scan can queue those reads
+ *                itself (see uring.c). Values are added to the
+ *                TagInfo as frames it does not have yet: APEv2 items
+ *                first, then ID3v1 fields, so ID3v2 wins over APEv2 and
+ *                APEv2 over ID3v1.
+ *
+ *                Functions:
+ *                - add_trailer_tags()
+ *                - read_trailer_tags()
+ *                - find_ape_items()
+ *                - add_trailer_tail()
+ *                - add_ape_items()
+ *                - add_trailer_frame()
+ *                - find_tag_frame()
+ *                - id3v1_genre_name()
+ *                - id3v1_genre_index()
+ *                - id3v1_holds_edit()
+ *                - id3v1_apply_edit()
+ *                - write_id3v1_trailer()
+ *                - trailer_start()
+ *                - find_trailer_start()
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "trailer.h"
+#include "frames.h"
+#include "text.h"
+#include "stats.h"
+
+// One ID3v1 field: the frame it holds and where it is in the 128 bytes
+typedef struct Id3v1Field
+{
+    const char *frame_id;
+    int offset;
+    int width;
+} Id3v1Field;
+
+static const Id3v1Field id3v1_fields[] =
+{
+    { "TIT2", 3, 30 },
+    { "TPE1", 33, 30 },
+    { "TALB", 63, 30 },
+    { "TYER", 93, 4 },
+    { "COMM", 97, 30 },     // 28 bytes when byte 125 is 0 and byte 126 is a track number (ID3v1.1)
+};
+
+// APEv2 item keys (compared without case) and the frames they fill
+static const char *const ape_keys[][2] =
+{
+    { "Title", "TIT2" }, { "Artist", "TPE1" }, { "Album", "TALB" }, { "Year", "TYER" },
+    { "Comment", "COMM" }, { "Track", "TRCK" }, { "Genre", "TCON" }, { "Composer", "TCOM" },
+    { "Album Artist", "TPE2" }, { "Disc", "TPOS" }, { "Publisher", "TPUB" }, { "Copyright", "TCOP" },
+    { "Conductor", "TPE3" }, { "Lyricist", "TEXT" }, { "BPM", "TBPM" }, { "ISRC", "TSRC" },
+    { "Language", "TLAN" }
+};
+
+// The genres of the ID3v1 specification (numbers 0-79)
+static const char *const genres[] =
+{
+    "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge", "Hip-Hop", "Jazz",
+    "Metal", "New Age", "Oldies", "Other", "Pop", "R&B", "Rap", "Reggae", "Rock", "Techno",
+    "Industrial", "Alternative", "Ska", "Death Metal", "Pranks", "Soundtrack", "Euro-Techno",
+    "Ambient", "Trip-Hop", "Vocal", "Jazz+Funk", "Fusion", "Trance", "Classical", "Instrumental",
+    "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise", "AlternRock", "Bass", "Soul",
+    "Punk", "Space", "Meditative", "Instrumental Pop", "Instrumental Rock", "Ethnic", "Gothic",
+    "Darkwave", "Techno-Industrial", "Electronic", "Pop-Folk", "Eurodance", "Dream",
+    "Southern Rock", "Comedy", "Cult", "Gangsta", "Top 40", "Christian Rap", "Pop/Funk",
+    "Jungle", "Native American", "Cabaret", "New Wave", "Psychadelic", "Rave", "Showtunes",
+    "Trailer", "Lo-Fi", "Tribal", "Acid Punk", "Acid Jazz", "Polka", "Retro", "Musical",
+    "Rock & Roll", "Hard Rock"
+};
+
+// Function to decode a little-endian 32-bit field (APEv2 integers are little-endian)
+static uint decode_le32(const unsigned char *buf)
+{
+    return (uint)buf[0] | ((uint)buf[1] << 8) | ((uint)buf[2] << 16) | ((uint)buf[3] << 24);
+}
+
+/*
+ * Adds the trailer values after the ID3v2 frames (if any) have been
+ * collected. A file with no ID3v2 tag, no APEv2 tag and no ID3v1 tag is
+ * reported here, since only now is it known that it has none.
+ */
+Status add_trailer_tags(TagInfo *tagInfo, int fd)
+{
+    if(read_trailer_tags(tagInfo, fd) || tagInfo->tag_buf != NULL)
+        return e_success;
+
+    fprintf(stderr, "ERROR: No ID3 tag found in %s\n", tagInfo->src_mp3_fname);
+    return e_failure;
+}
+
+/*
+ * Reads the last TRAILER_TAIL_SIZE bytes with one pread and adds what
+ * they hold, reading the APE item block with a second pread when there
+ * is a footer. Input that is not a regular file (a pipe) has no end to
+ * read, so it has no trailer.
+ */
+int read_trailer_tags(TagInfo *tagInfo, int fd)
+{
+    unsigned char tail[TRAILER_TAIL_SIZE];
+    struct stat st;
+
+    if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size < APE_FOOTER_SIZE)
+        return 0;
+
+    size_t want = st.st_size < (off_t)sizeof(tail) ? (size_t)st.st_size : sizeof(tail);
+    ssize_t got = pread(fd, tail, want, st.st_size - want);
+    STATS_READ(got);
+    if(got != (ssize_t)want)
+        return 0;
+
+    off_t offset;
+    size_t length;
+    unsigned char *items = NULL;
+    size_t items_len = 0;
+    if(find_ape_items(tail, want, st.st_size, &offset, &length) && (items = malloc(length)) != NULL)
+    {
+        STATS_ADD(allocs, 1);
+        got = pread(fd, items, length, offset);
+        STATS_READ(got);
+        items_len = got > 0 ? (size_t)got : 0;
+    }
+
+    int found = add_trailer_tail(tagInfo, tail, want, items, items_len);
+    free(items);
+    return found;
+}
+
+// Function to find the APEv2 footer in the last bytes of a file (the 32 before an ID3v1 tag, if there is one)
+static const unsigned char *find_ape_footer(const unsigned char *tail, size_t len)
+{
+    size_t ape_end = len >= ID3V1_SIZE && memcmp(tail + len - ID3V1_SIZE, "TAG", 3) == 0 ? len - ID3V1_SIZE : len;
+
+    if(ape_end >= APE_FOOTER_SIZE && memcmp(tail + ape_end - APE_FOOTER_SIZE, "APETAGEX", 8) == 0)
+        return tail + ape_end - APE_FOOTER_SIZE;
+    return NULL;
+}
+
+/*
+ * Finds the APE item block announced by a footer in the last len bytes
+ * of a file of file_size bytes. Returns 1 with the range to read (cut
+ * to APE_ITEMS_MAX), 0 when there is no footer or its size is wrong.
+ */
+int find_ape_items(const unsigned char *tail, size_t len, off_t file_size, off_t *offset, size_t *length)
+{
+    const unsigned char *footer = find_ape_footer(tail, len);
+    if(footer == NULL)
+        return 0;
+
+    off_t footer_offset = file_size - len + (footer - tail);
+    uint size = decode_le32(footer + 12);
+    if(size <= APE_FOOTER_SIZE || (off_t)(size - APE_FOOTER_SIZE) > footer_offset)
+        return 0;
+
+    *length = size - APE_FOOTER_SIZE;
+    *offset = footer_offset - *length;
+    if(*length > APE_ITEMS_MAX)
+        *length = APE_ITEMS_MAX;
+    return 1;
+}
+
+/*
+ * Adds the values of the trailer tags from bytes already read: the last
+ * len bytes of the file and the APE item block find_ape_items() pointed
+ * at (NULL if it could not be read). Returns 1 if either tag exists.
+ */
+int add_trailer_tail(TagInfo *tagInfo, const unsigned char *tail, size_t len, const unsigned char *items, size_t items_len)
+{
+    const unsigned char *footer = find_ape_footer(tail, len);
+    int has_id3v1 = len >= ID3V1_SIZE && memcmp(tail + len - ID3V1_SIZE, "TAG", 3) == 0;
+
+    if(footer != NULL && items != NULL)
+        add_ape_items(tagInfo, items, items_len, decode_le32(footer + 16));
+
+    if(has_id3v1)
+    {
+        const unsigned char *v1 = tail + len - ID3V1_SIZE;
+        int has_track = v1[125] == 0 && v1[126] != 0;
+
+        for(size_t i = 0; i < sizeof(id3v1_fields) / sizeof(id3v1_fields[0]); i++)
+        {
+            const Id3v1Field *field = &id3v1_fields[i];
+            int width = field->offset == 97 && has_track ? 28 : field->width;
+
+            // Fields are padded with zeros or spaces
+            const unsigned char *value = v1 + field->offset;
+            size_t value_len = strnlen((const char *)value, width);
+            while(value_len > 0 && value[value_len - 1] == ' ')
+                value_len--;
+            add_trailer_frame(tagInfo, field->frame_id, e_text_latin1, value, value_len);
+        }
+
+        char number[8];
+        if(has_track)
+        {
+            int number_len = snprintf(number, sizeof(number), "%u", v1[126]);
+            add_trailer_frame(tagInfo, "TRCK", e_text_latin1, (const unsigned char *)number, number_len);
+        }
+
+        const char *genre = id3v1_genre_name(v1[127]);
+        if(genre != NULL)
+            add_trailer_frame(tagInfo, "TCON", e_text_latin1, (const unsigned char *)genre, strlen(genre));
+        else if(v1[127] != 255)
+        {
+            int number_len = snprintf(number, sizeof(number), "%u", v1[127]);
+            add_trailer_frame(tagInfo, "TCON", e_text_latin1, (const unsigned char *)number, number_len);
+        }
+    }
+    return has_id3v1 || footer != NULL;
+}
+
+// Function to add the text items of an APE item block (count items, end bytes of it read)
+void add_ape_items(TagInfo *tagInfo, const unsigned char *items, size_t end, uint count)
+{
+    size_t pos = 0;
+    for(uint i = 0; i < count && pos + 8 < end; i++)
+    {
+        uint value_size = decode_le32(items + pos);
+        uint flags = decode_le32(items + pos + 4);
+        const unsigned char *key = items + pos + 8;
+        const unsigned char *key_end = memchr(key, 0, end - pos - 8);
+        if(key_end == NULL)
+            break;
+
+        size_t value_pos = key_end - items + 1;
+        if(value_size > end - value_pos)
+            break;
+
+        for(size_t k = 0; (flags & 0x06) == 0 && k < sizeof(ape_keys) / sizeof(ape_keys[0]); k++)
+        {
+            if(strcasecmp((const char *)key, ape_keys[k][0]) == 0)
+            {
+                add_trailer_frame(tagInfo, ape_keys[k][1], e_text_utf8, items + value_pos, value_size);
+                break;
+            }
+        }
+        pos = value_pos + value_size;
+    }
+}
+
+// Function to store a trailer value: decoded to UTF-8 into the text blocks, so it outlives the read buffer
+void add_trailer_frame(TagInfo *tagInfo, const char *frame_id, unsigned char encoding, const unsigned char *value, size_t len)
+{
+    int index = tagInfo->frame_count;
+
+    if(len == 0 || find_tag_frame(tagInfo, frame_id) >= 0 || reserve_tag_frame(tagInfo) == e_failure)
+        return;
+
+    const char *text = decode_frame_text(tagInfo, encoding, value, len, &tagInfo->frame_Size[index]);
+    if(text == NULL || tagInfo->frame_Size[index] == 0)
+        return;
+
+    strcpy(tagInfo->frame_id[index], frame_id);
+    tagInfo->frame_data[index] = text;
+    tagInfo->frame_count++;
+}
+
+// Function to find a frame already collected in TagInfo
+int find_tag_frame(const TagInfo *tagInfo, const char *frame_id)
+{
+    for(int i = 0; i < tagInfo->frame_count; i++)
+        if(strcmp(tagInfo->frame_id[i], frame_id) == 0)
+            return i;
+    return -1;
+}
+
+// Function to name a genre number; numbers past the standard list have no name
+const char *id3v1_genre_name(unsigned char genre)
+{
+    if(genre < sizeof(genres) / sizeof(genres[0]))
+        return genres[genre];
+    return NULL;
+}
+
+// Function to turn a genre (name, "(N)" or "N") into its ID3v1 number
+unsigned char id3v1_genre_index(const char *name, size_t len)
+{
+    char buffer[64];
+
+    if(len >= sizeof(buffer))
+        return 255;
+    memcpy(buffer, name, len);
+    buffer[len] = '\0';
+
+    const char *number = buffer[0] == '(' ? buffer + 1 : buffer;
+    char *end;
+    long value = strtol(number, &end, 10);
+    if(end != number && (*end == '\0' || *end == ')') && value >= 0 && value < 255)
+        return value;
+
+    for(size_t i = 0; i < sizeof(genres) / sizeof(genres[0]); i++)
+        if(strcasecmp(buffer, genres[i]) == 0)
+            return i;
+    return 255;
+}
+
+/*
+ * True when the file ends in an ID3v1 tag and every frame of the edit is
+ * one of its fields with a value that fits: ISO-8859-1 text within the
+ * field width, a track number 1-255, a known genre.
+ */
+int id3v1_holds_edit(const Edit *edit, int fd)
+{
+    unsigned char trailer[ID3V1_SIZE] = { 0 };
+
+    // Built with the edit applied, so a new track number already narrows the comment
+    id3v1_apply_edit(edit, fd, trailer);
+    if(memcmp(trailer, "TAG", 3) != 0)
+        return 0;
+
+    for(int i = 0; i < edit->frame_count; i++)
+    {
+        const FrameEdit *frame = &edit->frames[i];
+        char *end;
+
+        if(strcmp(frame->frame_id, "TRCK") == 0)
+        {
+            long number = strtol(frame->data, &end, 10);
+            if(*end != '\0' || number <= 0 || number > 255)
+                return 0;
+            continue;
+        }
+        if(strcmp(frame->frame_id, "TCON") == 0)
+        {
+            if(id3v1_genre_index(frame->data, frame->size) == 255)
+                return 0;
+            continue;
+        }
+
+        // Only the comment without a description has an ID3v1 field
+        const char *frame_id = strcmp(frame->frame_id, "TDRC") == 0 ? "TYER" : frame->frame_id;
+        if(frame->description_size > 0)
+            frame_id = "";
+        int width = 0;
+        for(size_t f = 0; f < sizeof(id3v1_fields) / sizeof(id3v1_fields[0]); f++)
+            if(strcmp(frame_id, id3v1_fields[f].frame_id) == 0)
+                width = id3v1_fields[f].offset == 97 && trailer[125] == 0 && trailer[126] != 0 ? 28 : id3v1_fields[f].width;
+
+        // Characters past U+00FF, or more characters than the field has, would be lost
+        size_t chars;
+        if(width == 0 || choose_text_encoding(-1, 3, frame->data, frame->size) != e_text_latin1 ||
+           utf8_prefix(frame->data, frame->size, width, &chars) != frame->size)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Reads the last 128 bytes of fd and, if they are an ID3v1 tag, puts
+ * the edit's values for title, artist, album, year, comment, track and
+ * genre into a copy of them (ISO-8859-1, '?' for characters it cannot
+ * hold, cut to the field width). Returns 1 if the copy differs.
+ */
+int id3v1_apply_edit(const Edit *edit, int fd, unsigned char *trailer)
+{
+    unsigned char old[ID3V1_SIZE];
+    struct stat st;
+
+    if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size < ID3V1_SIZE)
+        return 0;
+
+    ssize_t got = pread(fd, old, ID3V1_SIZE, st.st_size - ID3V1_SIZE);
+    STATS_READ(got);
+    if(got != ID3V1_SIZE || memcmp(old, "TAG", 3) != 0)
+        return 0;
+    memcpy(trailer, old, ID3V1_SIZE);
+
+    int track = old[125] == 0 ? old[126] : 0;
+    for(int i = 0; i < edit->frame_count; i++)
+    {
+        const FrameEdit *frame = &edit->frames[i];
+
+        if(strcmp(frame->frame_id, "TRCK") == 0)
+        {
+            long number = strtol(frame->data, NULL, 10);
+            if(number > 0 && number < 256)
+                track = number;
+            continue;
+        }
+        if(strcmp(frame->frame_id, "TCON") == 0)
+        {
+            trailer[127] = id3v1_genre_index(frame->data, frame->size);
+            continue;
+        }
+
+        const char *frame_id = strcmp(frame->frame_id, "TDRC") == 0 ? "TYER" : frame->frame_id;
+        if(frame->description_size > 0)
+            continue;
+        for(size_t f = 0; f < sizeof(id3v1_fields) / sizeof(id3v1_fields[0]); f++)
+        {
+            const Id3v1Field *field = &id3v1_fields[f];
+            if(strcmp(frame_id, field->frame_id) != 0)
+                continue;
+
+            unsigned char encoded[TEXT_ENCODED_MAX(ID3V1_SIZE)];
+            size_t len = frame->size < ID3V1_SIZE ? frame->size : ID3V1_SIZE;
+            len = encode_text(e_text_latin1, frame->data, len, encoded);
+            if(len > (size_t)field->width)
+                len = field->width;
+
+            memset(trailer + field->offset, 0, field->width);
+            memcpy(trailer + field->offset, encoded, len);
+        }
+    }
+
+    // A track number takes the last two comment bytes (ID3v1.1), so a longer comment is cut to 28
+    if(track != 0)
+    {
+        trailer[125] = 0;
+        trailer[126] = track;
+    }
+
+    return memcmp(old, trailer, ID3V1_SIZE) != 0;
+}
+
+// Function to overwrite the ID3v1 tag at the end of fd
+Status write_id3v1_trailer(int fd, const unsigned char *trailer)
+{
+    struct stat st;
+
+    if(fstat(fd, &st) == -1 || st.st_size < ID3V1_SIZE)
+        return e_failure;
+
+    ssize_t written = pwrite(fd, trailer, ID3V1_SIZE, st.st_size - ID3V1_SIZE);
+    STATS_WRITE(written);
+    if(written != ID3V1_SIZE)
+    {
+        perror("pwrite");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/*
+ * The audio data ends where the trailer tags begin: before the ID3v1
+ * tag, and before the APE items (and the APE header, when footer flag
+ * bit 31 says there is one).
+ */
+off_t trailer_start(int fd, off_t file_size)
+{
+    unsigned char tail[TRAILER_TAIL_SIZE];
+
+    if(file_size < APE_FOOTER_SIZE)
+        return file_size;
+
+    size_t want = file_size < (off_t)sizeof(tail) ? (size_t)file_size : sizeof(tail);
+    ssize_t got = pread(fd, tail, want, file_size - want);
+    STATS_READ(got);
+    if(got != (ssize_t)want)
+        return file_size;
+    return find_trailer_start(tail, want, file_size);
+}
+
+// Function to find where the trailer tags begin from the last len bytes of a file of file_size bytes
+off_t find_trailer_start(const unsigned char *tail, size_t len, off_t file_size)
+{
+    off_t end = file_size;
+    if(len >= ID3V1_SIZE && memcmp(tail + len - ID3V1_SIZE, "TAG", 3) == 0)
+        end -= ID3V1_SIZE;
+
+    const unsigned char *footer = find_ape_footer(tail, len);
+    if(footer != NULL)
+    {
+        off_t size = decode_le32(footer + 12) + ((decode_le32(footer + 20) & 0x80000000u) ? APE_FOOTER_SIZE : 0);
+        if(size <= end)
+            end -= size;
+    }
+    return end;
+}
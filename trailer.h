@@ -0,0 +1,92 @@
+/***********************************************************************
+ *  File Name   : trailer.h
+ *  Description : Header file for the Tag Trailer Module.
+ *                Declares the readers for the tags kept at the end of
+ *                an MP3 file: the 128-byte ID3v1 (v1.1) tag and the
+ *                APEv2 tag, whose 32-byte footer sits at the end of the
+ *                file or just before the ID3v1 tag. Both are found with
+ *                one pread of the file's last bytes. Their values fill
+ *                in frames the ID3v2 tag does not have; the precedence
+ *                is ID3v2, then APEv2, then ID3v1. Edits write the
+ *                ID3v1 fields back in place.
+ *
+ *                Functions:
+ *                - add_trailer_tags()
+ *                - read_trailer_tags()
+ *                - find_ape_items()
+ *                - add_trailer_tail()
+ *                - add_ape_items()
+ *                - add_trailer_frame()
+ *                - find_tag_frame()
+ *                - id3v1_genre_name()
+ *                - id3v1_genre_index()
+ *                - id3v1_holds_edit()
+ *                - id3v1_apply_edit()
+ *                - write_id3v1_trailer()
+ *                - trailer_start()
+ *                - find_trailer_start()
+ *
+ ***********************************************************************/
+
+#ifndef TRAILER_H
+#define TRAILER_H
+
+#include "types.h"
+#include "view.h"
+#include "edit.h"
+
+// Size of an ID3v1 tag ("TAG" + fields)
+#define ID3V1_SIZE 128
+
+// Size of an APEv2 header or footer
+#define APE_FOOTER_SIZE 32
+
+// Largest APE item block that is read (items past it, e.g. embedded pictures, are ignored)
+#define APE_ITEMS_MAX (1024 * 1024)
+
+// Bytes at the end of a file that hold both trailer tags (or their footer)
+#define TRAILER_TAIL_SIZE (ID3V1_SIZE + APE_FOOTER_SIZE)
+
+// Function to read the trailer tags of fd into TagInfo; fails only when the file has no tag of any kind
+Status add_trailer_tags(TagInfo *tagInfo, int fd);
+
+// Function to add the APEv2 and ID3v1 values for frames TagInfo does not have yet; returns 1 if either tag exists
+int read_trailer_tags(TagInfo *tagInfo, int fd);
+
+// Function to find the APEv2 item block to read from the last len bytes of a file; returns 1 if there is one
+int find_ape_items(const unsigned char *tail, size_t len, off_t file_size, off_t *offset, size_t *length);
+
+// Function to add the ID3v1 and APEv2 values from the last bytes of a file and its APE items; returns 1 if either tag exists
+int add_trailer_tail(TagInfo *tagInfo, const unsigned char *tail, size_t len, const unsigned char *items, size_t items_len);
+
+// Function to add the text items of an APEv2 item block
+void add_ape_items(TagInfo *tagInfo, const unsigned char *items, size_t end, uint count);
+
+// Function to add one value as a frame unless TagInfo already has that frame
+void add_trailer_frame(TagInfo *tagInfo, const char *frame_id, unsigned char encoding, const unsigned char *value, size_t len);
+
+// Function to find a frame in TagInfo by ID (-1 if it is not there)
+int find_tag_frame(const TagInfo *tagInfo, const char *frame_id);
+
+// Function to get the name of an ID3v1 genre number (NULL past the standard list)
+const char *id3v1_genre_name(unsigned char genre);
+
+// Function to find the ID3v1 genre number of a name or of "(N)" / "N" (255 if there is none)
+unsigned char id3v1_genre_index(const char *name, size_t len);
+
+// Function to check whether fd has an ID3v1 tag that can hold every value of the edit without loss
+int id3v1_holds_edit(const Edit *edit, int fd);
+
+// Function to build the ID3v1 tag of fd with the edit's values; returns 1 if the file has one and it changes
+int id3v1_apply_edit(const Edit *edit, int fd, unsigned char *trailer);
+
+// Function to write an ID3v1 tag over the last 128 bytes of fd
+Status write_id3v1_trailer(int fd, const unsigned char *trailer);
+
+// Function to find where the trailer tags of a file of file_size bytes begin (file_size if it has none)
+off_t trailer_start(int fd, off_t file_size);
+
+// Function to find where the trailer tags begin from the last bytes of a file already read
+off_t find_trailer_start(const unsigned char *tail, size_t len, off_t file_size);
+
+#endif  // TRAILER_H
@@ -7,7 +7,7 @@
  *                Type Definitions:
  *                - uint
  *                - Status (e_success, e_failure)
- *                - OperationType (e_display, e_edit, e_unsupported)
+ *                - OperationType (e_display, e_edit, e_batch, e_query, e_extract, e_serve, e_client, e_watch, e_unsupported)
  *
  *                Macros:
  *                - MAX_FRAME_COUNT
@@ -30,8 +30,8 @@
 // Define shorthand for unsigned int
 typedef unsigned int uint;
 
-// Maximum number of frames to be processed (can be updated as needed)
-#define MAX_FRAME_COUNT 8
+// Maximum number of frames asked for in one query
+#define MAX_FRAME_COUNT 64
 
 // Size of a frame ID in bytes (ID3 uses 4-character frame IDs)
 #define FRAME_ID_SIZE 4
@@ -57,12 +57,24 @@ typedef enum
  * Enum representing the type of operation requested
  * e_display     → View the ID3 tag data
  * e_edit        → Edit a frame in the ID3 tag (for future extension)
+ * e_batch       → Apply a manifest of edits to many files
+ * e_query       → Print only the requested frames
+ * e_extract     → Write the attached picture to an image file
+ * e_serve       → Run the tag daemon on a Unix socket
+ * e_client      → Send requests to the tag daemon
+ * e_watch       → Follow a directory with inotify and re-read changed files
  * e_unsupported → Invalid or unsupported operation
  */
 typedef enum
 {
     e_display,
     e_edit,
+    e_batch,
+    e_query,
+    e_extract,
+    e_serve,
+    e_client,
+    e_watch,
     e_unsupported
 } OperationType;
 
@@ -0,0 +1,121 @@
+/***********************************************************************
+ *  File Name   : unsync.c
+ *  Description : Source file for the ID3 unsynchronisation module.
+ *                The only byte that matters is 0xFF, so the kernel is a
+ *                search for it: a compare against a vector of 0xFF and
+ *                a movemask per block. Decoding then drops the 0x00 that
+ *                follows a found 0xFF, encoding inserts one where the
+ *                next byte needs it; everything between two 0xFF bytes
+ *                is moved as one run.
+ *
+ *                Functions:
+ *                - unsync_decode()
+ *                - unsync_encode()
+ *                - ff_prefix()
+ *
+ ***********************************************************************/
+
+#include <string.h>
+
+#include "unsync.h"
+#include "cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#ifdef CPU_AVX2
+__attribute__((target("avx2")))
+static size_t ff_prefix_avx2(const unsigned char *src, size_t len)
+{
+    const __m256i ff = _mm256_set1_epi8((char)0xFF);
+    size_t i = 0;
+
+    for(; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, ff));
+        if(mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    while(i < len && src[i] != 0xFF)
+        i++;
+    return i;
+}
+#endif
+
+// Function to count the bytes before the first 0xFF
+size_t ff_prefix(const unsigned char *src, size_t len)
+{
+    size_t i = 0;
+
+#ifdef CPU_AVX2
+    if(len >= 32 && cpu_has_avx2())
+        return ff_prefix_avx2(src, len);
+#endif
+#ifdef CPU_SSE2
+    const __m128i ff = _mm_set1_epi8((char)0xFF);
+    for(; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, ff));
+        if(mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    while(i < len && src[i] != 0xFF)
+        i++;
+    return i;
+}
+
+/*
+ * Decodes in place: each run up to the next 0xFF is moved down over the
+ * bytes dropped so far (nothing moves until the first 0x00 is dropped).
+ */
+size_t unsync_decode(unsigned char *data, size_t len)
+{
+    size_t in = 0, out = 0;
+
+    while(in < len)
+    {
+        size_t run = ff_prefix(data + in, len - in);
+        if(out != in)
+            memmove(data + out, data + in, run);
+        in += run;
+        out += run;
+        if(in == len)
+            break;
+
+        data[out++] = 0xFF;
+        in++;
+        if(in < len && data[in] == 0x00)
+            in++;
+    }
+    return out;
+}
+
+/*
+ * Encodes into a separate buffer: runs are copied as they are, and a
+ * 0x00 is added after a 0xFF that ends the data or is followed by 0x00
+ * or by a byte that would complete a sync pattern (>= 0xE0).
+ */
+size_t unsync_encode(const unsigned char *src, size_t len, unsigned char *out)
+{
+    size_t in = 0, pos = 0;
+
+    while(in < len)
+    {
+        size_t run = ff_prefix(src + in, len - in);
+        memcpy(out + pos, src + in, run);
+        in += run;
+        pos += run;
+        if(in == len)
+            break;
+
+        out[pos++] = 0xFF;
+        in++;
+        if(in == len || src[in] == 0x00 || src[in] >= 0xE0)
+            out[pos++] = 0x00;
+    }
+    return pos;
+}
@@ -0,0 +1,36 @@
+/***********************************************************************
+ *  File Name   : unsync.h
+ *  Description : Header file for the ID3 unsynchronisation module.
+ *                Unsynchronisation puts a 0x00 after every 0xFF that is
+ *                followed by 0x00 or by a byte >= 0xE0 (or ends the
+ *                data), so no MPEG sync pattern appears inside a tag.
+ *                Both directions look for the next 0xFF 16 (SSE2) or 32
+ *                (AVX2, chosen at run time) bytes at a time and move the
+ *                runs in between with memmove/memcpy, so data without
+ *                0xFF bytes is handled at memory speed. Part of libid3.
+ *
+ *                Functions:
+ *                - unsync_decode()
+ *                - unsync_encode()
+ *                - ff_prefix()
+ *
+ ***********************************************************************/
+
+#ifndef UNSYNC_H
+#define UNSYNC_H
+
+#include <stddef.h>
+
+// Largest output of unsync_encode() for len input bytes
+#define UNSYNC_ENCODED_MAX(len) (2 * (size_t)(len))
+
+// Function to remove the 0x00 after every 0xFF in place; returns the decoded length
+size_t unsync_decode(unsigned char *data, size_t len);
+
+// Function to unsynchronise len bytes into out (UNSYNC_ENCODED_MAX(len) bytes); returns the encoded length
+size_t unsync_encode(const unsigned char *src, size_t len, unsigned char *out);
+
+// Function to count the bytes before the first 0xFF (len if there is none); also finds MPEG sync words
+size_t ff_prefix(const unsigned char *src, size_t len);
+
+#endif  // UNSYNC_H
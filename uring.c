@@ -0,0 +1,629 @@
+/***********************************************************************
+ *  File Name   : uring.c
+ *  Description : Source file for the io_uring scan backend.
+ *                Sets up one io_uring with the raw system calls and
+ *                drives every file of a scan through it from a single
+ *                I/O thread. Up to URING_DEPTH files are in flight; a
+ *                file is opened, its first URING_HEAD_SIZE bytes are
+ *                read, and only when the header announces a larger tag
+ *                is a second read issued for exactly the rest of it.
+ *                The last TRAILER_TAIL_SIZE bytes (ID3v1 tag and APEv2
+ *                footer) are read next, then the APE item block when
+ *                there is a footer and the start of the audio under
+ *                --audio, so the ring thread never blocks on a read.
+ *                Each follow-up request is chained in user space when
+ *                the previous one completes, because its offset and
+ *                length are only known from what that one read; the
+ *                file size comes from an fstat() of the inode the open
+ *                just loaded. Finished jobs are handed to the
+ *                printing thread exactly like the thread pool does.
+ *                Kernels (or sandboxes) without io_uring, or without
+ *                the openat/read/close opcodes, make uring_open() fail
+ *                and the scan falls back to the thread pool.
+ *
+ *                Functions:
+ *                - uring_open()
+ *                - uring_close()
+ *                - uring_scan_worker()
+ *                - uring_get_sqe()
+ *                - uring_submit()
+ *                - uring_start_file()
+ *                - uring_complete()
+ *                - uring_grow_slot()
+ *                - uring_read()
+ *                - uring_read_tail()
+ *                - uring_read_audio()
+ *                - uring_close_file()
+ *                - uring_fail_job()
+ *                - uring_finish_tag()
+ *
+ ***********************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+#include "id3.h"
+#include "mpeg.h"
+#include "stats.h"
+#include "trailer.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define URING_SUPPORTED 1
+#endif
+
+#ifdef URING_SUPPORTED
+
+static struct io_uring_sqe *uring_get_sqe(UringRing *ring, UringSlot *slot);
+static Status uring_submit(UringRing *ring, unsigned wait);
+static void uring_start_file(UringRing *ring, UringSlot *slot, ScanPool *pool);
+static int uring_complete(UringRing *ring, UringSlot *slot, int res, ScanPool *pool);
+static Status uring_grow_slot(UringSlot *slot, size_t size);
+static void uring_read(UringRing *ring, UringSlot *slot, unsigned char *buf, size_t len, off_t offset);
+static int uring_read_tail(UringRing *ring, UringSlot *slot, ScanPool *pool);
+static int uring_read_audio(UringRing *ring, UringSlot *slot, ScanPool *pool);
+static void uring_close_file(UringRing *ring, UringSlot *slot);
+static void uring_fail_job(UringSlot *slot, ScanPool *pool);
+static void uring_finish_tag(UringSlot *slot, ScanPool *pool);
+
+// Function to check that the kernel implements every opcode the scan uses
+static int uring_probe_ops(int fd)
+{
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    int ok = 0;
+
+    if(probe == NULL)
+        return 0;
+    if(syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+    {
+        static const int ops[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+        ok = 1;
+        for(size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+            if(ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+                ok = 0;
+    }
+    free(probe);
+    return ok;
+}
+
+/*
+ * Creates the ring and maps the submission queue, the completion queue
+ * and the SQE array. Any failure (ENOSYS, EPERM under seccomp, a kernel
+ * too old for the opcodes) leaves ring->fd at -1 and returns e_failure.
+ */
+Status uring_open(UringRing *ring, unsigned entries)
+{
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if(ring->fd < 0)
+    {
+        ring->fd = -1;
+        return e_failure;
+    }
+
+    if(!uring_probe_ops(ring->fd))
+    {
+        uring_close(ring);
+        return e_failure;
+    }
+
+    ring->entries = params.sq_entries;
+    ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(ring->cq_map_len > ring->sq_map_len)
+            ring->sq_map_len = ring->cq_map_len;
+        ring->cq_map_len = 0;
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sq_map == MAP_FAILED)
+    {
+        ring->sq_map = NULL;
+        uring_close(ring);
+        return e_failure;
+    }
+
+    ring->cq_map = ring->sq_map;
+    if(ring->cq_map_len > 0)
+    {
+        ring->cq_map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cq_map == MAP_FAILED)
+        {
+            ring->cq_map = NULL;
+            uring_close(ring);
+            return e_failure;
+        }
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        uring_close(ring);
+        return e_failure;
+    }
+
+    char *sq = ring->sq_map;
+    char *cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = cq + params.cq_off.cqes;
+    return e_success;
+}
+
+// Function to unmap whatever was mapped and close the ring
+void uring_close(UringRing *ring)
+{
+    if(ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_len);
+    if(ring->cq_map != NULL && ring->cq_map != ring->sq_map)
+        munmap(ring->cq_map, ring->cq_map_len);
+    if(ring->sq_map != NULL)
+        munmap(ring->sq_map, ring->sq_map_len);
+    if(ring->fd >= 0)
+        close(ring->fd);
+    free(ring->out.data);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+/*
+ * Keeps the ring full: new files are opened while fewer than
+ * URING_DEPTH are in flight, and every completion either queues the
+ * file's next request or releases its slot. Each slot has at most one
+ * request outstanding, so the submission queue (sized to the depth)
+ * can never overflow.
+ */
+void *uring_scan_worker(void *arg)
+{
+    ScanPool *pool = arg;
+    UringRing *ring = pool->ring;
+    unsigned depth = ring->entries < URING_DEPTH ? ring->entries : URING_DEPTH;
+    UringSlot *slots = calloc(depth, sizeof(UringSlot));
+    int *free_slots = malloc(sizeof(int) * depth);
+    int free_count = depth;
+    int next_job = 0;
+    unsigned active = 0;
+
+    if(slots == NULL || free_slots == NULL)
+    {
+        // Without slots nothing can be read; fail the jobs so the printer does not wait forever
+        for(int i = 0; i < pool->job_count; i++)
+        {
+            pool->jobs[i].status = e_failure;
+            finish_scan_job(pool, i);
+        }
+        free(slots);
+        free(free_slots);
+        return NULL;
+    }
+    for(unsigned i = 0; i < depth; i++)
+    {
+        slots[i].index = i;
+        free_slots[i] = depth - 1 - i;
+    }
+
+    while(next_job < pool->job_count || active > 0)
+    {
+        // Open files in list order so the printing thread is rarely kept waiting
+        while(free_count > 0 && next_job < pool->job_count)
+        {
+            UringSlot *slot = &slots[free_slots[--free_count]];
+            slot->job = next_job++;
+            uring_start_file(ring, slot, pool);
+            active++;
+        }
+
+        if(uring_submit(ring, 1) == e_failure)
+        {
+            perror("io_uring_enter");
+            break;
+        }
+
+        // Reap every completion that is ready
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while(head != tail)
+        {
+            struct io_uring_cqe *cqe = &((struct io_uring_cqe *)ring->cqes)[head & *ring->cq_mask];
+            int index = (int)cqe->user_data;
+            int res = cqe->res;
+            head++;
+            __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+            if(uring_complete(ring, &slots[index], res, pool))
+            {
+                free_slots[free_count++] = index;
+                active--;
+            }
+            tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    // Only reached early when the ring itself failed: fail what is left
+    for(int i = 0; i < pool->job_count; i++)
+    {
+        if(!pool->jobs[i].done)
+        {
+            pool->jobs[i].status = e_failure;
+            finish_scan_job(pool, i);
+        }
+    }
+
+    for(unsigned i = 0; i < depth; i++)
+        free(slots[i].buf);
+    free(slots);
+    free(free_slots);
+    return NULL;
+}
+
+// Function to take the next submission queue entry for a slot (each slot has at most one outstanding)
+static struct io_uring_sqe *uring_get_sqe(UringRing *ring, UringSlot *slot)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe *)ring->sqes)[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = slot->index;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->sq_pending++;
+    return sqe;
+}
+
+// Function to submit the queued entries and, with wait set, block until one completion is ready
+static Status uring_submit(UringRing *ring, unsigned wait)
+{
+    for(;;)
+    {
+        unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+        int ret = syscall(__NR_io_uring_enter, ring->fd, ring->sq_pending, wait, flags, NULL, 0);
+        if(ret >= 0)
+        {
+            ring->sq_pending -= (unsigned)ret < ring->sq_pending ? (unsigned)ret : ring->sq_pending;
+            return e_success;
+        }
+        if(errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return e_failure;
+        // EAGAIN/EBUSY: completions are backed up; reap them before submitting more
+        if(errno != EINTR && __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) != *ring->cq_head)
+            return e_success;
+    }
+}
+
+// Function to queue the open of a slot's file
+static void uring_start_file(UringRing *ring, UringSlot *slot, ScanPool *pool)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring, slot);
+
+    slot->stage = e_uring_open;
+    slot->fd = -1;
+    slot->file_size = -1;
+    slot->length = 0;
+    slot->tag_end = 0;
+    slot->tail_len = 0;
+    slot->items_len = 0;
+    slot->probe_len = 0;
+    slot->audio_end = -1;
+
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (unsigned long)pool->jobs[slot->job].path;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+}
+
+/*
+ * Advances one file after a completion. Returns 1 when the slot is free
+ * again (the file was closed, or never opened).
+ */
+static int uring_complete(UringRing *ring, UringSlot *slot, int res, ScanPool *pool)
+{
+    ScanJob *job = &pool->jobs[slot->job];
+    TagHeader header;
+    struct stat st;
+    off_t offset;
+    size_t length;
+
+    switch(slot->stage)
+    {
+        case e_uring_open:
+            if(res < 0)
+            {
+                fprintf(stderr, "fopen: %s\n", strerror(-res));
+                fprintf(stderr, "ERROR: Unable to open file %s\n", job->path);
+                uring_fail_job(slot, pool);
+                return 1;
+            }
+            slot->fd = res;
+
+            // The open has just loaded the inode, so the size for the tail read costs no I/O
+            if(fstat(slot->fd, &st) == 0 && S_ISREG(st.st_mode))
+                slot->file_size = st.st_size;
+            if(uring_grow_slot(slot, URING_HEAD_SIZE) == e_failure)
+                break;
+            uring_read(ring, slot, slot->buf, URING_HEAD_SIZE, 0);
+            slot->stage = e_uring_head;
+            return 0;
+
+        case e_uring_head:
+            STATS_READ(res);
+            if(res < HEADER_SIZE)
+            {
+                fprintf(stderr, "ERROR: Unable to read the ID3 header of %s\n", job->path);
+                break;
+            }
+            // No ID3v2 tag: the file may still have a trailer
+            if(read_tag_header(slot->buf, &header) == e_failure)
+            {
+                slot->length = 0;
+                return uring_read_tail(ring, slot, pool);
+            }
+
+            slot->tag_end = HEADER_SIZE + (size_t)header.tag_size;
+            slot->length = (size_t)res < slot->tag_end ? (size_t)res : slot->tag_end;
+
+            // Chain the read of exactly the rest of the tag, unless the file ended first
+            if(slot->length < slot->tag_end && res == URING_HEAD_SIZE)
+            {
+                if(uring_grow_slot(slot, slot->tag_end) == e_failure)
+                    break;
+                uring_read(ring, slot, slot->buf + slot->length, slot->tag_end - slot->length, slot->length);
+                slot->stage = e_uring_body;
+                return 0;
+            }
+            return uring_read_tail(ring, slot, pool);
+
+        case e_uring_body:
+            STATS_READ(res);
+            if(res > 0)
+                slot->length += res;
+
+            // A short read is retried; end of file only means a truncated tag, so parse what is there
+            if(res > 0 && slot->length < slot->tag_end)
+            {
+                uring_read(ring, slot, slot->buf + slot->length, slot->tag_end - slot->length, slot->length);
+                return 0;
+            }
+            return uring_read_tail(ring, slot, pool);
+
+        case e_uring_tail:
+            STATS_READ(res);
+            // Like read_trailer_tags(): a short read means no trailer
+            if(res != (int)slot->tail_len)
+                slot->tail_len = 0;
+
+            // The APE items go after the tag in the buffer; the tag is parsed only once everything is read
+            if(find_ape_items(slot->tail, slot->tail_len, slot->file_size, &offset, &length))
+            {
+                if(uring_grow_slot(slot, slot->length + length) == e_failure)
+                    break;
+                uring_read(ring, slot, slot->buf + slot->length, length, offset);
+                slot->stage = e_uring_items;
+                return 0;
+            }
+            return uring_read_audio(ring, slot, pool);
+
+        case e_uring_items:
+            STATS_READ(res);
+            slot->items_len = res > 0 ? (size_t)res : 0;
+            return uring_read_audio(ring, slot, pool);
+
+        case e_uring_audio:
+            STATS_READ(res);
+            slot->probe_len = res > 0 ? (size_t)res : 0;
+            uring_finish_tag(slot, pool);
+            uring_close_file(ring, slot);
+            return 0;
+
+        case e_uring_close:
+            return 1;
+    }
+
+    // Failure after the open: report the job and close the file
+    uring_fail_job(slot, pool);
+    uring_close_file(ring, slot);
+    return 0;
+}
+
+// Function to make sure the slot's buffer holds at least size bytes
+static Status uring_grow_slot(UringSlot *slot, size_t size)
+{
+    if(slot->buf_size >= size)
+        return e_success;
+
+    unsigned char *buf = realloc(slot->buf, size);
+    if(buf == NULL)
+        return e_failure;
+    STATS_ADD(allocs, 1);
+    slot->buf = buf;
+    slot->buf_size = size;
+    return e_success;
+}
+
+// Function to queue a read of len bytes at offset of the slot's file into buf
+static void uring_read(UringRing *ring, UringSlot *slot, unsigned char *buf, size_t len, off_t offset)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring, slot);
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot->fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->off = offset;
+}
+
+// Function to queue the read of the file's last bytes once the tag is complete; returns 0 (the slot stays busy)
+static int uring_read_tail(UringRing *ring, UringSlot *slot, ScanPool *pool)
+{
+    // A pipe or a file shorter than an APE footer has no trailer
+    if(slot->file_size < APE_FOOTER_SIZE)
+        return uring_read_audio(ring, slot, pool);
+
+    slot->tail_len = slot->file_size < TRAILER_TAIL_SIZE ? (size_t)slot->file_size : TRAILER_TAIL_SIZE;
+    uring_read(ring, slot, slot->tail, slot->tail_len, slot->file_size - slot->tail_len);
+    slot->stage = e_uring_tail;
+    return 0;
+}
+
+/*
+ * Under --audio, queues the read of the first AUDIO_PROBE_SIZE bytes of
+ * the audio (between the ID3v2 tag and the trailer tags, as
+ * find_audio_range() has it); otherwise, or when there is no audio,
+ * finishes the file. Returns 0 (the slot stays busy until the close).
+ */
+static int uring_read_audio(UringRing *ring, UringSlot *slot, ScanPool *pool)
+{
+    TagHeader header;
+
+    if(get_audio_mode() != e_audio_off && slot->file_size >= 0)
+    {
+        if(slot->length == 0 || read_tag_header(slot->buf, &header) == e_failure)
+            memset(&header, 0, sizeof(header));
+        slot->audio_end = slot->tail_len > 0 ? find_trailer_start(slot->tail, slot->tail_len, slot->file_size) : slot->file_size;
+        slot->audio_start = audio_start(&header);
+        if(slot->audio_start > slot->audio_end)
+            slot->audio_start = slot->audio_end;     // Truncated inside the tag: no audio
+
+        size_t pos = slot->length + slot->items_len;
+        size_t want = slot->audio_end - slot->audio_start < AUDIO_PROBE_SIZE ? (size_t)(slot->audio_end - slot->audio_start) : AUDIO_PROBE_SIZE;
+        if(want > 0 && uring_grow_slot(slot, pos + want) == e_success)
+        {
+            uring_read(ring, slot, slot->buf + pos, want, slot->audio_start);
+            slot->stage = e_uring_audio;
+            return 0;
+        }
+    }
+
+    uring_finish_tag(slot, pool);
+    uring_close_file(ring, slot);
+    return 0;
+}
+
+// Function to queue the close of the slot's file; its completion frees the slot
+static void uring_close_file(UringRing *ring, UringSlot *slot)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring, slot);
+
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = slot->fd;
+    slot->stage = e_uring_close;
+}
+
+// Function to finish a job that could not be read; its output is just the file line (table format only), as with the thread pool
+static void uring_fail_job(UringSlot *slot, ScanPool *pool)
+{
+    ScanJob *job = &pool->jobs[slot->job];
+    int len = 0;
+
+    job->output = NULL;
+    if(get_output_format() == e_format_table)
+        len = asprintf(&job->output, "File: %s\n", job->path);
+    if(len < 0)
+        job->output = NULL;
+    job->output_len = len < 0 ? 0 : (size_t)len;
+    job->status = e_failure;
+    finish_scan_job(pool, slot->job);
+}
+
+// Function to parse a fully read tag, format it into the job's output and hand the job to the printer
+static void uring_finish_tag(UringSlot *slot, ScanPool *pool)
+{
+    ScanJob *job = &pool->jobs[slot->job];
+    TagInfo tagInfo;
+
+    memset(&tagInfo, 0, sizeof(tagInfo));
+    tagInfo.src_mp3_fname = job->path;
+    if(open_scan_output(job, &tagInfo) == e_failure)
+    {
+        uring_fail_job(slot, pool);
+        return;
+    }
+
+    if(slot->length > 0)
+    {
+        read_tag_header(slot->buf, &tagInfo.header);
+        tagInfo.tag_buf = slot->buf;
+        tagInfo.tag_end = slot->length;
+    }
+
+    // The trailer tags and the APE items were read by the ring after the tag
+    long long start = STATS_START();
+    job->status = parse_tag_frames(&tagInfo);
+    if(job->status == e_success &&
+       !add_trailer_tail(&tagInfo, slot->tail, slot->tail_len, slot->buf + slot->length, slot->items_len) && tagInfo.tag_buf == NULL)
+    {
+        fprintf(stderr, "ERROR: No ID3 tag found in %s\n", job->path);
+        job->status = e_failure;
+    }
+    STATS_PHASE(e_phase_parse, start);
+    if(job->status == e_success)
+    {
+        // As read_audio_info() does, audio without a frame is still printed, as "none"
+        if(slot->audio_end >= 0)
+        {
+            start = STATS_START();
+            if(probe_audio_data(slot->buf + slot->length + slot->items_len, slot->probe_len,
+                                slot->audio_start, slot->audio_end, &tagInfo.audio) == e_failure)
+            {
+                memset(&tagInfo.audio, 0, sizeof(tagInfo.audio));
+                tagInfo.audio.source = "none";
+            }
+            STATS_PHASE(e_phase_mpeg, start);
+        }
+
+        start = STATS_START();
+        print_scan_output(job, &tagInfo, &pool->ring->out);
+        STATS_PHASE(e_phase_output, start);
+    }
+
+    release_tag_text(&tagInfo);
+    if(tagInfo.fptr_out != NULL)
+        fclose(tagInfo.fptr_out);
+    finish_scan_job(pool, slot->job);
+}
+
+#else
+
+// io_uring is not available on this platform: the scan always uses the thread pool
+Status uring_open(UringRing *ring, unsigned entries)
+{
+    (void)entries;
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    return e_failure;
+}
+
+void uring_close(UringRing *ring)
+{
+    (void)ring;
+}
+
+void *uring_scan_worker(void *arg)
+{
+    (void)arg;
+    return NULL;
+}
+
+#endif  // URING_SUPPORTED
@@ -0,0 +1,111 @@
+/***********************************************************************
+ *  File Name   : uring.h
+ *  Description : Header file for the io_uring scan backend.
+ *                Declares a minimal io_uring ring (set up with the raw
+ *                system calls, no liburing) and the scan loop that keeps
+ *                up to URING_DEPTH files in flight: each file moves
+ *                through open → read header → read rest of tag → read
+ *                the trailer tags (→ APE items → start of the audio)
+ *                → close as its completions arrive, so the device sees
+ *                a deep queue instead of one request per thread.
+ *
+ *                Structures:
+ *                - UringRing
+ *                - UringSlot
+ *
+ *                Functions:
+ *                - uring_open()
+ *                - uring_close()
+ *                - uring_scan_worker()
+ *
+ ***********************************************************************/
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+
+#include "types.h"
+#include "scan.h"
+#include "trailer.h"
+
+// Files kept in flight at once (ring size)
+#define URING_DEPTH 256
+
+// Bytes read with the header; covers the whole tag of most files in one request
+#define URING_HEAD_SIZE 4096
+
+// Submission and completion rings shared with the kernel
+typedef struct UringRing
+{
+    int fd;                         // io_uring file descriptor (-1 when not set up)
+    unsigned entries;               // Submission queue size
+    unsigned *sq_head;              // Kernel-owned submission head
+    unsigned *sq_tail;              // Our submission tail
+    unsigned *sq_mask;              // Submission index mask
+    unsigned *sq_array;             // Submission slot → SQE index
+    void *sqes;                     // Submission queue entries
+    unsigned sq_pending;            // SQEs queued but not yet submitted
+    unsigned *cq_head;              // Our completion head
+    unsigned *cq_tail;              // Kernel-owned completion tail
+    unsigned *cq_mask;              // Completion index mask
+    void *cqes;                     // Completion queue entries
+    void *sq_map;                   // Mapping of the submission ring
+    size_t sq_map_len;
+    void *cq_map;                   // Mapping of the completion ring (may equal sq_map)
+    size_t cq_map_len;
+    size_t sqes_len;                // Length of the SQE mapping
+    OutBuf out;                     // Records formatted by the ring thread (--format), reused for every file
+} UringRing;
+
+/*
+ * Stage of one file in flight
+ * e_uring_open  → openat submitted
+ * e_uring_head  → first URING_HEAD_SIZE bytes requested
+ * e_uring_body  → rest of the tag requested (exact size from the header)
+ * e_uring_tail  → last TRAILER_TAIL_SIZE bytes requested (ID3v1 tag, APEv2 footer)
+ * e_uring_items → APEv2 item block requested (only when the tail has a footer)
+ * e_uring_audio → first AUDIO_PROBE_SIZE bytes of the audio requested (--audio only)
+ * e_uring_close → close submitted
+ */
+typedef enum
+{
+    e_uring_open,
+    e_uring_head,
+    e_uring_body,
+    e_uring_tail,
+    e_uring_items,
+    e_uring_audio,
+    e_uring_close
+} UringStage;
+
+// One file in flight
+typedef struct UringSlot
+{
+    int index;                      // Position in the slot array (user_data of its requests)
+    int job;                        // Index of the ScanJob
+    UringStage stage;               // Request currently outstanding
+    int fd;                         // Descriptor once opened
+    off_t file_size;                // Size of the file (-1 when it is not a regular file)
+    unsigned char *buf;             // Tag, then APE items, then start of the audio (grown when needed)
+    size_t buf_size;                // Capacity of buf
+    size_t length;                  // Bytes of the tag read so far
+    size_t tag_end;                 // 10 + tag size from the header
+    unsigned char tail[TRAILER_TAIL_SIZE];  // Last bytes of the file
+    size_t tail_len;                // Bytes of tail read (0 when there is none)
+    size_t items_len;               // Bytes of APE items read into buf after the tag
+    size_t probe_len;               // Bytes of audio read into buf after the APE items
+    off_t audio_start;              // Where the audio starts (--audio)
+    off_t audio_end;                // Where the audio ends, -1 when it is not measured
+} UringSlot;
+
+// Function to set up the rings; fails (so the caller can fall back) where io_uring is unavailable
+Status uring_open(UringRing *ring, unsigned entries);
+
+// Function to unmap the rings and close the ring descriptor
+void uring_close(UringRing *ring);
+
+// Thread entry point: runs every job of the pool through the ring (arg is a ScanPool with a ring)
+void *uring_scan_worker(void *arg);
+
+#endif  // URING_H
@@ -9,9 +9,20 @@
  *                - open_files()
  *                - check_operation_type()
  *                - display_tag()
- *                - read_frame_id()
- *                - read_frame_size()
- *                - read_frame_data()
+ *                - read_tag_info()
+ *                - print_tag_record()
+ *                - load_tag_block()
+ *                - map_tag_file()
+ *                - read_tag_file()
+ *                - release_tag_block()
+ *                - parse_tag_frames()
+ *                - reserve_tag_frame()
+ *                - decode_frame_text()
+ *                - release_tag_text()
+ *                - measure_audio()
+ *                - print_tag()
+ *                - check_frame_index()
+ *                - collect_frame()
  *                - read_data_from_file()
  *                - read_size_from_file()
  *
@@ -21,11 +32,13 @@
 
 #include "view.h"
 #include "types.h"
-
-// Array of known frame IDs in ID3v2 tags
-const char *tags_name[MAX_FRAME_COUNT] = {"TPE1", "TIT2", "TALB", "TYER", "TCON", "TEXT", "TCOM", "COMM"};
-// Corresponding human-readable labels for the above frame IDs
-const char *tag_labels[MAX_FRAME_COUNT] = {"Artist", "Title", "Album", "Year", "Genre", "Lyricist", "Composer", "Comments"};  
+#include "id3.h"
+#include "frames.h"
+#include "text.h"
+#include "stats.h"
+#include "trailer.h"
+#include "hash.h"
+#include "output.h"
 
 // Function to validate input arguments and extract the MP3 filename
 Status read_and_validate_args(char **argv, TagInfo *tagInfo)
@@ -34,8 +47,8 @@ Status read_and_validate_args(char **argv, TagInfo *tagInfo)
     if(argv[2] == NULL)
         return e_failure;
 
-    // Ensure file ends with ".mp3"
-    if(strncmp(argv[2] + strlen(argv[2]) - 4, ".mp3", 4) != 0)
+    // Ensure file ends with ".mp3" ("-" reads the tag from stdin)
+    if(strcmp(argv[2], "-") != 0 && (strlen(argv[2]) < 4 || strncmp(argv[2] + strlen(argv[2]) - 4, ".mp3", 4) != 0))
     {
         fprintf(stderr, "File should be .mp3 file\n");
         return e_failure;
@@ -43,62 +56,323 @@ Status read_and_validate_args(char **argv, TagInfo *tagInfo)
 
     // Store the filename in the tagInfo structure
     tagInfo->src_mp3_fname = strdup(argv[2]);
+    tagInfo->fptr_out = stdout;
     return e_success;
 }
 
 // Function to display the ID3 tag frames from the MP3 file
 Status display_tag(TagInfo *tagInfo)
 {
-    int index = 0;
+    if(read_tag_info(tagInfo) == e_failure)
+        return e_failure;
 
-    // Determine the file size and set file pointer to start after header
-    fseek(tagInfo->fptr_src_mp3, 0, SEEK_END);
-    int file_end = ftell(tagInfo->fptr_src_mp3);
-    fseek(tagInfo->fptr_src_mp3, 10, SEEK_SET);  // Skip 10-byte ID3 header
+    long long start = STATS_START();
+    Status status = e_success;
+    if(get_output_format() == e_format_table)
+        print_tag(tagInfo);
+    else
+        status = print_tag_record(tagInfo);
+    STATS_PHASE(e_phase_output, start);
+
+    release_tag_block(tagInfo);
+    return status;
+}
 
-    // Read each frame sequentially
-    while(index < MAX_FRAME_COUNT && ftell(tagInfo->fptr_src_mp3) < file_end)
+/*
+ * Loads and parses the tag of the open file, adds the ID3v1/APEv2
+ * trailer and measures the audio as --audio / --hash ask. This is the
+ * one path every viewer (-v, the scan workers, the daemon and --watch)
+ * reads a file through. On success the caller releases the tag block;
+ * on failure nothing is left to release.
+ */
+Status read_tag_info(TagInfo *tagInfo)
+{
+    long long start = STATS_START();
+    if(load_tag_block(tagInfo) == e_failure)
+        return e_failure;
+    STATS_PHASE(e_phase_header, start);
+
+    start = STATS_START();
+    Status status = parse_tag_frames(tagInfo);
+    if(status == e_success)
+        status = add_trailer_tags(tagInfo, fileno(tagInfo->fptr_src_mp3));
+    STATS_PHASE(e_phase_parse, start);
+
+    // The audio starts where the tag ends
+    if(status == e_success)
+        measure_audio(tagInfo, fileno(tagInfo->fptr_src_mp3), &tagInfo->header);
+    else
+        release_tag_block(tagInfo);
+    return status;
+}
+
+// Function to write the file as one record (with the CSV/TSV column names) in a single write
+Status print_tag_record(TagInfo *tagInfo)
+{
+    OutBuf out = { 0 };
+    OutputFormat format = get_output_format();
+
+    format_header(&out, format);
+    format_tag_record(&out, format, tagInfo, tagInfo->src_mp3_fname);
+
+    Status status = e_failure;
+    if(!out.failed)
     {
-        // Read frame ID
-        if(read_frame_id(index, tagInfo) == e_failure)
-        {
-            // If unknown frame, still move pointer forward by size and continue
-            if(read_frame_size(index, tagInfo) == e_failure)
-                return e_failure;  
-            fseek(tagInfo->fptr_src_mp3, tagInfo->frame_Size[index] + 2, SEEK_CUR); // skip data and flags
-            continue;
-        }
+        struct iovec iov = { out.data, out.len };
+        fflush(tagInfo->fptr_out);
+        status = write_outputs(fileno(tagInfo->fptr_out), &iov, 1);
+    }
+    free(out.data);
+    return status;
+}
+
+/*
+ * Reads the 10-byte header, decodes the syncsafe tag size and brings the
+ * whole tag (header included) into memory in one go: a private mapping
+ * of just the tag region, or a single read into one buffer when the file
+ * cannot be mapped. The audio data after the tag is never read. A file
+ * that does not start with an ID3v2 tag is not an error yet (tag_buf is
+ * left NULL): it may still have an ID3v1 or APEv2 trailer.
+ */
+Status load_tag_block(TagInfo *tagInfo)
+{
+    unsigned char header_buf[HEADER_SIZE];
+    int fd = fileno(tagInfo->fptr_src_mp3);
+
+    tagInfo->tag_buf = NULL;
+    tagInfo->tag_end = 0;
+    tagInfo->mapped = 0;
+
+    // Read the header (pread, or fread when the input is not seekable)
+    ssize_t got = pread(fd, header_buf, HEADER_SIZE, 0);
+    STATS_READ(got);
+    if(got != HEADER_SIZE &&
+       read_data_from_file((char *)header_buf, HEADER_SIZE, tagInfo->fptr_src_mp3) == e_failure)
+    {
+        fprintf(stderr, "ERROR: Unable to read the ID3 header of %s\n", tagInfo->src_mp3_fname);
+        return e_failure;
+    }
+
+    if(read_tag_header(header_buf, &tagInfo->header) == e_failure)
+    {
+        memset(&tagInfo->header, 0, sizeof(tagInfo->header));
+        return e_success;
+    }
+
+    tagInfo->tag_end = HEADER_SIZE + (size_t)tagInfo->header.tag_size;
+    if(map_tag_file(tagInfo) == e_success)
+        return e_success;
+
+    return read_tag_file(tagInfo, header_buf);
+}
+
+// Function to map only the tag region of the file (private, so decoding an unsynchronised tag in place never reaches the file)
+Status map_tag_file(TagInfo *tagInfo)
+{
+    struct stat st;
+    int fd = fileno(tagInfo->fptr_src_mp3);
+
+    if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+        return e_failure;
+
+    // A truncated file must not be mapped past its end
+    if((off_t)tagInfo->tag_end > st.st_size)
+        tagInfo->tag_end = st.st_size;
+
+    void *map = mmap(NULL, tagInfo->tag_end, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED)
+        return e_failure;
+
+    tagInfo->tag_buf = map;
+    tagInfo->mapped = 1;
+    return e_success;
+}
+
+// Function to pull the tag into one heap buffer with a single read
+Status read_tag_file(TagInfo *tagInfo, const unsigned char *header_buf)
+{
+    unsigned char *buf = malloc(tagInfo->tag_end);
+    if(buf == NULL)
+        return e_failure;
+    STATS_ADD(allocs, 1);
+
+    memcpy(buf, header_buf, HEADER_SIZE);
+    size_t body = tagInfo->tag_end - HEADER_SIZE;
+
+    ssize_t got = pread(fileno(tagInfo->fptr_src_mp3), buf + HEADER_SIZE, body, HEADER_SIZE);
+    if(got < 0 && errno == ESPIPE)
+        got = fread(buf + HEADER_SIZE, 1, body, tagInfo->fptr_src_mp3);   // Not seekable: continue the stream
+    STATS_READ(got);
+
+    // A short read only means a truncated tag; parse what is there
+    tagInfo->tag_end = HEADER_SIZE + (got > 0 ? (size_t)got : 0);
+    tagInfo->tag_buf = buf;
+    return e_success;
+}
+
+// Function to unmap or free the tag block (and the values decoded from it)
+void release_tag_block(TagInfo *tagInfo)
+{
+    release_tag_text(tagInfo);
+    if(tagInfo->tag_buf == NULL)
+        return;
+
+    if(tagInfo->mapped)
+        munmap((void *)tagInfo->tag_buf, tagInfo->tag_end);
+    else
+        free((void *)tagInfo->tag_buf);
+    tagInfo->tag_buf = NULL;
+}
+
+/*
+ * Hands the tag block to the libid3 parser; collect_frame() records each
+ * registered frame as a view into the block, so nothing is copied. An
+ * unsynchronised tag is decoded in the block itself first, so the views
+ * stay valid after the parser is done.
+ */
+Status parse_tag_frames(TagInfo *tagInfo)
+{
+    Id3Context ctx;
+
+    tagInfo->frame_count = 0;
+    tagInfo->text = NULL;
+    if(tagInfo->tag_buf == NULL)
+        return e_success;    // No ID3v2 tag: only the trailer can add frames
+    if(id3_needs_resync(tagInfo->tag_buf, tagInfo->tag_end))
+        id3_resync((unsigned char *)tagInfo->tag_buf, tagInfo->tag_end);
+
+    id3_init(&ctx, NULL, collect_frame, tagInfo);
+    Status status = id3_parse_memory(&ctx, tagInfo->tag_buf, tagInfo->tag_end);
+    id3_release(&ctx);
+    return status;
+}
 
-        // Read frame size and data
-        if(read_frame_size(index, tagInfo) == e_failure)
-            return e_failure;
+/*
+ * Grows the frame arrays (doubling, from TAG_FRAME_ENTRIES) when the next
+ * frame would not fit, so no tag has its frames cut off. The arrays are
+ * kept until release_tag_text().
+ */
+Status reserve_tag_frame(TagInfo *tagInfo)
+{
+    if(tagInfo->frame_count < tagInfo->frame_capacity)
+        return e_success;
+
+    int capacity = tagInfo->frame_capacity ? tagInfo->frame_capacity * 2 : TAG_FRAME_ENTRIES;
+    char (*ids)[FRAME_ID_SIZE + 1] = realloc(tagInfo->frame_id, sizeof(*ids) * capacity);
+    if(ids != NULL)
+        tagInfo->frame_id = ids;
+    int *sizes = realloc(tagInfo->frame_Size, sizeof(int) * capacity);
+    if(sizes != NULL)
+        tagInfo->frame_Size = sizes;
+    const char **data = realloc(tagInfo->frame_data, sizeof(char *) * capacity);
+    if(data != NULL)
+        tagInfo->frame_data = data;
+
+    // Arrays that did grow are kept; the capacity only counts once all three have
+    if(ids == NULL || sizes == NULL || data == NULL)
+        return e_failure;
+    STATS_ADD(allocs, 3);
+    tagInfo->frame_capacity = capacity;
+    return e_success;
+}
 
-        fseek(tagInfo->fptr_src_mp3, 3, SEEK_CUR);  // Skip encoding byte and 2-byte flags
+/*
+ * Decodes one value to UTF-8 into the current text block, starting a new
+ * block when it does not fit. The worst-case size is reserved and the
+ * unused part handed back, so the next value follows directly.
+ */
+const char *decode_frame_text(TagInfo *tagInfo, unsigned char encoding, const unsigned char *text, size_t len, int *size)
+{
+    size_t reserve = TEXT_DECODED_MAX(len);
+    TextBlock *block = tagInfo->text;
 
-        if(read_frame_data(index, tagInfo) == e_failure)
-            return e_failure;
+    if(block == NULL || block->size - block->used < reserve)
+    {
+        size_t capacity = reserve > TEXT_BLOCK_SIZE ? reserve : TEXT_BLOCK_SIZE;
+        block = malloc(sizeof(TextBlock) + capacity);
+        if(block == NULL)
+            return NULL;
+        STATS_ADD(allocs, 1);
+        block->next = tagInfo->text;
+        block->used = 0;
+        block->size = capacity;
+        tagInfo->text = block;
+    }
 
-        index++;
+    char *out = block->data + block->used;
+    size_t length = decode_text(encoding, text, len, out);
+    block->used += length;
+    *size = length;
+    return out;
+}
+
+// Function to free every block of decoded values and the frame arrays that point into them
+void release_tag_text(TagInfo *tagInfo)
+{
+    while(tagInfo->text != NULL)
+    {
+        TextBlock *next = tagInfo->text->next;
+        free(tagInfo->text);
+        tagInfo->text = next;
     }
 
-    // Print the tag information in a formatted table
-    printf("===========================================================================\n");
-    printf("| %-15s:%6s%-50s|\n", "Tag Name", " ", "Tag Data");
-    printf("===========================================================================\n");
+    free(tagInfo->frame_id);
+    free(tagInfo->frame_Size);
+    free(tagInfo->frame_data);
+    tagInfo->frame_id = NULL;
+    tagInfo->frame_Size = NULL;
+    tagInfo->frame_data = NULL;
+    tagInfo->frame_count = 0;
+    tagInfo->frame_capacity = 0;
+}
+
+// Function to read what --audio and --hash ask for from the audio after the tag (a hash loaded from the index is kept)
+void measure_audio(TagInfo *tagInfo, int fd, const TagHeader *header)
+{
+    read_audio_info(fd, header, get_audio_mode(), &tagInfo->audio);
+    if(get_hash_mode() && !tagInfo->hashed && hash_audio(fd, header, &tagInfo->audio_hash) == e_success)
+        tagInfo->hashed = 1;
+}
+
+// Function to print the tag information in a formatted table to the TagInfo output stream
+void print_tag(TagInfo *tagInfo)
+{
+    FILE *out = tagInfo->fptr_out;
 
-    for (int i = 0; i < index; i++)
+    fprintf(out, "===========================================================================\n");
+    fprintf(out, "| %-15s:%6s%-50s|\n", "Tag Name", " ", "Tag Data");
+    fprintf(out, "===========================================================================\n");
+
+    for (int i = 0; i < tagInfo->frame_count; i++)
     {
-        for (int j = 0; j < MAX_FRAME_COUNT; j++)
+        const FrameDesc *desc = lookup_frame(pack_frame_id(tagInfo->frame_id[i]));
+        if (desc == NULL)
+            continue;
+
+        // Binary frames are summarised; text is not null-terminated in the mapping, so print by length
+        if (desc->kind == e_frame_binary)
         {
-            if (strcmp(tagInfo->frame_id[i], tags_name[j]) == 0)
-            {
-                printf("| %-15s:%6s%-50s|\n", tag_labels[j], " ", tagInfo->frame_data[i]);
-                break;
-            }
+            char summary[32];
+            snprintf(summary, sizeof(summary), "<binary, %d bytes>", tagInfo->frame_Size[i]);
+            fprintf(out, "| %-15s:%6s%-50s|\n", desc->label, " ", summary);
+        }
+        else
+        {
+            // Values are UTF-8: cut and pad by characters, not bytes, so the columns line up
+            size_t chars;
+            size_t bytes = utf8_prefix(tagInfo->frame_data[i], tagInfo->frame_Size[i], 50, &chars);
+            fprintf(out, "| %-15s:%6s%.*s%*s|\n", desc->label, " ", (int)bytes, tagInfo->frame_data[i],
+                    (int)(50 - chars), "");
         }
     }
-    printf("===========================================================================\n");
-    return e_success;
+    print_audio_info(out, &tagInfo->audio);
+    if (tagInfo->hashed)
+    {
+        char digest[32];
+        snprintf(digest, sizeof(digest), "%016llx (xxh64)", (unsigned long long)tagInfo->audio_hash);
+        fprintf(out, "| %-15s:%6s%-50s|\n", "Audio Hash", " ", digest);
+    }
+    fprintf(out, "===========================================================================\n");
 }
 
 // Function to determine the operation type from command-line arguments
@@ -108,15 +382,33 @@ OperationType check_operation_type(char *argv[])
         return e_edit;
     if(strcmp(argv[1], "-v") == 0) 
         return e_display;
+    if(strcmp(argv[1], "-b") == 0)
+        return e_batch;
+    if(strcmp(argv[1], "-g") == 0)
+        return e_query;
+    if(strcmp(argv[1], "-x") == 0)
+        return e_extract;
+    if(strcmp(argv[1], "-d") == 0)
+        return e_serve;
+    if(strcmp(argv[1], "-c") == 0)
+        return e_client;
+    if(strcmp(argv[1], "--watch") == 0)
+        return e_watch;
 
     // Invalid operation
     fprintf(stderr, "Error: Invalid Operation => %s\n", argv[1]);
     return e_unsupported;
 }
 
-// Function to open the source MP3 file
+// Function to open the source MP3 file ("-" is stdin, read forward only up to the end of the tag)
 Status open_files(TagInfo *tagInfo)
 {
+    if(strcmp(tagInfo->src_mp3_fname, "-") == 0)
+    {
+        tagInfo->fptr_src_mp3 = stdin;
+        return e_success;
+    }
+
     // Open MP3 file in binary read mode
     tagInfo->fptr_src_mp3 = fopen(tagInfo->src_mp3_fname, "rb");
     if (tagInfo->fptr_src_mp3 == NULL)
@@ -128,82 +420,65 @@ Status open_files(TagInfo *tagInfo)
     return e_success;
 }
 
-// Helper function to check if the current frame ID is supported
+// Helper function to check if the current frame ID is in the frame registry
 Status check_frame_index(char *frame_id)
 {
-    for(int i = 0; i < MAX_FRAME_COUNT; i++)
-    {
-        if(strcmp(tags_name[i], frame_id) == 0)
-            return e_success;
-    }
-    return e_failure;
-}
-
-// Function to read the 4-byte frame ID and store it
-Status read_frame_id(int index, TagInfo *tagInfo)
-{
-    char frame_id[5] = {0}; // Temporary buffer to store 4-byte frame ID + null terminator
-
-    // Read 4 bytes of frame ID
-    if(read_data_from_file(frame_id, 4, tagInfo->fptr_src_mp3) == e_failure)
-        return e_failure;
-
-    // If not a valid/known frame, skip
-    if(check_frame_index(frame_id) == e_failure)
+    if(lookup_frame(pack_frame_id(frame_id)) == NULL)
         return e_failure;
-
-    // Store the valid frame ID
-    strcpy(tagInfo->frame_id[index], frame_id);
     return e_success;
 }
 
-// Function to read the 4-byte frame size, reorder bytes to convert to int
-Status read_frame_size(int index, TagInfo *tagInfo)
+/*
+ * libid3 frame callback: records the frame value in the next TagInfo slot.
+ * Unregistered frames are skipped. The value starts after the encoding
+ * byte, language and description as the frame layout requires, and ends
+ * at its terminator. ASCII and UTF-8 values stay views into the tag;
+ * ISO-8859-1 and UTF-16 values are decoded to UTF-8. Binary frames keep
+ * their whole data and size. Stops the parse only when the frame arrays
+ * cannot grow.
+ */
+int collect_frame(void *user, const char *id, const unsigned char *data, size_t len)
 {
-    int frame_size;
+    TagInfo *tagInfo = user;
+    int index = tagInfo->frame_count;
 
-    // Read 4 bytes as raw int
-    if(read_size_from_file(&frame_size, 4, tagInfo->fptr_src_mp3) == e_failure)
+    if(check_frame_index((char *)id) == e_failure)
+        return 0;
+    if(reserve_tag_frame(tagInfo) == e_failure)
     {
-        fprintf(stderr, "Cannot read the size\n");
-        return e_failure;
+        fprintf(stderr, "WARNING: Out of memory, only the first %d frames of %s are shown\n", index, tagInfo->src_mp3_fname);
+        return 1;
     }
 
-    // Convert from big-endian to little-endian (ID3v2 uses sync-safe integers)
-    unsigned int b0 = (frame_size & 0x000000FF) << 24;
-    unsigned int b1 = (frame_size & 0x0000FF00) << 8;
-    unsigned int b2 = (frame_size & 0x00FF0000) >> 8;
-    unsigned int b3 = (frame_size & 0xFF000000) >> 24;
+    const FrameDesc *desc = lookup_frame(pack_frame_id(id));
+    uint offset = desc->kind == e_frame_binary ? 0 : frame_text_offset(desc, data, len);
 
-    frame_size = b0 | b1 | b2 | b3;
+    strcpy(tagInfo->frame_id[index], id);
+    tagInfo->frame_data[index] = (const char *)data + offset;
+    tagInfo->frame_Size[index] = len - offset;
 
-    tagInfo->frame_Size[index] = frame_size;
-    return e_success;
-}
-
-// Function to read the frame data content based on previously read size
-Status read_frame_data(int index, TagInfo *tagInfo)
-{  
-    int size = tagInfo->frame_Size[index];
-
-    // Allocate memory to hold frame data
-    tagInfo->frame_data[index] = malloc(size);
-    if(tagInfo->frame_data[index] == NULL)
-        return e_failure;
-
-    // Read frame data (excluding last byte for null termination)
-    if(read_data_from_file(tagInfo->frame_data[index], size - 1, tagInfo->fptr_src_mp3) == e_failure)
-        return e_failure;
-
-    // Null-terminate the string
-    tagInfo->frame_data[index][size - 1] = '\0';
+    if(desc->kind != e_frame_binary)
+    {
+        unsigned char encoding = frame_value_encoding(desc, data, len);
+        size_t length = text_view_length(encoding, data + offset, len - offset);
 
-    return e_success;
+        if(length != TEXT_NEEDS_DECODE)
+            tagInfo->frame_Size[index] = length;
+        else
+        {
+            const char *text = decode_frame_text(tagInfo, encoding, data + offset, len - offset, &tagInfo->frame_Size[index]);
+            if(text != NULL)
+                tagInfo->frame_data[index] = text;
+        }
+    }
+    tagInfo->frame_count++;
+    return 0;
 }
 
 // Utility to read binary data of specified size from a file
 Status read_data_from_file(char *data, uint size, FILE * fptr_src_mp3)
 {
+    STATS_READ((ssize_t)size);
     if(fread(data, size, 1, fptr_src_mp3) != 1)
         return e_failure;
     return e_success;
@@ -5,6 +5,7 @@
  *                reading and displaying ID3v2 tag frames from an MP3 file.
  *
  *                Structures:
+ *                - TextBlock
  *                - TagInfo
  *
  *                Functions:
@@ -12,9 +13,20 @@
  *                - open_files()
  *                - check_operation_type()
  *                - display_tag()
- *                - read_frame_id()
- *                - read_frame_size()
- *                - read_frame_data()
+ *                - read_tag_info()
+ *                - print_tag_record()
+ *                - load_tag_block()
+ *                - map_tag_file()
+ *                - read_tag_file()
+ *                - release_tag_block()
+ *                - parse_tag_frames()
+ *                - reserve_tag_frame()
+ *                - decode_frame_text()
+ *                - release_tag_text()
+ *                - measure_audio()
+ *                - print_tag()
+ *                - check_frame_index()
+ *                - collect_frame()
  *                - read_data_from_file()
  *                - read_size_from_file()
  *
@@ -28,17 +40,54 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
 
 #include "types.h"  // Includes custom Status and OperationType definitions
+#include "id3.h"    // Includes TagHeader and the libid3 parser
+#include "mpeg.h"   // Includes AudioInfo
 
-// Structure to hold tag information extracted from the MP3 file
+// Smallest block allocated for decoded frame text
+#define TEXT_BLOCK_SIZE 4096
+
+// Frames the frame lists of a TagInfo are first allocated for; they double when a tag has more
+#define TAG_FRAME_ENTRIES 32
+
+// Block of decoded UTF-8 values; blocks are chained so values never move once decoded
+typedef struct TextBlock
+{
+    struct TextBlock *next;                     // Previously filled block
+    size_t used;                                // Bytes handed out
+    size_t size;                                // Capacity of data
+    char data[];
+} TextBlock;
+
+/*
+ * Structure to hold tag information extracted from the MP3 file.
+ * All parse state lives here, so separate instances can be used from
+ * separate threads at the same time.
+ */
 typedef struct TagInfo
 {
     FILE *fptr_src_mp3;                         // File pointer to source MP3 file
     char *src_mp3_fname;                        // Name of the source MP3 file
-    char frame_id[MAX_FRAME_COUNT][FRAME_ID_SIZE + 1];   // Array of frame IDs (each is a 4-character string + null terminator)
-    int frame_Size[MAX_FRAME_COUNT];           // Array holding sizes of corresponding frames
-    char *frame_data[MAX_FRAME_COUNT];         // Array of pointers to frame data (dynamically allocated)
+    FILE *fptr_out;                             // Stream the tag table is printed to (stdout, or a per-file buffer when scanning)
+    char (*frame_id)[FRAME_ID_SIZE + 1];       // Array of frame IDs (each is a 4-character string + null terminator)
+    int *frame_Size;                           // Length of each frame value (whole data size for binary frames)
+    const char **frame_data;                   // Frame value as UTF-8, not null-terminated (view into the tag block, or decoded into text; NULL for binary frames loaded from an index)
+    int frame_count;                           // Number of frames found
+    int frame_capacity;                        // Frames the three arrays above have room for (grown by reserve_tag_frame())
+    TagHeader header;                          // Decoded 10-byte ID3v2 header
+    const unsigned char *tag_buf;              // Header + tag body (mapping or heap buffer)
+    size_t tag_end;                            // Length of tag_buf (10 + tag size)
+    int mapped;                                // 1 if tag_buf is a mapping, 0 if it was read into the heap
+    TextBlock *text;                           // Values that had to be decoded to UTF-8 (NULL if none)
+    AudioInfo audio;                           // Duration and bitrate (source is NULL unless --audio is given)
+    uint64_t audio_hash;                       // Hash of the audio data (--hash)
+    int hashed;                                // 1 once audio_hash is set (computed, or loaded from the index)
 } TagInfo;
 
 // Function to validate command-line arguments and initialize TagInfo
@@ -53,14 +102,47 @@ OperationType check_operation_type(char *argv[]);
 // Function to display tag/frame information from the MP3 file
 Status display_tag(TagInfo *tagInfo);
 
-// Function to read a frame ID at a given index
-Status read_frame_id(int index, TagInfo *tagInfo);
+// Function to read the tag, the trailer and (as asked) the audio of the open file into TagInfo
+Status read_tag_info(TagInfo *tagInfo);
+
+// Function to print the file in the --format chosen instead of the table
+Status print_tag_record(TagInfo *tagInfo);
+
+// Function to load the whole tag block (header size bounded) into memory
+Status load_tag_block(TagInfo *tagInfo);
+
+// Function to map only the tag region of the file (private copy-on-write mapping)
+Status map_tag_file(TagInfo *tagInfo);
+
+// Function to read the tag region into a heap buffer with a single read (fallback)
+Status read_tag_file(TagInfo *tagInfo, const unsigned char *header_buf);
+
+// Function to unmap or free the tag block
+void release_tag_block(TagInfo *tagInfo);
+
+// Function to collect frames as (pointer, length) views into the tag block
+Status parse_tag_frames(TagInfo *tagInfo);
+
+// Function to decode a value that is not already UTF-8 into the TagInfo's text blocks
+const char *decode_frame_text(TagInfo *tagInfo, unsigned char encoding, const unsigned char *text, size_t len, int *size);
+
+// Function to make room for one more frame in the TagInfo frame arrays
+Status reserve_tag_frame(TagInfo *tagInfo);
+
+// Function to free the decoded values and the frame arrays
+void release_tag_text(TagInfo *tagInfo);
+
+// Function to read the duration and hash of the audio when --audio / --hash ask for them
+void measure_audio(TagInfo *tagInfo, int fd, const TagHeader *header);
+
+// Function to print the collected frames as a table to tagInfo->fptr_out
+void print_tag(TagInfo *tagInfo);
 
-// Function to read the size of a frame at a given index
-Status read_frame_size(int index, TagInfo *tagInfo);
+// Function to check whether a frame ID is in the frame registry
+Status check_frame_index(char *frame_id);
 
-// Function to read the actual frame data at a given index
-Status read_frame_data(int index, TagInfo *tagInfo);
+// libid3 callback that stores one frame in the TagInfo passed as user
+int collect_frame(void *user, const char *id, const unsigned char *data, size_t len);
 
 // Generic function to read binary data from a file into a buffer
 Status read_data_from_file(char *data, uint size, FILE *fptr_src_mp3);
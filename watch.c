@@ -0,0 +1,707 @@
+/***********************************************************************
+ *  File Name   : watch.c
+ *  Description : Source file for the Library Watch Module.
+ *                Every directory of the tree gets an inotify watch, so
+ *                nothing is stat()ed or read while the library is idle;
+ *                the process sleeps in poll() until the kernel reports
+ *                an event. Events are collected into a batch that is
+ *                handled once no event arrived for the debounce time
+ *                (or WATCH_MAX_DELAY_MS after its first event), so an
+ *                album copied in is read once, after the copy.
+ *
+ *                A batch is sorted by path and only the last event of
+ *                each file counts. Written or moved-in files are read
+ *                through read_tag_info(), the path of -v; with --index
+ *                a file the index still matches is skipped, and the
+ *                index is rewritten once per batch with the new records
+ *                and with deleted files dropped. A new directory is
+ *                watched and its files are read; a directory moved away
+ *                stops being watched and every file known under it is
+ *                reported removed. A subdirectory that cannot be watched
+ *                (no permission) is skipped with a warning.
+ *
+ *                Events (in the --format of -v):
+ *                - table  : "Changed: <path>" and the tag table, or "Removed: <path>"
+ *                - NDJSON : {"event":"changed",<record of -v>} or {"event":"removed","path":…}
+ *                - CSV/TSV: the rows of each changed file
+ *
+ *                Functions:
+ *                - run_watch()
+ *                - read_and_validate_watch_args()
+ *                - watch_tree()
+ *                - forget_tree()
+ *                - read_watch_events()
+ *                - add_watch_change()
+ *                - flush_watch_changes()
+ *                - emit_watch_event()
+ *
+ ***********************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/signalfd.h>
+
+#include "watch.h"
+#include "index.h"
+
+// Function to read the monotonic clock in milliseconds
+static long long monotonic_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Function to check for the .mp3 suffix
+static int is_mp3_name(const char *name)
+{
+    size_t length = strlen(name);
+    return length >= 4 && strcmp(name + length - 4, ".mp3") == 0;
+}
+
+// Function to join a directory and a name into a new string
+static char *join_path(const char *dir, const char *name)
+{
+    char *path = malloc(strlen(dir) + strlen(name) + 2);
+    if(path != NULL)
+        sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+// Function to order known files by path
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Function to order changes by path, and by arrival for one path
+static int compare_changes(const void *a, const void *b)
+{
+    const WatchChange *left = a, *right = b;
+    int order = strcmp(left->path, right->path);
+    if(order != 0)
+        return order;
+    return left->seq < right->seq ? -1 : left->seq > right->seq;
+}
+
+/*
+ * Watches the tree and then sleeps in poll() on the inotify fd and a
+ * signalfd. The poll timeout is infinite while no batch is open, so an
+ * idle library costs no CPU at all. SIGINT and SIGTERM handle the open
+ * batch before exiting, so no event that was already seen is lost.
+ */
+Status run_watch(int argc, char **argv)
+{
+    Watch watch;
+    sigset_t signals;
+
+    if(read_and_validate_watch_args(argc, argv, &watch) == e_failure)
+        return e_failure;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+
+    int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(signal_fd == -1 || watch.fd == -1)
+    {
+        perror("inotify_init1");
+        return e_failure;
+    }
+
+    Status status = watch_tree(&watch, watch.root, 0);
+    if(status == e_success)
+    {
+        qsort(watch.files, watch.file_count, sizeof(char *), compare_paths);
+        fprintf(stderr, "INFO: Watching %s (%d director%s)\n", watch.root, watch.dir_count, watch.dir_count == 1 ? "y" : "ies");
+
+        // CSV and TSV start with their column names
+        OutBuf header = { 0 };
+        format_header(&header, get_output_format());
+        if(header.len > 0)
+        {
+            struct iovec iov = { header.data, header.len };
+            status = write_outputs(STDOUT_FILENO, &iov, 1);
+        }
+        free(header.data);
+    }
+
+    long long first_event = 0, last_event = 0;
+    while(status == e_success)
+    {
+        int timeout = -1;
+        if(watch.change_count > 0)
+        {
+            long long now = monotonic_ms();
+            long long due = last_event + watch.debounce_ms;
+            if(due > first_event + WATCH_MAX_DELAY_MS)
+                due = first_event + WATCH_MAX_DELAY_MS;
+            timeout = due > now ? (int)(due - now) : 0;
+        }
+
+        struct pollfd fds[2] = { { watch.fd, POLLIN, 0 }, { signal_fd, POLLIN, 0 } };
+        if(poll(fds, 2, timeout) == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            perror("poll");
+            status = e_failure;
+            break;
+        }
+
+        if(fds[0].revents & POLLIN)
+        {
+            int had_changes = watch.change_count > 0;
+            if(read_watch_events(&watch) == e_failure)
+                status = e_failure;
+            if(watch.change_count > 0)
+            {
+                last_event = monotonic_ms();
+                if(!had_changes)
+                    first_event = last_event;
+            }
+        }
+
+        int stop = fds[1].revents & POLLIN;
+        if(watch.change_count > 0 && (stop || timeout == 0 || monotonic_ms() >= last_event + watch.debounce_ms ||
+                                      monotonic_ms() >= first_event + WATCH_MAX_DELAY_MS))
+        {
+            if(flush_watch_changes(&watch) == e_failure)
+                status = e_failure;
+        }
+        if(stop)
+            break;
+    }
+
+    for(int wd = 0; wd < watch.dir_capacity; wd++)
+        free(watch.dirs[wd]);
+    free(watch.dirs);
+    for(int i = 0; i < watch.change_count; i++)
+        free(watch.changes[i].path);
+    free(watch.changes);
+    for(int i = 0; i < watch.file_count; i++)
+        free(watch.files[i]);
+    free(watch.files);
+    free(watch.root);
+    close(watch.fd);
+    close(signal_fd);
+    return status;
+}
+
+// Function to read the directory and the optional --index / --debounce values
+Status read_and_validate_watch_args(int argc, char **argv, Watch *watch)
+{
+    struct stat st;
+
+    memset(watch, 0, sizeof(*watch));
+    watch->fd = -1;
+    watch->debounce_ms = WATCH_DEBOUNCE_MS;
+
+    if(argc < 3)
+    {
+        fprintf(stderr, "ERROR: Missing directory. Usage: %s --watch <dir> [--index <file>] [--debounce MS]\n", argv[0]);
+        return e_failure;
+    }
+    if(stat(argv[2], &st) == -1 || !S_ISDIR(st.st_mode))
+    {
+        fprintf(stderr, "ERROR: Not a directory => %s\n", argv[2]);
+        return e_failure;
+    }
+
+    for(int i = 3; i < argc; i += 2)
+    {
+        if(i + 1 >= argc)
+        {
+            fprintf(stderr, "ERROR: Missing value for %s\n", argv[i]);
+            return e_failure;
+        }
+
+        if(strcmp(argv[i], "--index") == 0)
+            watch->index_fname = argv[i + 1];
+        else if(strcmp(argv[i], "--debounce") == 0)
+        {
+            watch->debounce_ms = atoi(argv[i + 1]);
+            if(watch->debounce_ms < 0)
+            {
+                fprintf(stderr, "ERROR: --debounce must not be negative\n");
+                return e_failure;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Unknown option %s\n", argv[i]);
+            return e_failure;
+        }
+    }
+
+    // Paths in events are built from the root, so "dir/" and "dir" give the same paths as -v
+    watch->root = strdup(argv[2]);
+    if(watch->root == NULL)
+        return e_failure;
+    for(size_t length = strlen(watch->root); length > 1 && watch->root[length - 1] == '/'; length--)
+        watch->root[length - 1] = '\0';
+    return e_success;
+}
+
+// Function to remember the directory of a watch descriptor
+static Status set_watch_dir(Watch *watch, int wd, const char *dir)
+{
+    if(wd >= watch->dir_capacity)
+    {
+        int capacity = watch->dir_capacity ? watch->dir_capacity : 64;
+        while(capacity <= wd)
+            capacity *= 2;
+        char **dirs = realloc(watch->dirs, sizeof(char *) * capacity);
+        if(dirs == NULL)
+            return e_failure;
+        memset(dirs + watch->dir_capacity, 0, sizeof(char *) * (capacity - watch->dir_capacity));
+        watch->dirs = dirs;
+        watch->dir_capacity = capacity;
+    }
+
+    char *copy = strdup(dir);
+    if(copy == NULL)
+        return e_failure;
+    if(watch->dirs[wd] == NULL)
+        watch->dir_count++;
+    free(watch->dirs[wd]);
+    watch->dirs[wd] = copy;
+    return e_success;
+}
+
+// Function to add a file found by the first listing to the known files (sorted once the listing is done)
+static Status remember_file(Watch *watch, const char *path)
+{
+    if(watch->file_count == watch->file_capacity)
+    {
+        int capacity = watch->file_capacity ? watch->file_capacity * 2 : 256;
+        char **files = realloc(watch->files, sizeof(char *) * capacity);
+        if(files == NULL)
+            return e_failure;
+        watch->files = files;
+        watch->file_capacity = capacity;
+    }
+
+    char *copy = strdup(path);
+    if(copy == NULL)
+        return e_failure;
+    watch->files[watch->file_count++] = copy;
+    return e_success;
+}
+
+/*
+ * The watch is added before the directory is listed, so a file that
+ * appears in between is reported by inotify, the listing, or both (a
+ * duplicate change is harmless). Symlinked directories are not followed,
+ * as in -v. Only the root must be watchable: a subdirectory that is not
+ * (no permission, or already gone) is skipped with a warning. Running out
+ * of watches stops the mode, since no later directory could be watched.
+ */
+Status watch_tree(Watch *watch, const char *dir, int queue_files)
+{
+    int wd = inotify_add_watch(watch->fd, dir, WATCH_EVENTS);
+    if(wd == -1)
+    {
+        perror(dir);
+        if(errno == ENOSPC)
+            fprintf(stderr, "ERROR: Out of inotify watches; raise fs.inotify.max_user_watches\n");
+        else if(strcmp(dir, watch->root) != 0)
+        {
+            fprintf(stderr, "WARNING: Not watching %s and the directories below it\n", dir);
+            return e_success;
+        }
+        return e_failure;
+    }
+    if(set_watch_dir(watch, wd, dir) == e_failure)
+        return e_failure;
+
+    DIR *stream = opendir(dir);
+    if(stream == NULL)
+    {
+        perror(dir);
+        return e_success;    // Gone again already; its IN_IGNORED cleans up
+    }
+
+    Status status = e_success;
+    struct dirent *entry;
+    while(status == e_success && (entry = readdir(stream)) != NULL)
+    {
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        int is_dir = entry->d_type == DT_DIR;
+        int is_file = entry->d_type == DT_REG || entry->d_type == DT_LNK;
+        int wanted = is_mp3_name(entry->d_name);
+        if(entry->d_type != DT_UNKNOWN && !is_dir && !(is_file && wanted))
+            continue;
+
+        char *path = join_path(dir, entry->d_name);
+        if(path == NULL)
+        {
+            status = e_failure;
+            break;
+        }
+
+        // Some filesystems do not fill in d_type
+        struct stat st;
+        if(entry->d_type == DT_UNKNOWN && lstat(path, &st) == 0)
+        {
+            is_dir = S_ISDIR(st.st_mode);
+            is_file = S_ISREG(st.st_mode) || S_ISLNK(st.st_mode);
+        }
+
+        if(is_dir)
+            status = watch_tree(watch, path, queue_files);
+        else if(is_file && wanted)
+            status = queue_files ? add_watch_change(watch, path, 0) : remember_file(watch, path);
+        free(path);
+    }
+    closedir(stream);
+    return status;
+}
+
+/*
+ * Drops the watches of a directory and everything below it. Where the
+ * directory went is not known (it may have left the tree), so every
+ * known file under it becomes a removal; if it was moved within the
+ * tree, its IN_MOVED_TO lists the files again under their new paths.
+ */
+Status forget_tree(Watch *watch, const char *dir)
+{
+    size_t length = strlen(dir);
+
+    for(int wd = 0; wd < watch->dir_capacity; wd++)
+    {
+        const char *path = watch->dirs[wd];
+        if(path == NULL || strncmp(path, dir, length) != 0 || (path[length] != '\0' && path[length] != '/'))
+            continue;
+
+        inotify_rm_watch(watch->fd, wd);
+        free(watch->dirs[wd]);
+        watch->dirs[wd] = NULL;
+        watch->dir_count--;
+    }
+
+    // The known files under dir/ are one run of the sorted list
+    int low = 0, high = watch->file_count;
+    while(low < high)
+    {
+        int mid = (low + high) / 2;
+        if(strcmp(watch->files[mid], dir) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    for(int i = low; i < watch->file_count && strncmp(watch->files[i], dir, length) == 0; i++)
+    {
+        if(watch->files[i][length] != '/')
+            continue;    // A sibling such as "dir2/…" sorts inside the run
+        if(add_watch_change(watch, watch->files[i], 1) == e_failure)
+            return e_failure;
+    }
+    return e_success;
+}
+
+/*
+ * Reads until the inotify fd is empty. A queue overflow means events
+ * were lost, so the whole tree is listed again and every file becomes a
+ * change (with --index the unchanged ones are skipped when the batch is
+ * read).
+ */
+Status read_watch_events(Watch *watch)
+{
+    char buf[WATCH_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for(;;)
+    {
+        ssize_t got = read(watch->fd, buf, sizeof(buf));
+        if(got == -1 && errno == EINTR)
+            continue;
+        if(got == -1 && errno == EAGAIN)
+            return e_success;
+        if(got <= 0)
+        {
+            perror("read");
+            return e_failure;
+        }
+
+        for(char *pos = buf; pos < buf + got; )
+        {
+            const struct inotify_event *event = (const struct inotify_event *)pos;
+            pos += sizeof(struct inotify_event) + event->len;
+
+            if(event->mask & IN_Q_OVERFLOW)
+            {
+                fprintf(stderr, "INFO: Event queue overflowed; re-listing %s\n", watch->root);
+                if(watch_tree(watch, watch->root, 1) == e_failure)
+                    return e_failure;
+                continue;
+            }
+
+            if(event->wd < 0 || event->wd >= watch->dir_capacity || watch->dirs[event->wd] == NULL)
+                continue;
+            if(event->mask & IN_IGNORED)
+            {
+                free(watch->dirs[event->wd]);
+                watch->dirs[event->wd] = NULL;
+                watch->dir_count--;
+                continue;
+            }
+            if(event->len == 0)
+                continue;
+
+            char *path = join_path(watch->dirs[event->wd], event->name);
+            if(path == NULL)
+                return e_failure;
+
+            Status status = e_success;
+            if(event->mask & IN_ISDIR)
+            {
+                // A new or moved-in directory (an album copied in) is watched and its files read
+                if(event->mask & (IN_CREATE | IN_MOVED_TO))
+                    status = watch_tree(watch, path, 1);
+                else if(event->mask & IN_MOVED_FROM)
+                    status = forget_tree(watch, path);
+            }
+            else if(is_mp3_name(event->name))
+            {
+                if(event->mask & (IN_DELETE | IN_MOVED_FROM))
+                    status = add_watch_change(watch, path, 1);
+                else if(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                    status = add_watch_change(watch, path, 0);
+            }
+            free(path);
+            if(status == e_failure)
+                return e_failure;
+        }
+    }
+}
+
+// Function to append one event to the batch
+Status add_watch_change(Watch *watch, const char *path, int removed)
+{
+    if(watch->change_count == watch->change_capacity)
+    {
+        int capacity = watch->change_capacity ? watch->change_capacity * 2 : 64;
+        WatchChange *changes = realloc(watch->changes, sizeof(WatchChange) * capacity);
+        if(changes == NULL)
+            return e_failure;
+        watch->changes = changes;
+        watch->change_capacity = capacity;
+    }
+
+    WatchChange *change = &watch->changes[watch->change_count];
+    change->path = strdup(path);
+    if(change->path == NULL)
+        return e_failure;
+    change->removed = removed;
+    change->seq = watch->seq++;
+    watch->change_count++;
+    return e_success;
+}
+
+/*
+ * Reads one file the way -v does, under a shared flock() so an edit in
+ * progress is not seen half written; with an index its record is added
+ * to the batch's records.
+ */
+static Status read_changed_file(const char *path, TagIndex *index, OutBuf *out, char ***records, int *record_count)
+{
+    TagInfo tagInfo;
+    struct stat st;
+
+    memset(&tagInfo, 0, sizeof(tagInfo));
+    tagInfo.src_mp3_fname = (char *)path;
+    if(open_files(&tagInfo) == e_failure)
+        return e_failure;
+
+    int fd = fileno(tagInfo.fptr_src_mp3);
+    flock(fd, LOCK_SH);
+
+    Status status = e_failure;
+    if(fstat(fd, &st) == 0 && read_tag_info(&tagInfo) == e_success)
+    {
+        emit_watch_event(out, &tagInfo, path);
+
+        char *record;
+        size_t record_len;
+        if(index != NULL && build_index_record(&tagInfo, path, &st, &record, &record_len) == e_success)
+            (*records)[(*record_count)++] = record;
+        release_tag_block(&tagInfo);
+        status = e_success;
+    }
+    fclose(tagInfo.fptr_src_mp3);
+    return status;
+}
+
+/*
+ * Merges the sorted batch into the sorted known files: a path that exists
+ * after the batch is kept or added (its string is taken from the change),
+ * any other is dropped.
+ */
+static Status update_known_files(Watch *watch)
+{
+    int capacity = watch->file_count + watch->change_count + 1;
+    char **files = malloc(sizeof(char *) * capacity);
+    int count = 0, known = 0;
+
+    if(files == NULL)
+        return e_failure;
+
+    for(int i = 0; i < watch->change_count; i++)
+    {
+        WatchChange *change = &watch->changes[i];
+        if(i + 1 < watch->change_count && strcmp(change->path, watch->changes[i + 1].path) == 0)
+            continue;
+
+        while(known < watch->file_count && strcmp(watch->files[known], change->path) < 0)
+            files[count++] = watch->files[known++];
+
+        if(known < watch->file_count && strcmp(watch->files[known], change->path) == 0)
+        {
+            if(change->present)
+                files[count++] = watch->files[known];
+            else
+                free(watch->files[known]);
+            known++;
+        }
+        else if(change->present)
+        {
+            files[count++] = change->path;
+            change->path = NULL;
+        }
+    }
+    while(known < watch->file_count)
+        files[count++] = watch->files[known++];
+
+    free(watch->files);
+    watch->files = files;
+    watch->file_count = count;
+    watch->file_capacity = capacity;
+    return e_success;
+}
+
+// Function to handle the batch: one event per file, then one index write
+Status flush_watch_changes(Watch *watch)
+{
+    TagIndex index;
+    TagIndex *use_index = NULL;
+    OutBuf out = { 0 };
+    int record_count = 0;
+    Status status = e_success;
+
+    qsort(watch->changes, watch->change_count, sizeof(WatchChange), compare_changes);
+
+    // The index file is replaced on every write, so it is mapped afresh for each batch
+    if(watch->index_fname != NULL && open_tag_index(&index, watch->index_fname) == e_success)
+        use_index = &index;
+    char **records = malloc(sizeof(char *) * watch->change_count);
+    if(records == NULL)
+        status = e_failure;
+
+    for(int i = 0; i < watch->change_count && status == e_success; i++)
+    {
+        WatchChange *change = &watch->changes[i];
+        struct stat st;
+
+        // Only the last event of a path counts
+        change->present = 0;
+        if(i + 1 < watch->change_count && strcmp(change->path, watch->changes[i + 1].path) == 0)
+            continue;
+
+        // A path that is there again was replaced (deleted, then written or moved in) and is read instead
+        int exists = stat(change->path, &st) == 0 && S_ISREG(st.st_mode);
+        change->present = exists;
+        if(change->removed && !exists)
+        {
+            emit_watch_event(&out, NULL, change->path);
+            char *record;
+            size_t record_len;
+            if(use_index != NULL && build_index_removal(change->path, &record, &record_len) == e_success)
+                records[record_count++] = record;
+        }
+        else if(exists && (use_index == NULL || lookup_tag_index(use_index, change->path, &st) == NULL))
+            read_changed_file(change->path, use_index, &out, &records, &record_count);
+    }
+
+    if(get_output_format() == e_format_table)
+        fflush(stdout);
+    else if(out.failed)
+        status = e_failure;
+    else if(out.len > 0)
+    {
+        struct iovec iov = { out.data, out.len };
+        status = write_outputs(STDOUT_FILENO, &iov, 1);
+    }
+    free(out.data);
+
+    if(use_index != NULL)
+    {
+        if(record_count > 0 && write_tag_index(use_index, records, record_count, NULL, 0) == e_failure)
+            status = e_failure;
+        close_tag_index(use_index);
+    }
+    for(int i = 0; i < record_count; i++)
+        free(records[i]);
+    free(records);
+
+    if(status == e_success)
+        status = update_known_files(watch);
+
+    for(int i = 0; i < watch->change_count; i++)
+        free(watch->changes[i].path);
+    watch->change_count = 0;
+    return status;
+}
+
+/*
+ * The table goes straight to stdout. NDJSON events are the record of -v
+ * with an "event" member in front; CSV and TSV only have rows for files
+ * that exist.
+ */
+void emit_watch_event(OutBuf *out, TagInfo *tagInfo, const char *path)
+{
+    OutputFormat format = get_output_format();
+
+    if(format == e_format_table)
+    {
+        printf("%s: %s\n", tagInfo != NULL ? "Changed" : "Removed", path);
+        if(tagInfo != NULL)
+        {
+            tagInfo->fptr_out = stdout;
+            print_tag(tagInfo);
+        }
+    }
+    else if(format == e_format_ndjson && tagInfo == NULL)
+    {
+        out_append(out, "{\"event\":\"removed\",\"path\":", 26);
+        out_json_string(out, path, strlen(path));
+        out_append(out, "}\n", 2);
+    }
+    else if(format == e_format_ndjson)
+    {
+        // The record's own opening brace is replaced by the event member
+        out_append(out, "{\"event\":\"changed\",", 19);
+        size_t start = out->len;
+        format_tag_record(out, format, tagInfo, path);
+        if(!out->failed)
+        {
+            memmove(out->data + start, out->data + start + 1, out->len - start - 1);
+            out->len--;
+        }
+    }
+    else if(tagInfo != NULL)
+        format_tag_record(out, format, tagInfo, path);
+}
@@ -0,0 +1,98 @@
+/***********************************************************************
+ *  File Name   : watch.h
+ *  Description : Header file for the Library Watch Module.
+ *                Declares the --watch mode, which follows a directory
+ *                tree with inotify, re-reads only the MP3 files that
+ *                changed, prints one event per file and keeps the tag
+ *                index up to date.
+ *
+ *                Structures:
+ *                - WatchChange
+ *                - Watch
+ *
+ *                Functions:
+ *                - run_watch()
+ *                - read_and_validate_watch_args()
+ *                - watch_tree()
+ *                - forget_tree()
+ *                - read_watch_events()
+ *                - add_watch_change()
+ *                - flush_watch_changes()
+ *                - emit_watch_event()
+ *
+ ***********************************************************************/
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <sys/inotify.h>
+
+#include "types.h"
+#include "view.h"
+#include "output.h"
+
+// Events asked for on every directory; IN_CREATE is only acted on for new directories (a new file is read on IN_CLOSE_WRITE)
+#define WATCH_EVENTS (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+// Quiet time after the last event before a batch is read, unless --debounce gives another (milliseconds)
+#define WATCH_DEBOUNCE_MS 250
+
+// A batch is read at the latest this long after its first event, even while events keep coming
+#define WATCH_MAX_DELAY_MS 2000
+
+// Bytes of inotify events read at a time
+#define WATCH_BUFFER_SIZE (64 * 1024)
+
+// One file event; the last event for a path decides what is done with it
+typedef struct WatchChange
+{
+    char *path;                 // MP3 file that changed
+    int removed;                // 1 if it was deleted or moved away, 0 if it was written or moved in
+    int present;                // Set when the batch is read: 1 if the file exists afterwards
+    unsigned long seq;          // Arrival order, so sorting by path keeps the last event last
+} WatchChange;
+
+// State of one --watch run
+typedef struct Watch
+{
+    char *root;                 // Directory given to --watch
+    const char *index_fname;    // Tag index kept up to date (NULL without --index)
+    int debounce_ms;            // Quiet time before a batch is read
+    int fd;                     // inotify instance
+    char **dirs;                // Directory of each watch descriptor (NULL when unused)
+    int dir_capacity;           // Length of dirs
+    int dir_count;              // Directories watched
+    WatchChange *changes;       // Events of the batch being collected
+    int change_count;           // Events in changes
+    int change_capacity;        // Capacity of changes
+    char **files;               // MP3 files in the tree, sorted, so a directory moved away can report its files removed
+    int file_count;             // Paths in files
+    int file_capacity;          // Capacity of files
+    unsigned long seq;          // Next WatchChange.seq
+} Watch;
+
+// Function to run the watch mode: --watch <dir> [--index <file>] [--debounce MS]
+Status run_watch(int argc, char **argv);
+
+// Function to read the directory and the optional --index / --debounce values
+Status read_and_validate_watch_args(int argc, char **argv, Watch *watch);
+
+// Function to watch a directory and every directory below it; its MP3 files become changes with queue_files, else known files
+Status watch_tree(Watch *watch, const char *dir, int queue_files);
+
+// Function to stop watching a directory tree that was moved away and report its files removed
+Status forget_tree(Watch *watch, const char *dir);
+
+// Function to read every pending inotify event and turn it into changes
+Status read_watch_events(Watch *watch);
+
+// Function to record one file event
+Status add_watch_change(Watch *watch, const char *path, int removed);
+
+// Function to re-read the changed files of the batch, print their events and update the index
+Status flush_watch_changes(Watch *watch);
+
+// Function to print one event: the file's record (or table) when it changed, its path when it was removed
+void emit_watch_event(OutBuf *out, TagInfo *tagInfo, const char *path);
+
+#endif  // WATCH_H